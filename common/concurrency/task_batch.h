@@ -0,0 +1,100 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "../exception/exceptions.h"
+#include "../log/log.h"
+
+#include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <tbb/spin_mutex.h>
+
+#include <functional>
+#include <vector>
+
+namespace caspar {
+
+// Collects the tasks issued from one thread between begin() and end(), so that the owner 
+// can run them together in a single task instead of one by one.
+class task_batch : boost::noncopyable
+{
+	tbb::spin_mutex						mutex_;
+	boost::thread::id					thread_;
+	std::vector<std::function<void()>>	tasks_;
+public:
+	typedef std::vector<std::function<void()>> tasks_t;
+
+	void begin()
+	{
+		tbb::spin_mutex::scoped_lock lock(mutex_);
+
+		if(thread_ != boost::thread::id())
+			BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("Batch already begun."));
+
+		thread_ = boost::this_thread::get_id();
+	}
+
+	tasks_t end()
+	{
+		tbb::spin_mutex::scoped_lock lock(mutex_);
+
+		if(thread_ != boost::this_thread::get_id())
+			BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("No batch begun on this thread."));
+
+		thread_ = boost::thread::id();
+
+		tasks_t tasks;
+		tasks.swap(tasks_);
+		return tasks;
+	}
+
+	// Collects the task if the calling thread has begun a batch, otherwise returns false.
+	template<typename F>
+	bool try_add(const F& task)
+	{
+		tbb::spin_mutex::scoped_lock lock(mutex_);
+
+		if(thread_ != boost::this_thread::get_id())
+			return false;
+
+		tasks_.push_back(task);
+		return true;
+	}
+
+	static void run(const tasks_t& tasks)
+	{
+		BOOST_FOREACH(auto& task, tasks)
+		{
+			try
+			{
+				task();
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+		}
+	}
+};
+
+}
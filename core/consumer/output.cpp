@@ -27,6 +27,7 @@
 
 #include "output.h"
 
+#include "../info_snapshot.h"
 #include "../video_format.h"
 #include "../mixer/gpu/ogl_device.h"
 #include "../mixer/read_frame.h"
@@ -61,6 +62,7 @@ struct output::implementation
 	boost::circular_buffer<safe_ptr<read_frame>>	frames_;
 	std::map<int, int64_t>							send_to_consumers_delays_;
 
+	info_publisher									info_;
 	executor										executor_;
 		
 public:
@@ -69,6 +71,7 @@ public:
 		, graph_(graph)
 		, monitor_subject_("/output")
 		, format_desc_(format_desc)
+		, info_(L"output")
 		, executor_(L"output")
 	{
 		graph_->set_color("consume-time", diagnostics::color(1.0f, 0.4f, 0.0f, 0.8));
@@ -84,6 +87,7 @@ public:
 		executor_.invoke([&]
 		{
 			consumers_.insert(std::make_pair(index, consumer));
+			info_.invalidate();
 			CASPAR_LOG(info) << print() << L" " << consumer->print() << L" Added.";
 		}, high_priority);
 	}
@@ -106,6 +110,7 @@ public:
 				old_consumer = it->second;
 				send_to_consumers_delays_.erase(it->first);
 				consumers_.erase(it);
+				info_.invalidate();
 			}
 		}, high_priority);
 
@@ -140,11 +145,13 @@ public:
 					CASPAR_LOG(info) << print() << L" " << it->second->print() << L" Removed.";
 					send_to_consumers_delays_.erase(it->first);
 					consumers_.erase(it++);
+					info_.invalidate();
 				}
 			}
 			
 			format_desc_ = format_desc;
 			frames_.clear();
+			info_.invalidate();
 		});
 	}
 	
@@ -182,6 +189,8 @@ public:
 	{
 		executor_.begin_invoke([=]
 		{
+			info_.update([this]{return consumers_info();});
+
 			try
 			{
 				consume_timer_.restart();
@@ -235,6 +244,7 @@ public:
 							CASPAR_LOG(error) << "Failed to recover consumer: " << consumer->print() << L". Removing it.";
 							send_to_consumers_delays_.erase(it->first);
 							it = consumers_.erase(it);
+							info_.invalidate();
 						}
 					}
 				}
@@ -253,6 +263,7 @@ public:
 							CASPAR_LOG(info) << print() << L" " << consumer->print() << L" Removed.";
 							send_to_consumers_delays_.erase(result_it->first);
 							consumers_.erase(result_it->first);
+							info_.invalidate();
 						}
 					}
 					catch(...)
@@ -266,6 +277,7 @@ public:
 								CASPAR_LOG(info) << print() << L" " << consumer->print() << L" Removed.";
 								send_to_consumers_delays_.erase(result_it->first);
 								consumers_.erase(result_it->first);
+								info_.invalidate();
 							}
 						}
 						catch(...)
@@ -274,6 +286,7 @@ public:
 							CASPAR_LOG(error) << "Failed to recover consumer: " << consumer->print() << L". Removing it.";
 							send_to_consumers_delays_.erase(result_it->first);
 							consumers_.erase(result_it->first);
+							info_.invalidate();
 						}
 					}
 				}
@@ -293,17 +306,22 @@ public:
 		return L"output[" + boost::lexical_cast<std::wstring>(channel_index_) + L"]";
 	}
 
+	boost::property_tree::wptree consumers_info()
+	{
+		boost::property_tree::wptree info;
+		BOOST_FOREACH(auto& consumer, consumers_)
+		{
+			info.add_child(L"consumers.consumer", consumer.second->info())
+				.add(L"index", consumer.first); 
+		}
+		return info;
+	}
+
 	boost::unique_future<boost::property_tree::wptree> info()
 	{
-		return std::move(executor_.begin_invoke([&]() -> boost::property_tree::wptree
+		return std::move(executor_.begin_invoke([&]
 		{			
-			boost::property_tree::wptree info;
-			BOOST_FOREACH(auto& consumer, consumers_)
-			{
-				info.add_child(L"consumers.consumer", consumer.second->info())
-					.add(L"index", consumer.first); 
-			}
-			return info;
+			return consumers_info();
 		}, high_priority));
 	}
 
@@ -353,6 +371,7 @@ void output::remove(const safe_ptr<frame_consumer>& consumer){impl_->remove(cons
 void output::send(const std::pair<safe_ptr<read_frame>, std::shared_ptr<void>>& frame) {impl_->send(frame); }
 void output::set_video_format_desc(const video_format_desc& format_desc){impl_->set_video_format_desc(format_desc);}
 boost::unique_future<boost::property_tree::wptree> output::info() const{return impl_->info();}
+std::shared_ptr<const info_snapshot> output::get_info_snapshot() const{return impl_->info_.get();}
 boost::unique_future<boost::property_tree::wptree> output::delay_info() const{return impl_->delay_info();}
 bool output::empty() const{return impl_->empty();}
 monitor::subject& output::monitor_output() { return impl_->monitor_output(); }
@@ -33,6 +33,8 @@
 #include <boost/thread/future.hpp>
 
 namespace caspar { namespace core {
+
+class info_snapshot;
 	
 class output : public target<std::pair<safe_ptr<read_frame>, std::shared_ptr<void>>>
 			 , boost::noncopyable
@@ -56,6 +58,10 @@ public:
 	boost::unique_future<boost::property_tree::wptree> info() const;
 	boost::unique_future<boost::property_tree::wptree> delay_info() const;
 
+	// The consumers part of info(), as last published by the output thread. See 
+	// info_snapshot.h.
+	std::shared_ptr<const info_snapshot> get_info_snapshot() const;
+
 	bool empty() const;
 
 	monitor::subject& monitor_output();
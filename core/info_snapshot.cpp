@@ -0,0 +1,185 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "StdAfx.h"
+
+#include "info_snapshot.h"
+
+#include <common/env.h>
+#include <common/log/log.h>
+
+#include <boost/property_tree/xml_parser.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/timer.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
+
+#include <map>
+#include <sstream>
+
+namespace caspar { namespace core {
+
+struct info_snapshot::implementation : boost::noncopyable
+{
+	const std::wstring						key_;
+	const boost::property_tree::wptree		info_;
+	const unsigned int						generation_;
+
+	mutable tbb::mutex						mutex_;
+	mutable std::map<int, std::wstring>		xml_;
+
+	implementation(const std::wstring& key, const boost::property_tree::wptree& info, unsigned int generation)
+		: key_(key)
+		, info_(info)
+		, generation_(generation)
+	{
+	}
+
+	const std::wstring& xml(int depth) const
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		auto it = xml_.find(depth);
+		if(it == xml_.end())
+		{
+			std::wstringstream str;
+			boost::property_tree::xml_parser::write_xml_element(str, key_, info_, depth, boost::property_tree::xml_writer_settings<wchar_t>(' ', 3));
+			it = xml_.insert(std::make_pair(depth, str.str())).first;
+		}
+
+		return it->second;
+	}
+};
+
+info_snapshot::info_snapshot(const std::wstring& key, const boost::property_tree::wptree& info, unsigned int generation) 
+	: impl_(new implementation(key, info, generation)){}
+const boost::property_tree::wptree& info_snapshot::info() const{return impl_->info_;}
+unsigned int info_snapshot::generation() const{return impl_->generation_;}
+const std::wstring& info_snapshot::xml(int depth) const{return impl_->xml(depth);}
+
+struct info_publisher::implementation : boost::noncopyable
+{
+	const std::wstring						key_;
+	const double							refresh_interval_;
+	const double							keep_alive_;
+
+	mutable boost::mutex					mutex_;
+	mutable boost::condition_variable		updated_;
+	std::shared_ptr<const info_snapshot>	snapshot_;
+	unsigned int							updates_;
+	unsigned int							published_;
+
+	mutable tbb::atomic<bool>				polled_;
+	tbb::atomic<unsigned int>				invalidations_;
+	tbb::atomic<bool>						active_;
+
+	// Only used by the owner.
+	boost::timer							age_;
+	boost::timer							idle_;
+
+	implementation(const std::wstring& key)
+		: key_(key)
+		, refresh_interval_(env::properties().get(L"configuration.info-refresh-millis", 100) / 1000.0)
+		, keep_alive_(10.0)
+		, updates_(0)
+		, published_(0)
+	{
+		polled_			= false;
+		invalidations_	= 1;
+		active_			= false;
+	}
+
+	void update(const info_func_t& info)
+	{
+		if(polled_.fetch_and_store(false))
+		{
+			idle_.restart();
+			if(!active_.fetch_and_store(true))
+				++invalidations_;
+		}
+		else if(active_ && idle_.elapsed() > keep_alive_)
+			active_ = false;
+
+		if(!active_)
+			return;
+
+		// Invalidations after this point are picked up by the next update.
+		unsigned int invalidations = invalidations_;
+
+		if(invalidations == published_ && age_.elapsed() < refresh_interval_)
+			return;
+
+		age_.restart();
+
+		try
+		{
+			auto tree = info();
+
+			boost::lock_guard<boost::mutex> lock(mutex_);
+
+			if(!snapshot_ || snapshot_->info() != tree)
+				snapshot_ = std::make_shared<info_snapshot>(key_, tree, snapshot_ ? snapshot_->generation() + 1 : 1);
+
+			published_ = invalidations;
+			++updates_;
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			published_ = invalidations;
+			++updates_;
+		}
+
+		updated_.notify_all();
+	}
+
+	std::shared_ptr<const info_snapshot> get(const boost::posix_time::time_duration& timeout) const
+	{
+		boost::unique_lock<boost::mutex> lock(mutex_);
+
+		polled_ = true;
+
+		// Changes made before this call were invalidated before it, and are not in the 
+		// snapshot until an update has published that invalidation.
+		unsigned int invalidations = invalidations_;
+
+		if(active_ && snapshot_ && published_ == invalidations)
+			return snapshot_;
+
+		auto updates = updates_;
+		updated_.timed_wait(lock, timeout, [&]
+		{
+			return updates_ != updates && static_cast<int>(published_ - invalidations) >= 0;
+		});
+
+		return snapshot_;
+	}
+};
+
+info_publisher::info_publisher(const std::wstring& key) : impl_(new implementation(key)){}
+void info_publisher::update(const info_func_t& info){impl_->update(info);}
+void info_publisher::invalidate(){++impl_->invalidations_;}
+std::shared_ptr<const info_snapshot> info_publisher::get(const boost::posix_time::time_duration& timeout) const{return impl_->get(timeout);}
+
+}}
@@ -0,0 +1,93 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <functional>
+#include <string>
+
+namespace caspar { namespace core {
+
+// An immutable copy of a component's info() tree. The generation only advances
+// when the tree differs from the previous snapshot of the same component.
+class info_snapshot : boost::noncopyable
+{
+public:
+
+	// Constructors
+
+	info_snapshot(const std::wstring& key, const boost::property_tree::wptree& info, unsigned int generation);
+
+	// Properties
+
+	const boost::property_tree::wptree& info() const;
+	unsigned int generation() const;
+
+	// The tree as the XML element <key>, indented for the given depth (write_xml 
+	// settings ' ', 3). Rendered once per depth and shared by every reader.
+	const std::wstring& xml(int depth) const;
+
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+// Keeps the latest info_snapshot of a component that is owned by a single 
+// thread, e.g. the stage or the output executor. The owner calls update() once 
+// per frame; the tree is only rebuilt while someone reads the snapshots, 
+// and then when invalidate() has been called or the snapshot is older than 
+// the configured info-refresh-millis.
+class info_publisher : boost::noncopyable
+{
+public:
+
+	// Static Members
+
+	typedef std::function<boost::property_tree::wptree()> info_func_t;
+
+	// Constructors
+
+	explicit info_publisher(const std::wstring& key);
+
+	// Methods
+
+	void update(const info_func_t& info);
+	void invalidate();
+
+	// Properties
+
+	// Does not wait for the owner while the snapshots are being polled and the 
+	// snapshot is up to date. The first read after a quiet period, or after 
+	// invalidate(), waits for the owner's next update, and returns the old 
+	// snapshot (or nullptr) if that does not happen within timeout.
+	std::shared_ptr<const info_snapshot> get(const boost::posix_time::time_duration& timeout = boost::posix_time::seconds(2)) const;
+
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}
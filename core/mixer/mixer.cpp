@@ -31,6 +31,7 @@
 
 #include <common/env.h>
 #include <common/concurrency/executor.h>
+#include <common/concurrency/task_batch.h>
 #include <common/concurrency/future_util.h>
 #include <common/exception/exceptions.h>
 #include <common/gl/gl_check.h>
@@ -78,7 +79,8 @@ struct mixer::implementation : boost::noncopyable
 	image_mixer image_mixer_;
 	
 	std::unordered_map<int, blend_mode> blend_modes_;
-			
+
+	task_batch batch_;
 	executor executor_;
 	safe_ptr<monitor::subject>		 monitor_subject_;
 
@@ -101,6 +103,32 @@ public:
 		audio_mixer_.monitor_output().attach_parent(monitor_subject_);
 	}
 	
+	template<typename F>
+	void dispatch(const F& func)
+	{
+		if(!batch_.try_add(func))
+			executor_.begin_invoke(func, high_priority);
+	}
+
+	void begin_batch()
+	{
+		batch_.begin();
+	}
+
+	std::function<void()> end_batch()
+	{
+		auto tasks = std::make_shared<task_batch::tasks_t>(batch_.end());
+
+		// Normal priority, so that it runs after the frames already sent and before those sent after it.
+		return [=]
+		{
+			executor_.begin_invoke([=]
+			{
+				task_batch::run(*tasks);
+			});
+		};
+	}
+
 	void send(const std::pair<std::map<int, safe_ptr<core::basic_frame>>, std::shared_ptr<void>>& packet)
 	{			
 		executor_.begin_invoke([=]
@@ -157,26 +185,26 @@ public:
 				
 	void set_blend_mode(int index, blend_mode::type value)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			blend_modes_[index].mode = value;
-		}, high_priority);
+		});
 	}
 
 	void clear_blend_mode(int index)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			blend_modes_.erase(index);
-		}, high_priority);
+		});
 	}
 
 	void clear_blend_modes()
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			blend_modes_.clear();
-		}, high_priority);
+		});
 	}
 
 	chroma get_chroma(int index)
@@ -189,18 +217,18 @@ public:
 
     void set_chroma(int index, const chroma & value)
     {
-        executor_.begin_invoke([=]
+        dispatch([=]
         {
             blend_modes_[index].chroma = value;
-        }, high_priority);
+        });
     }
 
 	void set_straight_alpha_output(bool value)
 	{
-        executor_.begin_invoke([=]
+        dispatch([=]
         {
 			straighten_alpha_ = value;
-        }, high_priority);
+        });
 	}
 
 	bool get_straight_alpha_output()
@@ -221,10 +249,10 @@ public:
 
 	void set_master_volume(float volume)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			audio_mixer_.set_master_volume(volume);
-		}, high_priority);
+		});
 	}
 	
 	void set_video_format_desc(const video_format_desc& format_desc)
@@ -274,6 +302,8 @@ void mixer::set_straight_alpha_output(bool value) { impl_->set_straight_alpha_ou
 bool mixer::get_straight_alpha_output() { return impl_->get_straight_alpha_output(); }
 float mixer::get_master_volume() { return impl_->get_master_volume(); }
 void mixer::set_master_volume(float volume) { impl_->set_master_volume(volume); }
+void mixer::begin_batch(){impl_->begin_batch();}
+std::function<void()> mixer::end_batch(){return impl_->end_batch();}
 void mixer::set_video_format_desc(const video_format_desc& format_desc){impl_->set_video_format_desc(format_desc);}
 boost::unique_future<boost::property_tree::wptree> mixer::info() const{return impl_->info();}
 boost::unique_future<boost::property_tree::wptree> mixer::delay_info() const{return impl_->delay_info();}
@@ -33,6 +33,7 @@
 #include <boost/property_tree/ptree_fwd.hpp>
 #include <boost/thread/future.hpp>
 
+#include <functional>
 #include <map>
 
 namespace caspar { 
@@ -80,6 +81,11 @@ public:
 	float get_master_volume();
 	void set_master_volume(float volume);
 
+	// Until end_batch(), changes made from the calling thread are collected. The returned function 
+	// applies them together, in order with the frames sent before and after it is called.
+	void begin_batch();
+	std::function<void()> end_batch();
+
 	boost::unique_future<boost::property_tree::wptree> info() const;
 	boost::unique_future<boost::property_tree::wptree> delay_info() const;
 
@@ -139,6 +139,8 @@ public:
 	virtual safe_ptr<frame_producer>							get_following_producer() const override									{return (*producer_)->get_following_producer();}
 	virtual void												set_leading_producer(const safe_ptr<frame_producer>& producer) override	{(*producer_)->set_leading_producer(producer);}
 	virtual uint32_t											nb_frames() const override												{return (*producer_)->nb_frames();}
+	virtual void												begin_preroll(int hints) override										{(*producer_)->begin_preroll(hints);}
+	virtual bool												is_prerolled() const override											{return (*producer_)->is_prerolled();}
 	virtual monitor::subject&									monitor_output()														{return (*producer_)->monitor_output();}
 };
 
@@ -174,6 +176,8 @@ public:
 	virtual safe_ptr<frame_producer>							get_following_producer() const override									{return (producer_)->get_following_producer();}
 	virtual void												set_leading_producer(const safe_ptr<frame_producer>& producer) override	{(producer_)->set_leading_producer(producer);}
 	virtual uint32_t											nb_frames() const override												{return (producer_)->nb_frames();}
+	virtual void												begin_preroll(int hints) override										{(producer_)->begin_preroll(hints);}
+	virtual bool												is_prerolled() const override											{return (producer_)->is_prerolled();}
 	virtual monitor::subject&									monitor_output()														{return (producer_)->monitor_output();}
 };
 
@@ -72,6 +72,9 @@ public:
 	virtual void set_leading_producer(const safe_ptr<frame_producer>&) {}  // nothrow
 		
 	virtual uint32_t nb_frames() const {return std::numeric_limits<uint32_t>::max();}
+
+	virtual void begin_preroll(int /*hints*/) {} // nothrow, decode ahead while waiting in background.
+	virtual bool is_prerolled() const {return true;} // nothrow
 	
 	virtual safe_ptr<basic_frame> receive(int hints) = 0;
 	virtual safe_ptr<core::basic_frame> last_frame() const = 0;
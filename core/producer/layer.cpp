@@ -38,6 +38,7 @@ struct layer::implementation
 	int32_t						auto_play_delta_;
 	bool						is_paused_;
 	int64_t						current_frame_age_;
+	int							hints_;
 	safe_ptr<monitor::subject>	monitor_subject_;
 
 public:
@@ -47,6 +48,7 @@ public:
 		, frame_number_(0)
 		, auto_play_delta_(-1)
 		, is_paused_(false)
+		, hints_(frame_producer::NO_HINT)
 		, monitor_subject_(make_safe<monitor::subject>("/layer/" + boost::lexical_cast<std::string>(index)))
 	{
 	}
@@ -75,6 +77,8 @@ public:
 			receive(frame_producer::NO_HINT);
 			pause();
 		}
+		else if(background_ != frame_producer::empty())
+			background_->begin_preroll(hints_);
 	}
 	
 	void play()
@@ -108,7 +112,10 @@ public:
 	{		
 		try
 		{
-			*monitor_subject_ << monitor::message("/paused") % is_paused_;
+			hints_ = hints;
+
+			*monitor_subject_ << monitor::message("/paused") % is_paused_
+							  << monitor::message("/background/prerolled") % background_prerolled();
 
 			if(is_paused_)
 			{
@@ -152,6 +159,11 @@ public:
 		return (foreground ? foreground_ : background_)->call(param);
 	}
 
+	bool background_prerolled() const
+	{
+		return background_ != frame_producer::empty() && background_->is_prerolled();
+	}
+
 	bool empty() const
 	{
 		return background_ == core::frame_producer::empty() && foreground_ == core::frame_producer::empty();
@@ -169,6 +181,7 @@ public:
 		info.add(L"nb_frames",	 nb_frames == std::numeric_limits<int64_t>::max() ? -1 : nb_frames);
 		info.add(L"frames-left", nb_frames == std::numeric_limits<int64_t>::max() ? -1 : (foreground_->nb_frames() - frame_number_ - auto_play_delta_));
 		info.add(L"frame-age", current_frame_age_);
+		info.add(L"background.prerolled", background_prerolled());
 		info.add_child(L"foreground.producer", foreground_->info());
 		info.add_child(L"background.producer", background_->info());
 		return info;
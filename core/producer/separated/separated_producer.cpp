@@ -113,6 +113,17 @@ struct separated_producer : public frame_producer
 		return std::min(fill_producer_->nb_frames(), key_producer_->nb_frames());
 	}
 
+	virtual void begin_preroll(int hints) override
+	{
+		fill_producer_->begin_preroll(hints);
+		key_producer_->begin_preroll(hints | ALPHA_HINT);
+	}
+
+	virtual bool is_prerolled() const override
+	{
+		return fill_producer_->is_prerolled() && key_producer_->is_prerolled();
+	}
+
 	virtual std::wstring print() const override
 	{
 		return L"separated[fill:" + fill_producer_->print() + L"|key[" + key_producer_->print() + L"]]";
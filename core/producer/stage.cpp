@@ -25,10 +25,13 @@
 
 #include "layer.h"
 
+#include "../info_snapshot.h"
+
 #include "frame/basic_frame.h"
 #include "frame/frame_factory.h"
 
 #include <common/concurrency/executor.h>
+#include <common/concurrency/task_batch.h>
 
 #include <core/producer/frame/frame_transform.h>
 #include <core/consumer/frame_consumer.h>
@@ -104,7 +107,9 @@ struct stage::implementation : public std::enable_shared_from_this<implementatio
 	std::map<int, std::map<void*, std::shared_ptr<write_frame_consumer>>>		 layer_consumers_;
 	
 	safe_ptr<monitor::subject>													 monitor_subject_;
+	info_publisher																 info_;
 
+	task_batch																	 batch_;
 	executor																	 executor_;
 
 public:
@@ -113,12 +118,45 @@ public:
 		, format_desc_(format_desc)
 		, target_(target)
 		, monitor_subject_(make_safe<monitor::subject>("/stage"))
+		, info_(L"stage")
 		, executor_(L"stage")
 	{
 		graph_->set_color("tick-time", diagnostics::color(0.0f, 0.6f, 0.9f, 0.8));	
 		graph_->set_color("produce-time", diagnostics::color(0.0f, 1.0f, 0.0f));
 	}
 
+	template<typename F>
+	void dispatch(const F& func)
+	{
+		auto task = [=]
+		{
+			func();
+			info_.invalidate();
+		};
+
+		if(!batch_.try_add(task))
+			executor_.begin_invoke(task, high_priority);
+	}
+
+	void begin_batch()
+	{
+		batch_.begin();
+	}
+
+	void commit_batch(const std::function<void()>& on_applied)
+	{
+		auto tasks = std::make_shared<task_batch::tasks_t>(batch_.end());
+
+		// High priority, so that it runs before the next tick.
+		executor_.begin_invoke([=]
+		{
+			task_batch::run(*tasks);
+
+			if(on_applied)
+				on_applied();
+		}, high_priority);
+	}
+
 	void spawn_token()
 	{
 		std::weak_ptr<implementation> self = shared_from_this();
@@ -150,6 +188,8 @@ public:
 	{		
 		try
 		{
+			info_.update([this]{return layers_info();});
+
 			produce_timer_.restart();
 
 			std::map<int, safe_ptr<basic_frame>> frames;
@@ -223,17 +263,17 @@ public:
 		
 	void set_transform(int index, const frame_transform& transform, unsigned int mix_duration, const std::wstring& tween)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			auto src = transforms_[index].fetch();
 			auto dst = transform;
 			transforms_[index] = tweened_transform<frame_transform>(src, dst, mix_duration, tween);
-		}, high_priority);
+		});
 	}
 					
 	void apply_transforms(const std::vector<std::tuple<int, stage::transform_func_t, unsigned int, std::wstring>>& transforms)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			BOOST_FOREACH(auto& transform, transforms)
 			{
@@ -242,33 +282,33 @@ public:
 				auto dst = std::get<1>(transform)(tween.dest());
 				transforms_[std::get<0>(transform)] = tweened_transform<frame_transform>(src, dst, std::get<2>(transform), std::get<3>(transform));
 			}
-		}, high_priority);
+		});
 	}
 						
 	void apply_transform(int index, const stage::transform_func_t& transform, unsigned int mix_duration, const std::wstring& tween)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			auto src = transforms_[index].fetch();
 			auto dst = transform(src);
 			transforms_[index] = tweened_transform<frame_transform>(src, dst, mix_duration, tween);
-		}, high_priority);
+		});
 	}
 
 	void clear_transforms(int index)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			transforms_.unsafe_erase(index);
-		}, high_priority);
+		});
 	}
 
 	void clear_transforms()
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			transforms_.clear();
-		}, high_priority);
+		});
 	}
 
 	frame_transform get_current_transform(int index)
@@ -292,56 +332,57 @@ public:
 
 	void load(int index, const safe_ptr<frame_producer>& producer, bool preview, int auto_play_delta)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			get_layer(index).load(producer, preview, auto_play_delta);
-		}, high_priority);
+		});
 	}
 
 	void pause(int index)
 	{		
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			get_layer(index).pause();
-		}, high_priority);
+		});
 	}
 
 	void play(int index)
 	{		
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			get_layer(index).play();
-		}, high_priority);
+		});
 	}
 
 	void stop(int index)
 	{		
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			get_layer(index).stop();
-		}, high_priority);
+		});
 	}
 
 	void clear(int index)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			layers_.erase(index);
-		}, high_priority);
+		});
 	}
 		
 	void clear()
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			layers_.clear();
-		}, high_priority);
+		});
 	}	
 	
 	boost::unique_future<std::wstring> call(int index, bool foreground, const std::wstring& param)
 	{
 		return std::move(*executor_.invoke([=]
 		{
+			info_.invalidate();
 			return std::make_shared<boost::unique_future<std::wstring>>(std::move(get_layer(index).call(foreground, param)));
 		}, high_priority));
 	}
@@ -365,6 +406,9 @@ public:
 				layer->monitor_output().attach_parent(monitor_subject_);
 			
 			std::swap(layers_, other_impl->layers_);
+
+			info_.invalidate();
+			other_impl->info_.invalidate();
 						
 			BOOST_FOREACH(auto& layer, layers)
 				layer->monitor_output().detach_parent();
@@ -381,10 +425,10 @@ public:
 
 	void swap_layer(int index, int other_index)
 	{
-		executor_.begin_invoke([=]
+		dispatch([=]
 		{
 			std::swap(get_layer(index), get_layer(other_index));
-		}, task_priority::high_priority);
+		});
 	}
 
 	void swap_layer(int index, int other_index, stage& other)
@@ -405,6 +449,9 @@ public:
 
 				std::swap(my_layer, other_layer);
 
+				info_.invalidate();
+				other_impl->info_.invalidate();
+
 				my_layer.monitor_output().detach_parent();
 				other_layer.monitor_output().attach_parent(other_impl->monitor_subject_);
 			};		
@@ -437,18 +484,24 @@ public:
 		executor_.begin_invoke([=]
 		{
 			format_desc_ = format_desc;
+			info_.invalidate();
 		}, high_priority);
 	}
 
+	boost::property_tree::wptree layers_info()
+	{
+		boost::property_tree::wptree info;
+		BOOST_FOREACH(auto& layer, layers_)			
+			info.add_child(L"layers.layer", layer.second->info())
+				.add(L"index", layer.first);	
+		return info;
+	}
+
 	boost::unique_future<boost::property_tree::wptree> info()
 	{
-		return std::move(executor_.begin_invoke([this]() -> boost::property_tree::wptree
+		return std::move(executor_.begin_invoke([this]
 		{
-			boost::property_tree::wptree info;
-			BOOST_FOREACH(auto& layer, layers_)			
-				info.add_child(L"layers.layer", layer.second->info())
-					.add(L"index", layer.first);	
-			return info;
+			return layers_info();
 		}, high_priority));
 	}
 
@@ -488,6 +541,8 @@ void stage::apply_transform(int index, const std::function<core::frame_transform
 void stage::clear_transforms(int index){impl_->clear_transforms(index);}
 void stage::clear_transforms(){impl_->clear_transforms();}
 frame_transform stage::get_current_transform(int index) { return impl_->get_current_transform(index); }
+void stage::begin_batch(){impl_->begin_batch();}
+void stage::commit_batch(const std::function<void()>& on_applied){impl_->commit_batch(on_applied);}
 void stage::spawn_token(){impl_->spawn_token();}
 void stage::load(int index, const safe_ptr<frame_producer>& producer, bool preview, int auto_play_delta){impl_->load(index, producer, preview, auto_play_delta);}
 void stage::pause(int index){impl_->pause(index);}
@@ -505,6 +560,7 @@ boost::unique_future<safe_ptr<frame_producer>> stage::background(int index) {ret
 boost::unique_future<std::wstring> stage::call(int index, bool foreground, const std::wstring& param){return impl_->call(index, foreground, param);}
 void stage::set_video_format_desc(const video_format_desc& format_desc){impl_->set_video_format_desc(format_desc);}
 boost::unique_future<boost::property_tree::wptree> stage::info() const{return impl_->info();}
+std::shared_ptr<const info_snapshot> stage::get_info_snapshot() const{return impl_->info_.get();}
 boost::unique_future<boost::property_tree::wptree> stage::info(int index) const{return impl_->info(index);}
 boost::unique_future<boost::property_tree::wptree> stage::delay_info() const{return impl_->delay_info();}
 boost::unique_future<boost::property_tree::wptree> stage::delay_info(int index) const{return impl_->delay_info(index);}
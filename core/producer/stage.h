@@ -40,6 +40,7 @@ namespace caspar { namespace core {
 struct video_format_desc;
 struct frame_transform;
 struct write_frame_consumer;
+class info_snapshot;
 
 class stage : boost::noncopyable
 {
@@ -63,6 +64,12 @@ public:
 	void clear_transforms();
 	frame_transform get_current_transform(int index);
 
+	// Until commit_batch(), changes to layers and transforms made from the calling thread are collected, 
+	// and then applied together ahead of the next tick so that they take effect on the same frame. 
+	// on_applied is called right after them, before the tick.
+	void begin_batch();
+	void commit_batch(const std::function<void()>& on_applied = nullptr);
+
 	void spawn_token();
 			
 	void load(int index, const safe_ptr<frame_producer>& producer, bool preview = false, int auto_play_delta = -1);
@@ -88,6 +95,10 @@ public:
 	boost::unique_future<boost::property_tree::wptree> info() const;
 	boost::unique_future<boost::property_tree::wptree> info(int layer) const;
 
+	// The layers part of info(), as last published by the stage thread. Reading it 
+	// does not queue any work on the stage. See info_snapshot.h.
+	std::shared_ptr<const info_snapshot> get_info_snapshot() const;
+
 	boost::unique_future<boost::property_tree::wptree> delay_info() const;
 	boost::unique_future<boost::property_tree::wptree> delay_info(int layer) const;
 	
@@ -78,6 +78,16 @@ struct transition_producer : public frame_producer
 		return dest_producer_->call(params);
 	}
 
+	virtual void begin_preroll(int hints) override
+	{
+		dest_producer_->begin_preroll(hints);
+	}
+
+	virtual bool is_prerolled() const override
+	{
+		return dest_producer_->is_prerolled();
+	}
+
 	virtual safe_ptr<basic_frame> receive(int hints) override
 	{
 		if(++current_frame_ >= info_.duration)
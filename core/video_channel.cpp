@@ -23,6 +23,7 @@
 
 #include "video_channel.h"
 
+#include "info_snapshot.h"
 #include "video_format.h"
 
 #include "consumer/output.h"
@@ -53,6 +54,8 @@ struct video_channel::implementation : boost::noncopyable
 	const safe_ptr<caspar::core::stage>		stage_;
 
 	safe_ptr<monitor::subject>				monitor_subject_;
+
+	tbb::atomic<unsigned int>				format_generation_;
 	
 public:
 	implementation(video_channel& self, int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout)  
@@ -65,6 +68,8 @@ public:
 		, stage_(new caspar::core::stage(graph_, mixer_, format_desc))	
 		, monitor_subject_(make_safe<monitor::subject>("/channel/" + boost::lexical_cast<std::string>(index)))
 	{
+		format_generation_ = 0;
+
 		graph_->set_text(print());
 		diagnostics::register_graph(graph_);
 
@@ -98,6 +103,7 @@ public:
 			throw;
 		}
 		format_desc_ = format_desc;
+		++format_generation_;
 	}
 		
 	std::wstring print() const
@@ -105,24 +111,41 @@ public:
 		return L"video_channel[" + boost::lexical_cast<std::wstring>(index_) + L"|" +  format_desc_.name + L"]";
 	}
 
+	channel_info_snapshot get_info_snapshot() const
+	{
+		channel_info_snapshot snapshot;
+
+		snapshot.generation = format_generation_;
+		snapshot.video_mode = format_desc_.name;
+		snapshot.stage		= stage_->get_info_snapshot();
+		snapshot.output		= output_->get_info_snapshot();
+
+		if(snapshot.stage)
+			snapshot.generation += snapshot.stage->generation();
+
+		if(snapshot.output)
+			snapshot.generation += snapshot.output->generation();
+
+		return snapshot;
+	}
+
 	boost::property_tree::wptree info() const
 	{
 		boost::property_tree::wptree info;
 
-		auto stage_info  = stage_->info();
+		auto snapshot	 = get_info_snapshot();
 		auto mixer_info  = mixer_->info();
-		auto output_info = output_->info();
 
-		info.add(L"video-mode", format_desc_.name);
+		info.add(L"video-mode", snapshot.video_mode);
 
-		if (stage_info.timed_wait(boost::posix_time::seconds(2)))
-			info.add_child(L"stage", stage_info.get());
+		if (snapshot.stage)
+			info.add_child(L"stage", snapshot.stage->info());
 
 		if (mixer_info.timed_wait(boost::posix_time::seconds(2)))
 			info.add_child(L"mixer", mixer_info.get());
 
-		if (output_info.timed_wait(boost::posix_time::seconds(2)))
-			info.add_child(L"output", output_info.get());
+		if (snapshot.output)
+			info.add_child(L"output", snapshot.output->info());
    
 		return info;			   
 	}
@@ -159,4 +182,5 @@ boost::property_tree::wptree video_channel::info() const{return impl_->info();}
 int video_channel::index() const {return impl_->index_;}
 monitor::subject& video_channel::monitor_output(){return *impl_->monitor_subject_;}
 boost::property_tree::wptree video_channel::delay_info() const { return impl_->delay_info(); }
+channel_info_snapshot video_channel::get_info_snapshot() const { return impl_->get_info_snapshot(); }
 }}
\ No newline at end of file
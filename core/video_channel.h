@@ -30,6 +30,8 @@
 
 #include <agents.h>
 
+#include <string>
+
 namespace caspar { namespace core {
 	
 class stage;
@@ -38,6 +40,18 @@ class output;
 class ogl_device;
 struct video_format_desc;
 struct channel_layout;
+class info_snapshot;
+
+// The stage and output parts of video_channel::info() as last published by their 
+// threads. The generation advances whenever either of them or the video mode changes. 
+// The mixer is not part of it, since its mix-time changes on every frame.
+struct channel_info_snapshot
+{
+	std::wstring							video_mode;
+	std::shared_ptr<const info_snapshot>	stage;
+	std::shared_ptr<const info_snapshot>	output;
+	unsigned int							generation;
+};
 
 class video_channel : boost::noncopyable
 {
@@ -62,6 +76,7 @@ public:
 	
 	boost::property_tree::wptree info() const;
 	boost::property_tree::wptree delay_info() const;
+	channel_info_snapshot get_info_snapshot() const;
 
 	int index() const;
 	
@@ -0,0 +1,465 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "encoder_benchmark.h"
+
+#include "ffmpeg_consumer.h"
+
+#include <core/consumer/frame_consumer.h>
+#include <core/mixer/read_frame.h>
+#include <core/mixer/audio/audio_mixer.h>
+#include <core/mixer/audio/audio_util.h>
+#include <core/parameters/parameters.h>
+#include <core/video_format.h>
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/chrono.hpp>
+#include <boost/chrono/process_cpu_clocks.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <windows.h>
+
+namespace caspar { namespace ffmpeg {
+
+typedef boost::chrono::high_resolution_clock benchmark_clock;
+
+struct encoder_preset
+{
+	const wchar_t* name;
+	const wchar_t* extension;
+	const wchar_t* options;
+};
+
+// The codecs set up by the file consumer. Audio is PCM so that only the video encoder is measured.
+static const encoder_preset PRESETS[] = 
+{
+	{L"prores",			L".mov",	L"-vcodec prores -acodec pcm_s16le"},
+	{L"dnxhd",			L".mov",	L"-vcodec dnxhd -acodec pcm_s16le"},
+	{L"dv",				L".dv",		L"-vcodec dvvideo"},
+	{L"h264-ultrafast",	L".mov",	L"-vcodec libx264 -acodec pcm_s16le"},
+	{L"h264-veryfast",	L".mov",	L"-vcodec libx264 -preset veryfast -acodec pcm_s16le"},
+	{L"h264-medium",	L".mov",	L"-vcodec libx264 -preset medium -acodec pcm_s16le"},
+	{L"qtrle",			L".mov",	L"-vcodec qtrle -acodec pcm_s16le"},
+};
+
+static const size_t PATTERN_FRAMES = 8;
+
+typedef std::vector<uint8_t, tbb::cache_aligned_allocator<uint8_t>> image_buffer;
+
+// A channel output frame with pregenerated image data and a tone.
+class synthetic_frame : public core::read_frame
+{
+	const std::shared_ptr<const image_buffer>	image_;
+	const core::audio_buffer					audio_;
+	const core::channel_layout					channel_layout_;
+	const benchmark_clock::time_point			created_;
+public:
+	synthetic_frame(const std::shared_ptr<const image_buffer>& image, core::audio_buffer&& audio, const core::channel_layout& channel_layout)
+		: image_(image)
+		, audio_(std::move(audio))
+		, channel_layout_(channel_layout)
+		, created_(benchmark_clock::now())
+	{
+	}
+
+	virtual const boost::iterator_range<const uint8_t*> image_data() override
+	{
+		return boost::iterator_range<const uint8_t*>(image_->data(), image_->data() + image_->size());
+	}
+
+	virtual const boost::iterator_range<const int32_t*> audio_data() override
+	{
+		return boost::iterator_range<const int32_t*>(audio_.data(), audio_.data() + audio_.size());
+	}
+
+	virtual size_t image_size() const override
+	{
+		return image_->size();
+	}
+
+	virtual int num_channels() const override
+	{
+		return channel_layout_.num_channels;
+	}
+
+	virtual int64_t get_age_millis() const override
+	{
+		return boost::chrono::duration_cast<boost::chrono::milliseconds>(benchmark_clock::now() - created_).count();
+	}
+
+	virtual const core::multichannel_view<const int32_t, boost::iterator_range<const int32_t*>::const_iterator> multichannel_view() const override
+	{
+		return core::make_multichannel_view<const int32_t>(audio_.data(), audio_.data() + audio_.size(), channel_layout_);
+	}
+};
+
+// Moving color bars over a noise band, which keeps inter-frame codecs from idling.
+static std::shared_ptr<const image_buffer> create_pattern(const core::video_format_desc& format_desc, size_t index)
+{
+	static const uint8_t bars[][3] = {{192, 192, 192}, {0, 192, 192}, {192, 192, 0}, {0, 192, 0}, {192, 0, 192}, {0, 0, 192}, {192, 0, 0}, {16, 16, 16}};
+
+	auto image = std::make_shared<image_buffer>(format_desc.size);
+	
+	const int width		= static_cast<int>(format_desc.width);
+	const int height	= static_cast<int>(format_desc.height);
+	const int offset	= static_cast<int>(index) * width / 64;
+
+	tbb::parallel_for(0, height, [&](int y)
+	{
+		auto row	= image->data() + y * width * 4;
+		auto seed	= static_cast<uint32_t>(index * height + y) * 2654435761u;
+
+		for(int x = 0; x < width; ++x)
+		{
+			auto pixel = row + x * 4;
+
+			if(y > height * 3 / 4)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				pixel[0] = pixel[1] = pixel[2] = static_cast<uint8_t>(seed >> 24);
+			}
+			else
+			{
+				auto& bar = bars[((x + offset) * 8 / width) % 8];
+				pixel[0] = bar[0];
+				pixel[1] = bar[1];
+				pixel[2] = bar[2];
+			}
+
+			pixel[3] = 255;
+		}
+	});
+
+	return image;
+}
+
+// A 1 kHz tone at -20 dBFS on every channel.
+static core::audio_buffer create_tone(const core::video_format_desc& format_desc, int num_channels, int64_t first_sample, size_t samples)
+{
+	static const double PI = 3.14159265358979323846;
+
+	core::audio_buffer audio(samples * num_channels);
+
+	for(size_t n = 0; n < samples; ++n)
+	{
+		const auto t		= static_cast<double>(first_sample + n) / format_desc.audio_sample_rate;
+		const auto sample	= static_cast<int32_t>(std::sin(2.0 * PI * 1000.0 * t) * 0.1 * std::numeric_limits<int32_t>::max());
+
+		for(int c = 0; c < num_channels; ++c)
+			audio[n * num_channels + c] = sample;
+	}
+
+	return audio;
+}
+
+static double process_cpu_millis()
+{
+	using namespace boost::chrono;
+
+	return duration<double, boost::milli>(process_user_cpu_clock::now().time_since_epoch()).count() 
+		 + duration<double, boost::milli>(process_system_cpu_clock::now().time_since_epoch()).count();
+}
+
+// The recordings are written to a folder of their own below the temp folder, out of sight of the 
+// thumbnail generator and the media listing, and the folder is removed afterwards.
+static std::wstring create_benchmark_folder()
+{
+	wchar_t temp[MAX_PATH + 1];
+	if(GetTempPathW(MAX_PATH + 1, temp) == 0)
+		BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not find the temp folder."));
+
+	auto folder = boost::filesystem::wpath(temp) / (L"casparcg-encoder-benchmark-" + boost::lexical_cast<std::wstring>(GetCurrentProcessId()));
+	boost::filesystem::create_directories(folder);
+
+	return folder.file_string() + L"\\";
+}
+
+static void remove_benchmark_folder(const std::wstring& folder)
+{
+	try
+	{
+		boost::filesystem::remove_all(boost::filesystem::wpath(folder));
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+	}
+}
+
+static void remove_benchmark_file(const std::wstring& path)
+{
+	try
+	{
+		boost::filesystem::remove(boost::filesystem::wpath(path));
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+	}
+}
+
+static safe_ptr<core::frame_consumer> create_file_consumer(const core::video_format_desc& format_desc, const std::wstring& folder, const std::wstring& filename, const std::wstring& option_string)
+{
+	std::vector<std::wstring> params;
+	params.push_back(L"FILE");
+	params.push_back(filename);
+
+	std::vector<std::wstring> options;
+	boost::split(options, option_string, boost::is_any_of(L" "), boost::token_compress_on);
+	params.insert(params.end(), options.begin(), options.end());
+
+	auto consumer = create_consumer(core::parameters(params), folder);
+	consumer->initialize(format_desc, 0);
+
+	return consumer;
+}
+
+// Frames are sent to every consumer at the channel rate, and the consumers drop those they cannot keep up with.
+static void send_frames(const std::vector<safe_ptr<core::frame_consumer>>& consumers, const core::video_format_desc& format_desc, int frames, const std::vector<std::shared_ptr<const image_buffer>>& patterns)
+{
+	const auto& channel_layout	= core::default_channel_layout_repository().get_by_name(L"STEREO");
+	const auto frame_duration	= boost::chrono::duration_cast<benchmark_clock::duration>(boost::chrono::duration<double>(1.0 / format_desc.fps));
+	const auto start			= benchmark_clock::now();
+
+	int64_t audio_samples = 0;
+
+	for(int n = 0; n < frames; ++n)
+	{
+		const auto samples	= format_desc.audio_cadence[n % format_desc.audio_cadence.size()];
+		const auto frame	= make_safe<synthetic_frame>(patterns[n % patterns.size()], create_tone(format_desc, channel_layout.num_channels, audio_samples, samples), channel_layout);
+		audio_samples += samples;
+
+		BOOST_FOREACH(auto& consumer, consumers)
+			consumer->send(frame);
+
+		auto remaining = boost::chrono::duration_cast<boost::chrono::microseconds>(start + frame_duration * (n + 1) - benchmark_clock::now()).count();
+		if(remaining > 0)
+			boost::this_thread::sleep(boost::posix_time::microseconds(remaining));
+	}
+}
+
+static int dropped_frames(const boost::property_tree::wptree& encoder)
+{
+	return encoder.get(L"dropped-frames.convert-queue-full", 0) + encoder.get(L"dropped-frames.audio-encode-queue-full", 0);
+}
+
+static boost::property_tree::wptree run_preset(const core::video_format_desc& format_desc, int frames, const encoder_preset& preset, const std::wstring& folder, const std::vector<std::shared_ptr<const image_buffer>>& patterns)
+{
+	boost::property_tree::wptree info;
+	info.add(L"name",		preset.name);
+	info.add(L"options",	preset.options);
+
+	const auto filename = std::wstring(L"encoder-benchmark-") + preset.name + preset.extension;
+	const auto path		= folder + filename;
+
+	try
+	{
+		const auto start = benchmark_clock::now();
+
+		std::vector<safe_ptr<core::frame_consumer>> consumers;
+		consumers.push_back(create_file_consumer(format_desc, folder, filename, preset.options));
+
+		send_frames(consumers, format_desc, frames, patterns);
+
+		// Both are taken once the queued frames have been encoded and written.
+		const auto encoder	= drain_consumer(consumers.front()).get_child(L"encoder");
+		const auto elapsed	= boost::chrono::duration<double>(benchmark_clock::now() - start).count();
+		const auto encoded	= encoder.get(L"encoded-frames", 0);
+		const auto dropped	= dropped_frames(encoder);
+		const auto bytes	= boost::filesystem::file_size(boost::filesystem::wpath(path));
+
+		info.add(L"frames",						frames);
+		info.add(L"fps",						encoded / elapsed);
+		info.add(L"realtime",					encoded / elapsed >= format_desc.fps * 0.99 && dropped == 0);
+		info.add(L"dropped-frames",				dropped);
+		info.add(L"bitrate-kbps",				static_cast<double>(bytes) * 8.0 / (frames / format_desc.fps) / 1000.0);
+		info.add_child(L"encode-time",			encoder.get_child(L"encode-time"));
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		info.add(L"error", L"Preset could not be recorded in " + format_desc.name + L".");
+	}
+
+	// Presets can write large files, so each is removed before the next is recorded.
+	remove_benchmark_file(path);
+
+	return info;
+}
+
+std::vector<std::wstring> get_encoder_benchmark_presets()
+{
+	std::vector<std::wstring> presets;
+
+	BOOST_FOREACH(auto& preset, PRESETS)
+		presets.push_back(preset.name);
+
+	return presets;
+}
+
+boost::property_tree::wptree benchmark_encoders(const core::video_format_desc& format_desc, int frames, const std::vector<std::wstring>& presets)
+{
+	if(format_desc.format == core::video_format::invalid)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("format_desc"));
+
+	if(frames < 1)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("frames"));
+
+	std::vector<std::shared_ptr<const image_buffer>> patterns;
+	for(size_t n = 0; n < PATTERN_FRAMES; ++n)
+		patterns.push_back(create_pattern(format_desc, n));
+
+	boost::property_tree::wptree info;
+	info.add(L"benchmark.format",	format_desc.name);
+	info.add(L"benchmark.frames",	frames);
+
+	const auto folder = create_benchmark_folder();
+
+	BOOST_FOREACH(auto& preset, PRESETS)
+	{
+		if(!presets.empty() && std::find_if(presets.begin(), presets.end(), [&](const std::wstring& name){return boost::iequals(name, preset.name);}) == presets.end())
+			continue;
+
+		CASPAR_LOG(info) << L"[encoder-benchmark] Recording " << frames << L" frames of " << format_desc.name << L" with " << preset.name << L".";
+
+		info.add_child(L"benchmark.presets.preset", run_preset(format_desc, frames, preset, folder, patterns));
+	}
+
+	remove_benchmark_folder(folder);
+
+	return info;
+}
+
+static boost::property_tree::wptree run_renditions(const core::video_format_desc& format_desc, int frames, const std::vector<std::wstring>& option_strings, const std::vector<std::wstring>& files, const std::wstring& folder, const std::vector<std::shared_ptr<const image_buffer>>& patterns)
+{
+	boost::property_tree::wptree info;
+
+	try
+	{
+		int encoded = 0;
+		int dropped = 0;
+
+		const auto start		= benchmark_clock::now();
+		const auto start_cpu	= process_cpu_millis();
+
+		std::vector<safe_ptr<core::frame_consumer>> consumers;
+		for(size_t n = 0; n < option_strings.size(); ++n)
+			consumers.push_back(create_file_consumer(format_desc, folder, files[n], option_strings[n]));
+
+		send_frames(consumers, format_desc, frames, patterns);
+
+		// The counts and times are taken once the queued frames have been encoded and written.
+		BOOST_FOREACH(auto& consumer, consumers)
+		{
+			auto encoder = drain_consumer(consumer).get_child(L"encoder");
+			encoded = std::max(encoded, encoder.get(L"encoded-frames", 0));
+			dropped += dropped_frames(encoder);
+		}
+
+		const auto cpu_millis	= process_cpu_millis() - start_cpu;
+		const auto elapsed		= boost::chrono::duration<double>(benchmark_clock::now() - start).count();
+
+		info.add(L"consumers",				option_strings.size());
+		info.add(L"fps",					encoded / elapsed);
+		info.add(L"dropped-frames",			dropped);
+		info.add(L"cpu-millis",				cpu_millis);
+		info.add(L"cpu-millis-per-frame",	encoded > 0 ? cpu_millis / encoded : 0.0);
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		info.add(L"error", L"Renditions could not be recorded in " + format_desc.name + L".");
+	}
+
+	return info;
+}
+
+boost::property_tree::wptree benchmark_renditions(const core::video_format_desc& format_desc, int frames, const std::wstring& vcodec, const std::vector<std::wstring>& sizes)
+{
+	if(format_desc.format == core::video_format::invalid)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("format_desc"));
+
+	if(frames < 1)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("frames") << arg_value_info(boost::lexical_cast<std::string>(frames)));
+
+	if(sizes.empty())
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("sizes"));
+
+	std::vector<std::shared_ptr<const image_buffer>> patterns;
+	for(size_t n = 0; n < PATTERN_FRAMES; ++n)
+		patterns.push_back(create_pattern(format_desc, n));
+
+	// Audio is PCM, so that the runs differ in their conversion and video encoding only.
+	const std::wstring options = L"-vcodec " + vcodec + L" -acodec pcm_s16le";
+
+	// One consumer writing every size, with the renditions scaled down from each other.
+	std::vector<std::wstring> shared_options(1, options + L" -renditions " + boost::join(sizes, L","));
+	std::vector<std::wstring> shared_files(1, L"renditions-benchmark.mov");
+
+	// A consumer of its own for every size, each scaling from the channel frame.
+	std::vector<std::wstring> independent_options(1, options);
+	std::vector<std::wstring> independent_files(1, L"renditions-benchmark-0.mov");
+
+	for(size_t n = 0; n < sizes.size(); ++n)
+	{
+		independent_options.push_back(options + L" -s " + sizes[n]);
+		independent_files.push_back(L"renditions-benchmark-" + boost::lexical_cast<std::wstring>(n + 1) + L".mov");
+	}
+
+	CASPAR_LOG(info) << L"[renditions-benchmark] Recording " << frames << L" frames of " << format_desc.name << L" with " << sizes.size() << L" renditions.";
+
+	const auto folder = create_benchmark_folder();
+
+	auto with_renditions	= run_renditions(format_desc, frames, shared_options, shared_files, folder, patterns);
+	auto independent		= run_renditions(format_desc, frames, independent_options, independent_files, folder, patterns);
+
+	remove_benchmark_folder(folder);
+
+	const auto cpu_with			= with_renditions.get(L"cpu-millis", 0.0);
+	const auto cpu_independent	= independent.get(L"cpu-millis", 0.0);
+
+	boost::property_tree::wptree info;
+	info.add(L"renditions.format",					format_desc.name);
+	info.add(L"renditions.frames",					frames);
+	info.add(L"renditions.vcodec",					vcodec);
+	info.add(L"renditions.sizes",					boost::join(sizes, L","));
+	info.add_child(L"renditions.one-consumer",		with_renditions);
+	info.add_child(L"renditions.independent",		independent);
+	info.add(L"renditions.cpu-saved-percent",		cpu_independent > 0.0 ? (cpu_independent - cpu_with) * 100.0 / cpu_independent : 0.0);
+
+	return info;
+}
+
+}}
@@ -0,0 +1,47 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <string>
+#include <vector>
+
+namespace caspar { 
+
+namespace core {
+	struct video_format_desc;
+}
+
+namespace ffmpeg {
+
+std::vector<std::wstring> get_encoder_benchmark_presets();
+
+// Records synthetic frames at the channel rate with each of the given presets, or all of them,
+// and reports the achieved frame rate, encode times, dropped frames and bitrate. Blocks until done.
+boost::property_tree::wptree benchmark_encoders(const core::video_format_desc& format_desc, int frames, const std::vector<std::wstring>& presets);
+
+// Records synthetic frames at the channel rate in the given sizes, in addition to the channel size, 
+// first with one file consumer writing the sizes as renditions and then with a file consumer for each 
+// size, and reports the process CPU time of both. Blocks until done.
+boost::property_tree::wptree benchmark_renditions(const core::video_format_desc& format_desc, int frames, const std::wstring& vcodec, const std::vector<std::wstring>& sizes);
+
+}}
@@ -24,9 +24,10 @@
 #include "../ffmpeg_error.h"
 
 #include "ffmpeg_consumer.h"
+#include "file_writer.h"
 
 #include "../ffmpeg_params.h"
-#include "../producer/audio/audio_resampler.h"
+#include "../producer/util/util.h"
 
 #include <core/parameters/parameters.h>
 #include <core/mixer/read_frame.h>
@@ -42,19 +43,34 @@
 #include <common/memory/memshfl.h>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/chrono.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
 #include <boost/timer.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <tbb/cache_aligned_allocator.h>
+#include <tbb/parallel_for.h>
 #include <tbb/parallel_invoke.h>
 #include <tbb/atomic.h>
+#include <tbb/spin_mutex.h>
+#include <tbb/task_scheduler_init.h>
 
 #include <boost/range/algorithm.hpp>
 #include <boost/range/algorithm_ext.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <deque>
+#include <fstream>
+#include <map>
 #include <string>
 
+#include <intrin.h>
+
 #if defined(_MSC_VER)
 #pragma warning (push)
 #pragma warning (disable : 4244)
@@ -65,6 +81,9 @@ extern "C"
 	#define __STDC_LIMIT_MACROS
 	#include <libavformat/avformat.h>
 	#include <libswscale/swscale.h>
+	#include <libswresample/swresample.h>
+	#include <libavutil/audio_fifo.h>
+	#include <libavutil/imgutils.h>
 	#include <libavutil/opt.h>
 	#include <libavutil/pixdesc.h>
 	#include <libavutil/parseutils.h>
@@ -73,6 +92,15 @@ extern "C"
 #pragma warning (pop)
 #endif
 
+static const size_t CONVERT_QUEUE_CAPACITY		= 8;
+static const size_t VIDEO_ENCODE_QUEUE_CAPACITY	= 4;
+static const size_t AUDIO_ENCODE_QUEUE_CAPACITY	= 8;
+static const size_t MUX_QUEUE_CAPACITY			= 32;
+static const int	AVIO_BUFFER_SIZE			= 256 * 1024;
+
+static const int VIDEO_STREAM_INDEX				= 0;
+static const int AUDIO_STREAM_INDEX				= 1;
+
 namespace caspar { namespace ffmpeg {
 	
 int av_opt_set(void *obj, const char *name, const char *val, int search_flags)
@@ -209,161 +237,899 @@ struct output_format
 	}
 };
 
+// Removes a non-negative integer option, returning the default if it is not present.
+static int take_option(std::vector<option>& options, const std::string& name, int default_value = 0)
+{
+	int value = default_value;
+
+	boost::range::remove_erase_if(options, [&](const option& o) -> bool
+	{
+		if(o.name != name)
+			return false;
+
+		try
+		{
+			value = boost::lexical_cast<int>(o.value);
+		}
+		catch(boost::bad_lexical_cast&)
+		{
+			BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info(name) << arg_value_info(o.value));
+		}
+
+		return true;
+	});
+
+	if(value < 0)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info(name));
+
+	return value;
+}
+
+static std::string take_string_option(std::vector<option>& options, const std::string& name)
+{
+	std::string value;
+
+	boost::range::remove_erase_if(options, [&](const option& o) -> bool
+	{
+		if(o.name != name)
+			return false;
+
+		value = o.value;
+		return true;
+	});
+
+	return value;
+}
+
+// The key muxes the audio of the fill and has no renditions of its own, so it is given the fill's 
+// options without the renditions and the audio encoder options.
+static std::vector<option> key_options(std::vector<option> options)
+{
+	auto codec_class = avcodec_get_class();
+
+	boost::range::remove_erase_if(options, [&](const option& o) -> bool
+	{
+		if(o.name == "renditions" || o.name == "acodec")
+			return true;
+
+		auto opt = av_opt_find(&codec_class, o.name.c_str(), nullptr, 0, AV_OPT_SEARCH_FAKE_OBJ);
+		return opt && (opt->flags & AV_OPT_FLAG_AUDIO_PARAM) && !(opt->flags & AV_OPT_FLAG_VIDEO_PARAM);
+	});
+
+	return options;
+}
+
+static safe_ptr<AVPacket> copy_packet(const AVPacket& pkt)
+{
+	auto copy = create_packet();
+	THROW_ON_ERROR2(av_copy_packet(copy.get(), const_cast<AVPacket*>(&pkt)), "[ffmpeg_consumer]");
+	return copy;
+}
+
 typedef std::vector<uint8_t, tbb::cache_aligned_allocator<uint8_t>>	byte_vector;
 
-struct ffmpeg_consumer : boost::noncopyable
-{		
-	const std::string						filename_;
+namespace internal {
+
+// BGRA to BT.601 studio swing YUV, the same matrix swscale uses by default.
+
+static void bgra_to_luma(const uint8_t* source, uint8_t* dest, int width)
+{
+	const __m128i mask		= _mm_set1_epi32(0xFF);
+	const __m128i r_coef	= _mm_set1_epi16(66);
+	const __m128i g_coef	= _mm_set1_epi16(129);
+	const __m128i b_coef	= _mm_set1_epi16(25);
+	const __m128i rounding	= _mm_set1_epi16(128);
+	const __m128i offset	= _mm_set1_epi16(16);
+
+	int x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		auto xmm0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x*4));
+		auto xmm1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x*4 + 16));
+
+		auto b = _mm_packs_epi32(_mm_and_si128(xmm0, mask), _mm_and_si128(xmm1, mask));
+		auto g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(xmm0, 8), mask), _mm_and_si128(_mm_srli_epi32(xmm1, 8), mask));
+		auto r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(xmm0, 16), mask), _mm_and_si128(_mm_srli_epi32(xmm1, 16), mask));
+
+		// The weighted sum is at most 56228 and is treated as unsigned.
+		auto y = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, r_coef), _mm_mullo_epi16(g, g_coef)), _mm_add_epi16(_mm_mullo_epi16(b, b_coef), rounding));
+		y = _mm_add_epi16(_mm_srli_epi16(y, 8), offset);
+
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dest + x), _mm_packus_epi16(y, y));
+	}
+
+	for(; x < width; ++x)
+	{
+		auto p = source + x*4;
+		dest[x] = static_cast<uint8_t>(((66*p[2] + 129*p[1] + 25*p[0] + 128) >> 8) + 16);
+	}
+}
+
+// The luma of a key picture, the same as converting the alpha copied into every color channel.
+static void bgra_to_key(const uint8_t* source, uint8_t* dest, int width)
+{
+	const __m128i coef		= _mm_set1_epi16(220);
+	const __m128i rounding	= _mm_set1_epi16(128);
+	const __m128i offset	= _mm_set1_epi16(16);
+
+	int x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		auto xmm0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x*4));
+		auto xmm1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x*4 + 16));
+
+		auto a = _mm_packs_epi32(_mm_srli_epi32(xmm0, 24), _mm_srli_epi32(xmm1, 24));
+
+		auto y = _mm_add_epi16(_mm_mullo_epi16(a, coef), rounding);
+		y = _mm_add_epi16(_mm_srli_epi16(y, 8), offset);
+
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dest + x), _mm_packus_epi16(y, y));
+	}
+
+	for(; x < width; ++x)
+		dest[x] = static_cast<uint8_t>(((220*source[x*4 + 3] + 128) >> 8) + 16);
+}
+
+// Averages horizontal pairs, and vertical pairs when source1 is given.
+static void bgra_to_chroma(const uint8_t* source0, const uint8_t* source1, uint8_t* u, uint8_t* v, int width)
+{
+	const int shift = source1 ? 2 : 1;
+
+	for(int x = 0; x < width/2; ++x)
+	{
+		auto p = source0 + x*8;
+
+		int b = p[0] + p[4];
+		int g = p[1] + p[5];
+		int r = p[2] + p[6];
+
+		if(source1)
+		{
+			auto q = source1 + x*8;
+			b += q[0] + q[4];
+			g += q[1] + q[5];
+			r += q[2] + q[6];
+		}
+
+		b >>= shift;
+		g >>= shift;
+		r >>= shift;
+
+		u[x] = static_cast<uint8_t>(((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+		v[x] = static_cast<uint8_t>(((112*r - 94*g - 18*b + 128) >> 8) + 128);
+	}
+}
+
+}
+
+// Same size BGRA to yuv420p or yuv422p, bypassing swscale. The alpha is written to key in 
+// the same pass, when given in the same format.
+static void fast_bgra_to_yuv(const uint8_t* source, int source_stride, AVFrame& dest, AVFrame* key, int width, int height, bool subsample_vertically)
+{
+	const int rows = subsample_vertically ? 2 : 1;
+
+	tbb::parallel_for(tbb::blocked_range<int>(0, height/rows), [&](const tbb::blocked_range<int>& r)
+	{
+		for(int n = r.begin(); n != r.end(); ++n)
+		{
+			auto source0 = source + n*rows*source_stride;
+			auto source1 = subsample_vertically ? source0 + source_stride : nullptr;
+
+			internal::bgra_to_luma(source0, dest.data[0] + n*rows*dest.linesize[0], width);
+			
+			if(source1)
+				internal::bgra_to_luma(source1, dest.data[0] + (n*rows + 1)*dest.linesize[0], width);
+
+			internal::bgra_to_chroma(source0, source1, dest.data[1] + n*dest.linesize[1], dest.data[2] + n*dest.linesize[2], width);
+
+			if(!key)
+				continue;
+
+			internal::bgra_to_key(source0, key->data[0] + n*rows*key->linesize[0], width);
+
+			if(source1)
+				internal::bgra_to_key(source1, key->data[0] + (n*rows + 1)*key->linesize[0], width);
+
+			std::memset(key->data[1] + n*key->linesize[1], 128, width/2);
+			std::memset(key->data[2] + n*key->linesize[2], 128, width/2);
+		}
+	});
+}
+
+// Scales the rows y to y + height. The scaled rows overlap the neighbouring slices by 
+// SLICE_OVERLAP rows, so that the vertical chroma filter sees the same rows at the seams as 
+// in a single pass, and are cropped when copied from the slice's own buffer to the picture.
+struct scale_slice
+{
+	int							y;
+	int							height;
+	int							src_y;
+	int							src_height;
+	std::shared_ptr<SwsContext>	sws;
+	std::shared_ptr<byte_vector>	buffer;		// Only when the picture has more than one slice.
+	AVPicture					picture;
+};
+
+static const int SLICE_OVERLAP = 16;
+
+static int default_slice_count(int height)
+{
+	return std::max(1, std::min(tbb::task_scheduler_init::default_num_threads(), height/64));
+}
+
+// Splits the conversion of a BGRA picture to pix_fmt into count slices. More than one slice is 
+// only exact without vertical scaling.
+static std::vector<scale_slice> create_scale_slices(int width, int height, int dest_width, int dest_height, PixelFormat pix_fmt, int count)
+{
+	const int rows = (height / count) & ~15; // Keep subsampled chroma rows and the dither pattern aligned.
+
+	std::vector<scale_slice> slices;
+
+	for(int n = 0; n < count; ++n)
+	{
+		scale_slice slice;
+		slice.y				= n * rows;
+		slice.height		= n < count - 1 ? rows : height - slice.y;
+		slice.src_y			= count > 1 ? std::max(0, slice.y - SLICE_OVERLAP) : 0;
+		slice.src_height	= count > 1 ? std::min(height, slice.y + slice.height + SLICE_OVERLAP) - slice.src_y : height;
+		slice.sws.reset(sws_getContext(width, slice.src_height, PIX_FMT_BGRA, dest_width, count > 1 ? slice.src_height : dest_height, pix_fmt, SWS_BICUBIC, nullptr, nullptr, nullptr), sws_freeContext);
 		
-	std::shared_ptr<AVFormatContext>		oc_;
-	const core::video_format_desc			format_desc_;
-	const core::channel_layout				channel_layout_;
-	
-	const safe_ptr<diagnostics::graph>		graph_;
+		if (slice.sws == nullptr) 
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Cannot initialize the conversion context"));
 
-	executor								encode_executor_;
-	
-	std::shared_ptr<AVStream>				audio_st_;
-	std::shared_ptr<AVStream>				video_st_;
-	
-	byte_vector								audio_outbuf_;
-	byte_vector								audio_buf_;
-	byte_vector								video_outbuf_;
-	byte_vector								key_picture_buf_;
-	byte_vector								picture_buf_;
-	std::shared_ptr<audio_resampler>		swr_;
-	std::shared_ptr<SwsContext>				sws_;
+		if(count > 1)
+		{
+			slice.buffer = std::make_shared<byte_vector>(avpicture_get_size(pix_fmt, dest_width, slice.src_height));
+			avpicture_fill(&slice.picture, slice.buffer->data(), pix_fmt, dest_width, slice.src_height);
+		}
 
-	int64_t									in_frame_number_;
-	int64_t									out_frame_number_;
+		slices.push_back(slice);
+	}
 
-	output_format							output_format_;
-	bool									key_only_;
-	tbb::atomic<int64_t>					current_encoding_delay_;
-	
-public:
-	ffmpeg_consumer(const std::string& filename, const core::video_format_desc& format_desc, std::vector<option> options, bool key_only, const core::channel_layout& audio_channel_layout)
-		: filename_(filename)
-		, video_outbuf_(1920*1080*8)
-		, audio_outbuf_(10000)
-		, format_desc_(format_desc)
-		, channel_layout_(audio_channel_layout)
-		, encode_executor_(print())
-		, in_frame_number_(0)
-		, out_frame_number_(0)
-		, output_format_(format_desc, filename, options)
-		, key_only_(key_only)
+	return slices;
+}
+
+static void scale_slices(std::vector<scale_slice>& slices, const uint8_t* source, int source_stride, AVFrame& dest, PixelFormat pix_fmt, int dest_width)
+{
+	const auto log2_chroma_h = av_pix_fmt_desc_get(pix_fmt)->log2_chroma_h;
+
+	tbb::parallel_for(0, static_cast<int>(slices.size()), [&](int n)
 	{
-		current_encoding_delay_ = 0;
+		auto& slice = slices[n];
 
-		// TODO: Ask stakeholders about case where file already exists.
-		boost::filesystem::remove(boost::filesystem::wpath(env::media_folder() + widen(filename))); // Delete the file if it exists
+		const uint8_t*	slice_source[4] = {source + slice.src_y * source_stride, nullptr, nullptr, nullptr};
+		const int		slice_stride[4] = {source_stride, 0, 0, 0};
 
-		graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
-		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
-		graph_->set_text(print());
-		diagnostics::register_graph(graph_);
+		if(!slice.buffer)
+		{
+			sws_scale(slice.sws.get(), slice_source, slice_stride, 0, slice.src_height, dest.data, dest.linesize);
+			return;
+		}
 
-		encode_executor_.set_capacity(8);
-				
+		sws_scale(slice.sws.get(), slice_source, slice_stride, 0, slice.src_height, slice.picture.data, slice.picture.linesize);
+
+		for(int i = 0; i < 4 && dest.data[i]; ++i)
+		{
+			const int shift = i == 1 || i == 2 ? log2_chroma_h : 0;
+
+			av_image_copy_plane(
+				dest.data[i] + (slice.y >> shift) * dest.linesize[i], dest.linesize[i],
+				slice.picture.data[i] + ((slice.y - slice.src_y) >> shift) * slice.picture.linesize[i], slice.picture.linesize[i],
+				av_image_get_linesize(pix_fmt, dest_width, i), slice.height >> shift);
+		}
+	});
+}
+
+// The picture is encoded on another thread while the next one is converted, so it owns its buffer.
+static std::shared_ptr<AVFrame> alloc_picture(PixelFormat pix_fmt, int width, int height)
+{
+	auto picture_buf = std::make_shared<byte_vector>(avpicture_get_size(pix_fmt, width, height));
+	std::shared_ptr<AVFrame> frame(avcodec_alloc_frame(), [picture_buf](AVFrame* frame)
+	{
+		av_free(frame);
+	});
+	avpicture_fill(reinterpret_cast<AVPicture*>(frame.get()), picture_buf->data(), pix_fmt, width, height);
+
+	return frame;
+}
+
+// One file of a recording. The encoders are owned by the consumer and outlive their segments, 
+// so that a recording can roll over to a new file without reopening them.
+class output_segment : boost::noncopyable
+{
+	const std::string					filename_;
+	const int64_t						start_time_;
+	const std::vector<AVCodecContext*>	codecs_;
+	const std::shared_ptr<file_writer>	writer_;
+	int64_t								position_;
+	int64_t								size_;
+	std::shared_ptr<AVIOContext>		pb_;
+	std::shared_ptr<AVFormatContext>	oc_;
+	std::vector<bool>					started_;
+	int64_t								end_time_;
+public:
+	// Without a writer the file is written through avio on the mux thread.
+	output_segment(const std::string& filename, AVOutputFormat* format, int64_t start_time, const std::vector<AVCodecContext*>& codecs, const std::shared_ptr<file_writer>& writer)
+		: filename_(filename)
+		, start_time_(start_time)
+		, codecs_(codecs)
+		, writer_(writer)
+		, position_(0)
+		, size_(0)
+		, started_(codecs.size(), false)
+		, end_time_(start_time)
+	{
 		AVFormatContext* oc;
 
 		THROW_ON_ERROR2(avformat_alloc_output_context2(
 			&oc, 
-			output_format_.format, 
+			format, 
 			nullptr, 
 			filename_.c_str()), "[ffmpeg_consumer]");
 
-		oc_.reset(oc);
-								
-		//  Add the audio and video streams using the default format codecs	and initialize the codecs.
-		auto options2 = options;
-		video_st_ = add_video_stream(options2);
+		oc_.reset(oc, [](AVFormatContext* oc)
+		{
+			if (!(oc->oformat->flags & AVFMT_NOFILE) && !(oc->flags & AVFMT_FLAG_CUSTOM_IO) && oc->pb) 
+				LOG_ON_ERROR2(avio_close(oc->pb), "[ffmpeg_consumer]"); // Close the output ffmpeg.
+
+			for(unsigned int n = 0; n < oc->nb_streams; ++n)
+				avcodec_close(oc->streams[n]->codec);
+
+			avformat_free_context(oc);
+		});
+
+		// The streams only describe the encoders to the muxer.
+		BOOST_FOREACH(auto c, codecs_)
+		{
+			auto st = av_new_stream(oc_.get(), static_cast<int>(oc_->nb_streams));
+			if (!st) 		
+				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not allocate stream.") << boost::errinfo_api_function("av_new_stream"));		
+
+			THROW_ON_ERROR2(avcodec_copy_context(st->codec, c), "[ffmpeg_consumer]");
+		}
 
-		if (!key_only)
-			audio_st_ = add_audio_stream(options);
-				
 		av_dump_format(oc_.get(), 0, filename_.c_str(), 1);
 		 
-		// Open the output ffmpeg, if needed.
-		if (!(oc_->oformat->flags & AVFMT_NOFILE)) 
-			THROW_ON_ERROR2(avio_open2(&oc_->pb, filename_.c_str(), AVIO_FLAG_WRITE, NULL, NULL), "[ffmpeg_consumer]");
+		if (!(oc_->oformat->flags & AVFMT_NOFILE) && writer_) 
+		{
+			auto buffer = static_cast<unsigned char*>(av_malloc(AVIO_BUFFER_SIZE));
+			if(!buffer)
+				BOOST_THROW_EXCEPTION(bad_alloc());
+
+			pb_.reset(avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 1, this, nullptr, &write_callback, &seek_callback), [](AVIOContext* pb)
+			{
+				av_free(pb->buffer);
+				av_free(pb);
+			});
+
+			if(!pb_)
+			{
+				av_free(buffer);
+				BOOST_THROW_EXCEPTION(bad_alloc());
+			}
+
+			oc_->pb		= pb_.get();
+			oc_->flags |= AVFMT_FLAG_CUSTOM_IO;
+		}
+		else if (!(oc_->oformat->flags & AVFMT_NOFILE)) 
+			THROW_ON_ERROR2(avio_open2(&oc_->pb, filename_.c_str(), AVIO_FLAG_WRITE, nullptr, nullptr), "[ffmpeg_consumer]");
 				
 		THROW_ON_ERROR2(avformat_write_header(oc_.get(), nullptr), "[ffmpeg_consumer]");
+	}
 
-		if(options.size() > 0)
+	~output_segment()
+	{
+		LOG_ON_ERROR2(av_write_trailer(oc_.get()), "[ffmpeg_consumer]");
+
+		// The writer finishes the file on its own thread.
+		if(pb_)
 		{
-			BOOST_FOREACH(auto& option, options)
-				CASPAR_LOG(warning) << L"Invalid option: -" << widen(option.name) << L" " << widen(option.value);
+			avio_flush(pb_.get());
+			writer_->close();
 		}
+	}
 
-		CASPAR_LOG(info) << print() << L" Successfully Initialized.";	
+	static int write_callback(void* opaque, uint8_t* buf, int buf_size)
+	{
+		auto self = static_cast<output_segment*>(opaque);
+
+		if(!self->writer_->write(self->position_, buf, buf_size))
+			return AVERROR(EIO);
+
+		self->position_ += buf_size;
+		self->size_		 = std::max(self->size_, self->position_);
+
+		return buf_size;
 	}
 
-	~ffmpeg_consumer()
-	{    
-		encode_executor_.stop();
-		encode_executor_.join();
+	// Seeking only moves the offset of the next write.
+	static int64_t seek_callback(void* opaque, int64_t offset, int whence)
+	{
+		auto self = static_cast<output_segment*>(opaque);
 
-		LOG_ON_ERROR2(av_write_trailer(oc_.get()), "[ffmpeg_consumer]");
-		
-		if (!key_only_)
-			audio_st_.reset();
-		video_st_.reset();
-			  
-		if (!(oc_->oformat->flags & AVFMT_NOFILE)) 
-			LOG_ON_ERROR2(avio_close(oc_->pb), "[ffmpeg_consumer]"); // Close the output ffmpeg.
+		switch(whence & ~AVSEEK_FORCE)
+		{
+		case AVSEEK_SIZE:	return self->size_;
+		case SEEK_SET:		self->position_ = offset;					break;
+		case SEEK_CUR:		self->position_ += offset;					break;
+		case SEEK_END:		self->position_ = self->size_ + offset;	break;
+		default:			return AVERROR(EINVAL);
+		}
 
-		CASPAR_LOG(info) << print() << L" Successfully Uninitialized.";	
+		return self->position_;
 	}
-			
-	std::wstring print() const
+
+	const std::shared_ptr<file_writer>& writer() const
 	{
-		return L"ffmpeg[" + widen(filename_) + L"]";
+		return writer_;
 	}
 
-	std::shared_ptr<AVStream> add_video_stream(std::vector<option>& options)
-	{ 
-		if(output_format_.vcodec == CODEC_ID_NONE)
-			return nullptr;
+	// The packet's stream index is the index of its encoder, and its timestamps are in the encoder's time base.
+	void write(const safe_ptr<AVPacket>& pkt)
+	{
+		const auto c	= codecs_.at(pkt->stream_index);
+		const auto st	= oc_->streams[pkt->stream_index];
 
-		auto st = av_new_stream(oc_.get(), 0);
-		if (!st) 		
-			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not allocate video-stream.") << boost::errinfo_api_function("av_new_stream"));		
+		AVRational time_base = {1, AV_TIME_BASE};
+		const auto offset = av_rescale_q(start_time_, time_base, st->time_base);
 
-		auto encoder = avcodec_find_encoder(output_format_.vcodec);
-		if (!encoder)
-			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Codec not found."));
+		if(pkt->pts != AV_NOPTS_VALUE)
+		{
+			end_time_ = std::max(end_time_, av_rescale_q(pkt->pts + std::max(pkt->duration, 1), c->time_base, time_base));
+			pkt->pts  = av_rescale_q(pkt->pts, c->time_base, st->time_base) - offset;
+		}
 
-		auto c = st->codec;
+		if(pkt->dts != AV_NOPTS_VALUE)
+			pkt->dts = av_rescale_q(pkt->dts, c->time_base, st->time_base) - offset;
 
-		avcodec_get_context_defaults3(c, encoder);
-				
-		c->codec_id			= output_format_.vcodec;
-		c->codec_type		= AVMEDIA_TYPE_VIDEO;
-		c->width			= output_format_.width;
-		c->height			= output_format_.height;
-		c->time_base.den	= format_desc_.time_scale;
-		c->time_base.num	= format_desc_.duration;
-		c->gop_size			= 25;
-		c->flags		   |= format_desc_.field_mode == core::field_mode::progressive ? 0 : (CODEC_FLAG_INTERLACED_ME | CODEC_FLAG_INTERLACED_DCT);
-		if(c->pix_fmt == PIX_FMT_NONE)
-			c->pix_fmt = PIX_FMT_YUV420P;
+		if(pkt->duration > 0)
+			pkt->duration = static_cast<int>(av_rescale_q(pkt->duration, c->time_base, st->time_base));
 
-		if(c->codec_id == CODEC_ID_PRORES)
-		{			
-			c->bit_rate	= c->width < 1280 ? 63*1000000 : 220*1000000;
-			c->pix_fmt	= PIX_FMT_YUV422P10;
-		}
-		else if(c->codec_id == CODEC_ID_DNXHD)
+		started_[pkt->stream_index] = true;
+
+		LOG_ON_ERROR2(av_interleaved_write_frame(oc_.get(), pkt.get()), "[ffmpeg_consumer]");
+	}
+
+	// Whether every stream has written to this segment.
+	bool started() const
+	{
+		return std::find(started_.begin(), started_.end(), false) == started_.end();
+	}
+
+	double duration() const
+	{
+		return static_cast<double>(end_time_ - start_time_) / AV_TIME_BASE;
+	}
+
+	const std::string& filename() const
+	{
+		return filename_;
+	}
+};
+
+// Counts durations in power of two millisecond buckets, from below 1 ms up to 1 s or more.
+class latency_histogram : boost::noncopyable
+{
+	std::array<tbb::atomic<int64_t>, 12>	buckets_;
+	tbb::atomic<int64_t>					count_;
+	tbb::atomic<int64_t>					total_micros_;
+public:
+	latency_histogram()
+	{
+		BOOST_FOREACH(auto& bucket, buckets_)
+			bucket = 0;
+
+		count_			= 0;
+		total_micros_	= 0;
+	}
+
+	void add(double seconds)
+	{
+		const auto millis = static_cast<int>(seconds * 1000.0);
+
+		size_t n = 0;
+		while(n + 1 < buckets_.size() && millis >= (1 << n))
+			++n;
+
+		++buckets_[n];
+		++count_;
+		total_micros_ += static_cast<int64_t>(seconds * 1000000.0);
+	}
+
+	// The upper bound of the bucket holding the given fraction of the samples.
+	int percentile(double fraction) const
+	{
+		const auto count	= static_cast<int64_t>(count_);
+		int64_t	   sum		= 0;
+
+		for(size_t n = 0; n < buckets_.size(); ++n)
 		{
-			if(c->width < 1280 || c->height < 720)
-				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Unsupported video dimensions."));
+			sum += buckets_[n];
 
-			c->bit_rate	= 220*1000000;
-			c->pix_fmt	= PIX_FMT_YUV422P;
+			if(sum > 0 && sum >= static_cast<int64_t>(fraction * count))
+				return 1 << n;
 		}
-		else if(c->codec_id == CODEC_ID_DVVIDEO)
+
+		return 0;
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		boost::property_tree::wptree info;
+		info.add(L"frames",		static_cast<int64_t>(count_));
+		info.add(L"mean-ms",	count_ > 0 ? static_cast<double>(total_micros_) / count_ / 1000.0 : 0.0);
+		info.add(L"p50-ms",		percentile(0.50));
+		info.add(L"p95-ms",		percentile(0.95));
+		info.add(L"p99-ms",		percentile(0.99));
+
+		for(size_t n = 0; n + 1 < buckets_.size(); ++n)
+			info.add(L"buckets.below-" + boost::lexical_cast<std::wstring>(1 << n) + L"-ms", static_cast<int64_t>(buckets_[n]));
+
+		info.add(L"buckets.above-" + boost::lexical_cast<std::wstring>(1 << (buckets_.size() - 2)) + L"-ms", static_cast<int64_t>(buckets_.back()));
+
+		return info;
+	}
+};
+
+// Decides when the encoder should trade quality for speed. Steps down quickly while the encode 
+// stage falls behind, and back up slowly once it has kept up for a while.
+class quality_controller
+{
+	static const int	MAX_LEVEL			= 5;
+	static const int	DOWNGRADE_FRAMES	= 5;
+	static const int	UPGRADE_FRAMES		= 250;
+	static const int	COOLDOWN_FRAMES		= 25;	// Lets a change take effect before the next one.
+
+	tbb::atomic<int>	level_;
+	tbb::atomic<int64_t>	downgrades_;
+	tbb::atomic<int64_t>	upgrades_;
+	int					behind_frames_;
+	int					ahead_frames_;
+	int					cooldown_;
+public:
+	quality_controller()
+		: behind_frames_(0)
+		, ahead_frames_(0)
+		, cooldown_(0)
+	{
+		level_		= 0;
+		downgrades_ = 0;
+		upgrades_	= 0;
+	}
+
+	// queue_fill is the fraction of the encode queue in use, encode_load the encode time over the frame duration.
+	// Returns whether the level changed.
+	bool update(double queue_fill, double encode_load)
+	{
+		const bool behind	= queue_fill >= 0.75 || encode_load > 0.9;
+		const bool ahead	= queue_fill <= 0.25 && encode_load < 0.6;
+
+		behind_frames_	= behind ? behind_frames_ + 1 : 0;
+		ahead_frames_	= ahead  ? ahead_frames_  + 1 : 0;
+
+		if(cooldown_ > 0)
+		{
+			--cooldown_;
+			return false;
+		}
+
+		if(behind_frames_ >= DOWNGRADE_FRAMES && level_ < MAX_LEVEL)
+		{
+			++level_;
+			++downgrades_;
+		}
+		else if(ahead_frames_ >= UPGRADE_FRAMES && level_ > 0)
+		{
+			--level_;
+			++upgrades_;
+		}
+		else
+			return false;
+
+		behind_frames_	= 0;
+		ahead_frames_	= 0;
+		cooldown_		= COOLDOWN_FRAMES;
+
+		return true;
+	}
+
+	int level() const
+	{
+		return level_;
+	}
+
+	int max_level() const
+	{
+		return MAX_LEVEL;
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		boost::property_tree::wptree info;
+		info.add(L"level",		static_cast<int>(level_));
+		info.add(L"downgrades",	static_cast<int64_t>(downgrades_));
+		info.add(L"upgrades",	static_cast<int64_t>(upgrades_));
+		return info;
+	}
+};
+
+struct closed_segment
+{
+	int64_t		index;
+	std::string	filename;
+	double		duration;
+};
+
+struct ffmpeg_consumer : boost::noncopyable
+{		
+	const std::string						filename_;
+		
+	const core::video_format_desc			format_desc_;
+	const core::channel_layout				channel_layout_;
+
+	// A rendition is converted from the next larger picture and muxes the audio of its parent.
+	const bool								rendition_;
+	std::vector<std::unique_ptr<ffmpeg_consumer>>	renditions_;
+	std::unique_ptr<ffmpeg_consumer>		key_;	// Converted in the same pass as the fill, and muxes its audio.
+	std::shared_ptr<SwsContext>				rendition_sws_;
+	
+	const safe_ptr<diagnostics::graph>		graph_;
+
+	// Each stage runs on its own thread. Only the first stages drop frames when full, 
+	// the later ones apply back-pressure to the stage before them.
+	executor								convert_executor_;
+	executor								video_encode_executor_;
+	executor								audio_encode_executor_;
+	executor								mux_executor_;
+	
+	std::shared_ptr<AVCodecContext>			audio_codec_;
+	std::shared_ptr<AVCodecContext>			video_codec_;
+	
+	byte_vector								key_picture_buf_;
+	std::shared_ptr<SwrContext>				swr_;
+	std::shared_ptr<AVAudioFifo>			audio_fifo_;
+	std::shared_ptr<AVFrame>				audio_convert_frame_;
+	std::shared_ptr<AVFrame>				audio_encode_frame_;
+	int										audio_encode_capacity_;
+	tbb::atomic<int64_t>					audio_pts_;	// Written on the audio encode thread, read by info().
+	tbb::atomic<int64_t>					audio_allocations_;
+	std::vector<scale_slice>				scale_slices_;
+	bool									fast_conversion_;
+
+	int64_t									in_frame_number_;
+	int64_t									out_frame_number_;
+
+	output_format							output_format_;
+	bool									key_only_;
+
+	// A segment time of 0 records a single file. A retention of 0 keeps every segment.
+	const int								segment_time_;
+	const int								segment_retention_;
+	std::map<int64_t, std::shared_ptr<output_segment>>	segments_;	// Only more than one while the streams roll over.
+	std::deque<closed_segment>				closed_segments_;
+
+	// Files are written through a write-behind buffer of write_buffer_ MB when it is set, 
+	// and otherwise by ffmpeg's own avio on the mux thread.
+	const int								write_buffer_;
+	const bool								direct_io_;
+	const int								sync_interval_;
+	const int								write_throttle_;
+	std::vector<std::shared_ptr<file_writer>>	writers_;	// Until the file is finished.
+	mutable tbb::spin_mutex					writers_mutex_;
+	tbb::atomic<int64_t>					current_segment_;
+	tbb::atomic<int64_t>					deleted_segments_;
+	tbb::atomic<int64_t>					current_encoding_delay_;
+
+	tbb::atomic<int64_t>					encoded_frames_;
+	latency_histogram						encode_times_;
+
+	// Only libx264 reconfigures its rate control on the fly, so only its crf or bitrate is adapted.
+	bool									adaptive_quality_;
+	quality_controller						quality_;
+	double									base_crf_;
+	int										base_bit_rate_;
+	int										base_max_rate_;
+
+	tbb::atomic<int64_t>					convert_queue_drops_;
+	tbb::atomic<int64_t>					audio_queue_drops_;
+
+	bool									drained_;
+	
+public:
+	ffmpeg_consumer(const std::string& filename, const core::video_format_desc& format_desc, std::vector<option> options, bool key_only, const core::channel_layout& audio_channel_layout, const ffmpeg_consumer* parent = nullptr)
+		: filename_(filename)
+		, format_desc_(format_desc)
+		, channel_layout_(audio_channel_layout)
+		, rendition_(parent != nullptr)
+		, convert_executor_(print() + L" convert")
+		, video_encode_executor_(print() + L" video-encode")
+		, audio_encode_executor_(print() + L" audio-encode")
+		, mux_executor_(print() + L" mux")
+		, audio_encode_capacity_(0)
+		, fast_conversion_(false)
+		, in_frame_number_(0)
+		, out_frame_number_(0)
+		, output_format_(format_desc, filename, options)
+		, key_only_(key_only)
+		, segment_time_(take_option(options, "segment_time"))
+		, segment_retention_(take_option(options, "segment_retention"))
+		, write_buffer_(take_option(options, "write_buffer"))
+		, direct_io_(take_option(options, "direct_io") != 0)
+		, sync_interval_(take_option(options, "sync_interval"))
+		, write_throttle_(take_option(options, "write_throttle"))
+		, adaptive_quality_(take_option(options, "adaptive_quality") != 0)
+		, base_crf_(-1.0)
+		, base_bit_rate_(0)
+		, base_max_rate_(0)
+		, drained_(false)
+	{
+		current_encoding_delay_ = 0;
+		audio_pts_				= 0;
+		audio_allocations_		= 0;
+		encoded_frames_			= 0;
+		convert_queue_drops_	= 0;
+		audio_queue_drops_		= 0;
+		current_segment_		= 0;
+		deleted_segments_		= 0;
+
+		// TODO: Ask stakeholders about case where file already exists.
+		boost::filesystem::remove(boost::filesystem::wpath(env::media_folder() + widen(filename))); // Delete the file if it exists
+
+		graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
+		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
+		graph_->set_color("convert-queue", diagnostics::color(0.7f, 0.4f, 0.4f));
+		graph_->set_color("video-encode-queue", diagnostics::color(1.0f, 1.0f, 0.0f));
+		graph_->set_color("audio-encode-queue", diagnostics::color(0.4f, 0.4f, 1.0f));
+		graph_->set_color("mux-queue", diagnostics::color(1.0f, 0.5f, 0.0f));
+		graph_->set_color("convert-time", diagnostics::color(0.9f, 0.9f, 0.9f));
+		graph_->set_color("disk-buffer", diagnostics::color(0.6f, 0.3f, 0.9f));
+		graph_->set_color("quality-level", diagnostics::color(1.0f, 0.2f, 0.2f));
+		graph_->set_text(print());
+		diagnostics::register_graph(graph_);
+
+		convert_executor_.set_capacity(CONVERT_QUEUE_CAPACITY);
+		video_encode_executor_.set_capacity(VIDEO_ENCODE_QUEUE_CAPACITY);
+		audio_encode_executor_.set_capacity(AUDIO_ENCODE_QUEUE_CAPACITY);
+		mux_executor_.set_capacity(MUX_QUEUE_CAPACITY);
+
+		auto renditions = take_string_option(options, "renditions");
+								
+		//  Open the audio and video encoders using the default format codecs.
+		auto options2 = options;
+		video_codec_ = open_video_encoder(options2);
+
+		if (parent)
+			audio_codec_ = parent->audio_codec_;
+		else if (!key_only)
+			audio_codec_ = open_audio_encoder(options);
+
+		if (adaptive_quality_)
+			init_adaptive_quality();
+				
+		segments_[0] = open_segment(0);
+
+		if (!renditions.empty())
+			add_renditions(renditions);
+
+		if(options.size() > 0)
+		{
+			BOOST_FOREACH(auto& option, options)
+				CASPAR_LOG(warning) << L"Invalid option: -" << widen(option.name) << L" " << widen(option.value);
+		}
+
+		CASPAR_LOG(info) << print() << L" Successfully Initialized.";	
+	}
+
+	~ffmpeg_consumer()
+	{    
+		drain();
+
+		CASPAR_LOG(info) << print() << L" Successfully Uninitialized.";	
+	}
+
+	// Finishes the file. No frames may be sent afterwards.
+	void drain()
+	{
+		if(drained_)
+			return;
+
+		drained_ = true;
+
+		// Drain the stages in pipeline order so that every accepted frame reaches the file.
+		convert_executor_.stop();
+		convert_executor_.join();
+
+		video_encode_executor_.stop();
+		video_encode_executor_.join();
+
+		audio_encode_executor_.stop();
+		audio_encode_executor_.join();
+
+		try
+		{
+			flush_video_encoder();
+
+			if (audio_codec_ && !rendition_)
+				flush_audio_encoder();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+
+		// The renditions have received all of the audio, and drain their own stages.
+		renditions_.clear();
+		key_.reset();
+
+		mux_executor_.stop();
+		mux_executor_.join();
+
+		while(!segments_.empty())
+			close_segment(segments_.begin());
+
+		BOOST_FOREACH(auto& writer, writers_)
+			writer->wait();
+
+		if(segment_time_ > 0)
+			write_index(true);
+	}
+			
+	std::wstring print() const
+	{
+		return L"ffmpeg[" + widen(filename_) + L"]";
+	}
+
+	static std::shared_ptr<AVCodecContext> alloc_encoder(AVCodec* encoder)
+	{
+		std::shared_ptr<AVCodecContext> codec(avcodec_alloc_context3(encoder), [](AVCodecContext* c)
+		{
+			LOG_ON_ERROR2(avcodec_close(c), "[ffmpeg_consumer]");
+			av_free(c);
+		});
+
+		if(!codec)
+			BOOST_THROW_EXCEPTION(bad_alloc());
+
+		return codec;
+	}
+
+	std::shared_ptr<AVCodecContext> open_video_encoder(std::vector<option>& options)
+	{ 
+		if(output_format_.vcodec == CODEC_ID_NONE)
+			return nullptr;
+
+		auto encoder = avcodec_find_encoder(output_format_.vcodec);
+		if (!encoder)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Codec not found."));
+
+		auto codec	= alloc_encoder(encoder);
+		auto c		= codec.get();
+				
+		c->codec_id			= output_format_.vcodec;
+		c->codec_type		= AVMEDIA_TYPE_VIDEO;
+		c->width			= output_format_.width;
+		c->height			= output_format_.height;
+		c->time_base.den	= format_desc_.time_scale;
+		c->time_base.num	= format_desc_.duration;
+		c->gop_size			= 25;
+		c->flags		   |= format_desc_.field_mode == core::field_mode::progressive ? 0 : (CODEC_FLAG_INTERLACED_ME | CODEC_FLAG_INTERLACED_DCT);
+		if(c->pix_fmt == PIX_FMT_NONE)
+			c->pix_fmt = PIX_FMT_YUV420P;
+
+		if(c->codec_id == CODEC_ID_PRORES)
+		{			
+			c->bit_rate	= c->width < 1280 ? 63*1000000 : 220*1000000;
+			c->pix_fmt	= PIX_FMT_YUV422P10;
+		}
+		else if(c->codec_id == CODEC_ID_DNXHD)
+		{
+			if(c->width < 1280 || c->height < 720)
+				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Unsupported video dimensions."));
+
+			c->bit_rate	= 220*1000000;
+			c->pix_fmt	= PIX_FMT_YUV422P;
+		}
+		else if(c->codec_id == CODEC_ID_DVVIDEO)
 		{
 			c->width = c->height == 1280 ? 960  : c->width;
 			
@@ -391,263 +1157,809 @@ public:
 		}
 		else if(c->codec_id == CODEC_ID_QTRLE)
 		{
-			c->pix_fmt = PIX_FMT_ARGB;
+			c->pix_fmt = PIX_FMT_ARGB;
+		}
+				
+		c->max_b_frames = 0; // b-frames not supported.
+				
+		const bool threads_set = boost::range::find_if(options, [](const option& o){return o.name == "threads";}) != options.end();
+
+		boost::range::remove_erase_if(options, [&](const option& o)
+		{
+			return ffmpeg::av_opt_set(c, o.name.c_str(), o.value.c_str(), AV_OPT_SEARCH_CHILDREN) > -1 ||
+				   ffmpeg::av_opt_set(c->priv_data, o.name.c_str(), o.value.c_str(), AV_OPT_SEARCH_CHILDREN) > -1;
+		});
+				
+		if(output_format_.format->flags & AVFMT_GLOBALHEADER)
+			c->flags |= CODEC_FLAG_GLOBAL_HEADER;
+		
+		if(!threads_set) // -threads limits the encoder, e.g. to test the adaptive quality.
+			c->thread_count = boost::thread::hardware_concurrency();
+		c->thread_type	= FF_THREAD_FRAME | FF_THREAD_SLICE;
+		if(avcodec_open2(c, encoder, nullptr) < 0)
+		{
+			c->thread_count = 1;
+			THROW_ON_ERROR2(avcodec_open2(c, encoder, nullptr), "[ffmpeg_consumer]");
+		}
+
+		return codec;
+	}
+		
+	std::shared_ptr<AVCodecContext> open_audio_encoder(std::vector<option>& options)
+	{
+		if(output_format_.acodec == CODEC_ID_NONE)
+			return nullptr;
+
+		auto encoder = avcodec_find_encoder(output_format_.acodec);
+		if (!encoder)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("codec not found"));
+		
+		auto codec	= alloc_encoder(encoder);
+		auto c		= codec.get();
+
+		c->codec_id			= output_format_.acodec;
+		c->codec_type		= AVMEDIA_TYPE_AUDIO;
+		c->sample_rate		= 48000;
+		c->channels			= channel_layout_.num_channels;
+		c->channel_layout	= av_get_default_channel_layout(c->channels);
+		c->sample_fmt		= encoder->sample_fmts ? encoder->sample_fmts[0] : AV_SAMPLE_FMT_S16;
+
+		if(output_format_.vcodec == CODEC_ID_FLV1)		
+			c->sample_rate	= 44100;		
+
+		c->time_base.num	= 1;
+		c->time_base.den	= c->sample_rate;
+
+		if(output_format_.format->flags & AVFMT_GLOBALHEADER)
+			c->flags |= CODEC_FLAG_GLOBAL_HEADER;
+				
+		boost::range::remove_erase_if(options, [&](const option& o)
+		{
+			return ffmpeg::av_opt_set(c, o.name.c_str(), o.value.c_str(), AV_OPT_SEARCH_CHILDREN) > -1;
+		});
+
+		THROW_ON_ERROR2(avcodec_open2(c, encoder, nullptr), "[ffmpeg_consumer]");
+
+		return codec;
+	}
+
+	// Renditions are given as WIDTHxHEIGHT[:vcodec], separated by commas, and are written 
+	// next to the main file with the size appended to the name.
+	void add_renditions(const std::string& renditions)
+	{
+		std::vector<std::string> specs;
+		boost::split(specs, renditions, boost::is_any_of(","), boost::token_compress_on);
+
+		BOOST_FOREACH(auto& spec, specs)
+		{
+			std::vector<std::string> parts;
+			boost::split(parts, spec, boost::is_any_of(":"));
+
+			if(parts[0].empty())
+				continue;
+
+			std::vector<option> options;
+			options.push_back(option("f",		output_format_.format->name));
+			options.push_back(option("s",		parts[0]));
+			options.push_back(option("vcodec",	parts.size() > 1 ? parts[1] : video_codec_->codec->name));
+
+			if(segment_time_ > 0)
+			{
+				options.push_back(option("segment_time",		boost::lexical_cast<std::string>(segment_time_)));
+				options.push_back(option("segment_retention",	boost::lexical_cast<std::string>(segment_retention_)));
+			}
+
+			options.push_back(option("write_buffer",	boost::lexical_cast<std::string>(write_buffer_)));
+			options.push_back(option("adaptive_quality",	adaptive_quality_ ? "1" : "0"));
+			options.push_back(option("direct_io",		direct_io_ ? "1" : "0"));
+			options.push_back(option("sync_interval",	boost::lexical_cast<std::string>(sync_interval_)));
+
+			boost::filesystem::path path(filename_);
+			auto filename = (path.parent_path() / (path.stem().string() + "_" + parts[0] + path.extension().string())).string();
+
+			renditions_.push_back(std::unique_ptr<ffmpeg_consumer>(new ffmpeg_consumer(filename, format_desc_, options, key_only_, channel_layout_, this)));
+		}
+
+		// Largest first, so that each rendition can be scaled down from the one before it.
+		std::sort(renditions_.begin(), renditions_.end(), [](const std::unique_ptr<ffmpeg_consumer>& lhs, const std::unique_ptr<ffmpeg_consumer>& rhs)
+		{
+			return lhs->video_codec_->width * lhs->video_codec_->height > rhs->video_codec_->width * rhs->video_codec_->height;
+		});
+	}
+
+	void init_adaptive_quality()
+	{
+		auto c = video_codec_.get();
+
+		if(std::string(c->codec->name) != "libx264")
+		{
+			CASPAR_LOG(warning) << print() << L" Adaptive quality is not supported by " << widen(std::string(c->codec->name)) << L".";
+			adaptive_quality_ = false;
+			return;
+		}
+
+		if(av_opt_get_double(c->priv_data, "crf", 0, &base_crf_) < 0) // libx264 prefers crf over bitrate when both are set.
+			base_crf_ = -1.0;
+
+		base_bit_rate_ = c->bit_rate;
+		base_max_rate_ = c->rc_max_rate;
+
+		if(base_crf_ < 0.0 && base_bit_rate_ < 1)
+		{
+			CASPAR_LOG(warning) << print() << L" Adaptive quality needs crf or bitrate rate control.";
+			adaptive_quality_ = false;
+		}
+	}
+
+	// Runs on the video encode thread, and takes effect from the next frame.
+	void apply_quality_level(int level)
+	{
+		auto c = video_codec_.get();
+
+		if(base_crf_ >= 0.0)
+		{
+			const auto crf = std::min(51.0, base_crf_ + level * 4.0);
+			av_opt_set_double(c->priv_data, "crf", crf, 0);
+
+			CASPAR_LOG(info) << print() << L" Encoder quality level " << level << L", crf " << crf << L".";
+		}
+		else
+		{
+			const auto scale = std::pow(0.8, level);
+			c->bit_rate		= static_cast<int>(base_bit_rate_ * scale);
+			c->rc_max_rate	= static_cast<int>(base_max_rate_ * scale);
+
+			CASPAR_LOG(info) << print() << L" Encoder quality level " << level << L", " << c->bit_rate / 1000 << L" kbps.";
+		}
+
+		graph_->set_value("quality-level", static_cast<double>(level) / quality_.max_level());
+	}
+
+	// Must be called before the first frame is sent.
+	void attach_key(std::unique_ptr<ffmpeg_consumer> key)
+	{
+		key_ = std::move(key);
+
+		if(!shares_conversion(*key_))
+			CASPAR_LOG(info) << print() << L" The key differs in size or format and is converted on its own.";
+	}
+
+	bool shares_conversion(const ffmpeg_consumer& key) const
+	{
+		const auto c		= video_codec_.get();
+		const auto key_c	= key.video_codec_.get();
+
+		return c->width == key_c->width && c->height == key_c->height && c->pix_fmt == key_c->pix_fmt &&
+			   c->width == static_cast<int>(format_desc_.width) && c->height == static_cast<int>(format_desc_.height) && 
+			   (c->pix_fmt == PIX_FMT_YUV420P || c->pix_fmt == PIX_FMT_YUV422P);
+	}
+
+	std::vector<AVCodecContext*> codecs() const
+	{
+		std::vector<AVCodecContext*> codecs;
+		codecs.push_back(video_codec_.get());
+
+		if(audio_codec_)
+			codecs.push_back(audio_codec_.get());
+
+		return codecs;
+	}
+
+	void init_conversion(AVCodecContext* c)
+	{
+		const int width		= static_cast<int>(format_desc_.width);
+		const int height	= static_cast<int>(format_desc_.height);
+
+		fast_conversion_ =	c->width == width && c->height == height && 
+							(c->pix_fmt == PIX_FMT_YUV420P || c->pix_fmt == PIX_FMT_YUV422P);
+
+		if(fast_conversion_)
+		{
+			CASPAR_LOG(debug) << print() << L" Converting BGRA to " << widen(av_get_pix_fmt_name(c->pix_fmt)) << L" without swscale.";
+			return;
+		}
+
+		// Slices are scaled independently, which is only exact without vertical scaling.
+		const int count = c->height == height ? default_slice_count(height) : 1;
+
+		scale_slices_ = create_scale_slices(width, height, c->width, c->height, c->pix_fmt, count);
+
+		CASPAR_LOG(debug) << print() << L" Converting BGRA to " << widen(av_get_pix_fmt_name(c->pix_fmt)) << L" in " << count << L" slice(s).";
+	}
+
+	static std::shared_ptr<AVFrame> alloc_picture(AVCodecContext* c)
+	{
+		return ffmpeg::alloc_picture(c->pix_fmt, c->width, c->height);
+	}
+
+	// key_frame receives the key picture when it can be converted in the same pass.
+	std::shared_ptr<AVFrame> convert_video(core::read_frame& frame, AVCodecContext* c, std::shared_ptr<AVFrame>* key_frame = nullptr)
+	{
+		if(!fast_conversion_ && scale_slices_.empty()) 
+			init_conversion(c);
+
+		boost::timer convert_timer;
+
+		std::shared_ptr<AVFrame> in_frame(avcodec_alloc_frame(), av_free);
+		auto in_picture = reinterpret_cast<AVPicture*>(in_frame.get());
+
+		if (key_only_)
+		{
+			key_picture_buf_.resize(frame.image_data().size());
+			in_picture->linesize[0] = format_desc_.width * 4;
+			in_picture->data[0] = key_picture_buf_.data();
+
+			fast_memshfl(in_picture->data[0], frame.image_data().begin(), frame.image_data().size(), 0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
+		}
+		else
+		{
+			avpicture_fill(in_picture, const_cast<uint8_t*>(frame.image_data().begin()), PIX_FMT_BGRA, format_desc_.width, format_desc_.height);
+		}
+
+		auto out_frame = alloc_picture(c);
+
+		if(key_frame && fast_conversion_ && shares_conversion(*key_))
+			*key_frame = alloc_picture(key_->video_codec_.get());
+
+		if(fast_conversion_)
+			fast_bgra_to_yuv(in_frame->data[0], in_frame->linesize[0], *out_frame, key_frame ? key_frame->get() : nullptr, c->width, c->height, c->pix_fmt == PIX_FMT_YUV420P);
+		else
+			scale_slices(scale_slices_, in_frame->data[0], in_frame->linesize[0], *out_frame, c->pix_fmt, c->width);
+
+		graph_->set_value("convert-time", convert_timer.elapsed()*format_desc_.fps*0.5);
+
+		return out_frame;
+	}
+  
+	void convert_video_frame(const safe_ptr<core::read_frame>& frame)
+	{ 
+		auto c = video_codec_.get();
+		
+		auto in_time  = static_cast<double>(in_frame_number_) / format_desc_.fps;
+		auto out_time = static_cast<double>(out_frame_number_) / (static_cast<double>(c->time_base.den) / static_cast<double>(c->time_base.num));
+		
+		in_frame_number_++;
+
+		if(out_time - in_time > 0.01)
+			return;
+ 
+		std::shared_ptr<AVFrame> key_frame;
+
+		auto av_frame = convert_video(*frame, c, key_ ? &key_frame : nullptr);
+		av_frame->interlaced_frame	= format_desc_.field_mode != core::field_mode::progressive;
+		av_frame->top_field_first	= format_desc_.field_mode == core::field_mode::upper;
+		av_frame->pts				= out_frame_number_++;
+
+		queue_video_frame(frame, av_frame);
+		convert_renditions(frame, av_frame);
+
+		if(key_)
+			key_->convert_key_frame(frame, key_frame, av_rescale_q(av_frame->pts, c->time_base, key_->video_codec_->time_base));
+	}
+
+	void queue_video_frame(const safe_ptr<core::read_frame>& frame, const std::shared_ptr<AVFrame>& av_frame)
+	{
+		auto c = video_codec_.get();
+
+		if(segment_index(av_frame->pts, c->time_base) != segment_index(av_frame->pts - 1, c->time_base))
+			av_frame->pict_type = AV_PICTURE_TYPE_I; // Every segment starts with a key frame.
+
+		video_encode_executor_.begin_invoke([=]
+		{
+			encode_video_frame(frame, av_frame);
+		});
+
+		graph_->set_value("video-encode-queue", static_cast<double>(video_encode_executor_.size()) / VIDEO_ENCODE_QUEUE_CAPACITY);
+	}
+
+	void convert_renditions(const safe_ptr<core::read_frame>& frame, const std::shared_ptr<AVFrame>& av_frame)
+	{
+		auto source			= av_frame;
+		auto source_codec	= video_codec_.get();
+
+		BOOST_FOREACH(auto& rendition, renditions_)
+		{
+			source			= rendition->convert_rendition_frame(frame, source, source_codec, av_rescale_q(av_frame->pts, video_codec_->time_base, rendition->video_codec_->time_base));
+			source_codec	= rendition->video_codec_.get();
+		}
+	}
+
+	// Runs on the fill's convert stage, with the key picture when it was converted in the same pass.
+	void convert_key_frame(const safe_ptr<core::read_frame>& frame, std::shared_ptr<AVFrame> av_frame, int64_t pts)
+	{
+		if(!av_frame)
+			av_frame = convert_video(*frame, video_codec_.get());
+
+		av_frame->interlaced_frame	= format_desc_.field_mode != core::field_mode::progressive;
+		av_frame->top_field_first	= format_desc_.field_mode == core::field_mode::upper;
+		av_frame->pts				= pts;
+
+		queue_video_frame(frame, av_frame);
+		convert_renditions(frame, av_frame);
+	}
+
+	std::shared_ptr<AVFrame> scale_video(const AVFrame& source, AVCodecContext* source_codec, AVCodecContext* c)
+	{
+		if(!rendition_sws_)
+		{
+			rendition_sws_.reset(sws_getContext(source_codec->width, source_codec->height, source_codec->pix_fmt, c->width, c->height, c->pix_fmt, SWS_BICUBIC, nullptr, nullptr, nullptr), sws_freeContext);
+			
+			if (rendition_sws_ == nullptr) 
+				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Cannot initialize the conversion context"));
+		}
+
+		boost::timer convert_timer;
+
+		auto out_frame = alloc_picture(c);
+		sws_scale(rendition_sws_.get(), source.data, source.linesize, 0, source_codec->height, out_frame->data, out_frame->linesize);
+
+		graph_->set_value("convert-time", convert_timer.elapsed()*format_desc_.fps*0.5);
+
+		return out_frame;
+	}
+
+	// Runs on the parent's convert stage. Returns the picture for the next, smaller, rendition.
+	std::shared_ptr<AVFrame> convert_rendition_frame(const safe_ptr<core::read_frame>& frame, const std::shared_ptr<AVFrame>& source, AVCodecContext* source_codec, int64_t pts)
+	{
+		auto c = video_codec_.get();
+
+		auto av_frame = source_codec->width >= c->width && source_codec->height >= c->height ? scale_video(*source, source_codec, c) : convert_video(*frame, c);
+		av_frame->interlaced_frame	= format_desc_.field_mode != core::field_mode::progressive && c->height == static_cast<int>(format_desc_.height);
+		av_frame->top_field_first	= format_desc_.field_mode == core::field_mode::upper;
+		av_frame->pts				= pts;
+
+		queue_video_frame(frame, av_frame);
+
+		return av_frame;
+	}
+
+	void encode_video_frame(const safe_ptr<core::read_frame>& frame, const std::shared_ptr<AVFrame>& av_frame)
+	{
+		boost::timer frame_timer;
+
+		auto pkt = create_packet();
+		int got_packet = 0;
+
+		THROW_ON_ERROR2(avcodec_encode_video2(video_codec_.get(), pkt.get(), av_frame.get(), &got_packet), "[ffmpeg_consumer]");
+
+		graph_->set_value("frame-time", frame_timer.elapsed()*format_desc_.fps*0.5);
+		encode_times_.add(frame_timer.elapsed());
+		current_encoding_delay_ = frame->get_age_millis();
+		++encoded_frames_;
+
+		if(adaptive_quality_)
+		{
+			const auto queue_fill	= std::max(static_cast<double>(video_encode_executor_.size()) / VIDEO_ENCODE_QUEUE_CAPACITY, static_cast<double>(convert_executor_.size()) / CONVERT_QUEUE_CAPACITY);
+			const auto encode_load	= frame_timer.elapsed() * format_desc_.fps;
+
+			if(quality_.update(queue_fill, encode_load))
+				apply_quality_level(quality_.level());
+		}
+
+		if(got_packet)
+			write_packet(pkt, VIDEO_STREAM_INDEX);
+	}
+
+	void flush_video_encoder()
+	{
+		auto c = video_codec_.get();
+
+		if(!(c->codec->capabilities & CODEC_CAP_DELAY))
+			return;
+
+		for(int got_packet = 1; got_packet;)
+		{
+			auto pkt = create_packet();
+			THROW_ON_ERROR2(avcodec_encode_video2(c, pkt.get(), nullptr, &got_packet), "[ffmpeg_consumer]");
+
+			if(got_packet)
+				write_packet(pkt, VIDEO_STREAM_INDEX);
 		}
-				
-		c->max_b_frames = 0; // b-frames not supported.
-				
-		boost::range::remove_erase_if(options, [&](const option& o)
-		{
-			return ffmpeg::av_opt_set(c, o.name.c_str(), o.value.c_str(), AV_OPT_SEARCH_CHILDREN) > -1 ||
-				   ffmpeg::av_opt_set(c->priv_data, o.name.c_str(), o.value.c_str(), AV_OPT_SEARCH_CHILDREN) > -1;
-		});
-				
-		if(output_format_.format->flags & AVFMT_GLOBALHEADER)
-			c->flags |= CODEC_FLAG_GLOBAL_HEADER;
-		
-		c->thread_count = boost::thread::hardware_concurrency();
-		if(avcodec_open2(c, encoder, nullptr) < 0)
+	}
+
+	void write_packet(const safe_ptr<AVPacket>& pkt, int stream_index)
+	{
+		// Audio is encoded once and muxed into every rendition and the key.
+		if(stream_index == AUDIO_STREAM_INDEX)
 		{
-			c->thread_count = 1;
-			THROW_ON_ERROR2(avcodec_open2(c, encoder, nullptr), "[ffmpeg_consumer]");
+			BOOST_FOREACH(auto& rendition, renditions_)
+				rendition->write_packet(copy_packet(*pkt), stream_index);
+
+			if(key_)
+				key_->write_packet(copy_packet(*pkt), stream_index);
 		}
 
-		return std::shared_ptr<AVStream>(st, [](AVStream* st)
+		pkt->stream_index = stream_index;
+
+		mux_executor_.begin_invoke([=]
 		{
-			LOG_ON_ERROR2(avcodec_close(st->codec), "[ffmpeg_consumer]");
-			av_freep(&st->codec);
-			av_freep(&st);
+			mux_packet(pkt);
 		});
+
+		graph_->set_value("mux-queue", static_cast<double>(mux_executor_.size()) / MUX_QUEUE_CAPACITY);
 	}
-		
-	std::shared_ptr<AVStream> add_audio_stream(std::vector<option>& options)
+
+	int64_t segment_index(int64_t pts, AVRational time_base) const
 	{
-		if(output_format_.acodec == CODEC_ID_NONE)
-			return nullptr;
+		if(segment_time_ < 1 || pts < 0)
+			return 0;
 
-		auto st = av_new_stream(oc_.get(), 1);
-		if(!st)
-			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not allocate audio-stream") << boost::errinfo_api_function("av_new_stream"));		
-		
-		auto encoder = avcodec_find_encoder(output_format_.acodec);
-		if (!encoder)
-			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("codec not found"));
+		return av_rescale_rnd(pts, time_base.num, static_cast<int64_t>(time_base.den) * segment_time_, AV_ROUND_DOWN);
+	}
+
+	// Each stream rolls over to the next segment on its own, since the streams are encoded on 
+	// different threads. The previous segment is closed once every stream has moved on.
+	void mux_packet(const safe_ptr<AVPacket>& pkt)
+	{
+		const auto c = pkt->stream_index == VIDEO_STREAM_INDEX ? video_codec_.get() : audio_codec_.get();
+
+		auto index = pkt->pts == AV_NOPTS_VALUE ? static_cast<int64_t>(current_segment_) : segment_index(pkt->pts, c->time_base);
 		
-		auto c = st->codec;
+		if(!segments_.empty())
+			index = std::max(index, segments_.begin()->first); 
 
-		avcodec_get_context_defaults3(c, encoder);
+		auto it = segments_.find(index);
+		if(it == segments_.end())
+			it = segments_.insert(std::make_pair(index, open_segment(index))).first;
 
-		c->codec_id			= output_format_.acodec;
-		c->codec_type		= AVMEDIA_TYPE_AUDIO;
-		c->sample_rate		= 48000;
-		c->channels			= channel_layout_.num_channels;
-		c->sample_fmt		= AV_SAMPLE_FMT_S16;
+		it->second->write(pkt);
 
-		if(output_format_.vcodec == CODEC_ID_FLV1)		
-			c->sample_rate	= 44100;		
+		if(it->second->writer())
+			graph_->set_value("disk-buffer", it->second->writer()->fill());
 
-		if(output_format_.format->flags & AVFMT_GLOBALHEADER)
-			c->flags |= CODEC_FLAG_GLOBAL_HEADER;
-				
-		boost::range::remove_erase_if(options, [&](const option& o)
+		if(segments_.rbegin()->second->started())
 		{
-			return ffmpeg::av_opt_set(c, o.name.c_str(), o.value.c_str(), AV_OPT_SEARCH_CHILDREN) > -1;
-		});
+			while(segments_.size() > 1)
+				close_segment(segments_.begin());
+		}
+	}
 
-		THROW_ON_ERROR2(avcodec_open2(c, encoder, nullptr), "[ffmpeg_consumer]");
+	std::string segment_filename(int64_t index) const
+	{
+		if(segment_time_ < 1)
+			return filename_;
 
-		return std::shared_ptr<AVStream>(st, [](AVStream* st)
-		{
-			LOG_ON_ERROR2(avcodec_close(st->codec), "[ffmpeg_consumer]");;
-			av_freep(&st->codec);
-			av_freep(&st);
-		});
+		boost::filesystem::path path(filename_);
+		return (path.parent_path() / (boost::format("%s_%05d%s") % path.stem().string() % index % path.extension().string()).str()).string();
+	}
+
+	std::string index_filename() const
+	{
+		return boost::filesystem::path(filename_).replace_extension(".m3u8").string();
 	}
 
-	std::shared_ptr<AVFrame> convert_video(core::read_frame& frame, AVCodecContext* c)
+	std::shared_ptr<output_segment> open_segment(int64_t index)
 	{
-		if(!sws_) 
+		const auto filename = segment_filename(index);
+
+		std::shared_ptr<file_writer> writer;
+
+		if(write_buffer_ > 0 && !(output_format_.format->flags & AVFMT_NOFILE))
 		{
-			sws_.reset(sws_getContext(format_desc_.width, format_desc_.height, PIX_FMT_BGRA, c->width, c->height, c->pix_fmt, SWS_BICUBIC, nullptr, nullptr, nullptr), sws_freeContext);
-			if (sws_ == nullptr) 
-				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Cannot initialize the conversion context"));
+			writer = std::make_shared<file_writer>(widen(filename), write_buffer_ * 1024 * 1024, direct_io_, sync_interval_ * 1024 * 1024, write_throttle_ * 1024 * 1024);
+
+			tbb::spin_mutex::scoped_lock lock(writers_mutex_);
+			boost::range::remove_erase_if(writers_, [](const std::shared_ptr<file_writer>& writer){return writer->finished();});
+			writers_.push_back(writer);
 		}
 
-		std::shared_ptr<AVFrame> in_frame(avcodec_alloc_frame(), av_free);
-		auto in_picture = reinterpret_cast<AVPicture*>(in_frame.get());
+		auto segment = std::make_shared<output_segment>(
+				filename, 
+				output_format_.format, 
+				index * segment_time_ * AV_TIME_BASE, 
+				codecs(),
+				writer);
 
-		if (key_only_)
+		current_segment_ = std::max<int64_t>(current_segment_, index);
+
+		if(segment_time_ > 0)
+			CASPAR_LOG(info) << print() << L" Started segment " << widen(segment->filename());
+
+		return segment;
+	}
+
+	void close_segment(std::map<int64_t, std::shared_ptr<output_segment>>::iterator it)
+	{
+		closed_segment segment;
+		segment.index		= it->first;
+		segment.filename	= it->second->filename();
+		segment.duration	= it->second->duration();
+
+		segments_.erase(it); // Writes the trailer.
+
+		if(segment_time_ < 1)
+			return;
+
+		closed_segments_.push_back(segment);
+
+		const size_t retained = segment_retention_ > 0 ? std::max(1, segment_retention_ / segment_time_) : std::numeric_limits<size_t>::max();
+
+		while(closed_segments_.size() > retained)
 		{
-			key_picture_buf_.resize(frame.image_data().size());
-			in_picture->linesize[0] = format_desc_.width * 4;
-			in_picture->data[0] = key_picture_buf_.data();
+			try
+			{
+				boost::filesystem::remove(boost::filesystem::path(closed_segments_.front().filename));
+				++deleted_segments_;
+			}
+			catch(std::exception& e)
+			{
+				CASPAR_LOG(warning) << print() << L" Could not delete segment " << widen(closed_segments_.front().filename) << L". " << widen(e.what());
+			}
 
-			fast_memshfl(in_picture->data[0], frame.image_data().begin(), frame.image_data().size(), 0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
+			closed_segments_.pop_front();
 		}
-		else
+
+		write_index(false);
+	}
+
+	// An extended M3U playlist of the closed segments, oldest first.
+	void write_index(bool finished)
+	{
+		std::ofstream index(index_filename().c_str(), std::ios::out | std::ios::trunc);
+
+		index << "#EXTM3U\n";
+		index << "#EXT-X-VERSION:3\n";
+		index << "#EXT-X-TARGETDURATION:" << segment_time_ << "\n";
+		index << "#EXT-X-MEDIA-SEQUENCE:" << (closed_segments_.empty() ? 0 : closed_segments_.front().index) << "\n";
+
+		BOOST_FOREACH(auto& segment, closed_segments_)
 		{
-			avpicture_fill(in_picture, const_cast<uint8_t*>(frame.image_data().begin()), PIX_FMT_BGRA, format_desc_.width, format_desc_.height);
+			index << "#EXTINF:" << segment.duration << ",\n";
+			index << boost::filesystem::path(segment.filename).filename().string() << "\n";
 		}
 
-		std::shared_ptr<AVFrame> out_frame(avcodec_alloc_frame(), av_free);
-		picture_buf_.resize(avpicture_get_size(c->pix_fmt, c->width, c->height));
-		avpicture_fill(reinterpret_cast<AVPicture*>(out_frame.get()), picture_buf_.data(), c->pix_fmt, c->width, c->height);
-
-		sws_scale(sws_.get(), in_frame->data, in_frame->linesize, 0, format_desc_.height, out_frame->data, out_frame->linesize);
+		if(finished)
+			index << "#EXT-X-ENDLIST\n";
 
-		return out_frame;
+		if(!index)
+			CASPAR_LOG(warning) << print() << L" Could not write " << widen(index_filename());
 	}
-  
-	void encode_video_frame(core::read_frame& frame)
-	{ 
-		auto c = video_st_->codec;
-		
-		auto in_time  = static_cast<double>(in_frame_number_) / format_desc_.fps;
-		auto out_time = static_cast<double>(out_frame_number_) / (static_cast<double>(c->time_base.den) / static_cast<double>(c->time_base.num));
 		
-		in_frame_number_++;
+	std::shared_ptr<AVFrame> alloc_audio_frame(AVCodecContext* c, int nb_samples)
+	{
+		std::shared_ptr<AVFrame> frame(av_frame_alloc(), [](AVFrame* frame)
+		{
+			av_frame_free(&frame);
+		});
 
-		if(out_time - in_time > 0.01)
-			return;
- 
-		auto av_frame = convert_video(frame, c);
-		av_frame->interlaced_frame	= format_desc_.field_mode != core::field_mode::progressive;
-		av_frame->top_field_first	= format_desc_.field_mode == core::field_mode::upper;
-		av_frame->pts				= out_frame_number_++;
+		frame->format			= c->sample_fmt;
+		frame->channel_layout	= c->channel_layout;
+		frame->nb_samples		= nb_samples;
+		av_frame_set_channels(frame.get(), c->channels); // There are no default layouts for every channel count.
+
+		THROW_ON_ERROR2(av_frame_get_buffer(frame.get(), 0), "[ffmpeg_consumer]");
+		++audio_allocations_;
+
+		return frame;
+	}
+
+	// Queues the frame's samples in the encoder's sample format. Samples are read straight 
+	// from the frame, converted into a reusable buffer if needed, and copied once into the fifo.
+	void push_audio(core::read_frame& frame, AVCodecContext* c)
+	{
+		const auto audio_data	= frame.audio_data();
+		const int  nb_samples	= static_cast<int>(audio_data.size()) / frame.num_channels();
+
+		if(!audio_fifo_)
+		{
+			audio_fifo_.reset(av_audio_fifo_alloc(c->sample_fmt, c->channels, std::max(nb_samples, c->frame_size) * 4), av_audio_fifo_free);
+			++audio_allocations_;
+
+			if(c->sample_fmt != AV_SAMPLE_FMT_S32 || c->sample_rate != static_cast<int>(format_desc_.audio_sample_rate) || c->channels != frame.num_channels())
+			{
+				swr_.reset(swr_alloc_set_opts(nullptr,
+							c->channel_layout, c->sample_fmt, c->sample_rate,
+							av_get_default_channel_layout(frame.num_channels()), AV_SAMPLE_FMT_S32, format_desc_.audio_sample_rate,
+							0, nullptr), [](SwrContext* p){swr_free(&p);});
+
+				if(!swr_)
+					BOOST_THROW_EXCEPTION(bad_alloc());
+
+				av_opt_set_int(swr_.get(), "in_channel_count",	frame.num_channels(), 0);
+				av_opt_set_int(swr_.get(), "out_channel_count",	c->channels, 0);
+
+				THROW_ON_ERROR2(swr_init(swr_.get()), "[ffmpeg_consumer]");
+			}
+		}
 
-		int out_size = THROW_ON_ERROR2(avcodec_encode_video(c, video_outbuf_.data(), video_outbuf_.size(), av_frame.get()), "[ffmpeg_consumer]");
-		if(out_size == 0)
+		if(nb_samples < 1)
 			return;
-				
-		safe_ptr<AVPacket> pkt(new AVPacket, [](AVPacket* p)
+
+		const uint8_t* in[] = {reinterpret_cast<const uint8_t*>(audio_data.begin())};
+
+		if(!swr_)
 		{
-			av_free_packet(p);
-			delete p;
-		});
-		av_init_packet(pkt.get());
- 
-		if (c->coded_frame->pts != AV_NOPTS_VALUE)
-			pkt->pts = av_rescale_q(c->coded_frame->pts, c->time_base, video_st_->time_base);
+			write_audio_fifo(const_cast<uint8_t**>(in), nb_samples);
+			return;
+		}
+
+		const auto max_samples = static_cast<int>(av_rescale_rnd(swr_get_delay(swr_.get(), format_desc_.audio_sample_rate) + nb_samples, c->sample_rate, format_desc_.audio_sample_rate, AV_ROUND_UP));
 
-		if(c->coded_frame->key_frame)
-			pkt->flags |= AV_PKT_FLAG_KEY;
+		if(!audio_convert_frame_ || audio_convert_frame_->nb_samples < max_samples)
+			audio_convert_frame_ = alloc_audio_frame(c, max_samples);
 
-		pkt->stream_index	= video_st_->index;
-		pkt->data			= video_outbuf_.data();
-		pkt->size			= out_size;
- 			
-		av_interleaved_write_frame(oc_.get(), pkt.get());		
+		const auto converted = THROW_ON_ERROR2(swr_convert(swr_.get(), audio_convert_frame_->extended_data, max_samples, in, nb_samples), "[ffmpeg_consumer]");
+
+		write_audio_fifo(audio_convert_frame_->extended_data, converted);
 	}
-		
-	byte_vector convert_audio(core::read_frame& frame, AVCodecContext* c)
-	{
-		if(!swr_) 		
-			swr_.reset(new audio_resampler(c->channels, frame.num_channels(), 
-										   c->sample_rate, format_desc_.audio_sample_rate,
-										   c->sample_fmt, AV_SAMPLE_FMT_S32));
-		
 
-		auto audio_data = frame.audio_data();
+	void write_audio_fifo(uint8_t** data, int nb_samples)
+	{
+		if(av_audio_fifo_space(audio_fifo_.get()) < nb_samples)
+			++audio_allocations_; // The fifo grows.
 
-		std::vector<int8_t,  tbb::cache_aligned_allocator<int8_t>> audio_resample_buffer;
-		std::copy(reinterpret_cast<const uint8_t*>(audio_data.begin()), 
-				  reinterpret_cast<const uint8_t*>(audio_data.begin()) + audio_data.size()*4, 
-				  std::back_inserter(audio_resample_buffer));
-		
-		audio_resample_buffer = swr_->resample(std::move(audio_resample_buffer));
-		
-		return byte_vector(audio_resample_buffer.begin(), audio_resample_buffer.end());
+		THROW_ON_ERROR2(av_audio_fifo_write(audio_fifo_.get(), reinterpret_cast<void**>(data), nb_samples), "[ffmpeg_consumer]");
 	}
 
-	void encode_audio_frame(core::read_frame& frame)
-	{			
-		auto c = audio_st_->codec;
+	// Encodes whole codec frames from the fifo, and the remainder when flushing. Encoders that 
+	// only take whole frames get the remainder padded with silence.
+	void encode_audio_fifo(AVCodecContext* c, bool flush)
+	{
+		const bool variable_frame_size = c->frame_size < 2 || (flush && (c->codec->capabilities & CODEC_CAP_SMALL_LAST_FRAME));
+		const int  frame_size		   = c->frame_size < 2 ? std::max(av_audio_fifo_size(audio_fifo_.get()), 1) : c->frame_size;
 
-		boost::range::push_back(audio_buf_, convert_audio(frame, c));
-		
-		std::size_t frame_size = c->frame_size;
-		auto input_audio_size = frame_size * av_get_bytes_per_sample(c->sample_fmt) * c->channels;
-		
-		while(audio_buf_.size() >= input_audio_size)
+		while(av_audio_fifo_size(audio_fifo_.get()) >= (variable_frame_size || flush ? 1 : frame_size))
 		{
-			safe_ptr<AVPacket> pkt(new AVPacket, [](AVPacket* p)
+			if(audio_encode_capacity_ < frame_size)
 			{
-				av_free_packet(p);
-				delete p;
-			});
-			av_init_packet(pkt.get());
-
-			if(frame_size > 1)
-			{								
-				pkt->size = avcodec_encode_audio(c, audio_outbuf_.data(), audio_outbuf_.size(), reinterpret_cast<short*>(audio_buf_.data()));
-				audio_buf_.erase(audio_buf_.begin(), audio_buf_.begin() + input_audio_size);
+				audio_encode_frame_		= alloc_audio_frame(c, frame_size);
+				audio_encode_capacity_	= frame_size;
 			}
-			else
+
+			audio_encode_frame_->nb_samples = THROW_ON_ERROR2(av_audio_fifo_read(audio_fifo_.get(), reinterpret_cast<void**>(audio_encode_frame_->extended_data), frame_size), "[ffmpeg_consumer]");
+
+			if(!variable_frame_size && audio_encode_frame_->nb_samples < frame_size)
 			{
-				audio_outbuf_ = std::move(audio_buf_);		
-				audio_buf_.clear();
-				pkt->size = audio_outbuf_.size();
-				pkt->data = audio_outbuf_.data();
+				av_samples_set_silence(audio_encode_frame_->extended_data, audio_encode_frame_->nb_samples, frame_size - audio_encode_frame_->nb_samples, c->channels, c->sample_fmt);
+				audio_encode_frame_->nb_samples = frame_size;
 			}
-		
-			if(pkt->size == 0)
-				return;
 
-			if (c->coded_frame && c->coded_frame->pts != AV_NOPTS_VALUE)
-				pkt->pts = av_rescale_q(c->coded_frame->pts, c->time_base, audio_st_->time_base);
+			audio_encode_frame_->pts		= audio_pts_;
+			audio_pts_					   += audio_encode_frame_->nb_samples;
 
-			pkt->flags		 |= AV_PKT_FLAG_KEY;
-			pkt->stream_index = audio_st_->index;
-			pkt->data		  = reinterpret_cast<uint8_t*>(audio_outbuf_.data());
-		
-			av_interleaved_write_frame(oc_.get(), pkt.get());
+			auto pkt = create_packet();
+			int got_packet = 0;
+
+			THROW_ON_ERROR2(avcodec_encode_audio2(c, pkt.get(), audio_encode_frame_.get(), &got_packet), "[ffmpeg_consumer]");
+
+			if(got_packet)
+				write_packet(pkt, AUDIO_STREAM_INDEX);
+		}
+	}
+
+	void encode_audio_frame(core::read_frame& frame)
+	{			
+		auto c = audio_codec_.get();
+
+		push_audio(frame, c);
+		encode_audio_fifo(c, false);
+	}
+
+	void flush_audio_encoder()
+	{
+		auto c = audio_codec_.get();
+
+		if(audio_fifo_)
+			encode_audio_fifo(c, true);
+
+		if(!(c->codec->capabilities & CODEC_CAP_DELAY))
+			return;
+
+		for(int got_packet = 1; got_packet;)
+		{
+			auto pkt = create_packet();
+			THROW_ON_ERROR2(avcodec_encode_audio2(c, pkt.get(), nullptr, &got_packet), "[ffmpeg_consumer]");
+
+			if(got_packet)
+				write_packet(pkt, AUDIO_STREAM_INDEX);
 		}
 	}
 		 
 	void send(const safe_ptr<core::read_frame>& frame)
 	{
-		encode_executor_.begin_invoke([=]
+		convert_executor_.begin_invoke([=]
 		{		
-			boost::timer frame_timer;
-
-			encode_video_frame(*frame);
+			convert_video_frame(frame);
+		});
 
-			if (!key_only_)
+		if (!key_only_)
+		{
+			audio_encode_executor_.begin_invoke([=]
+			{
 				encode_audio_frame(*frame);
+			});
+		}
 
-			graph_->set_value("frame-time", frame_timer.elapsed()*format_desc_.fps*0.5);
-			current_encoding_delay_ = frame->get_age_millis();
-		});
+		graph_->set_value("convert-queue", static_cast<double>(convert_executor_.size()) / CONVERT_QUEUE_CAPACITY);
+		graph_->set_value("audio-encode-queue", static_cast<double>(audio_encode_executor_.size()) / AUDIO_ENCODE_QUEUE_CAPACITY);
+	}
+
+	bool convert_queue_full() const
+	{
+		return convert_executor_.size() >= convert_executor_.capacity();
+	}
+
+	bool audio_queue_full() const
+	{
+		return !key_only_ && audio_encode_executor_.size() >= audio_encode_executor_.capacity();
 	}
 
-	bool ready_for_frame()
+	bool ready_for_frame() const
 	{
-		return encode_executor_.size() < encode_executor_.capacity();
+		return !convert_queue_full() && !audio_queue_full();
 	}
 
 	void mark_dropped()
 	{
 		graph_->set_tag("dropped-frame");
 
+		if(convert_queue_full())
+			++convert_queue_drops_;
+		else
+			++audio_queue_drops_;
+
 		// TODO: adjust PTS accordingly to make dropped frames contribute
 		//       to the total playing time
 	}
+
+	boost::property_tree::wptree info() const
+	{
+		boost::property_tree::wptree info;
+		info.add(L"filename",								widen(filename_));
+		info.add(L"width",									video_codec_->width);
+		info.add(L"height",									video_codec_->height);
+		info.add(L"vcodec",									widen(std::string(video_codec_->codec->name)));
+		info.add(L"encoded-frames",							static_cast<int64_t>(encoded_frames_));
+		info.add_child(L"encode-time",						encode_times_.info());
+
+		if(adaptive_quality_)
+			info.add_child(L"adaptive-quality",				quality_.info());
+
+		info.add(L"stages.convert.queued",					convert_executor_.size());
+		info.add(L"stages.convert.capacity",				convert_executor_.capacity());
+		info.add(L"stages.video-encode.queued",				video_encode_executor_.size());
+		info.add(L"stages.video-encode.capacity",			video_encode_executor_.capacity());
+		info.add(L"stages.audio-encode.queued",				audio_encode_executor_.size());
+		info.add(L"stages.audio-encode.capacity",			audio_encode_executor_.capacity());
+		info.add(L"stages.mux.queued",						mux_executor_.size());
+		info.add(L"stages.mux.capacity",					mux_executor_.capacity());
+		info.add(L"dropped-frames.convert-queue-full",		static_cast<int64_t>(convert_queue_drops_));
+		info.add(L"dropped-frames.audio-encode-queue-full",	static_cast<int64_t>(audio_queue_drops_));
+		info.add(L"audio.encoded-samples",					static_cast<int64_t>(audio_pts_));
+		info.add(L"audio.allocations",						static_cast<int64_t>(audio_allocations_));
+		info.add(L"segment.time",							segment_time_);
+		info.add(L"segment.retention",						segment_retention_);
+		info.add(L"segment.current",						static_cast<int64_t>(current_segment_));
+		info.add(L"segment.deleted",						static_cast<int64_t>(deleted_segments_));
+
+		{
+			tbb::spin_mutex::scoped_lock lock(writers_mutex_);
+
+			if(!writers_.empty())
+				info.add_child(L"disk", writers_.back()->info());
+		}
+
+		BOOST_FOREACH(auto& rendition, renditions_)
+			info.add_child(L"renditions.rendition", rendition->info());
+		return info;
+	}
 };
 
 struct ffmpeg_consumer_proxy : public core::frame_consumer
 {
+	const std::wstring				folder_;
 	const std::wstring				filename_;
 	const std::vector<option>		options_;
 	const bool						separate_key_;
 	core::video_format_desc			format_desc_;
 
 	std::unique_ptr<ffmpeg_consumer> consumer_;
-	std::unique_ptr<ffmpeg_consumer> key_only_consumer_;
 
 public:
 
-	ffmpeg_consumer_proxy(const std::wstring& filename, const std::vector<option>& options, bool separate_key_)
-		: filename_(filename)
+	ffmpeg_consumer_proxy(const std::wstring& folder, const std::wstring& filename, const std::vector<option>& options, bool separate_key_)
+		: folder_(folder)
+		, filename_(folder + filename)
 		, options_(options)
 		, separate_key_(separate_key_)
 	{
@@ -668,26 +1980,11 @@ public:
 		if (!consumer_)
 			do_initialize(frame->multichannel_view().channel_layout());
 
-		bool ready_for_frame = consumer_->ready_for_frame();
-
-		if (ready_for_frame && separate_key_)
-			ready_for_frame = ready_for_frame && key_only_consumer_->ready_for_frame();
-
-		if (ready_for_frame)
-		{
+		if (consumer_->ready_for_frame())
 			consumer_->send(frame);
-
-			if (separate_key_)
-				key_only_consumer_->send(frame);
-		}
 		else
-		{
 			consumer_->mark_dropped();
 
-			if (separate_key_)
-				key_only_consumer_->mark_dropped();
-		}
-
 		return caspar::wrap_as_future(true);
 	}
 	
@@ -702,6 +1999,13 @@ public:
 		info.add(L"type", L"ffmpeg-consumer");
 		info.add(L"filename", filename_);
 		info.add(L"separate_key", separate_key_);
+
+		if (consumer_)
+			info.add_child(L"encoder", consumer_->info());
+
+		if (consumer_ && consumer_->key_)
+			info.add_child(L"key-encoder", consumer_->key_->info());
+
 		return info;
 	}
 		
@@ -719,11 +2023,18 @@ public:
 	{
 		return 200;
 	}
+
+	boost::property_tree::wptree drain()
+	{
+		if (consumer_)
+			consumer_->drain();
+
+		return info();
+	}
 private:
 	void do_initialize(const core::channel_layout& channel_layout)
 	{
 		consumer_.reset();
-		key_only_consumer_.reset();
 		consumer_.reset(new ffmpeg_consumer(
 				narrow(filename_),
 				format_desc_,
@@ -735,19 +2046,25 @@ private:
 		{
 			boost::filesystem::wpath fill_file(filename_);
 			auto without_extension = fill_file.stem();
-			auto key_file = env::media_folder() + without_extension + L"_A" + fill_file.extension();
+			auto key_file = folder_ + without_extension + L"_A" + fill_file.extension();
 			
-			key_only_consumer_.reset(new ffmpeg_consumer(
+			consumer_->attach_key(std::unique_ptr<ffmpeg_consumer>(new ffmpeg_consumer(
 					narrow(key_file),
 					format_desc_,
-					options_,
+					key_options(options_),
 					true,
-					channel_layout));
+					channel_layout,
+					consumer_.get())));
 		}
 	}
 };	
 
 safe_ptr<core::frame_consumer> create_consumer(const core::parameters& params)
+{
+	return create_consumer(params, env::media_folder());
+}
+
+safe_ptr<core::frame_consumer> create_consumer(const core::parameters& params, const std::wstring& folder)
 {
 	if(params.size() < 1 || params[0] != L"FILE")
 		return core::frame_consumer::empty();
@@ -779,7 +2096,7 @@ safe_ptr<core::frame_consumer> create_consumer(const core::parameters& params)
 		}
 	}
 		
-	return make_safe<ffmpeg_consumer_proxy>(env::media_folder() + filename, options, separate_key);
+	return make_safe<ffmpeg_consumer_proxy>(folder, filename, options, separate_key);
 }
 
 safe_ptr<core::frame_consumer> create_consumer(const boost::property_tree::wptree& ptree)
@@ -787,11 +2104,133 @@ safe_ptr<core::frame_consumer> create_consumer(const boost::property_tree::wptre
 	auto filename		= ptree.get<std::wstring>(L"path");
 	auto codec			= ptree.get(L"vcodec", L"libx264");
 	auto separate_key	= ptree.get(L"separate-key", false);
+	auto segment_time	= ptree.get(L"segment-time", 0);
+	auto retention		= ptree.get(L"segment-retention", 0);
+	auto renditions		= ptree.get(L"renditions", L"");
+	auto write_buffer	= ptree.get(L"write-buffer-mb", 0);
+	auto direct_io		= ptree.get(L"direct-io", false);
+	auto sync_interval	= ptree.get(L"sync-interval-mb", 0);
+	auto adaptive		= ptree.get(L"adaptive-quality", false);
 
 	std::vector<option> options;
 	options.push_back(option("vcodec", narrow(codec)));
+
+	if(!renditions.empty())
+		options.push_back(option("renditions", narrow(renditions)));
+
+	options.push_back(option("write_buffer",	boost::lexical_cast<std::string>(write_buffer)));
+	options.push_back(option("direct_io",		direct_io ? "1" : "0"));
+	options.push_back(option("sync_interval",	boost::lexical_cast<std::string>(sync_interval)));
+	options.push_back(option("adaptive_quality",	adaptive ? "1" : "0"));
+
+	if(segment_time > 0)
+	{
+		options.push_back(option("segment_time", boost::lexical_cast<std::string>(segment_time)));
+		options.push_back(option("segment_retention", boost::lexical_cast<std::string>(retention)));
+	}
 	
-	return make_safe<ffmpeg_consumer_proxy>(env::media_folder() + filename, options, separate_key);
+	return make_safe<ffmpeg_consumer_proxy>(env::media_folder(), filename, options, separate_key);
+}
+
+boost::property_tree::wptree drain_consumer(const safe_ptr<core::frame_consumer>& consumer)
+{
+	auto proxy = dynamic_cast<ffmpeg_consumer_proxy*>(consumer.get());
+	if(!proxy)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("consumer"));
+
+	return proxy->drain();
+}
+
+template<typename F>
+static double mean_conversion_millis(int frames, const F& convert)
+{
+	typedef boost::chrono::high_resolution_clock clock;
+
+	convert(); // Touches the buffers and the scaler tables first.
+
+	const auto start = clock::now();
+
+	for(int n = 0; n < frames; ++n)
+		convert();
+
+	return boost::chrono::duration<double, boost::milli>(clock::now() - start).count() / frames;
+}
+
+static int64_t count_differing_bytes(const AVFrame& lhs, const AVFrame& rhs, PixelFormat pix_fmt, int width, int height)
+{
+	const auto log2_chroma_h = av_pix_fmt_desc_get(pix_fmt)->log2_chroma_h;
+
+	int64_t count = 0;
+
+	for(int i = 0; i < 4 && lhs.data[i]; ++i)
+	{
+		const int shift = i == 1 || i == 2 ? log2_chroma_h : 0;
+		const int bytes	= av_image_get_linesize(pix_fmt, width, i);
+
+		for(int y = 0; y < height >> shift; ++y)
+		{
+			auto row0 = lhs.data[i] + y * lhs.linesize[i];
+			auto row1 = rhs.data[i] + y * rhs.linesize[i];
+
+			for(int x = 0; x < bytes; ++x)
+				count += row0[x] != row1[x] ? 1 : 0;
+		}
+	}
+
+	return count;
+}
+
+boost::property_tree::wptree benchmark_conversion(const std::vector<core::video_format_desc>& formats, int frames)
+{
+	if(frames < 1)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("frames") << arg_value_info(boost::lexical_cast<std::string>(frames)));
+
+	// The formats of the fast path, and one that always goes through swscale.
+	static const PixelFormat PIX_FMTS[] = {PIX_FMT_YUV420P, PIX_FMT_YUV422P, PIX_FMT_YUV422P10LE};
+
+	boost::property_tree::wptree info;
+	info.add(L"conversion.frames",	frames);
+	info.add(L"conversion.threads",	tbb::task_scheduler_init::default_num_threads());
+
+	BOOST_FOREACH(auto& format_desc, formats)
+	{
+		const int width		= static_cast<int>(format_desc.width);
+		const int height	= static_cast<int>(format_desc.height);
+
+		CASPAR_LOG(info) << L"[conversion-benchmark] Converting " << frames << L" frames of " << format_desc.name << L".";
+
+		// Noise, so that no path can take shortcuts on flat areas.
+		byte_vector source(format_desc.size);
+		for(size_t n = 0; n < source.size(); ++n)
+			source[n] = static_cast<uint8_t>((n * 2654435761u) >> 24);
+
+		BOOST_FOREACH(auto pix_fmt, PIX_FMTS)
+		{
+			auto single_pass	= create_scale_slices(width, height, width, height, pix_fmt, 1);
+			auto slices			= create_scale_slices(width, height, width, height, pix_fmt, default_slice_count(height));
+			auto single_frame	= alloc_picture(pix_fmt, width, height);
+			auto sliced_frame	= alloc_picture(pix_fmt, width, height);
+
+			boost::property_tree::wptree run;
+			run.add(L"format",				format_desc.name);
+			run.add(L"pix-fmt",				widen(std::string(av_get_pix_fmt_name(pix_fmt))));
+			run.add(L"frame-budget-millis",	1000.0 / format_desc.fps);
+			run.add(L"swscale-millis",		mean_conversion_millis(frames, [&]{scale_slices(single_pass, source.data(), width * 4, *single_frame, pix_fmt, width);}));
+			run.add(L"slices",				slices.size());
+			run.add(L"slices-millis",		mean_conversion_millis(frames, [&]{scale_slices(slices, source.data(), width * 4, *sliced_frame, pix_fmt, width);}));
+			run.add(L"slices-differing-bytes", count_differing_bytes(*single_frame, *sliced_frame, pix_fmt, width, height));
+
+			if(pix_fmt == PIX_FMT_YUV420P || pix_fmt == PIX_FMT_YUV422P)
+			{
+				auto fast_frame = alloc_picture(pix_fmt, width, height);
+				run.add(L"fast-millis",		mean_conversion_millis(frames, [&]{fast_bgra_to_yuv(source.data(), width * 4, *fast_frame, nullptr, width, height, pix_fmt == PIX_FMT_YUV420P);}));
+			}
+
+			info.add_child(L"conversion.runs.run", run);
+		}
+	}
+
+	return info;
 }
 
 }}
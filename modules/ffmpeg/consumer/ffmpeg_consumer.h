@@ -31,11 +31,22 @@ namespace caspar {
 namespace core {
 	struct frame_consumer;
 	class parameters;
+	struct video_format_desc;
 }
 
 namespace ffmpeg {
 	
 safe_ptr<core::frame_consumer> create_consumer(const core::parameters& params);
+safe_ptr<core::frame_consumer> create_consumer(const core::parameters& params, const std::wstring& folder);
 safe_ptr<core::frame_consumer> create_consumer(const boost::property_tree::wptree& ptree);
 
+// Waits until a file consumer has encoded and written every frame it accepted, and returns its info then. 
+// The consumer must not be sent frames afterwards.
+boost::property_tree::wptree drain_consumer(const safe_ptr<core::frame_consumer>& consumer);
+
+// Converts a BGRA frame of each of the given formats to yuv420p, yuv422p and yuv422p10 in a single 
+// swscale pass, in parallel slices and, where it applies, on the fast path, and reports the mean time 
+// per frame of each. Also reports how many bytes of the sliced conversion differ from the single pass.
+boost::property_tree::wptree benchmark_conversion(const std::vector<core::video_format_desc>& formats, int frames);
+
 }}
\ No newline at end of file
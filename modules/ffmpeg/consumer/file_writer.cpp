@@ -0,0 +1,432 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "file_writer.h"
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <boost/thread.hpp>
+#include <boost/timer.hpp>
+
+#include <tbb/atomic.h>
+
+#include <deque>
+#include <vector>
+
+#include <malloc.h>
+#include <windows.h>
+
+namespace caspar { namespace ffmpeg {
+
+// Covers both 512 byte and 4K sector drives.
+static const size_t SECTOR_SIZE		= 4096;
+static const size_t STAGING_SIZE	= 1024 * 1024;
+
+struct file_write_chunk
+{
+	int64_t					offset;
+	std::vector<uint8_t>	data;
+};
+
+struct file_writer::implementation : boost::noncopyable
+{
+	const std::wstring							path_;
+	const size_t								capacity_;
+	const bool									direct_;
+	const size_t								sync_interval_;
+	const size_t								throttle_;
+
+	mutable boost::mutex						mutex_;
+	boost::condition_variable					cond_;
+	std::deque<file_write_chunk>				chunks_;
+	size_t										queued_bytes_;
+	bool										closing_;
+
+	HANDLE										handle_;
+	std::shared_ptr<uint8_t>					staging_;		// Direct writes only.
+	size_t										staged_;
+	int64_t										file_position_;	// Where the next block is written.
+	int64_t										file_size_;
+	std::vector<file_write_chunk>				patches_;		// Direct writes before the staged data.
+	size_t										unsynced_bytes_;
+	boost::timer								throttle_timer_;
+	int64_t										throttled_bytes_;
+
+	tbb::atomic<bool>							failed_;
+	tbb::atomic<bool>							finished_;
+	tbb::atomic<int64_t>						written_bytes_;
+	tbb::atomic<int64_t>						writes_;
+	tbb::atomic<int64_t>						syncs_;
+	tbb::atomic<int64_t>						full_waits_;
+	tbb::atomic<int64_t>						write_micros_;
+	tbb::atomic<int64_t>						max_write_micros_;
+	boost::timer								timer_;
+
+	boost::thread								thread_;
+
+	implementation(const std::wstring& path, size_t buffer_size, bool direct, size_t sync_interval, size_t throttle)
+		: path_(path)
+		, capacity_(std::max<size_t>(buffer_size, STAGING_SIZE))
+		, direct_(direct)
+		, sync_interval_(sync_interval)
+		, throttle_(throttle)
+		, queued_bytes_(0)
+		, closing_(false)
+		, handle_(INVALID_HANDLE_VALUE)
+		, staged_(0)
+		, file_position_(0)
+		, file_size_(0)
+		, unsynced_bytes_(0)
+		, throttled_bytes_(0)
+	{
+		failed_				= false;
+		finished_			= false;
+		written_bytes_		= 0;
+		writes_				= 0;
+		syncs_				= 0;
+		full_waits_			= 0;
+		write_micros_		= 0;
+		max_write_micros_	= 0;
+
+		handle_ = CreateFileW(path_.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | (direct_ ? FILE_FLAG_NO_BUFFERING : 0), nullptr);
+		if(handle_ == INVALID_HANDLE_VALUE)
+			BOOST_THROW_EXCEPTION(io_error() << msg_info(narrow(print()) + " Could not open file.") << boost::errinfo_api_function("CreateFileW"));
+
+		if(direct_)
+			staging_.reset(static_cast<uint8_t*>(_aligned_malloc(STAGING_SIZE, SECTOR_SIZE)), _aligned_free);
+
+		thread_ = boost::thread([this]{run();});
+	}
+
+	~implementation()
+	{
+		close();
+		wait();
+	}
+
+	std::wstring print() const
+	{
+		return L"file_writer[" + path_ + L"]";
+	}
+
+	bool write(int64_t offset, const uint8_t* data, size_t size)
+	{
+		file_write_chunk chunk;
+		chunk.offset = offset;
+		chunk.data.assign(data, data + size);
+
+		{
+			boost::unique_lock<boost::mutex> lock(mutex_);
+
+			if(queued_bytes_ + size > capacity_ && !failed_)
+				++full_waits_;
+
+			while(queued_bytes_ + size > capacity_ && queued_bytes_ > 0 && !failed_)
+				cond_.wait(lock);
+
+			if(failed_ || closing_)
+				return false;
+
+			queued_bytes_ += size;
+			chunks_.push_back(std::move(chunk));
+		}
+
+		cond_.notify_all();
+
+		return true;
+	}
+
+	void close()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			closing_ = true;
+		}
+
+		cond_.notify_all();
+	}
+
+	void wait()
+	{
+		if(thread_.joinable())
+			thread_.join();
+	}
+
+	void run()
+	{
+		win32_exception::ensure_handler_installed_for_thread("file-writer-thread");
+
+		while(true)
+		{
+			file_write_chunk chunk;
+
+			{
+				boost::unique_lock<boost::mutex> lock(mutex_);
+
+				while(chunks_.empty() && !closing_)
+					cond_.wait(lock);
+
+				if(chunks_.empty())
+					break;
+
+				chunk = std::move(chunks_.front());
+				chunks_.pop_front();
+			}
+
+			if(!failed_)
+			{
+				try
+				{
+					write_chunk(chunk);
+				}
+				catch(...)
+				{
+					CASPAR_LOG_CURRENT_EXCEPTION();
+					failed_ = true;
+				}
+			}
+
+			{
+				boost::lock_guard<boost::mutex> lock(mutex_);
+				queued_bytes_ -= chunk.data.size();
+			}
+
+			cond_.notify_all();
+		}
+
+		try
+		{
+			if(!failed_)
+				finish();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+			failed_ = true;
+		}
+
+		if(handle_ != INVALID_HANDLE_VALUE)
+			CloseHandle(handle_);
+
+		finished_ = true;
+	}
+
+	void write_chunk(const file_write_chunk& chunk)
+	{
+		file_size_ = std::max(file_size_, chunk.offset + static_cast<int64_t>(chunk.data.size()));
+
+		if(!direct_)
+		{
+			if(chunk.offset != file_position_)
+				seek(handle_, chunk.offset);
+
+			write_file(handle_, chunk.data.data(), chunk.data.size());
+			file_position_ = chunk.offset + chunk.data.size();
+			return;
+		}
+
+		auto offset	= chunk.offset;
+		auto data	= chunk.data.data();
+		auto size	= chunk.data.size();
+
+		// Data that is already on disk is rewritten when closing.
+		if(offset < file_position_)
+		{
+			const auto count = static_cast<size_t>(std::min<int64_t>(file_position_ - offset, size));
+
+			file_write_chunk patch;
+			patch.offset = offset;
+			patch.data.assign(data, data + count);
+			patches_.push_back(std::move(patch));
+
+			offset	+= count;
+			data	+= count;
+			size	-= count;
+		}
+
+		const auto staged_end = file_position_ + static_cast<int64_t>(staged_);
+
+		// Forward seeks leave a gap, which is filled with zeros.
+		if(size > 0 && offset > staged_end)
+			stage(nullptr, static_cast<size_t>(offset - staged_end));
+		
+		// Data within the staged block is overwritten in place.
+		if(size > 0 && offset < staged_end)
+		{
+			const auto count = static_cast<size_t>(std::min<int64_t>(staged_end - offset, size));
+
+			memcpy(staging_.get() + (offset - file_position_), data, count);
+
+			data	+= count;
+			size	-= count;
+		}
+		
+		stage(data, size);
+	}
+
+	// Appends to the staging block and writes it out whenever it is full.
+	void stage(const uint8_t* data, size_t size)
+	{
+		while(size > 0)
+		{
+			const auto count = std::min(size, STAGING_SIZE - staged_);
+
+			if(data)
+			{
+				memcpy(staging_.get() + staged_, data, count);
+				data += count;
+			}
+			else
+				memset(staging_.get() + staged_, 0, count);
+
+			staged_ += count;
+			size	-= count;
+
+			if(staged_ == STAGING_SIZE)
+			{
+				write_file(handle_, staging_.get(), STAGING_SIZE);
+				file_position_ += STAGING_SIZE;
+				staged_			= 0;
+			}
+		}
+	}
+
+	void finish()
+	{
+		if(direct_)
+		{
+			// The tail is padded to a whole sector, and the file is truncated to its size afterwards.
+			if(staged_ > 0)
+			{
+				const auto padded = (staged_ + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+				memset(staging_.get() + staged_, 0, padded - staged_);
+				write_file(handle_, staging_.get(), padded);
+			}
+
+			CloseHandle(handle_);
+
+			handle_ = CreateFileW(path_.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if(handle_ == INVALID_HANDLE_VALUE)
+				BOOST_THROW_EXCEPTION(io_error() << msg_info(narrow(print()) + " Could not reopen file.") << boost::errinfo_api_function("CreateFileW"));
+
+			BOOST_FOREACH(auto& patch, patches_)
+			{
+				seek(handle_, patch.offset);
+				write_file(handle_, patch.data.data(), patch.data.size());
+			}
+
+			seek(handle_, file_size_);
+			if(!SetEndOfFile(handle_))
+				BOOST_THROW_EXCEPTION(io_error() << msg_info(narrow(print()) + " Could not truncate file.") << boost::errinfo_api_function("SetEndOfFile"));
+		}
+
+		sync();
+	}
+
+	void sync()
+	{
+		if(!FlushFileBuffers(handle_))
+			CASPAR_LOG(warning) << print() << L" Could not flush file buffers.";
+
+		unsynced_bytes_ = 0;
+		++syncs_;
+	}
+
+	void seek(HANDLE handle, int64_t offset)
+	{
+		LARGE_INTEGER position;
+		position.QuadPart = offset;
+
+		if(!SetFilePointerEx(handle, position, nullptr, FILE_BEGIN))
+			BOOST_THROW_EXCEPTION(io_error() << msg_info(narrow(print()) + " Could not seek.") << boost::errinfo_api_function("SetFilePointerEx"));
+	}
+
+	void write_file(HANDLE handle, const uint8_t* data, size_t size)
+	{
+		boost::timer write_timer;
+
+		DWORD written = 0;
+		if(!WriteFile(handle, data, static_cast<DWORD>(size), &written, nullptr) || written != size)
+			BOOST_THROW_EXCEPTION(io_error() << msg_info(narrow(print()) + " Could not write.") << boost::errinfo_api_function("WriteFile"));
+
+		const auto micros = static_cast<int64_t>(write_timer.elapsed() * 1000000.0);
+		write_micros_ += micros;
+		
+		for(int64_t max = max_write_micros_; micros > max; max = max_write_micros_)
+			max_write_micros_.compare_and_swap(micros, max);
+
+		written_bytes_ += size;
+		++writes_;
+
+		unsynced_bytes_ += size;
+		if(sync_interval_ > 0 && unsynced_bytes_ >= sync_interval_)
+			sync();
+
+		if(throttle_ > 0)
+		{
+			throttled_bytes_ += size;
+			
+			const auto ahead = static_cast<double>(throttled_bytes_) / throttle_ - throttle_timer_.elapsed();
+			if(ahead > 0.0)
+				boost::this_thread::sleep(boost::posix_time::milliseconds(static_cast<int64_t>(ahead * 1000.0)));
+		}
+	}
+
+	double fill() const
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		return static_cast<double>(queued_bytes_) / static_cast<double>(capacity_);
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		const auto elapsed = timer_.elapsed();
+
+		boost::property_tree::wptree info;
+		info.add(L"path",					path_);
+		info.add(L"direct",					direct_);
+		info.add(L"buffer.capacity",		capacity_);
+		info.add(L"buffer.fill",			fill());
+		info.add(L"buffer.full-waits",		static_cast<int64_t>(full_waits_));
+		info.add(L"written-bytes",			static_cast<int64_t>(written_bytes_));
+		info.add(L"throughput-mbps",		elapsed > 0.0 ? static_cast<double>(written_bytes_) * 8.0 / elapsed / 1000000.0 : 0.0);
+		info.add(L"write-time.mean-ms",		writes_ > 0 ? static_cast<double>(write_micros_) / writes_ / 1000.0 : 0.0);
+		info.add(L"write-time.max-ms",		static_cast<double>(max_write_micros_) / 1000.0);
+		info.add(L"syncs",					static_cast<int64_t>(syncs_));
+		info.add(L"failed",					static_cast<bool>(failed_));
+		return info;
+	}
+};
+
+file_writer::file_writer(const std::wstring& path, size_t buffer_size, bool direct, size_t sync_interval, size_t throttle) 
+	: impl_(new implementation(path, buffer_size, direct, sync_interval, throttle)){}
+file_writer::~file_writer(){}
+bool file_writer::write(int64_t offset, const uint8_t* data, size_t size){return impl_->write(offset, data, size);}
+void file_writer::close(){impl_->close();}
+bool file_writer::finished() const{return impl_->finished_;}
+void file_writer::wait(){impl_->wait();}
+double file_writer::fill() const{return impl_->fill();}
+boost::property_tree::wptree file_writer::info() const{return impl_->info();}
+
+}}
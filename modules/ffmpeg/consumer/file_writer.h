@@ -0,0 +1,60 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace caspar { namespace ffmpeg {
+
+// Writes a file on its own thread through a write-behind buffer, so that the muxer only blocks 
+// when the buffer is full. Writes may target any offset, as muxers seek back to patch headers.
+class file_writer : boost::noncopyable
+{
+public:
+
+	// direct:			Unbuffered, sector aligned writes that bypass the system cache.
+	// sync_interval:	Bytes between flushes to disk, 0 only flushes when closing.
+	// throttle:		Bytes per second, 0 for unlimited. For testing slow disks.
+	file_writer(const std::wstring& path, size_t buffer_size, bool direct, size_t sync_interval, size_t throttle);
+	~file_writer();
+
+	// Returns false if the writer has failed.
+	bool write(int64_t offset, const uint8_t* data, size_t size);
+
+	// Writes the remaining data and closes the file without waiting for it.
+	void close();
+	bool finished() const;
+	void wait();
+
+	double fill() const;
+	boost::property_tree::wptree info() const;
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}
@@ -0,0 +1,167 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "replay_buffer.h"
+
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
+#include <map>
+
+namespace caspar { namespace ffmpeg {
+
+struct replay_buffer::implementation : boost::noncopyable
+{
+	const std::wstring									name_;
+	const core::video_format_desc						format_desc_;
+	const core::channel_layout							channel_layout_;
+	const size_t										capacity_;
+
+	mutable boost::mutex								mutex_;
+	std::deque<std::shared_ptr<const replay_frame>>		frames_;
+	int64_t												bytes_;
+	int64_t												dropped_frames_;
+
+	implementation(const std::wstring& name, const core::video_format_desc& format_desc, const core::channel_layout& channel_layout, size_t capacity)
+		: name_(name)
+		, format_desc_(format_desc)
+		, channel_layout_(channel_layout)
+		, capacity_(std::max<size_t>(capacity, 1))
+		, bytes_(0)
+		, dropped_frames_(0)
+	{
+	}
+
+	static int64_t size_of(const replay_frame& frame)
+	{
+		return frame.video.size() + frame.audio.size() * sizeof(int32_t);
+	}
+
+	void push(const std::shared_ptr<const replay_frame>& frame)
+	{
+		std::shared_ptr<const replay_frame> dropped; // Freed outside of the lock.
+
+		boost::mutex::scoped_lock lock(mutex_);
+
+		// Frames are numbered consecutively, which allows them to be looked up by index.
+		if(!frames_.empty() && frame->number != frames_.back()->number + 1)
+		{
+			frames_.clear();
+			bytes_ = 0;
+		}
+
+		if(frames_.size() >= capacity_)
+		{
+			dropped = frames_.front();
+			frames_.pop_front();
+			bytes_ -= size_of(*dropped);
+			++dropped_frames_;
+		}
+
+		frames_.push_back(frame);
+		bytes_ += size_of(*frame);
+	}
+
+	std::shared_ptr<const replay_frame> get(int64_t number) const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		if(frames_.empty() || number < frames_.front()->number || number > frames_.back()->number)
+			return nullptr;
+
+		return frames_[static_cast<size_t>(number - frames_.front()->number)];
+	}
+
+	int64_t first() const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		return frames_.empty() ? 0 : frames_.front()->number;
+	}
+
+	int64_t last() const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		return frames_.empty() ? -1 : frames_.back()->number;
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		boost::property_tree::wptree info;
+		info.add(L"name",				name_);
+		info.add(L"capacity",			capacity_);
+		info.add(L"frames",				frames_.size());
+		info.add(L"first",				frames_.empty() ? 0 : frames_.front()->number);
+		info.add(L"last",				frames_.empty() ? -1 : frames_.back()->number);
+		info.add(L"seconds",			frames_.size() / format_desc_.fps);
+		info.add(L"bytes",				bytes_);
+		info.add(L"dropped-frames",		dropped_frames_);
+		return info;
+	}
+};
+
+replay_buffer::replay_buffer(const std::wstring& name, const core::video_format_desc& format_desc, const core::channel_layout& channel_layout, size_t capacity)
+	: impl_(new implementation(name, format_desc, channel_layout, capacity)){}
+void replay_buffer::push(const std::shared_ptr<const replay_frame>& frame){impl_->push(frame);}
+std::shared_ptr<const replay_frame> replay_buffer::get(int64_t number) const{return impl_->get(number);}
+int64_t replay_buffer::first() const{return impl_->first();}
+int64_t replay_buffer::last() const{return impl_->last();}
+const std::wstring& replay_buffer::name() const{return impl_->name_;}
+const core::video_format_desc& replay_buffer::format_desc() const{return impl_->format_desc_;}
+const core::channel_layout& replay_buffer::channel_layout() const{return impl_->channel_layout_;}
+boost::property_tree::wptree replay_buffer::info() const{return impl_->info();}
+
+static boost::mutex& registry_mutex()
+{
+	static boost::mutex mutex;
+	return mutex;
+}
+
+static std::map<std::wstring, std::weak_ptr<replay_buffer>>& registry()
+{
+	static std::map<std::wstring, std::weak_ptr<replay_buffer>> buffers;
+	return buffers;
+}
+
+void register_replay_buffer(const std::shared_ptr<replay_buffer>& buffer)
+{
+	boost::mutex::scoped_lock lock(registry_mutex());
+	registry()[buffer->name()] = buffer;
+}
+
+std::shared_ptr<replay_buffer> find_replay_buffer(const std::wstring& name)
+{
+	boost::mutex::scoped_lock lock(registry_mutex());
+
+	auto it = registry().find(name);
+	if(it == registry().end())
+		return nullptr;
+
+	auto buffer = it->second.lock();
+	if(!buffer)
+		registry().erase(it);
+
+	return buffer;
+}
+
+}}
@@ -0,0 +1,81 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <core/video_format.h>
+#include <core/mixer/audio/audio_mixer.h>
+#include <core/mixer/audio/audio_util.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace ffmpeg {
+
+// One channel frame with its picture compressed on its own, so that it can be decoded without 
+// its neighbours.
+struct replay_frame
+{
+	int64_t					number;
+	std::vector<uint8_t>	video;		// Followed by zeroed padding for the decoder.
+	size_t					video_size;	// Without the padding.
+	core::audio_buffer		audio;
+	core::field_mode::type	mode;
+};
+
+// The last frames of a channel, kept in memory. Written by the replay consumer and read by 
+// any number of replay producers. The oldest frame is dropped when the buffer is full.
+class replay_buffer : boost::noncopyable
+{
+public:
+	replay_buffer(const std::wstring& name, const core::video_format_desc& format_desc, const core::channel_layout& channel_layout, size_t capacity);
+
+	void push(const std::shared_ptr<const replay_frame>& frame);
+
+	// Returns nullptr if the frame has been dropped, or not yet been recorded.
+	std::shared_ptr<const replay_frame> get(int64_t number) const;
+
+	// The oldest and newest frame numbers. last() is -1 while the buffer is empty.
+	int64_t first() const;
+	int64_t last() const;
+
+	const std::wstring& name() const;
+	const core::video_format_desc& format_desc() const;
+	const core::channel_layout& channel_layout() const;
+
+	boost::property_tree::wptree info() const;
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+// Buffers are found by name for as long as their consumer is alive. A new buffer replaces an older one 
+// of the same name, and producers keep playing from the buffer they started with.
+void register_replay_buffer(const std::shared_ptr<replay_buffer>& buffer);
+std::shared_ptr<replay_buffer> find_replay_buffer(const std::wstring& name);
+
+}}
@@ -0,0 +1,323 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "replay_consumer.h"
+#include "replay_buffer.h"
+
+#include "../ffmpeg_error.h"
+#include "../producer/util/util.h"
+
+#include <core/consumer/frame_consumer.h>
+#include <core/mixer/read_frame.h>
+#include <core/mixer/audio/audio_util.h>
+#include <core/parameters/parameters.h>
+#include <core/video_format.h>
+
+#include <common/concurrency/executor.h>
+#include <common/concurrency/future_util.h>
+#include <common/diagnostics/graph.h>
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread.hpp>
+#include <boost/timer.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/spin_mutex.h>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C" 
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavcodec/avcodec.h>
+	#include <libswscale/swscale.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+static const size_t ENCODE_QUEUE_CAPACITY = 4;
+
+// Encodes every frame of a channel as a JPEG picture into a replay buffer, keeping the audio 
+// uncompressed. Frames are dropped rather than delaying the channel when the encoder falls behind.
+struct replay_consumer : public core::frame_consumer
+{
+	const std::wstring						name_;
+	const int								seconds_;
+	const int								quality_;
+	core::video_format_desc					format_desc_;
+
+	const safe_ptr<diagnostics::graph>		graph_;
+	tbb::atomic<int64_t>					current_encoding_delay_;
+	tbb::atomic<int64_t>					dropped_frames_;
+
+	std::shared_ptr<replay_buffer>			buffer_;
+	mutable tbb::spin_mutex					buffer_mutex_;	// Guards buffer_ for info().
+	std::shared_ptr<AVCodecContext>			encoder_;
+	std::shared_ptr<SwsContext>				sws_;
+	std::shared_ptr<AVFrame>				picture_;
+	std::vector<uint8_t>					picture_buf_;
+	int64_t									frame_number_;
+
+	executor								executor_;
+public:
+	replay_consumer(const std::wstring& name, int seconds, int quality)
+		: name_(name)
+		, seconds_(seconds)
+		, quality_(quality)
+		, frame_number_(0)
+		, executor_(L"replay_consumer[" + name + L"]")
+	{
+		current_encoding_delay_ = 0;
+		dropped_frames_			= 0;
+
+		executor_.set_capacity(ENCODE_QUEUE_CAPACITY);
+
+		graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
+		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
+		graph_->set_color("encode-queue", diagnostics::color(1.0f, 1.0f, 0.0f));
+		graph_->set_text(print());
+		diagnostics::register_graph(graph_);
+	}
+
+	~replay_consumer()
+	{
+		executor_.stop();
+		executor_.join();
+	}
+
+	// frame_consumer
+
+	virtual void initialize(const core::video_format_desc& format_desc, int) override
+	{
+		executor_.invoke([=]
+		{
+			format_desc_ = format_desc;
+
+			// The buffer is created with the first frame, once the channel layout is known.
+			set_buffer(nullptr);
+			encoder_.reset();
+			sws_.reset();
+			frame_number_ = 0;
+		});
+	}
+
+	virtual boost::unique_future<bool> send(const safe_ptr<core::read_frame>& frame) override
+	{
+		if(executor_.size() >= executor_.capacity())
+		{
+			++dropped_frames_;
+			graph_->set_tag("dropped-frame");
+		}
+		else
+		{
+			executor_.begin_invoke([=]
+			{
+				try
+				{
+					encode(frame);
+				}
+				catch(...)
+				{
+					CASPAR_LOG_CURRENT_EXCEPTION();
+				}
+			});
+		}
+
+		graph_->set_value("encode-queue", static_cast<double>(executor_.size()) / ENCODE_QUEUE_CAPACITY);
+
+		return wrap_as_future(true);
+	}
+
+	virtual int64_t presentation_frame_age_millis() const override
+	{
+		return current_encoding_delay_;
+	}
+
+	virtual std::wstring print() const override
+	{
+		return L"replay_consumer[" + name_ + L"]";
+	}
+
+	virtual boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type", L"replay-consumer");
+		info.add(L"name", name_);
+		info.add(L"quality", quality_);
+		info.add(L"dropped-frames", static_cast<int64_t>(dropped_frames_));
+
+		auto buffer = get_buffer();
+		if(buffer)
+			info.add_child(L"buffer", buffer->info());
+
+		return info;
+	}
+
+	virtual bool has_synchronization_clock() const override
+	{
+		return false;
+	}
+
+	virtual size_t buffer_depth() const override
+	{
+		return 1;
+	}
+
+	virtual int index() const override
+	{
+		return 300;
+	}
+private:
+	std::shared_ptr<replay_buffer> get_buffer() const
+	{
+		tbb::spin_mutex::scoped_lock lock(buffer_mutex_);
+		return buffer_;
+	}
+
+	void set_buffer(const std::shared_ptr<replay_buffer>& buffer)
+	{
+		tbb::spin_mutex::scoped_lock lock(buffer_mutex_);
+		buffer_ = buffer;
+	}
+
+	void open(const core::read_frame& frame)
+	{
+		const int width		= static_cast<int>(format_desc_.width);
+		const int height	= static_cast<int>(format_desc_.height);
+
+		auto encoder = avcodec_find_encoder(CODEC_ID_MJPEG);
+		if(!encoder)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Codec not found."));
+
+		encoder_.reset(avcodec_alloc_context3(encoder), [](AVCodecContext* c)
+		{
+			LOG_ON_ERROR2(avcodec_close(c), "[replay_consumer]");
+			av_free(c);
+		});
+
+		auto c = encoder_.get();
+		c->width			= width;
+		c->height			= height;
+		c->time_base.num	= format_desc_.duration;
+		c->time_base.den	= format_desc_.time_scale;
+		c->pix_fmt			= PIX_FMT_YUVJ422P; // Holds studio swing yuv422p, which the mixer takes without conversion.
+		c->flags		   |= CODEC_FLAG_QSCALE;
+		c->global_quality	= FF_QP2LAMBDA * quality_;
+		c->thread_count		= boost::thread::hardware_concurrency();
+		c->thread_type		= FF_THREAD_SLICE;
+
+		if(avcodec_open2(c, encoder, nullptr) < 0)
+		{
+			c->thread_count = 1;
+			THROW_ON_ERROR2(avcodec_open2(c, encoder, nullptr), "[replay_consumer]");
+		}
+
+		sws_.reset(sws_getContext(width, height, PIX_FMT_BGRA, width, height, PIX_FMT_YUV422P, SWS_POINT, nullptr, nullptr, nullptr), sws_freeContext);
+		if(!sws_)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Cannot initialize the conversion context"));
+
+		picture_.reset(avcodec_alloc_frame(), av_free);
+		picture_buf_.resize(avpicture_get_size(PIX_FMT_YUV422P, width, height));
+		avpicture_fill(reinterpret_cast<AVPicture*>(picture_.get()), picture_buf_.data(), PIX_FMT_YUV422P, width, height);
+
+		const auto capacity = static_cast<size_t>(seconds_ * format_desc_.fps);
+
+		auto buffer = std::make_shared<replay_buffer>(name_, format_desc_, frame.multichannel_view().channel_layout(), capacity);
+		register_replay_buffer(buffer);
+		set_buffer(buffer);
+
+		CASPAR_LOG(info) << print() << L" Buffering " << capacity << L" frames.";
+	}
+
+	void encode(const safe_ptr<core::read_frame>& frame)
+	{
+		if(!buffer_)
+			open(*frame);
+
+		boost::timer frame_timer;
+
+		const uint8_t*	source[]		= {frame->image_data().begin(), nullptr, nullptr, nullptr};
+		const int		source_stride[]	= {static_cast<int>(format_desc_.width) * 4, 0, 0, 0};
+
+		sws_scale(sws_.get(), source, source_stride, 0, format_desc_.height, picture_->data, picture_->linesize);
+
+		picture_->pts		= frame_number_;
+		picture_->quality	= encoder_->global_quality;
+
+		auto pkt = create_packet();
+		int got_packet = 0;
+
+		THROW_ON_ERROR2(avcodec_encode_video2(encoder_.get(), pkt.get(), picture_.get(), &got_packet), "[replay_consumer]");
+
+		if(!got_packet)
+			return;
+
+		auto replay = std::make_shared<replay_frame>();
+		replay->number		= frame_number_++;
+		replay->video_size	= pkt->size;
+		replay->video.resize(pkt->size + FF_INPUT_BUFFER_PADDING_SIZE, 0);
+		std::copy(pkt->data, pkt->data + pkt->size, replay->video.begin());
+		replay->audio.assign(frame->audio_data().begin(), frame->audio_data().end());
+		replay->mode		= format_desc_.field_mode;
+
+		buffer_->push(replay);
+
+		current_encoding_delay_ = frame->get_age_millis();
+		graph_->set_value("frame-time", frame_timer.elapsed()*format_desc_.fps*0.5);
+	}
+};
+
+safe_ptr<core::frame_consumer> create_replay_consumer(const core::parameters& params)
+{
+	if(params.size() < 2 || params[0] != L"REPLAY")
+		return core::frame_consumer::empty();
+
+	auto name		= params[1];
+	auto seconds	= params.get(L"SECONDS", 60);
+	auto quality	= params.get(L"QUALITY", 4);
+
+	if(seconds < 1 || quality < 1 || quality > 31)
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("SECONDS must be positive and QUALITY between 1 and 31."));
+
+	return make_safe<replay_consumer>(name, seconds, quality);
+}
+
+safe_ptr<core::frame_consumer> create_replay_consumer(const boost::property_tree::wptree& ptree)
+{
+	auto name		= boost::to_upper_copy(ptree.get<std::wstring>(L"name"));
+	auto seconds	= ptree.get(L"seconds", 60);
+	auto quality	= ptree.get(L"quality", 4);
+
+	return make_safe<replay_consumer>(name, std::max(seconds, 1), std::max(1, std::min(quality, 31)));
+}
+
+}}
@@ -22,7 +22,10 @@
 #include "StdAfx.h"
 
 #include "consumer/ffmpeg_consumer.h"
+#include "consumer/replay_consumer.h"
 #include "producer/ffmpeg_producer.h"
+#include "producer/replay/replay_producer.h"
+#include "producer/filter/filter.h"
 #include "producer/util/util.h"
 
 #include <common/log/log.h>
@@ -254,6 +257,8 @@ void init(const safe_ptr<core::media_info_repository>& media_info_repo)
     avformat_network_init();
 	
 	core::register_consumer_factory([](const core::parameters& params){return ffmpeg::create_consumer(params);});
+	core::register_consumer_factory([](const core::parameters& params){return ffmpeg::create_replay_consumer(params);});
+	core::register_producer_factory(create_replay_producer);
 	core::register_producer_factory(create_producer);
 	core::register_thumbnail_producer_factory(create_thumbnail_producer);
 
@@ -268,6 +273,7 @@ void init(const safe_ptr<core::media_info_repository>& media_info_repo)
 
 void uninit()
 {
+	clear_filter_pool();
 	avfilter_uninit();
     avformat_network_deinit();
 	av_lockmgr_register(nullptr);
@@ -27,15 +27,15 @@
 #include "../ffmpeg_error.h"
 #include "../ffmpeg_params.h"
 
+#include "input/frame_extractor.h"
 #include "muxer/frame_muxer.h"
-#include "input/input.h"
+#include "shared/shared_decoder.h"
 #include "util/util.h"
-#include "audio/audio_decoder.h"
-#include "video/video_decoder.h"
 
 #include <common/env.h>
 #include <common/utility/assert.h>
 #include <common/diagnostics/graph.h>
+#include <common/concurrency/executor.h>
 
 #include <core/monitor/monitor.h>
 #include <core/video_format.h>
@@ -53,7 +53,11 @@
 #include <boost/range/algorithm/find_if.hpp>
 #include <boost/range/algorithm/find.hpp>
 #include <boost/regex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
 #include <tbb/parallel_invoke.h>
 
 #include <limits>
@@ -86,6 +90,70 @@ std::wstring get_relative_or_original(
 
 	return result;
 }
+
+// Memory shared by all producers for frames decoded ahead while waiting in background.
+class preroll_budget : boost::noncopyable
+{
+	const int64_t				capacity_;
+	int64_t						used_;
+	boost::mutex				mutex_;
+	boost::condition_variable	released_;
+
+	preroll_budget()
+		: capacity_(static_cast<int64_t>(env::properties().get(L"configuration.ffmpeg.preroll-budget-mb", 256)) * 1024 * 1024)
+		, used_(0)
+	{
+	}
+public:
+	static preroll_budget& instance()
+	{
+		static preroll_budget budget;
+		return budget;
+	}
+
+	// Waits until the bytes fit, or abort is set. Fails at once if they never can.
+	bool reserve(int64_t bytes, const tbb::atomic<bool>& abort)
+	{
+		if(bytes > capacity_)
+			return false;
+
+		boost::unique_lock<boost::mutex> lock(mutex_);
+
+		while(used_ + bytes > capacity_)
+		{
+			if(abort)
+				return false;
+
+			released_.timed_wait(lock, boost::posix_time::milliseconds(100));
+		}
+
+		used_ += bytes;
+
+		return true;
+	}
+
+	// For frames that were decoded beyond what was reserved. They are paid for even if 
+	// the budget is exceeded, and the next reservation waits until it is back within it.
+	void charge(int64_t bytes)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		used_ += bytes;
+	}
+
+	// Also wakes the prerolls that are waiting, e.g. to let them see that they have been aborted.
+	void release(int64_t bytes)
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			used_ -= bytes;
+		}
+
+		released_.notify_all();
+	}
+};
+
+// Most decode steps yield one frame, and two when fields are split into frames.
+static const uint32_t PREROLL_FRAMES_PER_DECODE = 2;
 				
 struct ffmpeg_producer : public core::frame_producer
 {
@@ -97,15 +165,16 @@ struct ffmpeg_producer : public core::frame_producer
 	
 	const safe_ptr<diagnostics::graph>							graph_;
 	boost::timer												frame_timer_;
+	boost::timer												first_frame_timer_;	// Started by the first receive, so a clip loaded in the background is not charged for its wait.
+	double														first_frame_latency_;
+	bool														received_;
 					
 	const safe_ptr<core::frame_factory>							frame_factory_;
 	const core::video_format_desc								format_desc_;
 
 	std::shared_ptr<void>										initial_logger_disabler_;
 
-	input														input_;	
-	std::unique_ptr<video_decoder>								video_decoder_;
-	std::unique_ptr<audio_decoder>								audio_decoder_;	
+	shared_decoder												decoder_;
 	std::unique_ptr<frame_muxer>								muxer_;
 
 	const double												fps_;
@@ -119,6 +188,16 @@ struct ffmpeg_producer : public core::frame_producer
 
 	int64_t														frame_number_;
 	uint32_t													file_frame_number_;
+
+	tbb::mutex													decode_mutex_;
+	const uint32_t												preroll_target_;
+	int64_t														preroll_frame_size_;
+	tbb::atomic<uint32_t>										prerolled_frames_;
+	tbb::atomic<uint32_t>										reserved_frames_;
+	tbb::atomic<bool>											preroll_started_;
+	tbb::atomic<bool>											preroll_ready_;
+	tbb::atomic<bool>											preroll_abort_;
+	std::unique_ptr<executor>									preroll_executor_;
 		
 public:
 	explicit ffmpeg_producer(const safe_ptr<core::frame_factory>& frame_factory, const std::wstring& filename, FFMPEG_Resource resource_type, const std::wstring& filter, bool loop, uint32_t start, uint32_t length, bool thumbnail_mode, const std::wstring& custom_channel_order, const ffmpeg_producer_params& vid_params)
@@ -128,62 +207,59 @@ public:
 		, frame_factory_(frame_factory)		
 		, format_desc_(frame_factory->get_video_format_desc())
 		, initial_logger_disabler_(temporary_disable_logging_for_thread(thumbnail_mode))
-		, input_(graph_, filename_, resource_type, loop, start, length, thumbnail_mode, vid_params)
-		, fps_(read_fps(*input_.context(), format_desc_.fps))
+		, decoder_(graph_, filename_, resource_type, loop, start, length, thumbnail_mode, vid_params, format_desc_, custom_channel_order)
+		, fps_(read_fps(*decoder_.context(), format_desc_.fps))
 		, start_(start)
 		, length_(length)
 		, thumbnail_mode_(thumbnail_mode)
 		, last_frame_(core::basic_frame::empty())
 		, frame_number_(0)
+		, first_frame_latency_(-1.0)
+		, received_(false)
+		, preroll_target_(thumbnail_mode || resource_type != FFMPEG_FILE ? 0 : env::properties().get(L"configuration.ffmpeg.preroll-frames", 8))
 	{
+		prerolled_frames_	= 0;
+		reserved_frames_	= 0;
+		preroll_started_	= false;
+		preroll_ready_		= false;
+		preroll_abort_		= false;
+
 		graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
 		graph_->set_color("underflow", diagnostics::color(0.6f, 0.3f, 0.9f));	
 		diagnostics::register_graph(graph_);
 	
-		try
-		{
-			video_decoder_.reset(new video_decoder(input_.context()));
-			if (!thumbnail_mode_)
-				CASPAR_LOG(info) << print() << L" " << video_decoder_->print();
-		}
-		catch(averror_stream_not_found&)
-		{
-			//CASPAR_LOG(warning) << print() << " No video-stream found. Running without video.";	
-		}
-		catch(...)
-		{
-			if (!thumbnail_mode_)
-			{
-				CASPAR_LOG_CURRENT_EXCEPTION();
-				CASPAR_LOG(warning) << print() << "Failed to open video-stream. Running without video.";	
-			}
-		}
+		if(decoder_.has_video() && !thumbnail_mode_)
+			CASPAR_LOG(info) << print() << L" " << decoder_.print_video();
 
 		core::channel_layout audio_channel_layout = core::default_channel_layout_repository().get_by_name(L"STEREO");
 
-		if (!thumbnail_mode_)
+		if(decoder_.has_audio())
 		{
-			try
-			{
-				audio_decoder_.reset(new audio_decoder(input_.context(), frame_factory->get_video_format_desc(), custom_channel_order));
-				audio_channel_layout = audio_decoder_->channel_layout();
-				CASPAR_LOG(info) << print() << L" " << audio_decoder_->print();
-			}
-			catch(averror_stream_not_found&)
-			{
-				//CASPAR_LOG(warning) << print() << " No audio-stream found. Running without audio.";	
-			}
-			catch(...)
-			{
-				CASPAR_LOG_CURRENT_EXCEPTION();
-				CASPAR_LOG(warning) << print() << " Failed to open audio-stream. Running without audio.";		
-			}
+			audio_channel_layout = decoder_.channel_layout();
+			CASPAR_LOG(info) << print() << L" " << decoder_.print_audio();
 		}
 
-		if(!video_decoder_ && !audio_decoder_)
-			BOOST_THROW_EXCEPTION(averror_stream_not_found() << msg_info("No streams found"));
+		if(decoder_.subscribers() > 1)
+			CASPAR_LOG(info) << print() << L" Sharing decoding with " << decoder_.subscribers() - 1 << L" other producer(s).";
 
 		muxer_.reset(new frame_muxer(fps_, frame_factory, thumbnail_mode_, audio_channel_layout, filter));
+
+		preroll_frame_size_ = (decoder_.has_video() ? decoder_.width() * decoder_.height() * 4 : 0)
+							+ format_desc_.audio_cadence.front() * audio_channel_layout.num_channels * sizeof(int32_t);
+	}
+
+	~ffmpeg_producer()
+	{
+		preroll_abort_ = true;
+
+		if(preroll_executor_)
+		{
+			preroll_executor_->clear(); // Drops a preroll that has not started yet.
+			preroll_budget::instance().release(0);
+			preroll_executor_.reset(); // A running preroll stops after its current decode step.
+		}
+
+		preroll_budget::instance().release(reserved_frames_ * preroll_frame_size_);
 	}
 
 	// frame_producer
@@ -198,10 +274,46 @@ public:
 		return disable_audio(last_frame_);
 	}
 
+	virtual void begin_preroll(int hints) override
+	{
+		if(preroll_target_ == 0 || preroll_started_.fetch_and_store(true))
+			return;
+
+		// Every producer prerolls on a thread of its own, so that only the budget limits how many prerolls run at once.
+		preroll_executor_.reset(new executor(L"preroll"));
+		preroll_executor_->set_priority_class(below_normal_priority_class);
+		preroll_executor_->begin_invoke([=]
+		{
+			try
+			{
+				do_preroll(hints);
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+		});
+	}
+
+	virtual bool is_prerolled() const override
+	{
+		return preroll_target_ == 0 || preroll_ready_;
+	}
+
 	std::pair<safe_ptr<core::basic_frame>, uint32_t> render_frame(int hints)
 	{		
 		frame_timer_.restart();
 		auto disable_logging = temporary_disable_logging_for_thread(thumbnail_mode_);
+
+		if(!received_)
+		{
+			received_ = true;
+			first_frame_timer_.restart();
+		}
+
+		preroll_abort_ = true;
+
+		tbb::mutex::scoped_lock lock(decode_mutex_);
 				
 		for(int n = 0; n < 16 && frame_buffer_.size() < 2; ++n)
 			try_decode_frame(hints);
@@ -210,7 +322,7 @@ public:
 
 		if (frame_buffer_.empty())
 		{
-			if (input_.eof())
+			if (decoder_.eof())
 			{
 				send_osc();
 				return std::make_pair(last_frame(), -1);
@@ -230,6 +342,20 @@ public:
 		
 		auto frame = frame_buffer_.front(); 
 		frame_buffer_.pop();
+
+		if(reserved_frames_ > 0)
+		{
+			--reserved_frames_;
+			preroll_budget::instance().release(preroll_frame_size_);
+		}
+
+		if(first_frame_latency_ < 0.0)
+		{
+			first_frame_latency_ = first_frame_timer_.elapsed();
+
+			if (!thumbnail_mode_)
+				CASPAR_LOG(debug) << print() << L" First frame after " << static_cast<int>(first_frame_latency_ * 1000.0) << L" ms.";
+		}
 		
 		++frame_number_;
 		file_frame_number_ = frame.second;
@@ -253,111 +379,18 @@ public:
 																			% static_cast<int32_t>(file_nb_frames())
 							<< core::monitor::message("/file/fps")			% fps_
 							<< core::monitor::message("/file/path")			% path_relative_to_media_
-							<< core::monitor::message("/loop")				% input_.loop();
-	}
-	
-	safe_ptr<core::basic_frame> render_specific_frame(uint32_t file_position, int hints)
-	{
-		// Some trial and error and undeterministic stuff here
-		static const int NUM_RETRIES = 32;
-		
-		if (file_position > 0) // Assume frames are requested in sequential order,
-			                   // therefore no seeking should be necessary for the first frame.
-		{
-			input_.seek(file_position > 1 ? file_position - 2: file_position).get();
-			boost::this_thread::sleep(boost::posix_time::milliseconds(40));
-		}
-
-		for (int i = 0; i < NUM_RETRIES; ++i)
-		{
-			boost::this_thread::sleep(boost::posix_time::milliseconds(40));
-		
-			auto frame = render_frame(hints);
-
-			if (frame.second == std::numeric_limits<uint32_t>::max())
-			{
-				// Retry
-				continue;
-			}
-			else if (frame.second == file_position + 1 || frame.second == file_position)
-				return frame.first;
-			else if (frame.second > file_position + 1)
-			{
-				CASPAR_LOG(trace) << print() << L" " << frame.second << L" received, wanted " << file_position + 1;
-				int64_t adjusted_seek = file_position - (frame.second - file_position + 1);
-
-				if (adjusted_seek > 1 && file_position > 0)
-				{
-					CASPAR_LOG(trace) << print() << L" adjusting to " << adjusted_seek;
-					input_.seek(static_cast<uint32_t>(adjusted_seek) - 1).get();
-					boost::this_thread::sleep(boost::posix_time::milliseconds(40));
-				}
-				else
-					return frame.first;
-			}
-		}
-
-		CASPAR_LOG(trace) << print() << " Giving up finding frame at " << file_position;
-		return core::basic_frame::empty();
-	}
-
-	virtual safe_ptr<core::basic_frame> create_thumbnail_frame() override
-	{
-		auto disable_logging = temporary_disable_logging_for_thread(thumbnail_mode_);
-
-		auto total_frames = nb_frames();
-		auto grid = env::properties().get(L"configuration.thumbnails.video-grid", 2);
-
-		if (grid < 1)
-		{
-			CASPAR_LOG(error) << L"configuration/thumbnails/video-grid cannot be less than 1";
-			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("configuration/thumbnails/video-grid cannot be less than 1"));
-		}
-
-		if (grid == 1)
-		{
-			return render_specific_frame(total_frames / 2, 0/*DEINTERLACE_HINT*/);
-		}
-
-		auto num_snapshots = grid * grid;
-
-		std::vector<safe_ptr<core::basic_frame>> frames;
-
-		for (int i = 0; i < num_snapshots; ++i)
-		{
-			int x = i % grid;
-			int y = i / grid;
-			int desired_frame;
-			
-			if (i == 0)
-				desired_frame = 0; // first
-			else if (i == num_snapshots - 1)
-				desired_frame = total_frames - 1; // last
-			else
-				// evenly distributed across the file.
-				desired_frame = total_frames * i / (num_snapshots - 1);
-
-			auto frame = render_specific_frame(desired_frame, 0/*DEINTERLACE_HINT*/);
-			frame->get_frame_transform().fill_scale[0] = 1.0 / static_cast<double>(grid);
-			frame->get_frame_transform().fill_scale[1] = 1.0 / static_cast<double>(grid);
-			frame->get_frame_transform().fill_translation[0] = 1.0 / static_cast<double>(grid) * x;
-			frame->get_frame_transform().fill_translation[1] = 1.0 / static_cast<double>(grid) * y;
-
-			frames.push_back(frame);
-		}
-
-		return make_safe<core::basic_frame>(frames);
+							<< core::monitor::message("/loop")				% decoder_.loop();
 	}
 	
 	uint32_t file_frame_number() const
 	{
-		return video_decoder_ ? video_decoder_->file_frame_number() : 0;
+		return decoder_.file_frame_number();
 	}
 
 	virtual uint32_t nb_frames() const override
 	{
 		//if(input_.loop())
-		if(resource_type_ == FFMPEG_DEVICE || resource_type_ == FFMPEG_STREAM || input_.loop()) 
+		if(resource_type_ == FFMPEG_DEVICE || resource_type_ == FFMPEG_STREAM || decoder_.loop()) 
 			return std::numeric_limits<uint32_t>::max();
 
 		uint32_t nb_frames = file_nb_frames();
@@ -370,10 +403,7 @@ public:
 
 	uint32_t file_nb_frames() const
 	{
-		uint32_t file_nb_frames = 0;
-		file_nb_frames = std::max(file_nb_frames, video_decoder_ ? video_decoder_->nb_frames() : 0);
-		file_nb_frames = std::max(file_nb_frames, audio_decoder_ ? audio_decoder_->nb_frames() : 0);
-		return file_nb_frames;
+		return decoder_.nb_frames();
 	}
 	
 	virtual boost::unique_future<std::wstring> call(const std::wstring& param) override
@@ -395,16 +425,22 @@ public:
 		boost::property_tree::wptree info;
 		info.add(L"type",				L"ffmpeg-producer");
 		info.add(L"filename",			filename_);
-		info.add(L"width",				video_decoder_ ? video_decoder_->width() : 0);
-		info.add(L"height",				video_decoder_ ? video_decoder_->height() : 0);
-		info.add(L"progressive",		video_decoder_ ? video_decoder_->is_progressive() : false);
+		info.add(L"width",				decoder_.has_video() ? decoder_.width() : 0);
+		info.add(L"height",				decoder_.has_video() ? decoder_.height() : 0);
+		info.add(L"progressive",		decoder_.has_video() ? decoder_.is_progressive() : false);
 		info.add(L"fps",				fps_);
-		info.add(L"loop",				input_.loop());
+		info.add(L"loop",				decoder_.loop());
 		info.add(L"frame-number",		frame_number_);
 		auto nb_frames2 = nb_frames();
 		info.add(L"nb-frames",			nb_frames2 == std::numeric_limits<int64_t>::max() ? -1 : nb_frames2);
 		info.add(L"file-frame-number",	file_frame_number_);
 		info.add(L"file-nb-frames",		file_nb_frames());
+		info.add(L"first-frame-latency",	first_frame_latency_ < 0.0 ? -1 : static_cast<int>(first_frame_latency_ * 1000.0));
+		info.add(L"decoder-subscribers",	decoder_.subscribers());
+		info.add(L"decode-time",			decoder_.decode_time() * 1000.0);
+		info.add(L"preroll.target",		preroll_target_);
+		info.add(L"preroll.frames",		static_cast<uint32_t>(prerolled_frames_));
+		info.add(L"preroll.ready",		is_prerolled());
 		return info;
 	}
 
@@ -412,7 +448,7 @@ public:
 
 	std::wstring print_mode() const
 	{
-		return video_decoder_ ? ffmpeg::print_mode(video_decoder_->width(), video_decoder_->height(), fps_, !video_decoder_->is_progressive()) : L"";
+		return decoder_.has_video() ? ffmpeg::print_mode(decoder_.width(), decoder_.height(), fps_, !decoder_.is_progressive()) : L"";
 	}
 					
 	std::wstring do_call(const std::wstring& param)
@@ -424,29 +460,100 @@ public:
 		if(boost::regex_match(param, what, loop_exp))
 		{
 			if(!what["VALUE"].str().empty())
-				input_.loop(boost::lexical_cast<bool>(what["VALUE"].str()));
-			return boost::lexical_cast<std::wstring>(input_.loop());
+				decoder_.loop(boost::lexical_cast<bool>(what["VALUE"].str()));
+			return boost::lexical_cast<std::wstring>(decoder_.loop());
 		}
 		if(boost::regex_match(param, what, seek_exp))
 		{
-			input_.seek(boost::lexical_cast<uint32_t>(what["VALUE"].str()));
+			decoder_.seek(boost::lexical_cast<uint32_t>(what["VALUE"].str()));
 			return L"";
 		}
 
 		BOOST_THROW_EXCEPTION(invalid_argument());
 	}
 
-	void try_decode_frame(int hints)
+	void do_preroll(int hints)
 	{
-		std::shared_ptr<AVPacket> pkt;
+		auto& budget = preroll_budget::instance();
+
+		boost::timer timer;
+		int idle = 0;
+
+		while(!preroll_abort_)
+		{
+			uint32_t missing = 0;
+
+			{
+				tbb::mutex::scoped_lock lock(decode_mutex_);
+
+				if(preroll_abort_)
+					break;
+
+				if(frame_buffer_.size() >= preroll_target_ || decoder_.eof())
+				{
+					preroll_ready_ = true;
+					break;
+				}
+
+				// The frames of a decode step are reserved before they are decoded.
+				const auto needed = static_cast<uint32_t>(frame_buffer_.size()) + PREROLL_FRAMES_PER_DECODE;
+
+				if(reserved_frames_ < needed)
+					missing = needed - reserved_frames_;
+				else
+				{
+					auto before = frame_buffer_.size();
+
+					try_decode_frame(hints);
+
+					if(frame_buffer_.size() > reserved_frames_)
+					{
+						const auto excess = static_cast<uint32_t>(frame_buffer_.size()) - reserved_frames_;
+						budget.charge(excess * preroll_frame_size_);
+						reserved_frames_ += excess;
+					}
+
+					prerolled_frames_ = static_cast<uint32_t>(frame_buffer_.size());
+
+					idle = frame_buffer_.size() > before ? 0 : idle + 1;
+				}
+			}
+
+			if(missing > 0)
+			{
+				// Waits outside of the decode lock, so that the producer can start playing meanwhile.
+				if(!budget.reserve(missing * preroll_frame_size_, preroll_abort_))
+				{
+					if(!preroll_abort_)
+						CASPAR_LOG(warning) << print() << L" Preroll budget is too small for " << missing << L" frames.";
+					break;
+				}
+
+				reserved_frames_ += missing;
+			}
+			else if(idle > 8) // Packets are read asynchronously, give the input a moment to catch up.
+				boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+		}
 
-		for(int n = 0; n < 32 && ((video_decoder_ && !video_decoder_->ready()) || (audio_decoder_ && !audio_decoder_->ready())) && input_.try_pop(pkt); ++n)
 		{
-			if(video_decoder_)
-				video_decoder_->push(pkt);
-			if(audio_decoder_)
-				audio_decoder_->push(pkt);
+			tbb::mutex::scoped_lock lock(decode_mutex_);
+
+			// Only the decoded frames stay charged, until they are played.
+			if(reserved_frames_ > frame_buffer_.size())
+			{
+				const auto surplus = reserved_frames_ - static_cast<uint32_t>(frame_buffer_.size());
+				reserved_frames_ -= surplus;
+				budget.release(surplus * preroll_frame_size_);
+			}
 		}
+
+		if(preroll_ready_)
+			CASPAR_LOG(debug) << print() << L" Prerolled " << static_cast<uint32_t>(prerolled_frames_) << L" frames in " << static_cast<int>(timer.elapsed() * 1000.0) << L" ms.";
+	}
+
+	void try_decode_frame(int hints)
+	{
+		decoder_.pump();
 		
 		std::shared_ptr<AVFrame>			video;
 		std::shared_ptr<core::audio_buffer> audio;
@@ -454,19 +561,19 @@ public:
 		tbb::parallel_invoke(
 		[&]
 		{
-			if(!muxer_->video_ready() && video_decoder_)	
-				video = video_decoder_->poll();	
+			if(!muxer_->video_ready() && decoder_.has_video())	
+				video = decoder_.poll_video();	
 		},
 		[&]
 		{		
-			if(!muxer_->audio_ready() && audio_decoder_)
-				audio = audio_decoder_->poll();
+			if(!muxer_->audio_ready() && decoder_.has_audio())
+				audio = decoder_.poll_audio();
 		});
 		
 		muxer_->push(video, hints);
 		muxer_->push(audio);
 
-		if(!audio_decoder_)
+		if(!decoder_.has_audio())
 		{
 			if(video == flush_video())
 				muxer_->push(flush_audio());
@@ -474,7 +581,7 @@ public:
 				muxer_->push(empty_audio());
 		}
 
-		if(!video_decoder_)
+		if(!decoder_.has_video())
 		{
 			if(audio == flush_audio())
 				muxer_->push(flush_video(), 0);
@@ -482,9 +589,7 @@ public:
 				muxer_->push(empty_video(), 0);
 		}
 		
-		size_t file_frame_number = 0;
-		file_frame_number = std::max(file_frame_number, video_decoder_ ? video_decoder_->file_frame_number() : 0);
-		//file_frame_number = std::max(file_frame_number, audio_decoder_ ? audio_decoder_->file_frame_number() : 0);
+		size_t file_frame_number = decoder_.file_frame_number();
 
 		for(auto frame = muxer_->poll(); frame; frame = muxer_->poll())
 			frame_buffer_.push(std::make_pair(make_safe_ptr(frame), file_frame_number));
@@ -496,6 +601,126 @@ public:
 	}
 };
 
+// Decodes the frames of thumbnails synchronously on the thumbnail generator thread.
+struct ffmpeg_thumbnail_producer : public core::frame_producer
+{
+	core::monitor::subject				monitor_subject_;
+	const std::wstring					filename_;
+	const safe_ptr<core::frame_factory>	frame_factory_;
+	std::shared_ptr<void>				initial_logger_disabler_;
+	frame_extractor						extractor_;
+	safe_ptr<core::basic_frame>			last_frame_;
+
+public:
+	explicit ffmpeg_thumbnail_producer(const safe_ptr<core::frame_factory>& frame_factory, const std::wstring& filename)
+		: filename_(filename)
+		, frame_factory_(frame_factory)
+		, initial_logger_disabler_(temporary_disable_logging_for_thread(true))
+		, extractor_(filename)
+		, last_frame_(core::basic_frame::empty())
+	{
+	}
+
+	// frame_producer
+
+	virtual safe_ptr<core::basic_frame> receive(int) override
+	{
+		if(last_frame_ == core::basic_frame::empty())
+			last_frame_ = render_specific_frame(nb_frames() / 2);
+
+		return last_frame_;
+	}
+
+	virtual safe_ptr<core::basic_frame> last_frame() const override
+	{
+		return last_frame_;
+	}
+
+	safe_ptr<core::basic_frame> render_specific_frame(uint32_t file_position)
+	{
+		auto disable_logging = temporary_disable_logging_for_thread(true);
+
+		auto av_frame = extractor_.extract(file_position);
+
+		if(!av_frame)
+			return core::basic_frame::empty();
+
+		return make_write_frame(this, make_safe_ptr(av_frame), frame_factory_, 0, core::default_channel_layout_repository().get_by_name(L"STEREO"));
+	}
+
+	virtual safe_ptr<core::basic_frame> create_thumbnail_frame() override
+	{
+		boost::timer timer;
+
+		auto total_frames = nb_frames();
+		auto grid = env::properties().get(L"configuration.thumbnails.video-grid", 2);
+
+		if (grid < 1)
+		{
+			CASPAR_LOG(error) << L"configuration/thumbnails/video-grid cannot be less than 1";
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("configuration/thumbnails/video-grid cannot be less than 1"));
+		}
+
+		if (grid == 1)
+			return render_specific_frame(total_frames / 2);
+
+		auto num_snapshots = grid * grid;
+
+		std::vector<safe_ptr<core::basic_frame>> frames;
+
+		for (int i = 0; i < num_snapshots; ++i)
+		{
+			int x = i % grid;
+			int y = i / grid;
+			int desired_frame;
+			
+			if (i == 0)
+				desired_frame = 0; // first
+			else if (i == num_snapshots - 1)
+				desired_frame = total_frames - 1; // last
+			else
+				// evenly distributed across the file.
+				desired_frame = total_frames * i / (num_snapshots - 1);
+
+			auto frame = make_safe<core::basic_frame>(render_specific_frame(desired_frame));
+			frame->get_frame_transform().fill_scale[0] = 1.0 / static_cast<double>(grid);
+			frame->get_frame_transform().fill_scale[1] = 1.0 / static_cast<double>(grid);
+			frame->get_frame_transform().fill_translation[0] = 1.0 / static_cast<double>(grid) * x;
+			frame->get_frame_transform().fill_translation[1] = 1.0 / static_cast<double>(grid) * y;
+
+			frames.push_back(frame);
+		}
+
+		CASPAR_LOG(trace) << print() << L" Extracted " << num_snapshots << L" frames in " << static_cast<int>(timer.elapsed() * 1000.0) << L" ms.";
+
+		return make_safe<core::basic_frame>(frames);
+	}
+
+	virtual uint32_t nb_frames() const override
+	{
+		return extractor_.nb_frames();
+	}
+
+	virtual std::wstring print() const override
+	{
+		return L"ffmpeg-thumbnail[" + boost::filesystem::wpath(filename_).filename() + L"]";
+	}
+
+	boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type",		L"ffmpeg-thumbnail-producer");
+		info.add(L"filename",	filename_);
+		info.add(L"nb-frames",	nb_frames());
+		return info;
+	}
+
+	core::monitor::subject& monitor_output()
+	{
+		return monitor_subject_;
+	}
+};
+
 safe_ptr<core::frame_producer> create_producer(
 		const safe_ptr<core::frame_factory>& frame_factory,
 		const core::parameters& params)
@@ -577,13 +802,7 @@ safe_ptr<core::frame_producer> create_thumbnail_producer(
 	if(filename.empty())
 		return core::frame_producer::empty();
 	
-	auto loop		= false;
-	auto start		= 0;
-	auto length		= std::numeric_limits<uint32_t>::max();
-	auto filter_str = L"";
-
-	ffmpeg_producer_params vid_params;
-	return make_safe<ffmpeg_producer>(frame_factory, filename, FFMPEG_FILE, filter_str, loop, start, length, true, L"", vid_params);
+	return make_safe<ffmpeg_thumbnail_producer>(frame_factory, filename);
 }
 
 }}
\ No newline at end of file
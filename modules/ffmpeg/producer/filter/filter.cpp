@@ -23,8 +23,11 @@
 
 #include "filter.h"
 
+#include "../../ffmpeg.h"
 #include "../../ffmpeg_error.h"
 
+#include <common/concurrency/executor.h>
+#include <common/env.h>
 #include <common/exception/exceptions.h>
 
 #include <boost/assign.hpp>
@@ -34,9 +37,15 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/rational.hpp>
 
+#include <tbb/mutex.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_scheduler_init.h>
+
 #include <cstdio>
+#include <list>
 #include <sstream>
 #include <string>
 
@@ -60,6 +69,18 @@ extern "C"
 #endif
 
 namespace caspar { namespace ffmpeg {
+
+int tbb_execute(AVFilterContext* ctx, avfilter_action_func* func, void* arg, int* ret, int nb_jobs)
+{
+	tbb::parallel_for(0, nb_jobs, 1, [&](int jobnr)
+	{
+		int r = func(ctx, arg, jobnr, nb_jobs);
+		if(ret)
+			ret[jobnr] = r;
+	});
+
+	return 0;
+}
 	
 struct filter::implementation
 {
@@ -106,6 +127,13 @@ struct filter::implementation
 		video_graph_->nb_threads  = 0;
 		video_graph_->thread_type = AVFILTER_THREAD_SLICE;
 
+		if(env::properties().get(L"configuration.ffmpeg.tbb-filter-threads", false))
+		{
+			// Slice jobs (e.g. YADIF rows) are scheduled on the tbb workers instead of libavfilter's own threads.
+			video_graph_->nb_threads  = tbb::task_scheduler_init::default_num_threads();
+			video_graph_->execute	  = tbb_execute;
+		}
+
 		const auto vsrc_options = (boost::format("video_size=%1%x%2%:pix_fmt=%3%:time_base=%4%/%5%:pixel_aspect=%6%/%7%:frame_rate=%8%/%9%")
 			% in_width % in_height
 			% in_pix_fmt
@@ -275,4 +303,126 @@ std::vector<safe_ptr<AVFrame>> filter::poll_all()
 	return frames;
 }
 
+struct filter_pool : boost::noncopyable
+{
+	typedef std::pair<std::string, std::shared_ptr<filter>> entry;
+
+	tbb::mutex			mutex_;
+	std::list<entry>	spares_; // Most recently used configuration first.
+	const size_t		capacity_;
+	executor			executor_;
+
+	filter_pool()
+		: capacity_(env::properties().get(L"configuration.ffmpeg.filter-pool-size", 8))
+		, executor_(L"filter_pool")
+	{
+		executor_.set_priority_class(below_normal_priority_class);
+		executor_.begin_invoke([]
+		{
+			disable_logging_for_thread();
+		});
+	}
+
+	static filter_pool& instance()
+	{
+		static filter_pool pool;
+		return pool;
+	}
+
+	std::shared_ptr<filter> try_take(const std::string& key)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		auto it = std::find_if(spares_.begin(), spares_.end(), [&](const entry& e){return e.first == key;});
+		if(it == spares_.end())
+			return nullptr;
+
+		auto spare = it->second;
+		spares_.erase(it);
+		return spare;
+	}
+
+	void put(const std::string& key, const std::shared_ptr<filter>& spare)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		spares_.remove_if([&](const entry& e){return e.first == key;});
+		spares_.push_front(std::make_pair(key, spare));
+
+		while(spares_.size() > capacity_)
+			spares_.pop_back();
+	}
+
+	void clear()
+	{
+		executor_.clear();
+		executor_.wait();
+
+		tbb::mutex::scoped_lock lock(mutex_);
+		spares_.clear();
+	}
+
+	template<typename Func>
+	void prepare(const std::string& key, const Func& factory)
+	{
+		if(capacity_ == 0 || executor_.size() > capacity_)
+			return;
+
+		executor_.begin_invoke([=]
+		{
+			put(key, factory());
+		});
+	}
+};
+
+std::unique_ptr<filter> create_pooled_filter(
+		int in_width,
+		int in_height,
+		boost::rational<int> in_time_base,
+		boost::rational<int> in_frame_rate,
+		boost::rational<int> in_sample_aspect_ratio,
+		AVPixelFormat in_pix_fmt,
+		const std::vector<AVPixelFormat>& out_pix_fmts,
+		const std::string& filtergraph)
+{
+	auto factory = [=]() -> std::shared_ptr<filter>
+	{
+		return std::shared_ptr<filter>(new filter(
+				in_width,
+				in_height,
+				in_time_base,
+				in_frame_rate,
+				in_sample_aspect_ratio,
+				in_pix_fmt,
+				out_pix_fmts,
+				filtergraph));
+	};
+
+	std::string key = (boost::format("%1%x%2%:%3%:%4%/%5%:%6%/%7%:%8%/%9%:%10%") 
+			% in_width % in_height
+			% in_pix_fmt
+			% in_time_base.numerator() % in_time_base.denominator()
+			% in_frame_rate.numerator() % in_frame_rate.denominator()
+			% in_sample_aspect_ratio.numerator() % in_sample_aspect_ratio.denominator()
+			% boost::to_lower_copy(filtergraph)).str();
+
+	BOOST_FOREACH(auto fmt, out_pix_fmts)
+		key += ":" + boost::lexical_cast<std::string>(static_cast<int>(fmt));
+
+	auto& pool  = filter_pool::instance();
+	auto  spare = pool.try_take(key);
+
+	pool.prepare(key, factory);
+
+	if(!spare)
+		spare = factory();
+
+	return std::unique_ptr<filter>(new filter(std::move(*spare)));
+}
+
+void clear_filter_pool()
+{
+	filter_pool::instance().clear();
+}
+
 }}
\ No newline at end of file
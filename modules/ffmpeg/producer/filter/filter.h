@@ -27,6 +27,7 @@
 #include <boost/noncopyable.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -103,4 +104,20 @@ private:
 	safe_ptr<implementation> impl_;
 };
 
+// Creates a filter, preferring a graph that has already been configured for the same input and 
+// filtergraph. A spare graph for that configuration is then configured in the background, so that 
+// the next clip with the same configuration doesn't pay for graph initialization either.
+std::unique_ptr<filter> create_pooled_filter(
+		int in_width,
+		int in_height,
+		boost::rational<int> in_time_base,
+		boost::rational<int> in_frame_rate,
+		boost::rational<int> in_sample_aspect_ratio,
+		AVPixelFormat in_pix_fmt,
+		const std::vector<AVPixelFormat>& out_pix_fmts,
+		const std::string& filtergraph);
+
+// Releases all prepared graphs. Must be called before libavfilter is uninitialized.
+void clear_filter_pool();
+
 }}
\ No newline at end of file
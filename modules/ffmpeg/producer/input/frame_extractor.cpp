@@ -0,0 +1,335 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "frame_extractor.h"
+
+#include "../filter/filter.h"
+#include "../util/util.h"
+#include "../tbb_avcodec.h"
+#include "../../ffmpeg.h"
+#include "../../ffmpeg_error.h"
+
+#include <core/video_format.h>
+
+#include <common/env.h>
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+
+#include <boost/assign.hpp>
+#include <boost/chrono.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <numeric>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C" 
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavformat/avformat.h>
+	#include <libavcodec/avcodec.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+static const int MAX_DECODED_FRAMES = 1000; // Give up on broken files instead of decoding them to the end.
+
+namespace caspar { namespace ffmpeg {
+		
+struct frame_extractor::implementation : boost::noncopyable
+{
+	const std::wstring				filename_;
+	const safe_ptr<AVFormatContext>	format_context_; // Destroy this last
+	int								index_;
+	const safe_ptr<AVCodecContext>	codec_context_;
+	const double					fps_;
+
+	explicit implementation(const std::wstring& filename)
+		: filename_(filename)
+		, format_context_(open_input(filename))
+		, codec_context_(open_video_codec(*format_context_, index_))
+		, fps_(read_fps(*format_context_, 0.0))
+	{
+	}
+
+	static safe_ptr<AVFormatContext> open_input(const std::wstring& filename)
+	{
+		AVFormatContext* weak_context = nullptr;
+		THROW_ON_ERROR2(avformat_open_input(&weak_context, narrow(filename).c_str(), nullptr, nullptr), filename);
+		safe_ptr<AVFormatContext> context(weak_context, av_close_input_file);
+		THROW_ON_ERROR2(avformat_find_stream_info(weak_context, nullptr), filename);
+		fix_meta_data(*context);
+		return context;
+	}
+
+	// As open_codec, but the extracted frames are refcounted so that they outlive the next decode, 
+	// which only takes effect when set before the codec is opened.
+	static safe_ptr<AVCodecContext> open_video_codec(AVFormatContext& context, int& index)
+	{
+		AVCodec* decoder;
+		index = THROW_ON_ERROR2(av_find_best_stream(&context, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0), "");
+
+		context.streams[index]->codec->refcounted_frames = 1;
+
+		THROW_ON_ERROR2(tbb_avcodec_open(context.streams[index]->codec, decoder), "");
+		return safe_ptr<AVCodecContext>(context.streams[index]->codec, tbb_avcodec_close);
+	}
+
+	std::shared_ptr<AVFrame> extract(uint32_t file_position)
+	{
+		const auto stream		= format_context_->streams[index_];
+		const auto start_time	= stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+		const auto frame_ticks	= fps_ > 0.0 ? stream->time_base.den / (stream->time_base.num * fps_) : 0.0;
+		const auto target		= start_time + static_cast<int64_t>(file_position * frame_ticks);
+
+		// Land on the closest keyframe at or before the target, or restart from the beginning.
+		if(file_position == 0 || av_seek_frame(format_context_.get(), index_, target, AVSEEK_FLAG_BACKWARD) < 0)
+			LOG_ON_ERROR2(av_seek_frame(format_context_.get(), index_, 0, AVSEEK_FLAG_BYTE), print());
+
+		avcodec_flush_buffers(codec_context_.get());
+
+		std::shared_ptr<AVFrame> result;
+		
+		for(int n = 0; n < MAX_DECODED_FRAMES;)
+		{
+			auto packet = create_packet();
+
+			if(av_read_frame(format_context_.get(), packet.get()) < 0)
+				break;
+
+			if(packet->stream_index != index_)
+				continue;
+
+			THROW_ON_ERROR2(av_dup_packet(packet.get()), print());
+
+			auto frame = decode(packet);
+			if(!frame)
+				continue;
+
+			++n;
+			result = frame;
+
+			auto pts = av_frame_get_best_effort_timestamp(frame.get());
+			if(pts == AV_NOPTS_VALUE || pts + frame_ticks * 0.5 >= target)
+				return deinterlace(result);
+		}
+
+		// Drain frames delayed by the decoder.
+		if(codec_context_->codec->capabilities & CODEC_CAP_DELAY)
+		{
+			auto packet = create_packet();
+			packet->data = nullptr;
+			packet->size = 0;
+
+			for(auto frame = decode(packet); frame; frame = decode(packet))
+			{
+				result = frame;
+
+				auto pts = av_frame_get_best_effort_timestamp(frame.get());
+				if(pts == AV_NOPTS_VALUE || pts + frame_ticks * 0.5 >= target)
+					break;
+			}
+		}
+
+		return result ? deinterlace(result) : nullptr;
+	}
+
+	// Interlaced frames are deinterlaced with yadif, as the muxer does for the frames of a thumbnail.
+	std::shared_ptr<AVFrame> deinterlace(const std::shared_ptr<AVFrame>& frame) const
+	{
+		if(get_mode(*frame) == core::field_mode::progressive)
+			return frame;
+
+		// The filter takes over the references of the pushed frame, so it gets a clone of its own.
+		std::shared_ptr<AVFrame> input(av_frame_clone(frame.get()), [](AVFrame* p)
+		{
+			av_frame_free(&p);
+		});
+
+		if(!input)
+			return frame;
+
+		const auto fps = fps_ > 0.0 ? fps_ : 25.0;
+
+		filter yadif(
+				frame->width, 
+				frame->height,
+				boost::rational<int>(1000000, static_cast<int>(fps * 1000000)),
+				boost::rational<int>(static_cast<int>(fps * 1000000), 1000000),
+				boost::rational<int>(frame->sample_aspect_ratio.num, frame->sample_aspect_ratio.den),
+				static_cast<AVPixelFormat>(frame->format),
+				std::vector<AVPixelFormat>(),
+				"YADIF=0:-1");
+
+		yadif.push(input);
+		yadif.push(nullptr); // The end of the stream, so that yadif outputs the frame without waiting for the next.
+
+		auto deinterlaced = yadif.poll();
+
+		return deinterlaced ? deinterlaced : frame;
+	}
+
+	std::shared_ptr<AVFrame> decode(const safe_ptr<AVPacket>& packet)
+	{
+		auto decoded_frame = std::shared_ptr<AVFrame>(av_frame_alloc(), [](AVFrame* frame)
+		{
+			av_frame_free(&frame);
+		});
+
+		int frame_finished = 0;
+		THROW_ON_ERROR2(avcodec_decode_video2(codec_context_.get(), decoded_frame.get(), &frame_finished, packet.get()), print());
+
+		if(frame_finished == 0)
+			return nullptr;
+
+		// The RAW_VIDEO codec returns frame data owned by the packet.
+		return std::shared_ptr<AVFrame>(decoded_frame.get(), [decoded_frame, packet](AVFrame*){});
+	}
+
+	uint32_t nb_frames() const
+	{
+		return static_cast<uint32_t>(format_context_->streams[index_]->nb_frames);
+	}
+
+	std::wstring print() const
+	{
+		return L"frame_extractor[" + boost::filesystem::wpath(filename_).filename() + L"]";
+	}
+};
+
+frame_extractor::frame_extractor(const std::wstring& filename) : impl_(new implementation(filename)){}
+std::shared_ptr<AVFrame> frame_extractor::extract(uint32_t file_position){return impl_->extract(file_position);}
+uint32_t frame_extractor::nb_frames() const{return impl_->nb_frames();}
+std::wstring frame_extractor::print() const{return impl_->print();}
+
+typedef boost::chrono::high_resolution_clock extraction_clock;
+
+static double elapsed_millis(extraction_clock::time_point since)
+{
+	return boost::chrono::duration<double, boost::milli>(extraction_clock::now() - since).count();
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if(sorted.empty())
+		return 0.0;
+
+	return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+}
+
+boost::property_tree::wptree benchmark_frame_extraction(const std::wstring& folder, int files)
+{
+	if(files < 1)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("files") << arg_value_info(boost::lexical_cast<std::string>(files)));
+
+	if(!boost::filesystem::is_directory(boost::filesystem::wpath(folder)))
+		BOOST_THROW_EXCEPTION(file_not_found() << msg_info(narrow(folder)));
+
+	// The files that create_thumbnail_producer makes thumbnails of.
+	static const std::vector<std::wstring> invalid_exts = boost::assign::list_of
+			(L".png")(L".tga")(L".bmp")(L".jpg")(L".jpeg")(L".gif")(L".tiff")(L".tif")(L".jp2")(L".jpx")(L".j2k")(L".j2c")(L".swf")(L".ct")
+			(L".wav")(L".mp3");
+
+	const int grid		= std::max(1, env::properties().get(L"configuration.thumbnails.video-grid", 2));
+	const int snapshots	= grid * grid;
+
+	CASPAR_LOG(info) << L"[extraction-benchmark] Extracting " << snapshots << L" frames from each of up to " << files << L" files in " << folder << L".";
+
+	auto disable_logging = temporary_disable_logging_for_thread(true);
+
+	std::vector<double> open_times;
+	std::vector<double> file_times;
+	int failed_files	= 0;
+	int frames			= 0;
+	int missing_frames	= 0;
+
+	const auto start = extraction_clock::now();
+
+	for(boost::filesystem::wrecursive_directory_iterator it(folder), end; it != end && static_cast<int>(file_times.size()) + failed_files < files; ++it)
+	{
+		if(!boost::filesystem::is_regular_file(it->path()) || !is_valid_file(it->path().file_string(), invalid_exts))
+			continue;
+
+		const auto file_start = extraction_clock::now();
+
+		try
+		{
+			frame_extractor extractor(it->path().file_string());
+			open_times.push_back(elapsed_millis(file_start));
+
+			// The positions of create_thumbnail_frame.
+			const uint32_t total_frames = extractor.nb_frames();
+
+			for(int i = 0; i < snapshots; ++i)
+			{
+				uint32_t position;
+
+				if(snapshots == 1)
+					position = total_frames / 2;
+				else if(i == snapshots - 1)
+					position = std::max(total_frames, 1u) - 1;
+				else
+					position = total_frames * i / (snapshots - 1);
+
+				if(extractor.extract(position))
+					++frames;
+				else
+					++missing_frames;
+			}
+
+			file_times.push_back(elapsed_millis(file_start));
+		}
+		catch(...)
+		{
+			++failed_files;
+		}
+	}
+
+	const auto elapsed = elapsed_millis(start);
+
+	std::sort(open_times.begin(), open_times.end());
+	std::sort(file_times.begin(), file_times.end());
+
+	boost::property_tree::wptree info;
+	info.add(L"frame-extraction.folder",			folder);
+	info.add(L"frame-extraction.grid",				grid);
+	info.add(L"frame-extraction.files",				file_times.size());
+	info.add(L"frame-extraction.failed-files",		failed_files);
+	info.add(L"frame-extraction.frames",			frames);
+	info.add(L"frame-extraction.missing-frames",	missing_frames);
+	info.add(L"frame-extraction.files-per-second",	elapsed > 0.0 ? file_times.size() * 1000.0 / elapsed : 0.0);
+	info.add(L"frame-extraction.open-millis.p50",	percentile(open_times, 0.50));
+	info.add(L"frame-extraction.file-millis.mean",	file_times.empty() ? 0.0 : std::accumulate(file_times.begin(), file_times.end(), 0.0) / file_times.size());
+	info.add(L"frame-extraction.file-millis.p50",	percentile(file_times, 0.50));
+	info.add(L"frame-extraction.file-millis.p99",	percentile(file_times, 0.99));
+	info.add(L"frame-extraction.file-millis.max",	file_times.empty() ? 0.0 : file_times.back());
+
+	return info;
+}
+
+}}
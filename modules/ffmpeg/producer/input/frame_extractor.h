@@ -0,0 +1,59 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct AVFrame;
+
+namespace caspar { namespace ffmpeg {
+
+// Decodes single video frames of a file on the calling thread, without the buffering of input. 
+// Seeks to the closest keyframe preceding the requested frame and decodes forward until it is reached.
+// Interlaced frames are deinterlaced, since they are only shown as still images.
+class frame_extractor : boost::noncopyable
+{
+public:
+	explicit frame_extractor(const std::wstring& filename);
+
+	// Returns the frame at file_position, the last decodable frame before it, or nullptr.
+	std::shared_ptr<AVFrame> extract(uint32_t file_position);
+
+	uint32_t nb_frames() const;
+
+	std::wstring print() const;
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+// Extracts the frames of a thumbnail, as the thumbnail generator does, from up to the given number 
+// of media files in folder and its subfolders, and reports the time per file. Blocks until done.
+boost::property_tree::wptree benchmark_frame_extraction(const std::wstring& folder, int files);
+
+}}
@@ -33,6 +33,7 @@
 #include <core/producer/frame/frame_factory.h>
 #include <core/mixer/write_frame.h>
 #include <core/mixer/audio/audio_util.h>
+#include <core/video_format.h>
 
 #include <common/env.h>
 #include <common/exception/exceptions.h>
@@ -53,10 +54,17 @@ extern "C"
 #pragma warning (pop)
 #endif
 
+#include <boost/chrono.hpp>
 #include <boost/foreach.hpp>
-#include <boost/range/algorithm_ext/push_back.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/timer.hpp>
+#include <boost/circular_buffer.hpp>
+#include <boost/range/algorithm/max_element.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 
+#include <tbb/cache_aligned_allocator.h>
+
+#include <algorithm>
 #include <deque>
 #include <queue>
 #include <vector>
@@ -64,11 +72,91 @@ extern "C"
 using namespace caspar::core;
 
 namespace caspar { namespace ffmpeg {
+
+// Sample ring holding the audio of all pending streams back to back. Each entry in the stream queue
+// is the number of samples belonging to that stream, so flushing and truncating never moves sample
+// data, and chunks are copied straight into the destination frame. The ring grows when the pending
+// streams together need more than its capacity; only the size of a single stream is limited.
+class audio_sample_ring : boost::noncopyable
+{
+	typedef boost::circular_buffer<int32_t, tbb::cache_aligned_allocator<int32_t>> buffer_type;
+
+	buffer_type			samples_;
+	std::deque<size_t>	streams_;
+public:
+	explicit audio_sample_ring(size_t capacity)
+		: samples_(capacity)
+	{
+		streams_.push_back(0);
+	}
+
+	void flush()
+	{
+		streams_.push_back(0);
+	}
+
+	template<typename I>
+	void push(I begin, I end)
+	{
+		const size_t count = static_cast<size_t>(std::distance(begin, end));
+
+		reserve(count);
+
+		samples_.insert(samples_.end(), begin, end);
+		streams_.back() += count;
+	}
+
+	void push_silence(size_t count)
+	{
+		reserve(count);
+
+		samples_.insert(samples_.end(), count, 0);
+		streams_.back() += count;
+	}
+
+	void pop(size_t count, core::audio_buffer& dest)
+	{
+		CASPAR_VERIFY(streams_.front() >= count);
+
+		dest.resize(count);
+
+		auto one = samples_.array_one();
+		auto two = samples_.array_two();
+
+		const size_t count_one = std::min(count, one.second);
+		std::memcpy(dest.data(), one.first, count_one * sizeof(int32_t));
+
+		if(count > count_one)
+			std::memcpy(dest.data() + count_one, two.first, (count - count_one) * sizeof(int32_t));
+
+		samples_.erase_begin(count);
+		streams_.front() -= count;
+	}
+
+	void pop_stream()
+	{
+		samples_.erase_begin(streams_.front());
+		streams_.pop_front();
+
+		if(streams_.empty())
+			streams_.push_back(0);
+	}
+
+	void reserve(size_t count)
+	{
+		if(samples_.reserve() < count)
+			samples_.set_capacity(std::max(samples_.capacity() * 2, samples_.size() + count));
+	}
+
+	size_t front_size() const	{ return streams_.front(); }
+	size_t back_size() const	{ return streams_.back(); }
+	size_t streams() const		{ return streams_.size(); }
+};
 	
 struct frame_muxer::implementation : boost::noncopyable
 {	
 	std::queue<std::queue<safe_ptr<write_frame>>>	video_streams_;
-	std::queue<core::audio_buffer>					audio_streams_;
+	audio_sample_ring								audio_streams_;
 	std::queue<safe_ptr<basic_frame>>				frame_buffer_;
 	display_mode::type								display_mode_;
 	const double									in_fps_;
@@ -76,7 +164,9 @@ struct frame_muxer::implementation : boost::noncopyable
 	bool											auto_transcode_;
 	bool											auto_deinterlace_;
 	
-	std::vector<size_t>								audio_cadence_;
+	const std::vector<size_t>						audio_cadence_;
+	size_t											audio_cadence_index_;
+	const size_t									audio_stream_limit_;	// 32 frames on top of a one second packet, as some MXF files have.
 			
 	safe_ptr<core::frame_factory>					frame_factory_;
 	
@@ -92,12 +182,15 @@ struct frame_muxer::implementation : boost::noncopyable
 			const std::wstring& filter_str,
 			bool thumbnail_mode,
 			const core::channel_layout& audio_channel_layout)
-		: display_mode_(display_mode::invalid)
+		: audio_streams_(2 * 32 * *boost::max_element(frame_factory->get_video_format_desc().audio_cadence) * audio_channel_layout.num_channels)
+		, display_mode_(display_mode::invalid)
 		, in_fps_(in_fps)
 		, format_desc_(frame_factory->get_video_format_desc())
 		, auto_transcode_(env::properties().get(L"configuration.auto-transcode", true))
 		, auto_deinterlace_(env::properties().get(L"configuration.auto-deinterlace", true))
-		, audio_cadence_(format_desc_.audio_cadence)
+		, audio_cadence_(rotated_cadence(format_desc_.audio_cadence))
+		, audio_cadence_index_(0)
+		, audio_stream_limit_((32 * *boost::max_element(audio_cadence_) + format_desc_.audio_sample_rate) * audio_channel_layout.num_channels)
 		, frame_factory_(frame_factory)
 		, filter_str_(filter_str)
 		, thumbnail_mode_(thumbnail_mode)
@@ -105,11 +198,19 @@ struct frame_muxer::implementation : boost::noncopyable
 		, audio_channel_layout_(audio_channel_layout)
 	{
 		video_streams_.push(std::queue<safe_ptr<write_frame>>());
-		audio_streams_.push(core::audio_buffer());
-		
+	}
+
+	static std::vector<size_t> rotated_cadence(std::vector<size_t> cadence)
+	{
 		// Note: Uses 1 step rotated cadence for 1001 modes (1602, 1602, 1601, 1602, 1601)
 		// This cadence fills the audio mixer most optimally.
-		boost::range::rotate(audio_cadence_, std::end(audio_cadence_)-1);
+		boost::range::rotate(cadence, std::end(cadence)-1);
+		return cadence;
+	}
+
+	size_t audio_chunk_size() const
+	{
+		return audio_cadence_[audio_cadence_index_] * audio_channel_layout_.num_channels;
 	}
 
 	void push(const std::shared_ptr<AVFrame>& video_frame, int hints)
@@ -170,29 +271,29 @@ struct frame_muxer::implementation : boost::noncopyable
 
 		if(audio == flush_audio())
 		{
-			audio_streams_.push(core::audio_buffer());
+			audio_streams_.flush();
 		}
 		else if(audio == empty_audio())
 		{
-			boost::range::push_back(audio_streams_.back(), core::audio_buffer(audio_cadence_.front() * audio_channel_layout_.num_channels, 0));
+			audio_streams_.push_silence(audio_chunk_size());
 		}
 		else
 		{
-			boost::range::push_back(audio_streams_.back(), *audio);
+			audio_streams_.push(audio->begin(), audio->end());
 		}
 
-		if(audio_streams_.back().size() > 32*audio_cadence_.front() * audio_channel_layout_.num_channels)
+		if(audio_streams_.back_size() > audio_stream_limit_)
 			BOOST_THROW_EXCEPTION(invalid_operation() << source_info("frame_muxer") << msg_info("audio-stream overflow. This can be caused by incorrect frame-rate. Check clip meta-data."));
 	}
 	
 	bool video_ready() const
 	{		
-		return video_streams_.size() > 1 || (video_streams_.size() >= audio_streams_.size() && video_ready2());
+		return video_streams_.size() > 1 || (video_streams_.size() >= audio_streams_.streams() && video_ready2());
 	}
 	
 	bool audio_ready() const
 	{
-		return audio_streams_.size() > 1 || (audio_streams_.size() >= video_streams_.size() && audio_ready2());
+		return audio_streams_.streams() > 1 || (audio_streams_.streams() >= video_streams_.size() && audio_ready2());
 	}
 
 	bool video_ready2() const
@@ -213,9 +314,9 @@ struct frame_muxer::implementation : boost::noncopyable
 		switch(display_mode_)
 		{
 		case display_mode::duplicate:					
-			return audio_streams_.front().size()/2 >= audio_cadence_.front() * audio_channel_layout_.num_channels;
+			return audio_streams_.front_size()/2 >= audio_chunk_size();
 		default:										
-			return audio_streams_.front().size() >= audio_cadence_.front() * audio_channel_layout_.num_channels;
+			return audio_streams_.front_size() >= audio_chunk_size();
 		}
 	}
 		
@@ -228,20 +329,20 @@ struct frame_muxer::implementation : boost::noncopyable
 			return frame;
 		}
 
-		if(video_streams_.size() > 1 && audio_streams_.size() > 1 && (!video_ready2() || !audio_ready2()))
+		if(video_streams_.size() > 1 && audio_streams_.streams() > 1 && (!video_ready2() || !audio_ready2()))
 		{
-			if(!video_streams_.front().empty() || !audio_streams_.front().empty())
-				CASPAR_LOG(trace) << "Truncating: " << video_streams_.front().size() << L" video-frames, " << audio_streams_.front().size() << L" audio-samples.";
+			if(!video_streams_.front().empty() || audio_streams_.front_size() > 0)
+				CASPAR_LOG(trace) << "Truncating: " << video_streams_.front().size() << L" video-frames, " << audio_streams_.front_size() << L" audio-samples.";
 
 			video_streams_.pop();
-			audio_streams_.pop();
+			audio_streams_.pop_stream();
 		}
 
 		if(!video_ready2() || !audio_ready2() || display_mode_ == display_mode::invalid)
 			return nullptr;
 				
 		auto frame1				= pop_video();
-		frame1->audio_data()	= pop_audio();
+		pop_audio(frame1->audio_data());
 
 		switch(display_mode_)
 		{
@@ -263,7 +364,7 @@ struct frame_muxer::implementation : boost::noncopyable
 		case display_mode::duplicate:	
 			{
 				auto frame2				= make_safe<core::write_frame>(*frame1);
-				frame2->audio_data()	= pop_audio();
+				pop_audio(frame2->audio_data());
 
 				frame_buffer_.push(frame1);
 				frame_buffer_.push(frame2);
@@ -288,19 +389,11 @@ struct frame_muxer::implementation : boost::noncopyable
 		return frame;
 	}
 
-	core::audio_buffer pop_audio()
+	void pop_audio(core::audio_buffer& dest)
 	{
-		CASPAR_VERIFY(audio_streams_.front().size() >= audio_cadence_.front() * audio_channel_layout_.num_channels);
-
-		auto begin = audio_streams_.front().begin();
-		auto end   = begin + (audio_cadence_.front() * audio_channel_layout_.num_channels);
-
-		core::audio_buffer samples(begin, end);
-		audio_streams_.front().erase(begin, end);
+		audio_streams_.pop(audio_chunk_size(), dest);
 		
-		boost::range::rotate(audio_cadence_, std::begin(audio_cadence_)+1);
-
-		return samples;
+		audio_cadence_index_ = (audio_cadence_index_ + 1) % audio_cadence_.size();
 	}
 				
 	void update_display_mode(const std::shared_ptr<AVFrame>& frame, bool force_deinterlace)
@@ -353,17 +446,35 @@ struct frame_muxer::implementation : boost::noncopyable
 			
 		if(!filter_ || !boost::iequals(filter_->filter_str(), filter_str))
 		{
-			filter_.reset(new filter(
-				frame->width, 
-				frame->height,
-				boost::rational<int>(1000000, static_cast<int>(in_fps_ * 1000000)),
-				boost::rational<int>(static_cast<int>(in_fps_ * 1000000), 1000000),
-				boost::rational<int>(frame->sample_aspect_ratio.num, frame->sample_aspect_ratio.den),
-				static_cast<AVPixelFormat>(frame->format),
-				std::vector<AVPixelFormat>(),
-				narrow(filter_str)));
-			if (!thumbnail_mode_)
-				CASPAR_LOG(info) << L"[frame_muxer] " << display_mode::print(display_mode_) << L" " << print_mode(frame->width, frame->height, in_fps_, frame->interlaced_frame > 0);
+			if(thumbnail_mode_)
+			{
+				filter_.reset(new filter(
+					frame->width, 
+					frame->height,
+					boost::rational<int>(1000000, static_cast<int>(in_fps_ * 1000000)),
+					boost::rational<int>(static_cast<int>(in_fps_ * 1000000), 1000000),
+					boost::rational<int>(frame->sample_aspect_ratio.num, frame->sample_aspect_ratio.den),
+					static_cast<AVPixelFormat>(frame->format),
+					std::vector<AVPixelFormat>(),
+					narrow(filter_str)));
+			}
+			else
+			{
+				boost::timer filter_timer;
+
+				filter_ = create_pooled_filter(
+					frame->width, 
+					frame->height,
+					boost::rational<int>(1000000, static_cast<int>(in_fps_ * 1000000)),
+					boost::rational<int>(static_cast<int>(in_fps_ * 1000000), 1000000),
+					boost::rational<int>(frame->sample_aspect_ratio.num, frame->sample_aspect_ratio.den),
+					static_cast<AVPixelFormat>(frame->format),
+					std::vector<AVPixelFormat>(),
+					narrow(filter_str));
+
+				CASPAR_LOG(info) << L"[frame_muxer] " << display_mode::print(display_mode_) << L" " << print_mode(frame->width, frame->height, in_fps_, frame->interlaced_frame > 0)
+								 << L" (filter ready in " << static_cast<int>(filter_timer.elapsed() * 1000.0) << L" ms)";
+			}
 		}
 	}
 	
@@ -404,4 +515,97 @@ uint32_t frame_muxer::calc_nb_frames(uint32_t nb_frames) const {return impl_->ca
 bool frame_muxer::video_ready() const{return impl_->video_ready();}
 bool frame_muxer::audio_ready() const{return impl_->audio_ready();}
 
+// Only provides the format, since the benchmark pushes empty video frames that need no image.
+class benchmark_frame_factory : public core::frame_factory
+{
+	const core::video_format_desc format_desc_;
+public:
+	explicit benchmark_frame_factory(const core::video_format_desc& format_desc)
+		: format_desc_(format_desc)
+	{
+	}
+
+	virtual safe_ptr<core::write_frame> create_frame(const void*, const core::pixel_format_desc&, const core::channel_layout&) override
+	{
+		BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("The muxer benchmark creates no images."));
+	}
+
+	virtual core::video_format_desc get_video_format_desc() const override
+	{
+		return format_desc_;
+	}
+};
+
+static boost::property_tree::wptree run_muxer_audio(const core::video_format_desc& format_desc, const safe_ptr<core::frame_factory>& frame_factory, int frames, size_t packet_samples)
+{
+	typedef boost::chrono::high_resolution_clock clock;
+
+	const auto channel_layout = core::channel_layout::stereo();
+
+	frame_muxer muxer(format_desc.fps, frame_factory, false, channel_layout);
+	auto packet = std::make_shared<core::audio_buffer>(packet_samples * channel_layout.num_channels, 0);
+
+	int64_t pushed_samples	= 0;
+	int64_t needed_samples	= 0;
+	int		packets			= 0;
+	int		muxed_frames	= 0;
+
+	const auto start = clock::now();
+
+	// Each frame's audio is pushed before its video, as the producer does when it has decoded ahead.
+	for(int n = 0; n < frames; ++n)
+	{
+		needed_samples += format_desc.audio_cadence[n % format_desc.audio_cadence.size()];
+
+		for(; pushed_samples < needed_samples; pushed_samples += packet_samples, ++packets)
+			muxer.push(packet);
+
+		muxer.push(empty_video());
+
+		while(muxer.poll())
+			++muxed_frames;
+	}
+
+	const auto micros = boost::chrono::duration<double, boost::micro>(clock::now() - start).count();
+
+	boost::property_tree::wptree info;
+	info.add(L"packet-samples",		packet_samples);
+	info.add(L"packets",			packets);
+	info.add(L"frames",				muxed_frames);
+	info.add(L"millis",				micros / 1000.0);
+	info.add(L"micros-per-frame",	muxed_frames > 0 ? micros / muxed_frames : 0.0);
+
+	return info;
+}
+
+boost::property_tree::wptree benchmark_frame_muxer_audio(const core::video_format_desc& format_desc, int frames)
+{
+	if(format_desc.format == core::video_format::invalid)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("format_desc"));
+
+	if(frames < 1)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("frames") << arg_value_info(boost::lexical_cast<std::string>(frames)));
+
+	// From single samples, through odd sizes that straddle the cadence, up to the one second packets of some MXF files.
+	std::vector<size_t> packet_sizes;
+	packet_sizes.push_back(1);
+	packet_sizes.push_back(7);
+	packet_sizes.push_back(format_desc.audio_cadence.front());
+	packet_sizes.push_back(4099);
+	packet_sizes.push_back(format_desc.audio_sample_rate);
+
+	CASPAR_LOG(info) << L"[muxer-benchmark] Muxing " << frames << L" frames of " << format_desc.name << L" audio.";
+
+	auto frame_factory = make_safe<benchmark_frame_factory>(format_desc);
+
+	boost::property_tree::wptree info;
+	info.add(L"muxer-audio.format",	format_desc.name);
+	info.add(L"muxer-audio.frames",	frames);
+
+	BOOST_FOREACH(auto packet_samples, packet_sizes)
+		info.add_child(L"muxer-audio.runs.run", run_muxer_audio(format_desc, frame_factory, frames, packet_samples));
+
+	return info;
+}
+
 }}
\ No newline at end of file
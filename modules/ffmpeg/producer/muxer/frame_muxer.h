@@ -28,6 +28,7 @@
 #include <core/mixer/audio/audio_mixer.h>
 
 #include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
 
 #include <vector>
 
@@ -41,6 +42,7 @@ class write_frame;
 class basic_frame;
 struct frame_factory;
 struct channel_layout;
+struct video_format_desc;
 
 }
 
@@ -70,4 +72,8 @@ private:
 	safe_ptr<implementation> impl_;
 };
 
+// Muxes the given number of frames of audio, delivered in packets of sizes from a single sample up 
+// to a second, with empty video, and reports the time per frame for each packet size. Blocks until done.
+boost::property_tree::wptree benchmark_frame_muxer_audio(const core::video_format_desc& format_desc, int frames);
+
 }}
\ No newline at end of file
@@ -0,0 +1,286 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../StdAfx.h"
+
+#include "replay_producer.h"
+
+#include "../util/util.h"
+#include "../../ffmpeg_error.h"
+#include "../../consumer/replay_buffer.h"
+
+#include <core/monitor/monitor.h>
+#include <core/parameters/parameters.h>
+#include <core/producer/frame_producer.h>
+#include <core/producer/frame/basic_frame.h>
+#include <core/producer/frame/frame_factory.h>
+#include <core/mixer/write_frame.h>
+
+#include <common/concurrency/executor.h>
+#include <common/diagnostics/graph.h>
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread.hpp>
+#include <boost/timer.hpp>
+
+#include <limits>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C" 
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavcodec/avcodec.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+// Plays a range of a replay buffer. The next frame is decoded while the current one is shown. 
+// out_ is -1 to keep following the recording.
+struct replay_producer : public core::frame_producer
+{
+	core::monitor::subject							monitor_subject_;
+	const safe_ptr<core::frame_factory>				frame_factory_;
+	const std::shared_ptr<replay_buffer>			buffer_;
+	const int64_t									in_;
+	const int64_t									out_;
+
+	const safe_ptr<diagnostics::graph>				graph_;
+	boost::timer									frame_timer_;
+
+	int64_t											position_;
+	safe_ptr<core::basic_frame>						last_frame_;
+	std::shared_ptr<AVCodecContext>					decoder_;
+	boost::unique_future<std::shared_ptr<core::basic_frame>>	next_frame_;
+
+	executor										executor_;
+public:
+	replay_producer(const safe_ptr<core::frame_factory>& frame_factory, const std::shared_ptr<replay_buffer>& buffer, int64_t in, int64_t out)
+		: frame_factory_(frame_factory)
+		, buffer_(buffer)
+		, in_(in)
+		, out_(out)
+		, position_(in)
+		, last_frame_(core::basic_frame::empty())
+		, executor_(print())
+	{
+		auto decoder = avcodec_find_decoder(CODEC_ID_MJPEG);
+		if(!decoder)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Codec not found."));
+
+		decoder_.reset(avcodec_alloc_context3(decoder), [](AVCodecContext* c)
+		{
+			LOG_ON_ERROR2(avcodec_close(c), "[replay_producer]");
+			av_free(c);
+		});
+
+		decoder_->width			= buffer_->format_desc().width;
+		decoder_->height		= buffer_->format_desc().height;
+		decoder_->thread_count	= boost::thread::hardware_concurrency();
+
+		THROW_ON_ERROR2(avcodec_open2(decoder_.get(), decoder, nullptr), "[replay_producer]");
+
+		graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
+		graph_->set_color("underflow", diagnostics::color(0.6f, 0.3f, 0.9f));
+		graph_->set_color("skipped-frame", diagnostics::color(0.9f, 0.3f, 0.3f));
+		graph_->set_text(print());
+		diagnostics::register_graph(graph_);
+
+		decode_ahead(position_, core::frame_producer::NO_HINT);
+
+		CASPAR_LOG(info) << print() << L" Playing " << in_ << L" to " << (out_ < 0 ? L"live" : boost::lexical_cast<std::wstring>(out_)) << L".";
+	}
+
+	// frame_producer
+
+	virtual safe_ptr<core::basic_frame> receive(int hints) override
+	{
+		frame_timer_.restart();
+
+		if(finished())
+			return last_frame();
+
+		auto frame = next_frame_.get();
+
+		if(!frame)
+		{
+			// Frames older than the buffer have been dropped. Newer ones have not been recorded yet.
+			if(position_ < buffer_->first())
+			{
+				graph_->set_tag("skipped-frame");
+				position_ = buffer_->first();
+			}
+			else
+				graph_->set_tag("underflow");
+
+			decode_ahead(position_, hints);
+			return core::basic_frame::late();
+		}
+
+		last_frame_ = make_safe_ptr(frame);
+		++position_;
+
+		if(!finished())
+			decode_ahead(position_, hints);
+
+		graph_->set_value("frame-time", frame_timer_.elapsed()*buffer_->format_desc().fps*0.5);
+
+		monitor_subject_	<< core::monitor::message("/replay/frame")	% position_ % (out_ < 0 ? buffer_->last() : out_)
+							<< core::monitor::message("/replay/name")	% buffer_->name();
+
+		return last_frame_;
+	}
+
+	virtual safe_ptr<core::basic_frame> last_frame() const override
+	{
+		return disable_audio(last_frame_);
+	}
+
+	virtual uint32_t nb_frames() const override
+	{
+		return out_ < 0 ? std::numeric_limits<uint32_t>::max() : static_cast<uint32_t>(out_ - in_ + 1);
+	}
+
+	virtual std::wstring print() const override
+	{
+		return L"replay_producer[" + buffer_->name() + L"]";
+	}
+
+	virtual boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type", L"replay-producer");
+		info.add(L"name", buffer_->name());
+		info.add(L"in", in_);
+		info.add(L"out", out_);
+		info.add(L"position", position_);
+		info.add_child(L"buffer", buffer_->info());
+		return info;
+	}
+
+	core::monitor::subject& monitor_output()
+	{
+		return monitor_subject_;
+	}
+private:
+	bool finished() const
+	{
+		return out_ >= 0 && position_ > out_;
+	}
+
+	void decode_ahead(int64_t number, int hints)
+	{
+		next_frame_ = executor_.begin_invoke([=]() -> std::shared_ptr<core::basic_frame>
+		{
+			try
+			{
+				return decode(number, hints);
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				return nullptr;
+			}
+		});
+	}
+
+	std::shared_ptr<core::basic_frame> decode(int64_t number, int hints)
+	{
+		auto replay = buffer_->get(number);
+		if(!replay)
+			return nullptr;
+
+		AVPacket pkt;
+		av_init_packet(&pkt);
+		pkt.data = const_cast<uint8_t*>(replay->video.data());
+		pkt.size = static_cast<int>(replay->video_size);
+
+		safe_ptr<AVFrame> decoded(avcodec_alloc_frame(), av_free);
+		int got_picture = 0;
+
+		THROW_ON_ERROR2(avcodec_decode_video2(decoder_.get(), decoded.get(), &got_picture, &pkt), "[replay_producer]");
+
+		if(!got_picture)
+			return nullptr;
+
+		// The pictures hold studio swing yuv422p, see the replay consumer.
+		if(decoded->format == PIX_FMT_YUVJ422P)
+			decoded->format = PIX_FMT_YUV422P;
+
+		decoded->interlaced_frame	= replay->mode != core::field_mode::progressive;
+		decoded->top_field_first	= replay->mode == core::field_mode::upper;
+
+		std::shared_ptr<core::write_frame> frame = make_write_frame(this, decoded, frame_factory_, hints, buffer_->channel_layout());
+		frame->audio_data().assign(replay->audio.begin(), replay->audio.end());
+
+		return frame;
+	}
+};
+
+// REPLAY name [IN frame] [OUT frame|LENGTH frames] | [LAST seconds] [LIVE]
+safe_ptr<core::frame_producer> create_replay_producer(
+		const safe_ptr<core::frame_factory>& frame_factory,
+		const core::parameters& params)
+{
+	if(params.size() < 2 || params[0] != L"REPLAY")
+		return core::frame_producer::empty();
+
+	auto buffer = find_replay_buffer(params[1]);
+	if(!buffer)
+		BOOST_THROW_EXCEPTION(file_not_found() << msg_info("No replay buffer named " + narrow(params[1]) + "."));
+
+	const auto first	= buffer->first();
+	const auto last		= buffer->last();
+
+	if(last < 0)
+		BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("The replay buffer is empty."));
+
+	auto in		= params.get(L"IN", first);
+	auto out	= params.get(L"OUT", last);
+
+	if(params.has(L"LAST"))
+		in = last - static_cast<int64_t>(params.get(L"LAST", 0.0) * buffer->format_desc().fps) + 1;
+	
+	if(params.has(L"LENGTH"))
+		out = in + params.get(L"LENGTH", static_cast<int64_t>(0)) - 1;
+
+	if(params.has(L"LIVE"))
+		out = -1;
+
+	in = std::max(in, first);
+
+	if(out >= 0 && out < in)
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("OUT is before IN."));
+
+	return create_producer_print_proxy(
+		   create_producer_destroy_proxy(
+			make_safe<replay_producer>(frame_factory, buffer, in, out)));
+}
+
+}}
@@ -0,0 +1,803 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "shared_decoder.h"
+
+#include "../input/input.h"
+#include "../util/util.h"
+#include "../audio/audio_decoder.h"
+#include "../video/video_decoder.h"
+#include "../../ffmpeg_error.h"
+
+#include <common/env.h>
+#include <common/diagnostics/graph.h>
+#include <common/exception/exceptions.h>
+
+#include <core/video_format.h>
+
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
+
+#include <boost/chrono.hpp>
+#include <boost/chrono/process_cpu_clocks.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <boost/timer.hpp>
+
+#include <deque>
+#include <limits>
+#include <map>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C" 
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavcodec/avcodec.h>
+	#include <libavformat/avformat.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+static const size_t MAX_SHARED_VIDEO_FRAMES = 32;
+static const size_t MAX_SHARED_AUDIO_FRAMES = 256;
+
+// How long the frames from where a shareable pipeline (re)starts are kept for producers that join late.
+static const size_t JOIN_WINDOW_VIDEO_FRAMES = MAX_SHARED_VIDEO_FRAMES / 2;
+static const size_t JOIN_WINDOW_AUDIO_FRAMES = MAX_SHARED_AUDIO_FRAMES / 2;
+
+namespace caspar { namespace ffmpeg {
+
+struct subscriber_cursor
+{
+	int64_t				video;
+	int64_t				audio;
+	tbb::atomic<bool>	evicted;
+};
+
+// Where a stream of a pipeline last started over from its start frame, either when it was created or 
+// when it looped or was seeked back to it. Producers that open the file later join there, as long as 
+// those frames are still kept. Restarts are counted so that the video and audio restarts can be paired.
+struct restart_point
+{
+	int64_t		position;	// -1 once it is no longer kept.
+	int64_t		count;
+	int64_t		awaited_seek;	// Flushes are ignored until the one of a seek has been decoded, -1 if none.
+
+	restart_point()
+		: position(0)
+		, count(1)
+		, awaited_seek(-1)
+	{
+	}
+};
+
+struct decoding_pipeline : boost::noncopyable
+{
+	const std::wstring												filename_;
+	const uint32_t													start_;
+	const bool														thumbnail_mode_;
+	const bool														shareable_;
+
+	input															input_;
+	std::unique_ptr<video_decoder>									video_decoder_;
+	std::unique_ptr<audio_decoder>									audio_decoder_;
+
+	mutable tbb::mutex												video_mutex_;
+	std::deque<std::pair<std::shared_ptr<AVFrame>, uint32_t>>		video_;
+	int64_t															video_base_;
+	restart_point													video_restart_;
+	double															video_decode_time_;
+	int64_t															nb_decoded_video_;
+
+	mutable tbb::mutex												audio_mutex_;
+	std::deque<std::shared_ptr<core::audio_buffer>>					audio_;
+	int64_t															audio_base_;
+	restart_point													audio_restart_;
+
+	std::vector<std::shared_ptr<subscriber_cursor>>					cursors_; // Guarded by both video_mutex_ and audio_mutex_.
+	bool															subscribed_; // Likewise.
+
+	decoding_pipeline(
+			const safe_ptr<diagnostics::graph>& graph, 
+			const std::wstring& filename, 
+			FFMPEG_Resource resource_type, 
+			bool loop, 
+			uint32_t start, 
+			uint32_t length, 
+			bool thumbnail_mode, 
+			const ffmpeg_producer_params& vid_params,
+			const core::video_format_desc& format_desc,
+			const std::wstring& custom_channel_order,
+			bool shareable)
+		: filename_(filename)
+		, start_(start)
+		, thumbnail_mode_(thumbnail_mode)
+		, shareable_(shareable)
+		, input_(graph, filename, resource_type, loop, start, length, thumbnail_mode, vid_params)
+		, video_base_(0)
+		, video_decode_time_(0.0)
+		, nb_decoded_video_(0)
+		, audio_base_(0)
+		, subscribed_(false)
+	{
+		try
+		{
+			video_decoder_.reset(new video_decoder(input_.context()));
+		}
+		catch(averror_stream_not_found&)
+		{
+			//CASPAR_LOG(warning) << print() << " No video-stream found. Running without video.";	
+		}
+		catch(...)
+		{
+			if (!thumbnail_mode_)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				CASPAR_LOG(warning) << print() << "Failed to open video-stream. Running without video.";	
+			}
+		}
+
+		if (!thumbnail_mode_)
+		{
+			try
+			{
+				audio_decoder_.reset(new audio_decoder(input_.context(), format_desc, custom_channel_order));
+			}
+			catch(averror_stream_not_found&)
+			{
+				//CASPAR_LOG(warning) << print() << " No audio-stream found. Running without audio.";	
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				CASPAR_LOG(warning) << print() << " Failed to open audio-stream. Running without audio.";		
+			}
+		}
+
+		if(!video_decoder_ && !audio_decoder_)
+			BOOST_THROW_EXCEPTION(averror_stream_not_found() << msg_info("No streams found"));
+	}
+
+	// The first subscriber starts at the beginning. Later ones join at the last restart, if it is still kept.
+	std::shared_ptr<subscriber_cursor> try_subscribe(bool loop)
+	{
+		tbb::mutex::scoped_lock video_lock(video_mutex_);
+		tbb::mutex::scoped_lock audio_lock(audio_mutex_);
+
+		if(subscribed_)
+		{
+			if(!shareable_ || input_.loop() != loop)
+				return nullptr;
+
+			if(video_decoder_ && video_restart_.position < 0)
+				return nullptr;
+
+			if(audio_decoder_ && audio_restart_.position < 0)
+				return nullptr;
+
+			if(video_decoder_ && audio_decoder_ && video_restart_.count != audio_restart_.count)
+				return nullptr;
+		}
+
+		auto cursor = std::make_shared<subscriber_cursor>();
+		cursor->video	= subscribed_ ? std::max(video_base_, video_restart_.position) : video_base_;
+		cursor->audio	= subscribed_ ? std::max(audio_base_, audio_restart_.position) : audio_base_;
+		cursor->evicted = false;
+
+		subscribed_ = true;
+
+		cursors_.push_back(cursor);
+
+		return cursor;
+	}
+
+	void unsubscribe(const std::shared_ptr<subscriber_cursor>& cursor)
+	{
+		tbb::mutex::scoped_lock video_lock(video_mutex_);
+		tbb::mutex::scoped_lock audio_lock(audio_mutex_);
+
+		cursors_.erase(std::remove(cursors_.begin(), cursors_.end(), cursor), cursors_.end());
+
+		release_video();
+		release_audio();
+	}
+
+	size_t subscribers() const
+	{
+		tbb::mutex::scoped_lock video_lock(video_mutex_);
+		return cursors_.size();
+	}
+
+	void pump()
+	{
+		tbb::mutex::scoped_lock video_lock(video_mutex_);
+		tbb::mutex::scoped_lock audio_lock(audio_mutex_);
+
+		std::shared_ptr<AVPacket> pkt;
+
+		for(int n = 0; n < 32 && ((video_decoder_ && !video_decoder_->ready()) || (audio_decoder_ && !audio_decoder_->ready())) && input_.try_pop(pkt); ++n)
+		{
+			if(video_decoder_)
+				video_decoder_->push(pkt);
+			if(audio_decoder_)
+				audio_decoder_->push(pkt);
+		}
+	}
+
+	std::shared_ptr<AVFrame> poll_video(subscriber_cursor& cursor, uint32_t& file_frame_number)
+	{
+		tbb::mutex::scoped_lock lock(video_mutex_);
+
+		if(cursor.evicted)
+			return nullptr;
+
+		if(cursor.video == video_base_ + static_cast<int64_t>(video_.size()))
+		{
+			boost::timer decode_timer;
+			auto frame = video_decoder_->poll();
+			video_decode_time_ += decode_timer.elapsed();
+
+			if(!frame)
+				return nullptr;
+
+			++nb_decoded_video_;
+			video_.push_back(std::make_pair(frame, video_decoder_->file_frame_number()));
+
+			const auto end = video_base_ + static_cast<int64_t>(video_.size());
+
+			if(frame == flush_video())
+				restart(video_restart_, video_decoder_->file_frame_number(), end - 1);
+			else if(video_restart_.position >= 0 && end - video_restart_.position > static_cast<int64_t>(JOIN_WINDOW_VIDEO_FRAMES))
+				video_restart_.position = -1;
+
+			if(video_.size() > MAX_SHARED_VIDEO_FRAMES)
+				evict(video_base_, &subscriber_cursor::video);
+		}
+
+		auto item = video_[static_cast<size_t>(cursor.video - video_base_)];
+		++cursor.video;
+
+		release_video();
+
+		file_frame_number = item.second;
+
+		if(item.first == flush_video() || item.first == empty_video())
+			return item.first;
+
+		// The stored frame may only be handed out once nothing else can read it again, neither another 
+		// subscriber nor a producer that joins later, e.g. at the restart point.
+		const bool retained = cursor.video - 1 >= video_base_;
+
+		if(!shareable_ && !retained)
+			return item.first;
+
+		// Every subscriber gets its own reference since filters take over the references of pushed frames, 
+		// and the muxer changes the frames it is handed.
+		auto frame = item.first;
+		auto clone = av_frame_clone(frame.get());
+		if(!clone)
+			BOOST_THROW_EXCEPTION(bad_alloc());
+
+		return std::shared_ptr<AVFrame>(clone, [frame](AVFrame* p)
+		{
+			av_frame_free(&p);
+		});
+	}
+
+	std::shared_ptr<core::audio_buffer> poll_audio(subscriber_cursor& cursor)
+	{
+		tbb::mutex::scoped_lock lock(audio_mutex_);
+
+		if(cursor.evicted)
+			return nullptr;
+
+		if(cursor.audio == audio_base_ + static_cast<int64_t>(audio_.size()))
+		{
+			auto audio = audio_decoder_->poll();
+
+			if(!audio)
+				return nullptr;
+
+			audio_.push_back(audio);
+
+			const auto end = audio_base_ + static_cast<int64_t>(audio_.size());
+
+			if(audio == flush_audio())
+				restart(audio_restart_, audio_decoder_->file_frame_number(), end - 1);
+			else if(audio_restart_.position >= 0 && end - audio_restart_.position > static_cast<int64_t>(JOIN_WINDOW_AUDIO_FRAMES))
+				audio_restart_.position = -1;
+
+			if(audio_.size() > MAX_SHARED_AUDIO_FRAMES)
+				evict(audio_base_, &subscriber_cursor::audio);
+		}
+
+		auto audio = audio_[static_cast<size_t>(cursor.audio - audio_base_)];
+		++cursor.audio;
+
+		release_audio();
+
+		return audio;
+	}
+
+	bool at_end(const subscriber_cursor& cursor) const
+	{
+		if(video_decoder_)
+		{
+			tbb::mutex::scoped_lock lock(video_mutex_);
+			return cursor.video == video_base_ + static_cast<int64_t>(video_.size());
+		}
+
+		tbb::mutex::scoped_lock lock(audio_mutex_);
+		return cursor.audio == audio_base_ + static_cast<int64_t>(audio_.size());
+	}
+
+	boost::unique_future<bool> seek(uint32_t target)
+	{
+		tbb::mutex::scoped_lock video_lock(video_mutex_);
+		tbb::mutex::scoped_lock audio_lock(audio_mutex_);
+
+		// Frames decoded up to the seek are not a start any longer. Both streams continue counting 
+		// from the same restart, and ignore flushes that were queued before the seek.
+		const auto count = std::max(video_restart_.count, audio_restart_.count);
+
+		video_restart_.position		= -1;
+		video_restart_.count		= count;
+		video_restart_.awaited_seek	= target;
+		audio_restart_.position		= -1;
+		audio_restart_.count		= count;
+		audio_restart_.awaited_seek	= target;
+
+		return input_.seek(target);
+	}
+
+	void loop(bool value)
+	{
+		input_.loop(value);
+	}
+
+	double decode_time() const
+	{
+		tbb::mutex::scoped_lock lock(video_mutex_);
+		return nb_decoded_video_ > 0 ? video_decode_time_ / static_cast<double>(nb_decoded_video_) : 0.0;
+	}
+
+	std::wstring print() const
+	{
+		return L"ffmpeg[" + boost::filesystem::wpath(filename_).filename() + L"]";
+	}
+
+private:
+	void restart(restart_point& restart, uint32_t target, int64_t position)
+	{
+		if(restart.awaited_seek >= 0)
+		{
+			if(target != restart.awaited_seek)
+				return;
+
+			restart.awaited_seek = -1;
+		}
+
+		++restart.count;
+		restart.position = shareable_ && target == start_ ? position : -1;
+	}
+
+	void evict(int64_t base, int64_t subscriber_cursor::* position)
+	{
+		// Subscribers that haven't consumed the oldest frame continue on their own pipeline.
+		size_t active = 0;
+		BOOST_FOREACH(auto& cursor, cursors_)
+		{
+			if(!cursor->evicted)
+				++active;
+		}
+
+		if(active < 2)
+			return;
+
+		BOOST_FOREACH(auto& cursor, cursors_)
+		{
+			if(!cursor->evicted && (*cursor).*position == base)
+				cursor->evicted = true;
+		}
+	}
+
+	template<typename T>
+	void release(std::deque<T>& items, int64_t& base, const restart_point& restart, int64_t subscriber_cursor::* position)
+	{
+		auto min_position = base + static_cast<int64_t>(items.size());
+
+		if(shareable_ && restart.position >= 0)
+			min_position = std::min(min_position, restart.position);
+
+		BOOST_FOREACH(auto& cursor, cursors_)
+		{
+			if(!cursor->evicted)
+				min_position = std::min(min_position, (*cursor).*position);
+		}
+
+		while(base < min_position)
+		{
+			items.pop_front();
+			++base;
+		}
+	}
+
+	void release_video()
+	{
+		release(video_, video_base_, video_restart_, &subscriber_cursor::video);
+	}
+
+	void release_audio()
+	{
+		release(audio_, audio_base_, audio_restart_, &subscriber_cursor::audio);
+	}
+};
+
+class pipeline_registry : boost::noncopyable
+{
+	tbb::mutex												mutex_;
+	std::map<std::wstring, std::weak_ptr<decoding_pipeline>>	pipelines_;
+public:
+	static pipeline_registry& instance()
+	{
+		static pipeline_registry registry;
+		return registry;
+	}
+
+	std::shared_ptr<decoding_pipeline> find(const std::wstring& key, bool loop, std::shared_ptr<subscriber_cursor>& cursor)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		auto it = pipelines_.find(key);
+		if(it == pipelines_.end())
+			return nullptr;
+
+		auto pipeline = it->second.lock();
+		if(!pipeline)
+		{
+			pipelines_.erase(it);
+			return nullptr;
+		}
+
+		cursor = pipeline->try_subscribe(loop);
+
+		return cursor ? pipeline : nullptr;
+	}
+
+	void insert(const std::wstring& key, const std::shared_ptr<decoding_pipeline>& pipeline)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+		
+		for(auto it = pipelines_.begin(); it != pipelines_.end();)
+		{
+			if(it->second.expired())
+				it = pipelines_.erase(it);
+			else
+				++it;
+		}
+
+		pipelines_[key] = pipeline;
+	}
+};
+
+struct shared_decoder::implementation : boost::noncopyable
+{
+	const safe_ptr<diagnostics::graph>	graph_;
+	const std::wstring					filename_;
+	const FFMPEG_Resource				resource_type_;
+	const uint32_t						start_;
+	const uint32_t						length_;
+	const bool							thumbnail_mode_;
+	const ffmpeg_producer_params		vid_params_;
+	const core::video_format_desc		format_desc_;
+	const std::wstring					custom_channel_order_;
+
+	std::shared_ptr<decoding_pipeline>	pipeline_;
+	std::shared_ptr<subscriber_cursor>	cursor_;
+	uint32_t							file_frame_number_;
+
+	implementation(
+			const safe_ptr<diagnostics::graph>& graph, 
+			const std::wstring& filename, 
+			FFMPEG_Resource resource_type, 
+			bool loop, 
+			uint32_t start, 
+			uint32_t length, 
+			bool thumbnail_mode, 
+			const ffmpeg_producer_params& vid_params,
+			const core::video_format_desc& format_desc,
+			const std::wstring& custom_channel_order)
+		: graph_(graph)
+		, filename_(filename)
+		, resource_type_(resource_type)
+		, start_(start)
+		, length_(length)
+		, thumbnail_mode_(thumbnail_mode)
+		, vid_params_(vid_params)
+		, format_desc_(format_desc)
+		, custom_channel_order_(custom_channel_order)
+		, file_frame_number_(0)
+	{
+		const bool shareable = 
+				resource_type_ == FFMPEG_FILE && 
+				!thumbnail_mode_ && 
+				vid_params_.options.empty() && 
+				env::properties().get(L"configuration.ffmpeg.shared-decoding", false);
+
+		if(!shareable)
+		{
+			attach(create_pipeline(loop, false));
+			return;
+		}
+
+		const auto key = pipeline_key(loop);
+
+		pipeline_ = pipeline_registry::instance().find(key, loop, cursor_);
+
+		if(!pipeline_)
+		{
+			attach(create_pipeline(loop, true));
+			pipeline_registry::instance().insert(key, pipeline_);
+		}
+	}
+
+	~implementation()
+	{
+		pipeline_->unsubscribe(cursor_);
+	}
+
+	std::wstring pipeline_key(bool loop) const
+	{
+		return filename_ 
+			+ L"|" + boost::lexical_cast<std::wstring>(start_) 
+			+ L"|" + boost::lexical_cast<std::wstring>(length_) 
+			+ L"|" + boost::lexical_cast<std::wstring>(loop) 
+			+ L"|" + boost::lexical_cast<std::wstring>(format_desc_.audio_sample_rate) 
+			+ L"|" + custom_channel_order_;
+	}
+
+	std::shared_ptr<decoding_pipeline> create_pipeline(bool loop, bool shareable) const
+	{
+		return std::shared_ptr<decoding_pipeline>(new decoding_pipeline(graph_, filename_, resource_type_, loop, start_, length_, thumbnail_mode_, vid_params_, format_desc_, custom_channel_order_, shareable));
+	}
+
+	void attach(const std::shared_ptr<decoding_pipeline>& pipeline)
+	{
+		auto cursor = pipeline->try_subscribe(pipeline->input_.loop());
+		CASPAR_VERIFY(cursor);
+
+		if(pipeline_)
+			pipeline_->unsubscribe(cursor_);
+
+		pipeline_	= pipeline;
+		cursor_		= cursor;
+	}
+
+	boost::unique_future<bool> detach(bool loop, uint32_t target)
+	{
+		auto pipeline = create_pipeline(loop, false);
+
+		auto result = pipeline->seek(target);
+		attach(pipeline);
+
+		return std::move(result);
+	}
+
+	void pump()
+	{
+		if(cursor_->evicted)
+		{
+			CASPAR_LOG(info) << pipeline_->print() << L" Fell behind shared decoding. Continuing on a private pipeline.";
+			detach(pipeline_->input_.loop(), file_frame_number_);
+		}
+
+		pipeline_->pump();
+	}
+
+	std::shared_ptr<AVFrame> poll_video()
+	{
+		return pipeline_->poll_video(*cursor_, file_frame_number_);
+	}
+
+	std::shared_ptr<core::audio_buffer> poll_audio()
+	{
+		return pipeline_->poll_audio(*cursor_);
+	}
+
+	bool eof() const
+	{
+		return pipeline_->input_.eof() && pipeline_->at_end(*cursor_);
+	}
+
+	void loop(bool value)
+	{
+		if(value == pipeline_->input_.loop())
+			return;
+
+		if(pipeline_->subscribers() > 1)
+			detach(value, file_frame_number_);
+		else
+			pipeline_->loop(value);
+	}
+
+	boost::unique_future<bool> seek(uint32_t target)
+	{
+		if(pipeline_->subscribers() > 1)
+			return detach(pipeline_->input_.loop(), target);
+
+		return pipeline_->seek(target);
+	}
+
+	uint32_t nb_frames() const
+	{
+		uint32_t nb_frames = 0;
+		nb_frames = std::max(nb_frames, pipeline_->video_decoder_ ? pipeline_->video_decoder_->nb_frames() : 0);
+		nb_frames = std::max(nb_frames, pipeline_->audio_decoder_ ? pipeline_->audio_decoder_->nb_frames() : 0);
+		return nb_frames;
+	}
+};
+
+shared_decoder::shared_decoder(
+		const safe_ptr<diagnostics::graph>& graph, 
+		const std::wstring& filename, 
+		FFMPEG_Resource resource_type, 
+		bool loop, 
+		uint32_t start, 
+		uint32_t length, 
+		bool thumbnail_mode, 
+		const ffmpeg_producer_params& vid_params,
+		const core::video_format_desc& format_desc,
+		const std::wstring& custom_channel_order)
+	: impl_(new implementation(graph, filename, resource_type, loop, start, length, thumbnail_mode, vid_params, format_desc, custom_channel_order)){}
+void shared_decoder::pump(){impl_->pump();}
+std::shared_ptr<AVFrame> shared_decoder::poll_video(){return impl_->poll_video();}
+std::shared_ptr<core::audio_buffer> shared_decoder::poll_audio(){return impl_->poll_audio();}
+bool shared_decoder::has_video() const{return impl_->pipeline_->video_decoder_ != nullptr;}
+bool shared_decoder::has_audio() const{return impl_->pipeline_->audio_decoder_ != nullptr;}
+bool shared_decoder::eof() const{return impl_->eof();}
+void shared_decoder::loop(bool value){impl_->loop(value);}
+bool shared_decoder::loop() const{return impl_->pipeline_->input_.loop();}
+boost::unique_future<bool> shared_decoder::seek(uint32_t target){return impl_->seek(target);}
+safe_ptr<AVFormatContext> shared_decoder::context(){return impl_->pipeline_->input_.context();}
+size_t shared_decoder::width() const{return impl_->pipeline_->video_decoder_->width();}
+size_t shared_decoder::height() const{return impl_->pipeline_->video_decoder_->height();}
+bool shared_decoder::is_progressive() const{return impl_->pipeline_->video_decoder_->is_progressive();}
+uint32_t shared_decoder::nb_frames() const{return impl_->nb_frames();}
+uint32_t shared_decoder::file_frame_number() const{return impl_->file_frame_number_;}
+const core::channel_layout& shared_decoder::channel_layout() const{return impl_->pipeline_->audio_decoder_->channel_layout();}
+size_t shared_decoder::subscribers() const{return impl_->pipeline_->subscribers();}
+double shared_decoder::decode_time() const{return impl_->pipeline_->decode_time();}
+std::wstring shared_decoder::print_video() const{return impl_->pipeline_->video_decoder_->print();}
+std::wstring shared_decoder::print_audio() const{return impl_->pipeline_->audio_decoder_->print();}
+
+static double process_cpu_millis()
+{
+	using namespace boost::chrono;
+
+	return duration<double, boost::milli>(process_user_cpu_clock::now().time_since_epoch()).count() 
+		 + duration<double, boost::milli>(process_system_cpu_clock::now().time_since_epoch()).count();
+}
+
+// Polls the video and the audio of every producer in turn, the way their frame_muxers would.
+static boost::property_tree::wptree run_decoding(const std::wstring& filename, const core::video_format_desc& format_desc, int producers, int frames, bool shared)
+{
+	auto graph = make_safe<diagnostics::graph>();
+
+	std::vector<std::shared_ptr<decoding_pipeline>> pipelines;
+	std::vector<std::shared_ptr<subscriber_cursor>> cursors;
+
+	for(int n = 0; n < producers; ++n)
+	{
+		if(!shared || pipelines.empty())
+			pipelines.push_back(std::make_shared<decoding_pipeline>(graph, filename, FFMPEG_FILE, false, 0, std::numeric_limits<uint32_t>::max(), false, ffmpeg_producer_params(), format_desc, L"", shared));
+
+		cursors.push_back(pipelines.back()->try_subscribe(false));
+	}
+
+	const auto start_cpu	= process_cpu_millis();
+	const auto start		= boost::chrono::high_resolution_clock::now();
+
+	int decoded = 0;
+
+	for(; decoded < frames; ++decoded)
+	{
+		bool finished = false;
+
+		for(int n = 0; n < producers && !finished; ++n)
+		{
+			auto& pipeline	= *pipelines[shared ? 0 : n];
+			auto& cursor	= *cursors[n];
+
+			uint32_t file_frame_number = 0;
+
+			while(pipeline.video_decoder_ && !pipeline.poll_video(cursor, file_frame_number))
+			{
+				if(cursor.evicted || (pipeline.input_.eof() && pipeline.at_end(cursor)))
+				{
+					finished = true;
+					break;
+				}
+
+				pipeline.pump();
+				boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+			}
+
+			if(pipeline.audio_decoder_)
+			{
+				pipeline.pump();
+				while(pipeline.poll_audio(cursor));
+			}
+		}
+
+		if(finished)
+			break;
+	}
+
+	const auto cpu_millis	= process_cpu_millis() - start_cpu;
+	const auto wall_millis	= boost::chrono::duration<double, boost::milli>(boost::chrono::high_resolution_clock::now() - start).count();
+
+	for(size_t n = 0; n < cursors.size(); ++n)
+		pipelines[shared ? 0 : n]->unsubscribe(cursors[n]);
+
+	boost::property_tree::wptree info;
+	info.add(L"pipelines",				pipelines.size());
+	info.add(L"frames",					decoded);
+	info.add(L"cpu-millis",				cpu_millis);
+	info.add(L"cpu-millis-per-frame",	decoded > 0 ? cpu_millis / decoded : 0.0);
+	info.add(L"wall-millis",			wall_millis);
+
+	return info;
+}
+
+boost::property_tree::wptree benchmark_shared_decoding(const std::wstring& filename, const core::video_format_desc& format_desc, int producers, int frames)
+{
+	if(producers < 1)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("producers") << arg_value_info(boost::lexical_cast<std::string>(producers)));
+
+	if(frames < 1)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("frames") << arg_value_info(boost::lexical_cast<std::string>(frames)));
+
+	CASPAR_LOG(info) << L"[shared-decoding-benchmark] Decoding " << frames << L" frames of " << filename << L" for " << producers << L" producers.";
+
+	auto without_sharing	= run_decoding(filename, format_desc, producers, frames, false);
+	auto with_sharing		= run_decoding(filename, format_desc, producers, frames, true);
+
+	const auto cpu_without	= without_sharing.get(L"cpu-millis", 0.0);
+	const auto cpu_with		= with_sharing.get(L"cpu-millis", 0.0);
+
+	boost::property_tree::wptree info;
+	info.add(L"shared-decoding.file",						filename);
+	info.add(L"shared-decoding.producers",					producers);
+	info.add_child(L"shared-decoding.without-sharing",		without_sharing);
+	info.add_child(L"shared-decoding.with-sharing",			with_sharing);
+	info.add(L"shared-decoding.cpu-saved-percent",			cpu_without > 0.0 ? (cpu_without - cpu_with) * 100.0 / cpu_without : 0.0);
+
+	return info;
+}
+
+}}
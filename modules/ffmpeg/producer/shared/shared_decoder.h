@@ -0,0 +1,117 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "../../ffmpeg_params.h"
+
+#include <common/memory/safe_ptr.h>
+
+#include <core/mixer/audio/audio_mixer.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread/future.hpp>
+
+#include <cstdint>
+#include <string>
+
+struct AVFormatContext;
+struct AVFrame;
+
+namespace caspar {
+
+namespace diagnostics {
+
+class graph;
+
+}
+
+namespace core {
+
+struct video_format_desc;
+struct channel_layout;
+
+}
+
+namespace ffmpeg {
+
+// Demuxes and decodes a resource (input, video_decoder and audio_decoder) on behalf of a producer. 
+// When configuration/ffmpeg/shared-decoding is enabled, producers that play the same file from 
+// the same position with the same parameters subscribe to a single decoding pipeline, and decoded 
+// frames are kept until every subscriber has consumed them. The frames from where a pipeline starts 
+// or loops are kept for a moment, so that producers opened shortly after can still join. A subscriber 
+// that seeks, changes looping or falls too far behind the others continues on a private pipeline.
+class shared_decoder : boost::noncopyable
+{
+public:
+	explicit shared_decoder(
+			const safe_ptr<diagnostics::graph>& graph, 
+			const std::wstring& filename, 
+			FFMPEG_Resource resource_type, 
+			bool loop, 
+			uint32_t start, 
+			uint32_t length, 
+			bool thumbnail_mode, 
+			const ffmpeg_producer_params& vid_params,
+			const core::video_format_desc& format_desc,
+			const std::wstring& custom_channel_order);
+
+	// Feeds demuxed packets to the decoders. Call before polling.
+	void pump();
+
+	std::shared_ptr<AVFrame>			poll_video();
+	std::shared_ptr<core::audio_buffer>	poll_audio();
+
+	bool has_video() const;
+	bool has_audio() const;
+
+	bool eof() const;
+
+	void loop(bool value);
+	bool loop() const;
+
+	boost::unique_future<bool> seek(uint32_t target);
+
+	safe_ptr<AVFormatContext> context();
+
+	size_t		width() const;
+	size_t		height() const;
+	bool		is_progressive() const;
+	uint32_t	nb_frames() const;
+	uint32_t	file_frame_number() const;
+
+	const core::channel_layout& channel_layout() const;
+
+	size_t		subscribers() const;
+	double		decode_time() const;
+
+	std::wstring print_video() const;
+	std::wstring print_audio() const;
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+// Decodes the start of a file for the given number of producers, first on a private pipeline each 
+// and then on one shared pipeline, and reports the process CPU time of both. Blocks until done.
+boost::property_tree::wptree benchmark_shared_decoding(const std::wstring& filename, const core::video_format_desc& format_desc, int producers, int frames);
+
+}}
@@ -425,6 +425,38 @@ safe_ptr<AVCodecContext> open_codec(AVFormatContext& context, enum AVMediaType t
 	return safe_ptr<AVCodecContext>(context.streams[index]->codec, tbb_avcodec_close);
 }
 
+void fix_meta_data(AVFormatContext& context)
+{
+	auto video_index = av_find_best_stream(&context, AVMEDIA_TYPE_VIDEO, -1, -1, 0, 0);
+
+	if(video_index > -1)
+	{
+		auto video_stream	= context.streams[video_index];
+		auto video_context	= context.streams[video_index]->codec;
+						
+		if(boost::filesystem2::path(context.filename).extension() == ".flv")
+		{
+			try
+			{
+				auto meta = read_flv_meta_info(context.filename);
+				double fps = boost::lexical_cast<double>(meta["framerate"]);
+				video_stream->nb_frames = static_cast<int64_t>(boost::lexical_cast<double>(meta["duration"])*fps);
+			}
+			catch(...){}
+		}
+		else
+		{
+			auto stream_time	= video_stream->time_base;
+			auto duration		= video_stream->duration;
+			auto codec_time		= video_context->time_base;
+			auto ticks			= video_context->ticks_per_frame;
+
+			if(video_stream->nb_frames == 0)
+				video_stream->nb_frames = (duration*stream_time.num*codec_time.den)/(stream_time.den*codec_time.num*ticks);	
+		}
+	}
+}
+
 std::wstring print_mode(size_t width, size_t height, double fps, bool interlaced)
 {
 	std::wostringstream fps_ss;
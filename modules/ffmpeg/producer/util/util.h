@@ -75,6 +75,7 @@ bool is_sane_fps(AVRational time_base);
 AVRational fix_time_base(AVRational time_base);
 
 double read_fps(AVFormatContext& context, double fail_value);
+void fix_meta_data(AVFormatContext& context);
 
 std::wstring print_mode(size_t width, size_t height, double fps, bool interlaced);
 
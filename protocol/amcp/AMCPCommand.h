@@ -32,6 +32,9 @@
 
 namespace caspar { namespace protocol { namespace amcp {
 
+	class media_index;
+	class session_replayer;
+
 	enum AMCPCommandScheduling
 	{
 		Default = 0,
@@ -39,6 +42,14 @@ namespace caspar { namespace protocol { namespace amcp {
 		ImmediatelyAndClear
 	};
 
+	// Background commands run on a pool of queues of their own, so that they never hold up 
+	// the real-time ones on the general and the channel queues.
+	enum AMCPCommandLane
+	{
+		RealTime = 0,
+		Background
+	};
+
 	class AMCPCommand
 	{
 		AMCPCommand(const AMCPCommand&);
@@ -52,6 +63,9 @@ namespace caspar { namespace protocol { namespace amcp {
 		virtual AMCPCommandScheduling GetDefaultScheduling() = 0;
 		virtual int GetMinimumParameters() = 0;
 
+		// Housekeeping that may take long, such as listing media or generating thumbnails.
+		virtual AMCPCommandLane GetLane() {return RealTime;}
+
 		void SendReply();
 
 		void AddParameter(const std::wstring& param){_parameters.push_back(param);}
@@ -75,6 +89,12 @@ namespace caspar { namespace protocol { namespace amcp {
 		void SetMediaInfoRepo(const safe_ptr<core::media_info_repository>& media_info_repo) {media_info_repo_ = media_info_repo;}
 		std::shared_ptr<core::media_info_repository> GetMediaInfoRepo() { return media_info_repo_; }
 
+		void SetMediaIndex(const std::shared_ptr<media_index>& index) {media_index_ = index;}
+		std::shared_ptr<media_index> GetMediaIndex() { return media_index_; }
+
+		void SetSessionReplayer(const std::shared_ptr<session_replayer>& replayer) {session_replayer_ = replayer;}
+		std::shared_ptr<session_replayer> GetSessionReplayer() { return session_replayer_; }
+
 		void SetShutdownServerNow(boost::promise<bool>& shutdown_server_now) {shutdown_server_now_ = &shutdown_server_now;}
 		boost::promise<bool>& GetShutdownServerNow() { return *shutdown_server_now_; }
 
@@ -95,6 +115,10 @@ namespace caspar { namespace protocol { namespace amcp {
 
 		void SetScheduling(AMCPCommandScheduling s){scheduling_ = s;}
 		void SetReplyString(const std::wstring& str){replyString_ = str;}
+		const std::wstring& GetReplyString() const{return replyString_;}
+
+		void SetRequestId(const std::wstring& id){requestId_ = id;}
+		const std::wstring& GetRequestId() const{return requestId_;}
 
 	protected:
 		core::parameters _parameters;
@@ -107,9 +131,12 @@ namespace caspar { namespace protocol { namespace amcp {
 		std::vector<safe_ptr<core::video_channel>> channels_;
 		std::shared_ptr<core::thumbnail_generator> thumb_gen_;
 		std::shared_ptr<core::media_info_repository> media_info_repo_;
+		std::shared_ptr<media_index> media_index_;
+		std::shared_ptr<session_replayer> session_replayer_;
 		boost::promise<bool>* shutdown_server_now_;
 		AMCPCommandScheduling scheduling_;
 		std::wstring replyString_;
+		std::wstring requestId_;
 	};
 
 	typedef std::tr1::shared_ptr<AMCPCommand> AMCPCommandPtr;
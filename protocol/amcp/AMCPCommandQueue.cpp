@@ -23,27 +23,50 @@
 
 #include "AMCPCommandQueue.h"
 
+#include <boost/chrono.hpp>
+
+#include <algorithm>
+
 namespace caspar { namespace protocol { namespace amcp {
-	
-AMCPCommandQueue::AMCPCommandQueue() 
-	: executor_(L"AMCPCommandQueue")
+
+// Commands beyond this many are replied to with 500 FAILED instead of being queued.
+const std::size_t MAX_QUEUED_COMMANDS = 64;
+
+AMCPCommandQueue::AMCPCommandQueue(const std::wstring& name, AMCPCommandLane lane) 
+	: name_(name)
+	, lane_(lane)
+	, executed_(0)
+	, rejected_(0)
+	, totalLatency_(0.0)
+	, maxLatency_(0.0)
+	, lastLatency_(0.0)
+	, executor_(L"AMCPCommandQueue " + name)
 {
+	clearGeneration_ = 0;
+	pending_ = 0;
 }
 
 AMCPCommandQueue::~AMCPCommandQueue() 
 {
 }
 
-void AMCPCommandQueue::AddCommand(AMCPCommandPtr pCurrentCommand)
+bool AMCPCommandQueue::AddCommand(AMCPCommandPtr pCurrentCommand, const std::function<void()>& done)
 {
 	if(!pCurrentCommand)
-		return;
+		return false;
 
-	if(pCurrentCommand->GetScheduling() == ImmediatelyAndClear)
-		executor_.clear();
+	// Cleared commands are skipped rather than removed from the executor, so that done is still called for them.
+	bool clear = pCurrentCommand->GetScheduling() == ImmediatelyAndClear;
+	if(clear)
+		++clearGeneration_;
 
-	if(executor_.size() > 64)
+	if(!clear && executor_.size() > MAX_QUEUED_COMMANDS)
 	{
+		{
+			tbb::mutex::scoped_lock lock(statsMutex_);
+			++rejected_;
+		}
+
 		try
 		{
 			CASPAR_LOG(error) << "AMCP Command Queue Overflow.";
@@ -55,35 +78,86 @@ void AMCPCommandQueue::AddCommand(AMCPCommandPtr pCurrentCommand)
 		{
 			CASPAR_LOG_CURRENT_EXCEPTION();
 		}
+
+		return false;
 	}
+
+	++pending_;
+
+	auto generation	= static_cast<int>(clearGeneration_);
+	auto queued		= boost::chrono::high_resolution_clock::now();
 	
 	executor_.begin_invoke([=]
 	{
-		try
+		if(generation == clearGeneration_)
 		{
 			try
 			{
-				if(pCurrentCommand->Execute()) 
-					CASPAR_LOG(debug) << "Executed command: " << pCurrentCommand->print();
-				else 
-					CASPAR_LOG(warning) << "Failed to execute command: " << pCurrentCommand->print();
+				RecordLatency(boost::chrono::duration<double, boost::milli>(boost::chrono::high_resolution_clock::now() - queued).count());
+
+				try
+				{
+					if(pCurrentCommand->Execute()) 
+						CASPAR_LOG(debug) << "Executed command: " << pCurrentCommand->print();
+					else 
+						CASPAR_LOG(warning) << "Failed to execute command: " << pCurrentCommand->print();
+				}
+				catch(...)
+				{
+					CASPAR_LOG_CURRENT_EXCEPTION();
+					CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print();
+					pCurrentCommand->SetReplyString(L"500 FAILED\r\n");
+				}
+				
+				pCurrentCommand->SendReply();
+			
+				CASPAR_LOG(trace) << "Ready for a new command";
 			}
 			catch(...)
 			{
 				CASPAR_LOG_CURRENT_EXCEPTION();
-				CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print();
-				pCurrentCommand->SetReplyString(L"500 FAILED\r\n");
 			}
-				
-			pCurrentCommand->SendReply();
-			
-			CASPAR_LOG(trace) << "Ready for a new command";
+		}
+
+		--pending_;
+
+		try
+		{
+			if(done)
+				done();
 		}
 		catch(...)
 		{
 			CASPAR_LOG_CURRENT_EXCEPTION();
 		}
 	});
+
+	return true;
+}
+
+void AMCPCommandQueue::RecordLatency(double millis)
+{
+	tbb::mutex::scoped_lock lock(statsMutex_);
+
+	++executed_;
+	totalLatency_	+= millis;
+	maxLatency_		= std::max(maxLatency_, millis);
+	lastLatency_	= millis;
+}
+
+boost::property_tree::wptree AMCPCommandQueue::info() const
+{
+	tbb::mutex::scoped_lock lock(statsMutex_);
+
+	boost::property_tree::wptree info;
+	info.add(L"name",						name_);
+	info.add(L"pending",					static_cast<int>(pending_));
+	info.add(L"executed",					executed_);
+	info.add(L"rejected",					rejected_);
+	info.add(L"latency-millis.last",		lastLatency_);
+	info.add(L"latency-millis.average",		executed_ > 0 ? totalLatency_ / executed_ : 0.0);
+	info.add(L"latency-millis.max",			maxLatency_);
+	return info;
 }
 
 }}}
\ No newline at end of file
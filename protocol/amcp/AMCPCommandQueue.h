@@ -27,8 +27,13 @@
 
 #include <common/concurrency/executor.h>
 
+#include <boost/property_tree/ptree.hpp>
+
+#include <tbb\atomic.h>
 #include <tbb\mutex.h>
 
+#include <functional>
+
 namespace caspar { namespace protocol { namespace amcp {
 
 class AMCPCommandQueue
@@ -36,13 +41,33 @@ class AMCPCommandQueue
 	AMCPCommandQueue(const AMCPCommandQueue&);
 	AMCPCommandQueue& operator=(const AMCPCommandQueue&);
 public:
-	AMCPCommandQueue();
+	AMCPCommandQueue(const std::wstring& name, AMCPCommandLane lane);
 	~AMCPCommandQueue();
 
-	void AddCommand(AMCPCommandPtr pCommand);
+	// Replies 500 FAILED and returns false when the queue is full. Otherwise done, if given, is 
+	// called once the command has been replied to, or has been cleared from the queue.
+	bool AddCommand(AMCPCommandPtr pCommand, const std::function<void()>& done = nullptr);
+
+	AMCPCommandLane GetLane() const {return lane_;}
+	int GetPendingCount() const {return pending_;}	// Queued or executing.
+
+	// The commands pending, executed and rejected, and the time they waited to be executed.
+	boost::property_tree::wptree info() const;
 
 private:
-	executor			executor_;
+	void RecordLatency(double millis);
+
+	const std::wstring		name_;
+	const AMCPCommandLane	lane_;
+	tbb::atomic<int>		clearGeneration_;
+	tbb::atomic<int>		pending_;
+	mutable tbb::mutex		statsMutex_;
+	int						executed_;
+	int						rejected_;
+	double					totalLatency_;
+	double					maxLatency_;
+	double					lastLatency_;
+	executor				executor_;
 };
 typedef std::tr1::shared_ptr<AMCPCommandQueue> AMCPCommandQueuePtr;
 
@@ -27,6 +27,13 @@
 
 #include "AMCPCommandsImpl.h"
 #include "AMCPProtocolStrategy.h"
+#include "AMCPMediaIndex.h"
+#include "AMCPParserBenchmark.h"
+#include "AMCPReplyBenchmark.h"
+#include "AMCPSessionReplay.h"
+#include "AMCPSessionTrace.h"
+#include "../util/server_load_test.h"
+#include "../binary/binary_protocol_benchmark.h"
 
 #include <common/env.h>
 
@@ -39,6 +46,7 @@
 #include <common/utility/base64.h>
 
 #include <core/producer/frame_producer.h>
+#include <core/info_snapshot.h>
 #include <core/video_format.h>
 #include <core/producer/transition/transition_producer.h>
 #include <core/producer/channel/channel_producer.h>
@@ -55,6 +63,11 @@
 #include <modules/bluefish/bluefish.h>
 #include <modules/decklink/decklink.h>
 #include <modules/ffmpeg/ffmpeg.h>
+#include <modules/ffmpeg/consumer/encoder_benchmark.h>
+#include <modules/ffmpeg/producer/shared/shared_decoder.h>
+#include <modules/ffmpeg/producer/muxer/frame_muxer.h>
+#include <modules/ffmpeg/producer/input/frame_extractor.h>
+#include <modules/ffmpeg/consumer/ffmpeg_consumer.h>
 #include <modules/flash/flash.h>
 #include <modules/html/producer/html_producer.h>
 #include <modules/flash/util/swf.h>
@@ -85,7 +98,9 @@
 #include <boost/archive/iterators/insert_linebreaks.hpp>
 #include <boost/archive/iterators/transform_width.hpp>
 #include <boost/format.hpp>
+#include <boost/thread.hpp>
 
+#include <tbb/atomic.h>
 #include <tbb/concurrent_unordered_map.h>
 
 /* Return codes
@@ -266,39 +281,77 @@ std::wstring ListMedia(const std::shared_ptr<core::media_info_repository>& media
 	return boost::to_upper_copy(replyString.str());
 }
 
+std::wstring TemplateInfo(const boost::filesystem::wpath& path)
+{
+	if(boost::filesystem::is_regular_file(path) && (path.extension() == L".ft" || path.extension() == L".ct" || path.extension() == L".html"))
+	{
+		auto relativePath = boost::filesystem::wpath(path.file_string().substr(env::template_folder().size()-1, path.file_string().size()));
+
+		auto writeTimeStr = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(boost::filesystem::last_write_time(path)));
+		writeTimeStr.erase(std::remove_if(writeTimeStr.begin(), writeTimeStr.end(), [](char c){ return std::isdigit(c) == 0;}), writeTimeStr.end());
+		auto writeTimeWStr = std::wstring(writeTimeStr.begin(), writeTimeStr.end());
+
+		auto sizeStr = boost::lexical_cast<std::string>(boost::filesystem::file_size(path));
+		sizeStr.erase(std::remove_if(sizeStr.begin(), sizeStr.end(), [](char c){ return std::isdigit(c) == 0;}), sizeStr.end());
+
+		auto sizeWStr = std::wstring(sizeStr.begin(), sizeStr.end());
+
+		std::wstring dir = relativePath.parent_path().external_directory_string();
+		std::wstring file = boost::to_upper_copy(relativePath.filename());
+		relativePath = boost::filesystem::wpath(dir + L"/" + file);
+					
+		auto str = relativePath.replace_extension(TEXT("")).external_file_string();
+		boost::trim_if(str, boost::is_any_of("\\/"));
+
+		return std::wstring()
+				+ L"\""	+ str 
+				+ L"\" "	+ sizeWStr 
+				+ L" "		+ writeTimeWStr 
+				+ L"\r\n";		
+	}
+	return L"";
+}
+
 std::wstring ListTemplates() 
 {
 	std::wstringstream replyString;
 
 	for (boost::filesystem::wrecursive_directory_iterator itr(env::template_folder()), end; itr != end; ++itr)
-	{		
-		if(boost::filesystem::is_regular_file(itr->path()) && (itr->path().extension() == L".ft" || itr->path().extension() == L".ct" || itr->path().extension() == L".html"))
-		{
-			auto relativePath = boost::filesystem::wpath(itr->path().file_string().substr(env::template_folder().size()-1, itr->path().file_string().size()));
+		replyString << TemplateInfo(itr->path());
 
-			auto writeTimeStr = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(boost::filesystem::last_write_time(itr->path())));
-			writeTimeStr.erase(std::remove_if(writeTimeStr.begin(), writeTimeStr.end(), [](char c){ return std::isdigit(c) == 0;}), writeTimeStr.end());
-			auto writeTimeWStr = std::wstring(writeTimeStr.begin(), writeTimeStr.end());
+	return replyString.str();
+}
 
-			auto sizeStr = boost::lexical_cast<std::string>(boost::filesystem::file_size(itr->path()));
-			sizeStr.erase(std::remove_if(sizeStr.begin(), sizeStr.end(), [](char c){ return std::isdigit(c) == 0;}), sizeStr.end());
+std::wstring DataInfo(const boost::filesystem::wpath& path)
+{
+	if(boost::filesystem::is_regular_file(path) && boost::iequals(path.extension(), L".ftd"))
+	{
+		auto relativePath = boost::filesystem::wpath(path.file_string().substr(env::data_folder().size()-1, path.file_string().size()));
+		
+		auto str = relativePath.replace_extension(TEXT("")).external_file_string();
+		if(str[0] == '\\' || str[0] == '/')
+			str = std::wstring(str.begin() + 1, str.end());
 
-			auto sizeWStr = std::wstring(sizeStr.begin(), sizeStr.end());
+		return str + L"\r\n";
+	}
+	return L"";
+}
 
-			std::wstring dir = relativePath.parent_path().external_directory_string();
-			std::wstring file = boost::to_upper_copy(relativePath.filename());
-			relativePath = boost::filesystem::wpath(dir + L"/" + file);
-						
-			auto str = relativePath.replace_extension(TEXT("")).external_file_string();
-			boost::trim_if(str, boost::is_any_of("\\/"));
+// Resolves a path given by a client below one of the server's folders, and refuses paths that would leave it.
+boost::filesystem::wpath resolve_in_folder(const std::wstring& folder, const std::wstring& relative)
+{
+	boost::filesystem::wpath path(relative);
 
-			replyString << TEXT("\"") << str
-						<< TEXT("\" ") << sizeWStr
-						<< TEXT(" ") << writeTimeWStr
-						<< TEXT("\r\n");		
-		}
+	if(path.empty() || path.has_root_name() || path.has_root_directory())
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("path") << arg_value_info(narrow(relative)));
+
+	BOOST_FOREACH(auto& part, path)
+	{
+		if(part == L"..")
+			BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("path") << arg_value_info(narrow(relative)));
 	}
-	return replyString.str();
+
+	return boost::filesystem::wpath(folder) / path;
 }
 
 namespace amcp {
@@ -313,7 +366,11 @@ void AMCPCommand::SendReply()
 
 	if(replyString_.empty())
 		return;
-	pClientInfo_->Send(replyString_);
+
+	auto reply = requestId_.empty() ? replyString_ : L"RES " + requestId_ + L" " + replyString_;
+
+	record_reply(pClientInfo_, reply);
+	pClientInfo_->Send(reply);
 }
 
 void AMCPCommand::Clear() 
@@ -342,6 +399,520 @@ bool DiagnosticsCommand::DoExecute()
 	}
 }
 
+bool BenchmarkCommand::DoExecute()
+{	
+	// The benchmarks load the server for seconds at a time, so they are only served where they have been enabled.
+	if(!env::properties().get(L"configuration.amcp.benchmark", false))
+	{
+		SetReplyString(TEXT("403 BENCHMARK ERROR\r\n"));
+		return false;
+	}
+
+	try
+	{
+		boost::property_tree::wptree info;
+
+		const std::wstring subcommand = _parameters.empty() ? L"" : _parameters[0];
+
+		if(subcommand == L"PARSER")
+			info = RunParser();
+		else if(subcommand == L"REPLIES")
+			info = RunReplies();
+		else if(subcommand == L"MEDIAINDEX")
+			info = RunMediaIndex();
+		else if(subcommand == L"BINARY")
+			info = RunBinary();
+		else if(subcommand == L"DECODING")
+			info = RunDecoding();
+		else if(subcommand == L"MUXER")
+			info = RunMuxer();
+		else if(subcommand == L"THUMBNAILS")
+			info = RunThumbnails();
+		else if(subcommand == L"CONVERSION")
+			info = RunConversion();
+		else if(subcommand == L"RENDITIONS")
+			info = RunRenditions();
+		else
+			info = RunEncoders();
+
+		std::wstringstream replyString;
+		replyString << L"201 BENCHMARK OK\r\n";
+
+		boost::property_tree::xml_writer_settings<wchar_t> w(' ', 3);
+		boost::property_tree::write_xml(replyString, info, w);
+		replyString << L"\r\n";
+
+		SetReplyString(replyString.str());
+
+		return true;
+	}
+	catch(null_argument&)
+	{
+		SetReplyString(TEXT("402 BENCHMARK ERROR\r\n"));
+		return false;
+	}
+	catch(invalid_argument&)
+	{
+		SetReplyString(TEXT("403 BENCHMARK ERROR\r\n"));
+		return false;
+	}
+	catch(file_not_found&)
+	{
+		SetReplyString(TEXT("404 BENCHMARK ERROR\r\n"));
+		return false;
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		SetReplyString(TEXT("502 BENCHMARK FAILED\r\n"));
+		return false;
+	}
+}
+
+void BenchmarkCommand::ThrowInvalidParameter(size_t index)
+{
+	BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("parameters") << arg_value_info(narrow(_parameters[index])));
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunEncoders()
+{
+	auto format_desc	= core::video_format_desc::get(core::video_format::x1080i5000);
+	auto frames			= _parameters.get(L"FRAMES", 250);
+	auto all_presets	= ffmpeg::get_encoder_benchmark_presets();
+
+	std::vector<std::wstring> presets;
+
+	for(size_t n = 0; n < _parameters.size(); ++n)
+	{
+		if(_parameters[n] == L"FRAMES")
+			++n;
+		else if(core::video_format_desc::get(_parameters[n]).format != core::video_format::invalid)
+			format_desc = core::video_format_desc::get(_parameters[n]);
+		else if(std::find_if(all_presets.begin(), all_presets.end(), [&](const std::wstring& preset){return boost::iequals(preset, _parameters[n]);}) != all_presets.end())
+			presets.push_back(_parameters[n]);
+		else
+			ThrowInvalidParameter(n);
+	}
+
+	return ffmpeg::benchmark_encoders(format_desc, frames, presets);
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunParser()
+{
+	auto iterations = _parameters.get(L"ITERATIONS", 10000);
+	auto corpus		= get_default_parser_corpus();
+
+	for(size_t n = 1; n < _parameters.size(); ++n)
+	{
+		if(_parameters[n] == L"ITERATIONS")
+			++n;
+		else
+		{
+			// A captured corpus in the log folder, with one command per line.
+			auto path = resolve_in_folder(env::log_folder(), _parameters.at_original(n));
+
+			boost::filesystem::ifstream file(path);
+			if(!file)
+				BOOST_THROW_EXCEPTION(file_not_found() << msg_info(narrow(path.file_string())));
+
+			corpus.clear();
+
+			std::string line;
+			while(std::getline(file, line))
+			{
+				boost::trim_right_if(line, boost::is_any_of("\r"));
+				if(!line.empty())
+					corpus.push_back(widen(line));
+			}
+		}
+	}
+
+	// A strategy of its own, so that nothing is queued on the server's channels.
+	AMCPProtocolStrategy strategy(GetChannels(), GetThumbGenerator(), make_safe_ptr(GetMediaInfoRepo()), GetMediaIndex(), GetShutdownServerNow());
+
+	return benchmark_parser(strategy, corpus, iterations);
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunReplies()
+{
+	// A strategy of its own, so that the benchmark does not wait behind its own command.
+	AMCPProtocolStrategy strategy(GetChannels(), GetThumbGenerator(), make_safe_ptr(GetMediaInfoRepo()), GetMediaIndex(), GetShutdownServerNow());
+
+	return benchmark_replies(strategy, _parameters.get(L"ROUNDS", 50));
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunMediaIndex()
+{
+	return benchmark_media_index(_parameters.get(L"FILES", 100000));
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunBinary()
+{
+	// A strategy of its own, so that the AMCP traffic is not queued behind this command.
+	auto amcp = make_safe<AMCPProtocolStrategy>(GetChannels(), GetThumbGenerator(), make_safe_ptr(GetMediaInfoRepo()), GetMediaIndex(), GetShutdownServerNow());
+
+	return protocol::binary::benchmark_binary_protocol(
+			amcp,
+			GetChannels(),
+			_parameters.get(L"CHANNEL", 1),
+			_parameters.get(L"LAYER", 9999),
+			_parameters.get(L"MESSAGES", 1000),
+			_parameters.get(L"BATCH", 10));
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunDecoding()
+{
+	auto format_desc = core::video_format_desc::get(core::video_format::x1080i5000);
+
+	std::wstring filename;
+
+	for(size_t n = 1; n < _parameters.size(); ++n)
+	{
+		if(_parameters[n] == L"PRODUCERS" || _parameters[n] == L"FRAMES")
+			++n;
+		else if(core::video_format_desc::get(_parameters[n]).format != core::video_format::invalid)
+			format_desc = core::video_format_desc::get(_parameters[n]);
+		else
+			filename = _parameters.at_original(n);
+	}
+
+	if(filename.empty())
+		BOOST_THROW_EXCEPTION(null_argument() << arg_name_info("filename"));
+
+	auto path = resolve_in_folder(env::media_folder(), filename).file_string();
+	if(!boost::filesystem::exists(path))
+		path = ffmpeg::probe_stem(path);
+
+	if(path.empty())
+		BOOST_THROW_EXCEPTION(file_not_found() << msg_info(narrow(filename)));
+
+	return ffmpeg::benchmark_shared_decoding(path, format_desc, _parameters.get(L"PRODUCERS", 4), _parameters.get(L"FRAMES", 250));
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunMuxer()
+{
+	auto format_desc = core::video_format_desc::get(core::video_format::x1080i5000);
+
+	for(size_t n = 1; n < _parameters.size(); ++n)
+	{
+		if(_parameters[n] == L"FRAMES")
+			++n;
+		else if(core::video_format_desc::get(_parameters[n]).format != core::video_format::invalid)
+			format_desc = core::video_format_desc::get(_parameters[n]);
+		else
+			ThrowInvalidParameter(n);
+	}
+
+	return ffmpeg::benchmark_frame_muxer_audio(format_desc, _parameters.get(L"FRAMES", 2500));
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunThumbnails()
+{
+	auto folder = env::media_folder();
+
+	for(size_t n = 1; n < _parameters.size(); ++n)
+	{
+		if(_parameters[n] == L"FILES")
+			++n;
+		else
+			folder = resolve_in_folder(env::media_folder(), _parameters.at_original(n)).file_string();
+	}
+
+	return ffmpeg::benchmark_frame_extraction(folder, _parameters.get(L"FILES", 100));
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunConversion()
+{
+	std::vector<core::video_format_desc> formats;
+
+	for(size_t n = 1; n < _parameters.size(); ++n)
+	{
+		if(_parameters[n] == L"FRAMES")
+			++n;
+		else if(core::video_format_desc::get(_parameters[n]).format != core::video_format::invalid)
+			formats.push_back(core::video_format_desc::get(_parameters[n]));
+		else
+			ThrowInvalidParameter(n);
+	}
+
+	if(formats.empty())
+	{
+		formats.push_back(core::video_format_desc::get(core::video_format::pal));
+		formats.push_back(core::video_format_desc::get(core::video_format::x720p5000));
+		formats.push_back(core::video_format_desc::get(core::video_format::x1080i5000));
+		formats.push_back(core::video_format_desc::get(core::video_format::x2160p2500));
+	}
+
+	return ffmpeg::benchmark_conversion(formats, _parameters.get(L"FRAMES", 100));
+}
+
+boost::property_tree::wptree BenchmarkCommand::RunRenditions()
+{
+	static const boost::wregex size_expr(L"\\d+X\\d+");
+
+	auto format_desc	= core::video_format_desc::get(core::video_format::x1080i5000);
+	auto vcodec			= _parameters.get(L"VCODEC", L"libx264");
+
+	std::vector<std::wstring> sizes;
+
+	for(size_t n = 1; n < _parameters.size(); ++n)
+	{
+		if(_parameters[n] == L"FRAMES" || _parameters[n] == L"VCODEC")
+			++n;
+		else if(core::video_format_desc::get(_parameters[n]).format != core::video_format::invalid)
+			format_desc = core::video_format_desc::get(_parameters[n]);
+		else if(boost::regex_match(_parameters[n], size_expr))
+			sizes.push_back(boost::to_lower_copy(_parameters[n]));
+		else
+			ThrowInvalidParameter(n);
+	}
+
+	if(sizes.empty())
+	{
+		sizes.push_back(L"960x540");
+		sizes.push_back(L"640x360");
+	}
+
+	return ffmpeg::benchmark_renditions(format_desc, _parameters.get(L"FRAMES", 250), boost::to_lower_copy(vcodec), sizes);
+}
+
+bool BatchCommand::Add(const AMCPCommandPtr& command)
+{
+	if(!command->NeedChannel() || commands_.size() >= 256)
+		return false;
+
+	if(commands_.empty())
+	{
+		SetChannels(command->GetChannels());
+		SetChannel(command->GetChannel());
+		SetChannelIndex(command->GetChannelIndex());
+	}
+	else if(command->GetChannelIndex() != GetChannelIndex())
+		return false;
+
+	commands_.push_back(command);
+	return true;
+}
+
+bool BatchCommand::DoExecute()
+{
+	auto stage = GetChannel()->stage();
+	auto mixer = GetChannel()->mixer();
+
+	std::wstringstream replyString;
+	replyString << L"200 COMMIT OK\r\n";
+
+	stage->begin_batch();
+	mixer->begin_batch();
+
+	BOOST_FOREACH(auto& command, commands_)
+	{
+		try
+		{
+			if(!command->Execute())
+				CASPAR_LOG(warning) << "Failed to execute command: " << command->print();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+			command->SetReplyString(L"500 FAILED\r\n");
+		}
+
+		replyString << (command->GetReplyString().empty() ? L"500 FAILED\r\n" : command->GetReplyString());
+	}
+
+	// The mixer changes are released from the stage task, ahead of the frames of the tick they belong to.
+	stage->commit_batch(mixer->end_batch());
+
+	replyString << L"\r\n";
+	SetReplyString(replyString.str());
+
+	return true;
+}
+
+bool LoadTestCommand::DoExecute()
+{	
+	try
+	{
+		auto commands = _parameters.get(L"COMMANDS", 10);
+
+		std::vector<int> connections;
+
+		for(size_t n = 0; n < _parameters.size(); ++n)
+		{
+			if(_parameters[n] == L"COMMANDS")
+				++n;
+			else
+				connections.push_back(boost::lexical_cast<int>(_parameters[n]));
+		}
+
+		if(connections.empty())
+		{
+			connections.push_back(10);
+			connections.push_back(100);
+			connections.push_back(1000);
+		}
+
+		// The rounds send VERSION to an AMCP protocol of their own, with its own command queues, on a private port.
+		auto protocol = make_safe<AMCPProtocolStrategy>(GetChannels(), GetThumbGenerator(), make_safe_ptr(GetMediaInfoRepo()), GetMediaIndex(), GetShutdownServerNow());
+		auto info = IO::run_server_load_test(protocol, "VERSION", connections, commands);
+
+		std::wstringstream replyString;
+		replyString << L"201 LOADTEST OK\r\n";
+
+		boost::property_tree::xml_writer_settings<wchar_t> w(' ', 3);
+		boost::property_tree::write_xml(replyString, info, w);
+		replyString << L"\r\n";
+
+		SetReplyString(replyString.str());
+
+		return true;
+	}
+	catch(boost::bad_lexical_cast&)
+	{
+		SetReplyString(TEXT("403 LOADTEST ERROR\r\n"));
+		return false;
+	}
+	catch(out_of_range&)
+	{
+		SetReplyString(TEXT("403 LOADTEST ERROR\r\n"));
+		return false;
+	}
+	catch(invalid_argument&)
+	{
+		SetReplyString(TEXT("403 LOADTEST ERROR\r\n"));
+		return false;
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		SetReplyString(TEXT("502 LOADTEST FAILED\r\n"));
+		return false;
+	}
+}
+
+bool TraceCommand::DoExecute()
+{	
+	if(_parameters[0] == L"REPLAY")
+		return DoExecuteReplay();
+
+	try
+	{
+		if(_parameters[0] == L"START")
+		{
+			auto filename = _parameters.size() > 1 
+					? _parameters.at_original(1) 
+					: L"amcp-trace-" + boost::posix_time::to_iso_wstring(boost::posix_time::second_clock::local_time()) + L".txt";
+
+			start_session_recording(resolve_in_folder(env::log_folder(), filename).file_string());
+
+			SetReplyString(TEXT("202 TRACE OK\r\n"));
+			return true;
+		}
+		else if(_parameters[0] == L"STOP")
+		{
+			auto info = stop_session_recording();
+
+			std::wstringstream replyString;
+			replyString << L"201 TRACE OK\r\n";
+
+			boost::property_tree::xml_writer_settings<wchar_t> w(' ', 3);
+			boost::property_tree::write_xml(replyString, info, w);
+			replyString << L"\r\n";
+
+			SetReplyString(replyString.str());
+			return true;
+		}
+
+		SetReplyString(TEXT("403 TRACE ERROR\r\n"));
+		return false;
+	}
+	catch(invalid_operation&)
+	{
+		SetReplyString(TEXT("403 TRACE ERROR\r\n"));
+		return false;
+	}
+	catch(invalid_argument&)
+	{
+		SetReplyString(TEXT("403 TRACE ERROR\r\n"));
+		return false;
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		SetReplyString(TEXT("502 TRACE FAILED\r\n"));
+		return false;
+	}
+}
+
+bool TraceCommand::DoExecuteReplay()
+{
+	try
+	{
+		if(_parameters.size() < 2)
+		{
+			SetReplyString(TEXT("402 TRACE ERROR\r\n"));
+			return false;
+		}
+
+		auto filename	= resolve_in_folder(env::log_folder(), _parameters.at_original(1)).file_string();
+		auto speed_arg	= _parameters.get(L"SPEED", L"1");
+		auto speed		= speed_arg == L"MAX" ? 0.0 : boost::lexical_cast<double>(speed_arg);
+		auto port		= _parameters.get(L"PORT", 5250);
+		auto trace		= read_session_trace(filename);
+
+		if(speed < 0.0)
+		{
+			SetReplyString(TEXT("403 TRACE ERROR\r\n"));
+			return false;
+		}
+
+		// The replayed commands are queued on this server, so the replay must not hold up the queue it is on.
+		auto started = GetSessionReplayer()->start(trace, "127.0.0.1", port, speed, [=](const boost::property_tree::wptree& info)
+		{
+			boost::filesystem::wofstream report(boost::filesystem::wpath(filename + L".replay.xml"));
+			boost::property_tree::xml_writer_settings<wchar_t> w(' ', 3);
+			boost::property_tree::write_xml(report, info, w);
+
+			CASPAR_LOG(info) << L"[session-replay] Replayed " << filename << L": " 
+							 << info.get<int>(L"replay.replies") << L" replies, " 
+							 << info.get<int>(L"replay.errors") << L" errors (" << info.get<int>(L"replay.recorded-errors") << L" recorded), " 
+							 << info.get<int>(L"replay.unanswered") << L" unanswered, p99 latency " 
+							 << info.get<double>(L"replay.latency-millis.p99") << L" ms.";
+		});
+
+		if(!started)
+		{
+			SetReplyString(TEXT("403 TRACE ERROR\r\n"));
+			return false;
+		}
+
+		SetReplyString(TEXT("202 TRACE OK\r\n"));
+		return true;
+	}
+	catch(boost::bad_lexical_cast&)
+	{
+		SetReplyString(TEXT("403 TRACE ERROR\r\n"));
+		return false;
+	}
+	catch(invalid_argument&)
+	{
+		SetReplyString(TEXT("403 TRACE ERROR\r\n"));
+		return false;
+	}
+	catch(file_not_found&)
+	{
+		SetReplyString(TEXT("404 TRACE ERROR\r\n"));
+		return false;
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		SetReplyString(TEXT("502 TRACE FAILED\r\n"));
+		return false;
+	}
+}
+
 bool ChannelGridCommand::DoExecute()
 {
 	int index = 1;
@@ -1669,6 +2240,15 @@ bool CGCommand::DoExecuteInfo()
 	return true;
 }
 
+AMCPCommandLane DataCommand::GetLane()
+{
+	// Storing and removing stay on the general queue, in order with the templates that read the data.
+	if(!_parameters.empty() && (boost::iequals(_parameters[0], L"RETRIEVE") || boost::iequals(_parameters[0], L"LIST")))
+		return Background;
+
+	return RealTime;
+}
+
 bool DataCommand::DoExecute()
 {
 	std::wstring command = _parameters[0];
@@ -1793,25 +2373,19 @@ bool DataCommand::DoExecuteRemove()
 
 bool DataCommand::DoExecuteList() 
 {
+	auto index = GetMediaIndex();
+	auto listing = index ? index->data() : std::shared_ptr<const std::wstring>();
+	if(listing)
+	{
+		SetReplyString(TEXT("200 DATA LIST OK\r\n") + *listing + TEXT("\r\n"));
+		return true;
+	}
+
 	std::wstringstream replyString;
 	replyString << TEXT("200 DATA LIST OK\r\n");
 
 	for (boost::filesystem::wrecursive_directory_iterator itr(env::data_folder()), end; itr != end; ++itr)
-	{			
-		if(boost::filesystem::is_regular_file(itr->path()))
-		{
-			if(!boost::iequals(itr->path().extension(), L".ftd"))
-				continue;
-			
-			auto relativePath = boost::filesystem::wpath(itr->path().file_string().substr(env::data_folder().size()-1, itr->path().file_string().size()));
-			
-			auto str = relativePath.replace_extension(TEXT("")).external_file_string();
-			if(str[0] == '\\' || str[0] == '/')
-				str = std::wstring(str.begin() + 1, str.end());
-
-			replyString << str << TEXT("\r\n"); 	
-		}
-	}
+		replyString << DataInfo(itr->path());
 	
 	replyString << TEXT("\r\n");
 
@@ -1975,6 +2549,48 @@ void GenerateChannelInfo(int index, const safe_ptr<core::video_channel>& pChanne
 	replyString << index+1 << TEXT(" ") << pChannel->get_video_format_desc().name << TEXT(" PLAYING") << TEXT("\r\n");
 }
 
+template<typename T>
+void WriteInfoElement(std::wostream& out, const std::wstring& key, const T& value, int depth)
+{
+	boost::property_tree::xml_parser::write_xml_element(out, key, boost::property_tree::wptree(boost::lexical_cast<std::wstring>(value)), depth, boost::property_tree::xml_writer_settings<wchar_t>(' ', 3));
+}
+
+// Writes the same xml as the channel's info() tree with index and generation added, but from 
+// the channel's info snapshots, so that unchanged stage and output subtrees are not serialized again.
+void WriteChannelInfo(std::wostream& out, const safe_ptr<core::video_channel>& channel, const core::channel_info_snapshot& snapshot, int index, int depth)
+{
+	boost::property_tree::xml_writer_settings<wchar_t> w(' ', 3);
+	auto mixer_info = channel->mixer()->info();
+
+	out << std::wstring(depth*3, L' ') << L"<channel>\n";
+
+	WriteInfoElement(out, L"video-mode", snapshot.video_mode, depth+1);
+
+	if(snapshot.stage)
+		out << snapshot.stage->xml(depth+1);
+
+	if(mixer_info.timed_wait(boost::posix_time::seconds(2)))
+		boost::property_tree::xml_parser::write_xml_element(out, std::wstring(L"mixer"), mixer_info.get(), depth+1, w);
+
+	if(snapshot.output)
+		out << snapshot.output->xml(depth+1);
+
+	WriteInfoElement(out, L"index", index, depth+1);
+	WriteInfoElement(out, L"generation", snapshot.generation, depth+1);
+
+	out << std::wstring(depth*3, L' ') << L"</channel>\n";
+}
+
+// INFO ... SINCE [generation] replies 202 instead of the info, if it is still at that generation.
+bool IsUnchangedSince(const std::vector<std::wstring>& parameters, unsigned int generation)
+{
+	auto since = std::find(parameters.begin(), parameters.end(), L"SINCE");
+	if(since == parameters.end() || ++since == parameters.end())
+		return false;
+
+	return boost::lexical_cast<unsigned int>(*since) == generation;
+}
+
 bool InfoCommand::DoExecute()
 {
 	std::wstringstream replyString;
@@ -2042,18 +2658,38 @@ bool InfoCommand::DoExecute()
 									
 			boost::property_tree::write_xml(replyString, info, w);
 		}
+		else if(_parameters.size() >= 1 && _parameters[0] == L"QUEUES")
+		{
+			replyString << L"201 INFO QUEUES OK\r\n";
+
+			boost::property_tree::write_xml(replyString, queues_(), w);
+		}
 		else if(_parameters.size() >= 1 && _parameters[0] == L"SERVER")
 		{
-			replyString << L"201 INFO SERVER OK\r\n";
-			
-			boost::property_tree::wptree info;
+			std::vector<core::channel_info_snapshot> snapshots;
+			unsigned int generation = 0;
 
-			int index = 0;
 			BOOST_FOREACH(auto channel, channels_)
-				info.add_child(L"channels.channel", channel->info())
-					.add(L"index", ++index);
-			
-			boost::property_tree::write_xml(replyString, info, w);
+			{
+				snapshots.push_back(channel->get_info_snapshot());
+				generation += snapshots.back().generation;
+			}
+
+			if(IsUnchangedSince(_parameters, generation))
+			{
+				SetReplyString(L"202 INFO OK\r\n");
+				return true;
+			}
+
+			replyString << L"201 INFO SERVER OK\r\n";
+			replyString << L"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+			replyString << L"<channels>\n";
+
+			for(size_t n = 0; n < channels_.size(); ++n)
+				WriteChannelInfo(replyString, channels_[n], snapshots[n], n+1, 1);
+
+			WriteInfoElement(replyString, L"generation", generation, 1);
+			replyString << L"</channels>\n";
 		}
 		else if(_parameters.size() >= 2 && _parameters[1] == L"DELAY")
 		{
@@ -2098,8 +2734,16 @@ bool InfoCommand::DoExecute()
 				
 				if(layer == std::numeric_limits<int>::min())
 				{	
-					info.add_child(L"channel", channels_.at(channel)->info())
-							.add(L"index", channel);
+					auto snapshot = channels_.at(channel)->get_info_snapshot();
+
+					if(IsUnchangedSince(_parameters, snapshot.generation))
+					{
+						SetReplyString(L"202 INFO OK\r\n");
+						return true;
+					}
+
+					replyString << L"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+					WriteChannelInfo(replyString, channels_.at(channel), snapshot, channel, 0);
 				}
 				else
 				{
@@ -2112,11 +2756,27 @@ bool InfoCommand::DoExecute()
 					}
 					else
 					{
-						info.add_child(L"layer", channels_.at(channel)->stage()->info(layer).get())
-							.add(L"index", layer);
+						// Layers that are not in the stage snapshot yet are looked up on the stage.
+						auto snapshot = channels_.at(channel)->stage()->get_info_snapshot();
+						auto layers = snapshot ? snapshot->info().get_child_optional(L"layers") : boost::optional<const boost::property_tree::wptree&>();
+
+						if(layers)
+						{
+							BOOST_FOREACH(auto& child, *layers)
+							{
+								if(child.second.get(L"index", std::numeric_limits<int>::min()) == layer)
+									info.add_child(L"layer", child.second);
+							}
+						}
+
+						if(info.empty())
+						{
+							info.add_child(L"layer", channels_.at(channel)->stage()->info(layer).get())
+								.add(L"index", layer);
+						}
 					}
+					boost::property_tree::xml_parser::write_xml(replyString, info, w);
 				}
-				boost::property_tree::xml_parser::write_xml(replyString, info, w);
 			}
 			else
 			{
@@ -2149,6 +2809,14 @@ bool ClsCommand::DoExecute()
 		tga = still
 		col = still
 	*/
+	auto index = GetMediaIndex();
+	auto listing = index ? index->media() : std::shared_ptr<const std::wstring>();
+	if(listing)
+	{
+		SetReplyString(TEXT("200 CLS OK\r\n") + *listing + TEXT("\r\n"));
+		return true;
+	}
+
 	std::wstringstream replyString;
 	replyString << TEXT("200 CLS OK\r\n");
 	replyString << ListMedia(GetMediaInfoRepo());
@@ -2159,6 +2827,14 @@ bool ClsCommand::DoExecute()
 
 bool TlsCommand::DoExecute()
 {
+	auto index = GetMediaIndex();
+	auto listing = index ? index->templates() : std::shared_ptr<const std::wstring>();
+	if(listing)
+	{
+		SetReplyString(TEXT("200 TLS OK\r\n") + *listing + TEXT("\r\n"));
+		return true;
+	}
+
 	std::wstringstream replyString;
 	replyString << TEXT("200 TLS OK\r\n");
 
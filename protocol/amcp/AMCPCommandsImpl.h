@@ -25,6 +25,11 @@
 
 #include "AMCPCommand.h"
 
+#include <boost/filesystem/path.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <functional>
+
 namespace caspar {
 
 namespace core {
@@ -34,9 +39,14 @@ namespace core {
 
 namespace protocol {
 
-std::wstring ListMedia();
+std::wstring ListMedia(const std::shared_ptr<core::media_info_repository>& media_info_repo);
 std::wstring ListTemplates();
 
+// The line of the file in the CLS, TLS and DATA LIST replies, or an empty string if it is not listed.
+std::wstring MediaInfo(const boost::filesystem::wpath& path, const std::shared_ptr<core::media_info_repository>& media_info_repo);
+std::wstring TemplateInfo(const boost::filesystem::wpath& path);
+std::wstring DataInfo(const boost::filesystem::wpath& path);
+
 namespace amcp {
 	
 class ChannelGridCommand : public AMCPCommandBase<false, AddToQueue, 0>
@@ -51,6 +61,39 @@ class DiagnosticsCommand : public AMCPCommandBase<false, AddToQueue, 0>
 	bool DoExecute();
 };
 
+class BenchmarkCommand : public AMCPCommandBase<false, AddToQueue, 0>
+{
+	std::wstring print() const { return L"BenchmarkCommand";}
+	AMCPCommandLane GetLane() { return Background; }
+	bool DoExecute();
+	void ThrowInvalidParameter(size_t index);
+	boost::property_tree::wptree RunEncoders();
+	boost::property_tree::wptree RunParser();
+	boost::property_tree::wptree RunReplies();
+	boost::property_tree::wptree RunMediaIndex();
+	boost::property_tree::wptree RunBinary();
+	boost::property_tree::wptree RunDecoding();
+	boost::property_tree::wptree RunMuxer();
+	boost::property_tree::wptree RunThumbnails();
+	boost::property_tree::wptree RunConversion();
+	boost::property_tree::wptree RunRenditions();
+};
+
+class LoadTestCommand : public AMCPCommandBase<false, AddToQueue, 0>
+{
+	std::wstring print() const { return L"LoadTestCommand";}
+	AMCPCommandLane GetLane() { return Background; }
+	bool DoExecute();
+};
+
+class TraceCommand : public AMCPCommandBase<false, AddToQueue, 1>
+{
+	std::wstring print() const { return L"TraceCommand";}
+	AMCPCommandLane GetLane() { return Background; }
+	bool DoExecute();
+	bool DoExecuteReplay();
+};
+
 class CallCommand : public AMCPCommandBase<true, AddToQueue, 1>
 {
 	std::wstring print() const { return L"CallCommand";}
@@ -174,6 +217,7 @@ class CGCommand : public AMCPCommandBase<true, AddToQueue, 1>
 class DataCommand : public AMCPCommandBase<false, AddToQueue, 1>
 {
 	std::wstring print() const { return L"DataCommand";}
+	AMCPCommandLane GetLane();
 	bool DoExecute();
 	bool DoExecuteStore();
 	bool DoExecuteRetrieve();
@@ -184,6 +228,7 @@ class DataCommand : public AMCPCommandBase<false, AddToQueue, 1>
 class ThumbnailCommand : public AMCPCommandBase<false, AddToQueue, 1>
 {
 	std::wstring print() const { return L"ThumbnailCommand";}
+	AMCPCommandLane GetLane() { return Background; }
 	bool DoExecute();
 	bool DoExecuteRetrieve();
 	bool DoExecuteList();
@@ -194,18 +239,21 @@ class ThumbnailCommand : public AMCPCommandBase<false, AddToQueue, 1>
 class ClsCommand : public AMCPCommandBase<false, AddToQueue, 0>
 {
 	std::wstring print() const { return L"ClsCommand";}
+	AMCPCommandLane GetLane() { return Background; }
 	bool DoExecute();
 };
 
 class TlsCommand : public AMCPCommandBase<false, AddToQueue, 0>
 {
 	std::wstring print() const { return L"TlsCommand";}
+	AMCPCommandLane GetLane() { return Background; }
 	bool DoExecute();
 };
 
 class CinfCommand : public AMCPCommandBase<false, AddToQueue, 1>
 {
 	std::wstring print() const { return L"CinfCommand";}
+	AMCPCommandLane GetLane() { return Background; }
 	bool DoExecute();
 };
 
@@ -213,10 +261,11 @@ class InfoCommand : public AMCPCommandBase<false, AddToQueue, 0>
 {
 public:
 	std::wstring print() const { return L"InfoCommand";}
-	InfoCommand(const std::vector<safe_ptr<core::video_channel>>& channels) : channels_(channels){}
+	InfoCommand(const std::vector<safe_ptr<core::video_channel>>& channels, const std::function<boost::property_tree::wptree()>& queues) : channels_(channels), queues_(queues){}
 	bool DoExecute();
 private:
 	const std::vector<safe_ptr<core::video_channel>>& channels_;
+	const std::function<boost::property_tree::wptree()> queues_;
 };
 
 class VersionCommand : public AMCPCommandBase<false, AddToQueue, 0>
@@ -225,6 +274,19 @@ class VersionCommand : public AMCPCommandBase<false, AddToQueue, 0>
 	bool DoExecute();
 };
 
+// Commands sent between BEGIN and COMMIT. They are executed in order, their changes to the stage 
+// and mixer are applied on the same frame, and their replies are sent together.
+class BatchCommand : public AMCPCommandBase<true, AddToQueue, 0>
+{
+	std::vector<AMCPCommandPtr> commands_;
+public:
+	bool Add(const AMCPCommandPtr& command);
+	bool Empty() const { return commands_.empty(); }
+private:
+	std::wstring print() const { return L"BatchCommand";}
+	bool DoExecute();
+};
+
 class ByeCommand : public AMCPCommandBase<false, AddToQueue, 0>
 {
 	std::wstring print() const { return L"ByeCommand";}
@@ -0,0 +1,257 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "AMCPMediaIndex.h"
+
+#include "AMCPCommandsImpl.h"
+
+#include <common/env.h>
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/chrono.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <tbb/mutex.h>
+
+#include <map>
+#include <vector>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+typedef boost::chrono::high_resolution_clock media_index_clock;
+
+static double elapsed_millis(media_index_clock::time_point since)
+{
+	return boost::chrono::duration<double, boost::milli>(media_index_clock::now() - since).count();
+}
+
+// The lines of one listing by file, and the listing serialized on the first request after a change.
+class listing : boost::noncopyable
+{
+	mutable tbb::mutex								mutex_;
+	std::map<std::wstring, std::wstring>			lines_;
+	std::size_t										length_;
+	mutable std::shared_ptr<const std::wstring>		serialized_;
+	bool											ready_;
+public:
+	listing() 
+		: length_(0)
+		, ready_(false)
+	{
+	}
+
+	// An empty line removes the file from the listing.
+	void set(const std::wstring& file, const std::wstring& line)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		auto it = lines_.find(file);
+		if(it == lines_.end())
+		{
+			if(line.empty())
+				return;
+
+			lines_.insert(std::make_pair(file, line));
+		}
+		else
+		{
+			if(it->second == line)
+				return;
+
+			length_ -= it->second.size();
+
+			if(line.empty())
+			{
+				lines_.erase(it);
+				serialized_.reset();
+				return;
+			}
+
+			it->second = line;
+		}
+
+		length_ += line.size();
+		serialized_.reset();
+	}
+
+	void set_ready()
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+		ready_ = true;
+	}
+
+	std::size_t size() const
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+		return lines_.size();
+	}
+
+	std::shared_ptr<const std::wstring> get() const
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		if(!ready_)
+			return nullptr;
+
+		if(!serialized_)
+		{
+			auto serialized = std::make_shared<std::wstring>();
+			serialized->reserve(length_);
+			BOOST_FOREACH(auto& line, lines_)
+				serialized->append(line.second);
+			serialized_ = serialized;
+		}
+
+		return serialized_;
+	}
+};
+
+struct media_index::implementation : boost::noncopyable
+{
+	const std::shared_ptr<listing>				media_;
+	const std::shared_ptr<listing>				templates_;
+	const std::shared_ptr<listing>				data_;
+	std::vector<filesystem_monitor::ptr>		monitors_;
+
+	implementation(filesystem_monitor_factory& monitor_factory, const safe_ptr<core::media_info_repository>& media_info_repo)
+		: media_(std::make_shared<listing>())
+		, templates_(std::make_shared<listing>())
+		, data_(std::make_shared<listing>())
+	{
+		std::shared_ptr<core::media_info_repository> repo = media_info_repo;
+
+		monitor(monitor_factory, env::media_folder(), media_, [repo](filesystem_event event, const boost::filesystem::wpath& file) -> std::wstring
+		{
+			// The repository would otherwise keep describing the file as it was before it changed.
+			if(event == MODIFIED)
+				repo->remove(file.file_string());
+
+			return boost::to_upper_copy(MediaInfo(file, repo));
+		});
+		monitor(monitor_factory, env::template_folder(), templates_, [](filesystem_event, const boost::filesystem::wpath& file)
+		{
+			return TemplateInfo(file);
+		});
+		monitor(monitor_factory, env::data_folder(), data_, [](filesystem_event, const boost::filesystem::wpath& file)
+		{
+			return boost::to_upper_copy(DataInfo(file));
+		});
+	}
+
+	void monitor(
+			filesystem_monitor_factory& monitor_factory, 
+			const std::wstring& folder, 
+			const std::shared_ptr<listing>& target, 
+			const std::function<std::wstring (filesystem_event, const boost::filesystem::wpath&)>& describe)
+	{
+		monitors_.push_back(monitor_factory.create(
+				folder,
+				ALL,
+				true,
+				[=](filesystem_event event, const boost::filesystem::wpath& file)
+				{
+					auto key = boost::to_upper_copy(file.file_string());
+
+					if(event == REMOVED)
+						target->set(key, L"");
+					else
+						target->set(key, describe(event, file));
+				},
+				[=](const std::set<boost::filesystem::wpath>&)
+				{
+					target->set_ready();
+					CASPAR_LOG(info) << L"[media-index] Indexed " << target->size() << L" files in " << folder;
+				}));
+	}
+};
+
+media_index::media_index(filesystem_monitor_factory& monitor_factory, const safe_ptr<core::media_info_repository>& media_info_repo) 
+	: impl_(new implementation(monitor_factory, media_info_repo)){}
+std::shared_ptr<const std::wstring> media_index::media() const{return impl_->media_->get();}
+std::shared_ptr<const std::wstring> media_index::templates() const{return impl_->templates_->get();}
+std::shared_ptr<const std::wstring> media_index::data() const{return impl_->data_->get();}
+
+boost::property_tree::wptree benchmark_media_index(int files)
+{
+	if(files < 1)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("files") << arg_value_info(boost::lexical_cast<std::string>(files)));
+
+	auto file = [](int n)
+	{
+		return L"C:\\MEDIA\\FOLDER" + boost::lexical_cast<std::wstring>(n % 100) + L"\\CLIP" + boost::lexical_cast<std::wstring>(n) + L".MOV";
+	};
+	auto line = [](int n, int duration)
+	{
+		return L"\"FOLDER" + boost::lexical_cast<std::wstring>(n % 100) + L"\\CLIP" + boost::lexical_cast<std::wstring>(n) 
+				+ L"\"  MOVIE  104857600 20140101120000 " + boost::lexical_cast<std::wstring>(duration) + L" 1/25\r\n";
+	};
+
+	listing target;
+
+	auto start = media_index_clock::now();
+	for(int n = 0; n < files; ++n)
+		target.set(file(n), line(n, 250));
+	target.set_ready();
+	auto add_millis = elapsed_millis(start);
+
+	start = media_index_clock::now();
+	auto serialized = target.get();
+	auto serialize_millis = elapsed_millis(start);
+
+	static const int cached_rounds = 1000;
+	start = media_index_clock::now();
+	for(int n = 0; n < cached_rounds; ++n)
+		serialized = target.get();
+	auto cached_millis = elapsed_millis(start) / cached_rounds;
+
+	start = media_index_clock::now();
+	target.set(file(files / 2), line(files / 2, 500));
+	target.get();
+	auto modify_millis = elapsed_millis(start);
+
+	start = media_index_clock::now();
+	target.set(file(files / 3), L"");
+	target.get();
+	auto remove_millis = elapsed_millis(start);
+
+	start = media_index_clock::now();
+	target.set(file(files / 3), line(files / 3, 250));
+	target.get();
+	auto create_millis = elapsed_millis(start);
+
+	boost::property_tree::wptree info;
+	info.add(L"media-index.files",							files);
+	info.add(L"media-index.listing-bytes",					serialized->size() * sizeof(wchar_t));
+	info.add(L"media-index.add-all-millis",					add_millis);
+	info.add(L"media-index.serialize-millis",				serialize_millis);
+	info.add(L"media-index.serve-cached-millis",			cached_millis);
+	info.add(L"media-index.modify-and-serialize-millis",	modify_millis);
+	info.add(L"media-index.remove-and-serialize-millis",	remove_millis);
+	info.add(L"media-index.create-and-serialize-millis",	create_millis);
+
+	return info;
+}
+
+}}}
@@ -0,0 +1,57 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/filesystem/filesystem_monitor.h>
+#include <common/memory/safe_ptr.h>
+
+#include <core/producer/media_info/media_info_repository.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <memory>
+#include <string>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+// Keeps the CLS, TLS and DATA LIST listings of the media, template and data folders in memory. 
+// The folders are scanned once and then kept current by filesystem monitors, so the files are only 
+// inspected when they change. The serialized listing is cached until the next change.
+class media_index : boost::noncopyable
+{
+public:
+	media_index(filesystem_monitor_factory& monitor_factory, const safe_ptr<core::media_info_repository>& media_info_repo);
+
+	// The lines of each listing, or nullptr until the initial scan of its folder is complete.
+	std::shared_ptr<const std::wstring> media() const;
+	std::shared_ptr<const std::wstring> templates() const;
+	std::shared_ptr<const std::wstring> data() const;
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+// Fills a listing with the given number of synthetic entries and times adding them, serving the 
+// listing before and after it is cached, and changing, removing and re-adding single entries.
+boost::property_tree::wptree benchmark_media_index(int files);
+
+}}}
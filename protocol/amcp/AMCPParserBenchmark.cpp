@@ -0,0 +1,98 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "AMCPParserBenchmark.h"
+
+#include "AMCPProtocolStrategy.h"
+
+#include <common/exception/exceptions.h>
+
+#include <boost/chrono.hpp>
+#include <boost/foreach.hpp>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+typedef boost::chrono::high_resolution_clock benchmark_clock;
+
+std::vector<std::wstring> get_default_parser_corpus()
+{
+	std::vector<std::wstring> corpus;
+
+	corpus.push_back(L"MIXER 1-10 OPACITY 0.5 25 easeinsine");
+	corpus.push_back(L"MIXER 1-10 FILL 0.25 0.25 0.5 0.5 12 linear");
+	corpus.push_back(L"MIXER 1-20 CLIP 0 0 1 0.5 0");
+	corpus.push_back(L"MIXER 1-20 VOLUME 0.8 10");
+	corpus.push_back(L"MIXER 1 COMMIT");
+	corpus.push_back(L"CALL 1-10 SEEK 125");
+	corpus.push_back(L"CALL 1-20 LOOP 1");
+	corpus.push_back(L"CG 1-30 ADD 1 \"lower_third\" 1 \"<templateData><componentData id=\\\"f0\\\"><data id=\\\"text\\\" value=\\\"Jane Doe\\\"/></componentData><componentData id=\\\"f1\\\"><data id=\\\"text\\\" value=\\\"Reporter, London\\\"/></componentData></templateData>\"");
+	corpus.push_back(L"CG 1-30 UPDATE 1 \"<templateData><componentData id=\\\"f0\\\"><data id=\\\"text\\\" value=\\\"Live\\\"/></componentData></templateData>\"");
+	corpus.push_back(L"CG 1-30 NEXT 1");
+	corpus.push_back(L"PLAY 1-10 \"clips/opener\" MIX 25 LEFT");
+	corpus.push_back(L"LOADBG 1-10 \"clips/background loop\" LOOP AUTO");
+	corpus.push_back(L"/APP STOP 1-10");
+
+	return corpus;
+}
+
+boost::property_tree::wptree benchmark_parser(AMCPProtocolStrategy& strategy, const std::vector<std::wstring>& corpus, int iterations)
+{
+	if(corpus.empty())
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("corpus"));
+
+	if(iterations < 1)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("iterations"));
+
+	std::size_t characters	= 0;
+	std::size_t failed		= 0;
+
+	BOOST_FOREACH(auto& command, corpus)
+	{
+		characters += command.size();
+		if(!strategy.InterpretCommandString(command))
+			++failed;
+	}
+
+	const auto start = benchmark_clock::now();
+
+	for(int n = 0; n < iterations; ++n)
+	{
+		BOOST_FOREACH(auto& command, corpus)
+			strategy.InterpretCommandString(command);
+	}
+
+	const auto elapsed	= boost::chrono::duration<double>(benchmark_clock::now() - start).count();
+	const auto commands	= static_cast<double>(corpus.size()) * iterations;
+
+	boost::property_tree::wptree info;
+	info.add(L"parser.corpus-commands",		corpus.size());
+	info.add(L"parser.corpus-characters",	characters);
+	info.add(L"parser.failed-commands",		failed);
+	info.add(L"parser.iterations",			iterations);
+	info.add(L"parser.commands-per-second",	commands / elapsed);
+	info.add(L"parser.nanos-per-command",	elapsed * 1000000000.0 / commands);
+	info.add(L"parser.nanos-per-character",	elapsed * 1000000000.0 / (static_cast<double>(characters) * iterations));
+
+	return info;
+}
+
+}}}
@@ -0,0 +1,39 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <string>
+#include <vector>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+class AMCPProtocolStrategy;
+
+// MIXER, CALL, CG, PLAY and LOADBG commands as sent by automation during a graphics heavy show.
+std::vector<std::wstring> get_default_parser_corpus();
+
+// Interprets every command of the corpus the given number of times, without queueing or executing 
+// them, and reports the time per command and the number of commands that could not be interpreted.
+boost::property_tree::wptree benchmark_parser(AMCPProtocolStrategy& strategy, const std::vector<std::wstring>& corpus, int iterations);
+
+}}}
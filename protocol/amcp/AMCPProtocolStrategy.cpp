@@ -25,7 +25,12 @@
 #include "AMCPProtocolStrategy.h"
 
 #include "../util/AsyncEventServer.h"
+#include "../util/protocol_log.h"
 #include "AMCPCommandsImpl.h"
+#include "AMCPSessionReplay.h"
+#include "AMCPSessionTrace.h"
+
+#include <common/env.h>
 
 #include <stdio.h>
 #include <crtdbg.h>
@@ -33,9 +38,10 @@
 #include <algorithm>
 #include <cctype>
 
-#include <boost/algorithm/string/trim.hpp>
-#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
 
 #if defined(_MSC_VER)
@@ -48,6 +54,15 @@ using IO::ClientInfoPtr;
 
 const std::wstring AMCPProtocolStrategy::MessageDelimiter = TEXT("\r\n");
 
+inline void to_upper_ascii(std::wstring& str)
+{
+	BOOST_FOREACH(auto& c, str)
+	{
+		if(c >= TEXT('a') && c <= TEXT('z'))
+			c -= TEXT('a') - TEXT('A');
+	}
+}
+
 inline std::shared_ptr<core::video_channel> GetChannelSafe(unsigned int index, const std::vector<safe_ptr<core::video_channel>>& channels)
 {
 	return index < channels.size() ? std::shared_ptr<core::video_channel>(channels[index]) : nullptr;
@@ -57,29 +72,34 @@ AMCPProtocolStrategy::AMCPProtocolStrategy(
 		const std::vector<safe_ptr<core::video_channel>>& channels,
 		const std::shared_ptr<core::thumbnail_generator>& thumb_gen,
 		const safe_ptr<core::media_info_repository>& media_info_repo,
+		const std::shared_ptr<media_index>& media_index,
 		boost::promise<bool>& shutdown_server_now)
 	: channels_(channels)
 	, thumb_gen_(thumb_gen)
 	, media_info_repo_(media_info_repo)
+	, media_index_(media_index)
+	, session_replayer_(std::make_shared<session_replayer>())
 	, shutdown_server_now_(shutdown_server_now)
 {
-	AMCPCommandQueuePtr pGeneralCommandQueue(new AMCPCommandQueue());
-	commandQueues_.push_back(pGeneralCommandQueue);
+	RegisterCommands();
 
+	AMCPCommandQueuePtr pGeneralCommandQueue(new AMCPCommandQueue(TEXT("general"), RealTime));
+	commandQueues_.push_back(pGeneralCommandQueue);
 
 	std::shared_ptr<core::video_channel> pChannel;
 	unsigned int index = -1;
 	//Create a commandpump for each video_channel
 	while((pChannel = GetChannelSafe(++index, channels_)) != 0) {
-		AMCPCommandQueuePtr pChannelCommandQueue(new AMCPCommandQueue());
-		std::wstring title = TEXT("video_channel ");
-
-		//HACK: Perform real conversion from int to string
-		TCHAR num = TEXT('1')+static_cast<TCHAR>(index);
-		title += num;
-		
+		AMCPCommandQueuePtr pChannelCommandQueue(new AMCPCommandQueue(TEXT("channel-") + boost::lexical_cast<std::wstring>(index + 1), RealTime));
 		commandQueues_.push_back(pChannelCommandQueue);
 	}
+
+	// A fixed number of queues, so that housekeeping never takes more threads than this.
+	int backgroundWorkers = std::max(1, env::properties().get(TEXT("configuration.amcp.background-workers"), 2));
+	for(int n = 0; n < backgroundWorkers; ++n) {
+		AMCPCommandQueuePtr pBackgroundCommandQueue(new AMCPCommandQueue(TEXT("background-") + boost::lexical_cast<std::wstring>(n + 1), Background));
+		backgroundQueues_.push_back(pBackgroundCommandQueue);
+	}
 }
 
 AMCPProtocolStrategy::~AMCPProtocolStrategy() {
@@ -87,47 +107,61 @@ AMCPProtocolStrategy::~AMCPProtocolStrategy() {
 
 void AMCPProtocolStrategy::Parse(const TCHAR* pData, int charCount, ClientInfoPtr pClientInfo)
 {
-	size_t pos;
-	size_t oldLength = pClientInfo->currentMessage_.length();
+	auto& buffer = pClientInfo->currentMessage_;
 
-	if(pClientInfo->currentMessage_.capacity() < (oldLength + charCount))
-		pClientInfo->currentMessage_.reserve(oldLength + 8192 * 4);
+	// Only the new data, and the character before it, can complete a delimiter.
+	std::size_t searchPos = buffer.empty() ? 0 : buffer.size() - 1;
+	std::size_t messageStart = 0;
 
-	pClientInfo->currentMessage_.append(pData, charCount);
-
-	while(true) {
-		pos = pClientInfo->currentMessage_.find(MessageDelimiter, (oldLength>(MessageDelimiter.size()-1)) ? oldLength-(MessageDelimiter.size()-1) : 0);
-		if(pos != std::wstring::npos)
-		{
-			std::wstring message = pClientInfo->currentMessage_.substr(0,pos);
+	buffer.append(pData, charCount);
 
-			//This is where a complete message gets taken care of
-			if(message.length() > 0) {
-				ProcessMessage(message, pClientInfo);
-			}
+	std::size_t pos;
+	while((pos = buffer.find(MessageDelimiter, std::max(searchPos, messageStart))) != std::wstring::npos)
+	{
+		//This is where a complete message gets taken care of
+		if(pos > messageStart)
+			ProcessMessage(buffer.substr(messageStart, pos - messageStart), pClientInfo);
 
-			std::size_t nextStartPos = pos + MessageDelimiter.length();
-			if(nextStartPos < pClientInfo->currentMessage_.length())
-				pClientInfo->currentMessage_ = pClientInfo->currentMessage_.substr(nextStartPos);
-			else {
-				pClientInfo->currentMessage_.clear();
-				break;
-			}
-		}
-		else
-		{
-			break;
-		}
+		messageStart = pos + MessageDelimiter.length();
 	}
+
+	// The handled messages are removed at once rather than after each one.
+	buffer.erase(0, messageStart);
 }
 
 void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInfoPtr& pClientInfo)
 {	
-	if(message.length() < 512)
-		CASPAR_LOG(info) << L"Received message from " << pClientInfo->print() << ": " << message << L"\\r\\n";
-	else
-		CASPAR_LOG(info) << L"Received long message from " << pClientInfo->print() << ": " << message.substr(0, 510) << " [...]\\r\\n";
+	IO::log_received(*pClientInfo, message);
+	record_command(pClientInfo, message);
 	
+	// "REQ id command", replied to with "RES id reply", so that the client can match replies that complete out of order.
+	if(boost::istarts_with(message, TEXT("REQ ")))
+	{
+		auto idEnd			= message.find(TEXT(' '), 4);
+		auto commandStart	= idEnd != std::wstring::npos ? message.find_first_not_of(TEXT(' '), idEnd) : std::wstring::npos;
+
+		if(idEnd == 4 || commandStart == std::wstring::npos)
+			Reply(pClientInfo, std::wstring(), TEXT("400 ERROR\r\n") + message + TEXT("\r\n"));
+		else
+			ProcessCommand(message.substr(commandStart), message.substr(4, idEnd - 4), pClientInfo);
+	}
+	else
+		ProcessCommand(message, std::wstring(), pClientInfo);
+}
+
+void AMCPProtocolStrategy::Reply(ClientInfoPtr& pClientInfo, const std::wstring& requestId, const std::wstring& reply)
+{
+	auto tagged = requestId.empty() ? reply : TEXT("RES ") + requestId + TEXT(" ") + reply;
+
+	record_reply(pClientInfo, tagged);
+	pClientInfo->Send(tagged);
+}
+
+void AMCPProtocolStrategy::ProcessCommand(const std::wstring& message, const std::wstring& requestId, ClientInfoPtr& pClientInfo)
+{
+	if(ProcessBatchMessage(message, requestId, pClientInfo))
+		return;
+
 	bool bError = true;
 	MessageParserState state = New;
 
@@ -137,6 +171,16 @@ void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInf
 
 	if(pCommand != 0) {
 		pCommand->SetClientInfo(pClientInfo);	
+		pCommand->SetRequestId(requestId);
+
+		auto batch = GetBatch(pClientInfo);
+		if(batch) {
+			// Replied to on COMMIT.
+			if(!batch->Add(pCommand))
+				Reply(pClientInfo, requestId, TEXT("403 BATCH ERROR\r\n"));
+			return;
+		}
+
 		if(QueueCommand(pCommand))
 			bError = false;
 		else
@@ -160,13 +204,76 @@ void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInf
 			answer << TEXT("500 FAILED\r\n");
 			break;
 		}
-		pClientInfo->Send(answer.str());
+		Reply(pClientInfo, requestId, answer.str());
+	}
+}
+
+bool AMCPProtocolStrategy::ProcessBatchMessage(const std::wstring& message, const std::wstring& requestId, ClientInfoPtr& pClientInfo)
+{
+	if(message.size() > 16)
+		return false;
+
+	auto keyword = boost::trim_copy(message);
+	to_upper_ascii(keyword);
+
+	if(keyword != TEXT("BEGIN") && keyword != TEXT("COMMIT") && keyword != TEXT("DISCARD"))
+		return false;
+
+	std::shared_ptr<BatchCommand> batch;
+	{
+		tbb::mutex::scoped_lock lock(batchesMutex_);
+
+		for(auto it = batches_.begin(); it != batches_.end();)
+		{
+			if(it->first.expired())
+				it = batches_.erase(it);
+			else
+				++it;
+		}
+
+		auto it = batches_.find(pClientInfo);
+		if(it != batches_.end())
+		{
+			batch = it->second;
+			if(keyword != TEXT("BEGIN"))
+				batches_.erase(it);
+		}
+		else if(keyword == TEXT("BEGIN"))
+			batches_[pClientInfo] = std::make_shared<BatchCommand>();
+	}
+
+	if(keyword == TEXT("BEGIN"))
+		Reply(pClientInfo, requestId, batch ? TEXT("403 BEGIN ERROR\r\n") : TEXT("202 BEGIN OK\r\n"));
+	else if(!batch)
+		Reply(pClientInfo, requestId, TEXT("403 ") + keyword + TEXT(" ERROR\r\n"));
+	else if(keyword == TEXT("DISCARD") || batch->Empty())
+		Reply(pClientInfo, requestId, TEXT("202 ") + keyword + TEXT(" OK\r\n"));
+	else
+	{
+		batch->SetClientInfo(pClientInfo);
+		batch->SetRequestId(requestId);
+		if(!QueueCommand(batch))
+			Reply(pClientInfo, requestId, TEXT("401 COMMIT ERROR\r\n"));
 	}
+
+	return true;
+}
+
+std::shared_ptr<BatchCommand> AMCPProtocolStrategy::GetBatch(const ClientInfoPtr& pClientInfo)
+{
+	tbb::mutex::scoped_lock lock(batchesMutex_);
+
+	if(batches_.empty())
+		return nullptr;
+
+	auto it = batches_.find(pClientInfo);
+	return it != batches_.end() ? it->second : nullptr;
 }
 
 AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring& message, MessageParserState* pOutState)
 {
 	std::vector<std::wstring> tokens;
+	tokens.reserve(16);
 	unsigned int currentToken = 0;
 	std::wstring commandSwitch;
 
@@ -194,6 +301,7 @@ AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring&
 			break;
 
 		case GetCommand:
+			to_upper_ascii(tokens[currentToken]);
 			pCommand = CommandFactory(tokens[currentToken]);
 			if(pCommand == 0) {
 				goto ParseFinnished;
@@ -203,10 +311,12 @@ AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring&
 				pCommand->SetChannels(channels_);
 				pCommand->SetThumbGenerator(thumb_gen_);
 				pCommand->SetMediaInfoRepo(media_info_repo_);
+				pCommand->SetMediaIndex(media_index_);
+				pCommand->SetSessionReplayer(session_replayer_);
 				pCommand->SetShutdownServerNow(shutdown_server_now_);
 				//Set scheduling
 				if(commandSwitch.size() > 0) {
-					transform(commandSwitch.begin(), commandSwitch.end(), commandSwitch.begin(), toupper);
+					to_upper_ascii(commandSwitch);
 
 					if(commandSwitch == TEXT("/APP"))
 						pCommand->SetScheduling(AddToQueue);
@@ -244,23 +354,10 @@ AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring&
 			{
 //				assert(pCommand != 0);
 
-				std::wstring str = boost::trim_copy(tokens[currentToken]);
-				std::vector<std::wstring> split;
-				boost::split(split, str, boost::is_any_of("-"));
-					
 				int channelIndex = -1;
 				int layerIndex = -1;
-				try
-				{
-					channelIndex = boost::lexical_cast<int>(split[0]) - 1;
-
-					if(split.size() > 1)
-						layerIndex = boost::lexical_cast<int>(split[1]);
-				}
-				catch(...)
-				{
+				if(!ParseChannelLayer(tokens[currentToken], channelIndex, layerIndex))
 					goto ParseFinnished;
-				}
 
 				std::shared_ptr<core::video_channel> pChannel = GetChannelSafe(channelIndex, channels_);
 				if(pChannel == 0) {
@@ -305,121 +402,225 @@ bool AMCPProtocolStrategy::QueueCommand(AMCPCommandPtr pCommand) {
 		else
 			return false;
 	}
+	else if(!pCommand->GetRequestId().empty()) {
+		// Tagged clients can match the replies, so the lanes need not wait for each other.
+		GetLaneQueue(pCommand->GetLane())->AddCommand(pCommand);
+	}
 	else {
-		commandQueues_[0]->AddCommand(pCommand);
+		QueueClientCommand(pCommand);
 	}
 	return true;
 }
 
+AMCPCommandQueuePtr AMCPProtocolStrategy::GetLaneQueue(AMCPCommandLane lane) const
+{
+	if(lane == RealTime)
+		return commandQueues_[0];
+
+	return *std::min_element(backgroundQueues_.begin(), backgroundQueues_.end(), [](const AMCPCommandQueuePtr& lhs, const AMCPCommandQueuePtr& rhs)
+	{
+		return lhs->GetPendingCount() < rhs->GetPendingCount();
+	});
+}
+
+void AMCPProtocolStrategy::QueueClientCommand(AMCPCommandPtr pCommand)
+{
+	tbb::mutex::scoped_lock lock(clientCommandsMutex_);
+
+	std::weak_ptr<IO::ClientInfo> client = pCommand->GetClientInfo();
+	auto& commands = clientCommands_[client];
+	commands.deferred.push_back(pCommand);
+	DispatchClientCommands(client, commands);
+}
+
+// Called with clientCommandsMutex_ held. Untagged replies must arrive in the order the commands were sent, so 
+// a client's commands for one lane wait until those it has pending on the other lane are done.
+void AMCPProtocolStrategy::DispatchClientCommands(const std::weak_ptr<IO::ClientInfo>& client, ClientCommands& commands)
+{
+	while(!commands.deferred.empty()) {
+		auto pCommand = commands.deferred.front();
+		if(commands.pending == 0)
+			commands.queue = GetLaneQueue(pCommand->GetLane());
+		else if(commands.queue->GetLane() != pCommand->GetLane())
+			break;
+
+		commands.deferred.pop_front();
+
+		if(commands.queue->AddCommand(pCommand, [=]{OnClientCommandDone(client);}))
+			++commands.pending;
+	}
+
+	if(commands.pending == 0)
+		clientCommands_.erase(client);
+}
+
+void AMCPProtocolStrategy::OnClientCommandDone(const std::weak_ptr<IO::ClientInfo>& client)
+{
+	tbb::mutex::scoped_lock lock(clientCommandsMutex_);
+
+	auto it = clientCommands_.find(client);
+	if(it != clientCommands_.end() && --it->second.pending == 0)
+		DispatchClientCommands(client, it->second);
+}
+
+boost::property_tree::wptree AMCPProtocolStrategy::QueueInfo() const
+{
+	boost::property_tree::wptree info;
+
+	BOOST_FOREACH(auto& queue, commandQueues_)
+		info.add_child(TEXT("queues.real-time.queue"), queue->info());
+
+	BOOST_FOREACH(auto& queue, backgroundQueues_)
+		info.add_child(TEXT("queues.background.queue"), queue->info());
+
+	return info;
+}
+
 AMCPCommandPtr AMCPProtocolStrategy::CommandFactory(const std::wstring& str)
 {
-	std::wstring s = str;
-	transform(s.begin(), s.end(), s.begin(), toupper);
-	
-	if	   (s == TEXT("MIXER"))			return std::make_shared<MixerCommand>();
-	else if(s == TEXT("DIAG"))			return std::make_shared<DiagnosticsCommand>();
-	else if(s == TEXT("CHANNEL_GRID"))	return std::make_shared<ChannelGridCommand>();
-	else if(s == TEXT("CALL"))			return std::make_shared<CallCommand>();
-	else if(s == TEXT("SWAP"))			return std::make_shared<SwapCommand>();
-	else if(s == TEXT("ROUTE"))			return std::make_shared<RouteCommand>();
-	else if(s == TEXT("LOAD"))			return std::make_shared<LoadCommand>();
-	else if(s == TEXT("LOADBG"))		return std::make_shared<LoadbgCommand>();
-	else if(s == TEXT("ADD"))			return std::make_shared<AddCommand>();
-	else if(s == TEXT("REMOVE"))		return std::make_shared<RemoveCommand>();
-	else if(s == TEXT("PAUSE"))			return std::make_shared<PauseCommand>();
-	else if(s == TEXT("PLAY"))			return std::make_shared<PlayCommand>();
-	else if(s == TEXT("STOP"))			return std::make_shared<StopCommand>();
-	else if(s == TEXT("CLEAR"))			return std::make_shared<ClearCommand>();
-	else if(s == TEXT("PRINT"))			return std::make_shared<PrintCommand>();
-	else if(s == TEXT("LOG"))			return std::make_shared<LogCommand>();
-	else if(s == TEXT("CG"))			return std::make_shared<CGCommand>();
-	else if(s == TEXT("DATA"))			return std::make_shared<DataCommand>();
-	else if(s == TEXT("CINF"))			return std::make_shared<CinfCommand>();
-	else if(s == TEXT("INFO"))			return std::make_shared<InfoCommand>(channels_);
-	else if(s == TEXT("CLS"))			return std::make_shared<ClsCommand>();
-	else if(s == TEXT("TLS"))			return std::make_shared<TlsCommand>();
-	else if(s == TEXT("VERSION"))		return std::make_shared<VersionCommand>();
-	else if(s == TEXT("BYE"))			return std::make_shared<ByeCommand>();
-	else if(s == TEXT("SET"))			return std::make_shared<SetCommand>();
-	else if(s == TEXT("THUMBNAIL"))		return std::make_shared<ThumbnailCommand>();
-	//else if(s == TEXT("MONITOR"))
-	//{
-	//	result = AMCPCommandPtr(new MonitorCommand());
-	//}
-	else if(s == TEXT("KILL"))			return std::make_shared<KillCommand>();
-	else if(s == TEXT("RESTART"))		return std::make_shared<RestartCommand>();
-	return nullptr;
+	auto it = commandFactories_.find(str);
+	return it != commandFactories_.end() ? it->second() : nullptr;
+}
+
+void AMCPProtocolStrategy::RegisterCommands()
+{
+	auto& f = commandFactories_;
+
+	f[TEXT("MIXER")]		= []{return std::make_shared<MixerCommand>();};
+	f[TEXT("DIAG")]			= []{return std::make_shared<DiagnosticsCommand>();};
+	f[TEXT("BENCHMARK")]	= []{return std::make_shared<BenchmarkCommand>();};
+	f[TEXT("LOADTEST")]		= []{return std::make_shared<LoadTestCommand>();};
+	f[TEXT("TRACE")]		= []{return std::make_shared<TraceCommand>();};
+	f[TEXT("CHANNEL_GRID")]	= []{return std::make_shared<ChannelGridCommand>();};
+	f[TEXT("CALL")]			= []{return std::make_shared<CallCommand>();};
+	f[TEXT("SWAP")]			= []{return std::make_shared<SwapCommand>();};
+	f[TEXT("ROUTE")]		= []{return std::make_shared<RouteCommand>();};
+	f[TEXT("LOAD")]			= []{return std::make_shared<LoadCommand>();};
+	f[TEXT("LOADBG")]		= []{return std::make_shared<LoadbgCommand>();};
+	f[TEXT("ADD")]			= []{return std::make_shared<AddCommand>();};
+	f[TEXT("REMOVE")]		= []{return std::make_shared<RemoveCommand>();};
+	f[TEXT("PAUSE")]		= []{return std::make_shared<PauseCommand>();};
+	f[TEXT("PLAY")]			= []{return std::make_shared<PlayCommand>();};
+	f[TEXT("STOP")]			= []{return std::make_shared<StopCommand>();};
+	f[TEXT("CLEAR")]		= []{return std::make_shared<ClearCommand>();};
+	f[TEXT("PRINT")]		= []{return std::make_shared<PrintCommand>();};
+	f[TEXT("LOG")]			= []{return std::make_shared<LogCommand>();};
+	f[TEXT("CG")]			= []{return std::make_shared<CGCommand>();};
+	f[TEXT("DATA")]			= []{return std::make_shared<DataCommand>();};
+	f[TEXT("CINF")]			= []{return std::make_shared<CinfCommand>();};
+	f[TEXT("CLS")]			= []{return std::make_shared<ClsCommand>();};
+	f[TEXT("TLS")]			= []{return std::make_shared<TlsCommand>();};
+	f[TEXT("VERSION")]		= []{return std::make_shared<VersionCommand>();};
+	f[TEXT("BYE")]			= []{return std::make_shared<ByeCommand>();};
+	f[TEXT("SET")]			= []{return std::make_shared<SetCommand>();};
+	f[TEXT("THUMBNAIL")]	= []{return std::make_shared<ThumbnailCommand>();};
+	f[TEXT("KILL")]			= []{return std::make_shared<KillCommand>();};
+	f[TEXT("RESTART")]		= []{return std::make_shared<RestartCommand>();};
+
+	auto channels = channels_;
+	std::function<boost::property_tree::wptree()> queues = [this]{return QueueInfo();};
+	f[TEXT("INFO")]			= [=]{return std::make_shared<InfoCommand>(channels, queues);};
+}
+
+bool AMCPProtocolStrategy::ParseChannelLayer(const std::wstring& token, int& channelIndex, int& layerIndex)
+{
+	// "channel" or "channel-layer", anything after a second '-' is ignored.
+	auto it = token.begin();
+
+	auto parseNumber = [&](int& result) -> bool
+	{
+		int value = 0;
+		int digits = 0;
+		for(; it != token.end() && *it >= TEXT('0') && *it <= TEXT('9') && digits < 9; ++it, ++digits)
+			value = value * 10 + (*it - TEXT('0'));
+
+		result = value;
+		return digits > 0 && (it == token.end() || *it == TEXT('-'));
+	};
+
+	int channel = 0;
+	if(!parseNumber(channel))
+		return false;
+
+	channelIndex = channel - 1;
+
+	if(it != token.end())
+	{
+		++it;
+		if(!parseNumber(layerIndex))
+			return false;
+	}
+
+	return true;
 }
 
 std::size_t AMCPProtocolStrategy::TokenizeMessage(const std::wstring& message, std::vector<std::wstring>* pTokenVector)
 {
 	//split on whitespace but keep strings within quotationmarks
 	//treat \ as the start of an escape-sequence: the following char will indicate what to actually put in the string
+	//runs of ordinary characters are appended at once
 
 	std::wstring currentToken;
+	bool inQuote = false;
+
+	auto flush = [&]
+	{
+		if(!currentToken.empty())
+		{
+			pTokenVector->push_back(std::move(currentToken));
+			currentToken.clear();
+		}
+	};
 
-	char inQuote = 0;
-	bool getSpecialCode = false;
+	auto it = message.begin();
+	const auto end = message.end();
 
-	for(unsigned int charIndex=0; charIndex<message.size(); ++charIndex)
+	while(it != end)
 	{
-		if(getSpecialCode)
+		auto run = it;
+		while(run != end && *run != TEXT('\\') && *run != TEXT('\"') && (inQuote || *run != TEXT(' ')))
+			++run;
+
+		currentToken.append(it, run);
+		it = run;
+
+		if(it == end)
+			break;
+
+		switch(*it++)
 		{
-			//insert code-handling here
-			switch(message[charIndex])
+		case TEXT('\\'):
+			if(it == end)
+				break;
+
+			switch(*it++)
 			{
 			case TEXT('\\'):
-				currentToken += TEXT("\\");
+				currentToken += TEXT('\\');
 				break;
 			case TEXT('\"'):
-				currentToken += TEXT("\"");
+				currentToken += TEXT('\"');
 				break;
 			case TEXT('n'):
-				currentToken += TEXT("\n");
+				currentToken += TEXT('\n');
 				break;
 			default:
 				break;
 			};
-			getSpecialCode = false;
-			continue;
-		}
-
-		if(message[charIndex]==TEXT('\\'))
-		{
-			getSpecialCode = true;
-			continue;
-		}
-
-		if(message[charIndex]==' ' && inQuote==false)
-		{
-			if(currentToken.size()>0)
-			{
-				pTokenVector->push_back(currentToken);
-				currentToken.clear();
-			}
-			continue;
-		}
+			break;
 
-		if(message[charIndex]==TEXT('\"'))
-		{
-			inQuote ^= 1;
+		case TEXT('\"'):
+			inQuote = !inQuote;
+			flush();
+			break;
 
-			if(currentToken.size()>0)
-			{
-				pTokenVector->push_back(currentToken);
-				currentToken.clear();
-			}
-			continue;
+		default: // An unquoted space.
+			flush();
+			break;
 		}
-
-		currentToken += message[charIndex];
 	}
 
-	if(currentToken.size()>0)
-	{
-		pTokenVector->push_back(currentToken);
-		currentToken.clear();
-	}
+	flush();
 
 	return pTokenVector->size();
 }
@@ -32,8 +32,17 @@
 #include <boost/noncopyable.hpp>
 #include <boost/thread/future.hpp>
 
+#include <tbb/mutex.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <unordered_map>
+
 namespace caspar { namespace protocol { namespace amcp {
 
+class BatchCommand;
+
 class AMCPProtocolStrategy : public IO::IProtocolStrategy, boost::noncopyable
 {
 	enum MessageParserState {
@@ -53,6 +62,7 @@ public:
 			const std::vector<safe_ptr<core::video_channel>>& channels,
 			const std::shared_ptr<core::thumbnail_generator>& thumb_gen,
 			const safe_ptr<core::media_info_repository>& media_info_repo,
+			const std::shared_ptr<media_index>& media_index,
 			boost::promise<bool>& shutdown_server_now);
 	virtual ~AMCPProtocolStrategy();
 
@@ -67,16 +77,46 @@ private:
 	friend class AMCPCommand;
 
 	void ProcessMessage(const std::wstring& message, IO::ClientInfoPtr& pClientInfo);
+	void ProcessCommand(const std::wstring& message, const std::wstring& requestId, IO::ClientInfoPtr& pClientInfo);
+	bool ProcessBatchMessage(const std::wstring& message, const std::wstring& requestId, IO::ClientInfoPtr& pClientInfo);
+	static void Reply(IO::ClientInfoPtr& pClientInfo, const std::wstring& requestId, const std::wstring& reply);
+	std::shared_ptr<BatchCommand> GetBatch(const IO::ClientInfoPtr& pClientInfo);
 	std::size_t TokenizeMessage(const std::wstring& message, std::vector<std::wstring>* pTokenVector);
-	AMCPCommandPtr CommandFactory(const std::wstring& str);
+	AMCPCommandPtr CommandFactory(const std::wstring& str); // Expects an upper case command name.
+	void RegisterCommands();
+	static bool ParseChannelLayer(const std::wstring& token, int& channelIndex, int& layerIndex);
 
 	bool QueueCommand(AMCPCommandPtr);
+	AMCPCommandQueuePtr GetLaneQueue(AMCPCommandLane lane) const;
+	boost::property_tree::wptree QueueInfo() const;
+
+	// The untagged commands of a client that need no channel, which are replied to in order.
+	struct ClientCommands
+	{
+		AMCPCommandQueuePtr			queue;		// Of the pending ones.
+		int							pending;
+		std::deque<AMCPCommandPtr>	deferred;	// Until the pending ones, of the other lane, are done.
+
+		ClientCommands() : pending(0){}
+	};
+
+	void QueueClientCommand(AMCPCommandPtr pCommand);
+	void DispatchClientCommands(const std::weak_ptr<IO::ClientInfo>& client, ClientCommands& commands);
+	void OnClientCommandDone(const std::weak_ptr<IO::ClientInfo>& client);
 
 	std::vector<safe_ptr<core::video_channel>> channels_;
 	std::shared_ptr<core::thumbnail_generator> thumb_gen_;
 	safe_ptr<core::media_info_repository> media_info_repo_;
+	std::shared_ptr<media_index> media_index_;
+	std::shared_ptr<session_replayer> session_replayer_;
 	boost::promise<bool>& shutdown_server_now_;
+	tbb::mutex clientCommandsMutex_;
+	std::map<std::weak_ptr<IO::ClientInfo>, ClientCommands, std::owner_less<std::weak_ptr<IO::ClientInfo>>> clientCommands_;
 	std::vector<AMCPCommandQueuePtr> commandQueues_;
+	std::vector<AMCPCommandQueuePtr> backgroundQueues_;
+	std::unordered_map<std::wstring, std::function<AMCPCommandPtr()>> commandFactories_;
+	tbb::mutex batchesMutex_;
+	std::map<std::weak_ptr<IO::ClientInfo>, std::shared_ptr<BatchCommand>, std::owner_less<std::weak_ptr<IO::ClientInfo>>> batches_;
 	static const std::wstring MessageDelimiter;
 };
 
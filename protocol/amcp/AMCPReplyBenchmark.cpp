@@ -0,0 +1,170 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "AMCPReplyBenchmark.h"
+
+#include "AMCPProtocolStrategy.h"
+
+#include <common/exception/exceptions.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/chrono.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <deque>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+typedef boost::chrono::high_resolution_clock benchmark_clock;
+
+// Matches the replies to the commands by kind, replies of one kind arrive in the order they were sent.
+class reply_recorder : public IO::ClientInfo
+{
+	boost::mutex								mutex_;
+	boost::condition_variable					cond_;
+	std::deque<benchmark_clock::time_point>		pending_[2];
+	std::vector<double>							latencies_[2];
+	int											outstanding_;
+public:
+	enum kind { slow = 0, fast };
+
+	reply_recorder() : outstanding_(0){}
+
+	void sent(kind k)
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		pending_[k].push_back(benchmark_clock::now());
+		++outstanding_;
+	}
+
+	bool wait(const boost::posix_time::time_duration& timeout)
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		auto deadline = boost::get_system_time() + timeout;
+		while(outstanding_ > 0)
+		{
+			if(!cond_.timed_wait(lock, deadline))
+				return false;
+		}
+		return true;
+	}
+
+	std::vector<double> latencies(kind k)
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		auto result = latencies_[k];
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+	virtual void Send(const std::wstring& data) override
+	{
+		auto reply = data;
+		if(boost::starts_with(reply, L"RES "))
+			reply = reply.substr(std::min(reply.size(), reply.find(L' ', 4) + 1));
+
+		const kind k = boost::contains(reply.substr(0, reply.find(L'\r')), L"VERSION") ? fast : slow;
+
+		boost::mutex::scoped_lock lock(mutex_);
+		if(pending_[k].empty())
+			return;
+
+		latencies_[k].push_back(boost::chrono::duration<double, boost::milli>(benchmark_clock::now() - pending_[k].front()).count());
+		pending_[k].pop_front();
+
+		if(--outstanding_ == 0)
+			cond_.notify_all();
+	}
+
+	virtual void SendBytes(const std::vector<char>& data) override
+	{
+	}
+
+	virtual void Disconnect() override
+	{
+	}
+
+	virtual std::wstring print() const override
+	{
+		return L"reply-benchmark";
+	}
+};
+
+static boost::property_tree::wptree summarize(const std::vector<double>& latencies)
+{
+	boost::property_tree::wptree info;
+	info.add(L"count",	latencies.size());
+	info.add(L"p50",	latencies.empty() ? 0.0 : latencies[latencies.size() / 2]);
+	info.add(L"p99",	latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)]);
+	info.add(L"max",	latencies.empty() ? 0.0 : latencies.back());
+	return info;
+}
+
+static boost::property_tree::wptree run_mode(AMCPProtocolStrategy& strategy, int rounds, bool tagged)
+{
+	auto recorder = std::make_shared<reply_recorder>();
+
+	const auto start = benchmark_clock::now();
+
+	for(int n = 0; n < rounds; ++n)
+	{
+		const auto tag		= tagged ? L"REQ " + boost::lexical_cast<std::wstring>(n) : std::wstring();
+		const auto slow		= tag + (tagged ? L"-S CLS\r\n" : L"CLS\r\n");
+		const auto fast		= tag + (tagged ? L"-F VERSION\r\n" : L"VERSION\r\n");
+
+		recorder->sent(reply_recorder::slow);
+		strategy.Parse(slow.c_str(), static_cast<int>(slow.size()), recorder);
+
+		recorder->sent(reply_recorder::fast);
+		strategy.Parse(fast.c_str(), static_cast<int>(fast.size()), recorder);
+	}
+
+	const bool completed	= recorder->wait(boost::posix_time::seconds(120));
+	const auto elapsed		= boost::chrono::duration<double, boost::milli>(benchmark_clock::now() - start).count();
+
+	boost::property_tree::wptree info;
+	info.add(L"tagged",				tagged);
+	info.add(L"completed",			completed);
+	info.add(L"elapsed-millis",		elapsed);
+	info.add_child(L"slow-millis",	summarize(recorder->latencies(reply_recorder::slow)));
+	info.add_child(L"fast-millis",	summarize(recorder->latencies(reply_recorder::fast)));
+
+	return info;
+}
+
+boost::property_tree::wptree benchmark_replies(AMCPProtocolStrategy& strategy, int rounds)
+{
+	if(rounds < 1)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("rounds"));
+
+	boost::property_tree::wptree info;
+	info.add(L"replies.rounds", rounds);
+	info.add_child(L"replies.modes.mode", run_mode(strategy, rounds, false));
+	info.add_child(L"replies.modes.mode", run_mode(strategy, rounds, true));
+
+	return info;
+}
+
+}}}
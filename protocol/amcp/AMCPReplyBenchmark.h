@@ -0,0 +1,33 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <boost/property_tree/ptree.hpp>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+class AMCPProtocolStrategy;
+
+// Sends the given number of slow (CLS) and fast (VERSION) commands interleaved in one burst, first 
+// untagged and then tagged with REQ, and reports the reply latencies of each kind.
+boost::property_tree::wptree benchmark_replies(AMCPProtocolStrategy& strategy, int rounds);
+
+}}}
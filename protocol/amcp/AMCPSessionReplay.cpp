@@ -0,0 +1,714 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "AMCPSessionReplay.h"
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/mutex.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cwctype>
+#include <deque>
+#include <iterator>
+#include <map>
+
+using boost::asio::ip::tcp;
+
+namespace caspar { namespace protocol { namespace amcp {
+
+typedef boost::chrono::high_resolution_clock replay_clock;
+
+static const int reply_timeout_seconds = 30;
+
+static double elapsed_millis(replay_clock::time_point since, replay_clock::time_point until = replay_clock::now())
+{
+	return boost::chrono::duration<double, boost::milli>(until - since).count();
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if(sorted.empty())
+		return 0.0;
+
+	return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+}
+
+struct replay_command
+{
+	long long		due_micros;
+	std::size_t		connection;
+	std::wstring	message;
+	std::string		data;
+	bool			tagged;		// Recorded with REQ, and replayed with the index of the command as its id.
+	bool			in_batch;	// Replied to as part of the COMMIT, unless it is refused.
+};
+
+class session_replay;
+
+// Sends the commands given to it in order and splits the replies by their status codes: 200 is 
+// followed by lines up to an empty one, 201 and 400 by one line. Only accessed on the replay thread.
+class replay_connection : public std::enable_shared_from_this<replay_connection>
+{
+	session_replay&				replay_;
+	const std::size_t			index_;
+	tcp::socket					socket_;
+	boost::asio::streambuf		response_;
+	std::deque<std::string>		writes_;
+	int							data_lines_;
+	bool						until_empty_;
+public:
+	bool						connected;
+	bool						failed;
+
+	replay_connection(session_replay& replay, std::size_t index, boost::asio::io_service& service)
+		: replay_(replay)
+		, index_(index)
+		, socket_(service)
+		, data_lines_(0)
+		, until_empty_(false)
+		, connected(false)
+		, failed(false)
+	{
+	}
+
+	void connect(const tcp::endpoint& endpoint);
+	void send(const std::string& data);
+	void close()
+	{
+		boost::system::error_code ec;
+		socket_.close(ec);
+	}
+private:
+	void write_next();
+	void read_next();
+	void on_line(const std::string& line);
+	void fail();
+};
+
+// Tagged replies are matched by their id. Untagged replies come in the order that the untagged 
+// commands were sent on their connection, since the server replies to them in order.
+class session_replay : boost::noncopyable
+{
+	boost::asio::io_service&						service_;
+	const std::vector<replay_command>&				commands_;
+	const double									speed_;
+	std::vector<std::shared_ptr<replay_connection>>	connections_;
+	boost::asio::deadline_timer						timer_;
+	replay_clock::time_point						start_;
+	std::size_t										next_;
+	int												pending_connects_;
+	std::vector<replay_clock::time_point>			sent_at_;
+	std::map<int, std::size_t>						tagged_;	// By request id.
+	std::vector<std::deque<std::size_t>>			untagged_;	// By connection.
+	int												awaited_;	// Commands that are always replied to.
+	bool											finished_;
+public:
+	std::vector<std::pair<double, std::size_t>>		latencies;
+	std::map<int, int>								status_codes;
+	int												replies;
+	int												errors;
+	int												unanswered;
+	int												not_sent;
+	double											max_lag_millis;
+	bool											timed_out;
+
+	session_replay(boost::asio::io_service& service, const std::vector<replay_command>& commands, std::size_t connections, double speed)
+		: service_(service)
+		, commands_(commands)
+		, speed_(speed)
+		, timer_(service)
+		, next_(0)
+		, pending_connects_(0)
+		, sent_at_(commands.size())
+		, untagged_(connections)
+		, awaited_(0)
+		, finished_(false)
+		, replies(0)
+		, errors(0)
+		, unanswered(0)
+		, not_sent(0)
+		, max_lag_millis(0.0)
+		, timed_out(false)
+	{
+		for(std::size_t n = 0; n < connections; ++n)
+			connections_.push_back(std::make_shared<replay_connection>(*this, n, service_));
+	}
+
+	const std::vector<std::shared_ptr<replay_connection>>& connections() const
+	{
+		return connections_;
+	}
+
+	void start(const tcp::endpoint& endpoint)
+	{
+		pending_connects_ = static_cast<int>(connections_.size());
+		BOOST_FOREACH(auto& connection, connections_)
+			connection->connect(endpoint);
+	}
+
+	void on_connected()
+	{
+		// The schedule starts when every connection is ready, so that connecting does not count as lag.
+		if(--pending_connects_ > 0)
+			return;
+
+		start_ = replay_clock::now();
+		send_due();
+	}
+
+	void on_reply(std::size_t connection, int request_id, int status_code, const std::string& reply)
+	{
+		++replies;
+		++status_codes[status_code];
+		if(status_code >= 400)
+			++errors;
+
+		if(request_id >= 0)
+		{
+			auto it = tagged_.find(request_id);
+			if(it == tagged_.end() || commands_[it->second].connection != connection)
+				return;
+
+			complete(it->second);
+			tagged_.erase(it);
+		}
+		else
+		{
+			// Commands within a batch are only replied to on their own when they are refused. 
+			// Those that were not have been accepted, and are replied to by the COMMIT.
+			auto& untagged = untagged_[connection];
+			const bool refused = status_code == 400 || boost::contains(reply, "BATCH ERROR");
+
+			while(!untagged.empty() && commands_[untagged.front()].in_batch && !refused)
+				untagged.pop_front();
+
+			if(untagged.empty())
+				return;
+
+			complete(untagged.front());
+			untagged.pop_front();
+		}
+
+		finish_if_done();
+	}
+
+	void on_failed(std::size_t connection)
+	{
+		for(auto it = tagged_.begin(); it != tagged_.end();)
+		{
+			if(commands_[it->second].connection == connection)
+			{
+				++unanswered;
+				--awaited_;
+				it = tagged_.erase(it);
+			}
+			else
+				++it;
+		}
+
+		BOOST_FOREACH(auto command, untagged_[connection])
+		{
+			if(!commands_[command].in_batch)
+			{
+				++unanswered;
+				--awaited_;
+			}
+		}
+
+		untagged_[connection].clear();
+
+		finish_if_done();
+	}
+
+private:
+	void send_due()
+	{
+		if(finished_)
+			return;
+
+		const auto now = replay_clock::now();
+
+		while(next_ < commands_.size())
+		{
+			auto& command = commands_[next_];
+			auto due = start_ + boost::chrono::microseconds(speed_ > 0.0 ? static_cast<long long>(command.due_micros / speed_) : 0);
+
+			if(due > now)
+			{
+				timer_.expires_from_now(boost::posix_time::microseconds(boost::chrono::duration_cast<boost::chrono::microseconds>(due - now).count()));
+				timer_.async_wait([this](const boost::system::error_code& ec)
+				{
+					if(!ec)
+						send_due();
+				});
+				return;
+			}
+
+			max_lag_millis = std::max(max_lag_millis, elapsed_millis(due, now));
+			send(next_++);
+		}
+
+		if(finish_if_done())
+			return;
+
+		timer_.expires_from_now(boost::posix_time::seconds(reply_timeout_seconds));
+		timer_.async_wait([this](const boost::system::error_code& ec)
+		{
+			if(ec)
+				return;
+
+			timed_out = true;
+			unanswered += awaited_;
+			finish();
+		});
+	}
+
+	void send(std::size_t index)
+	{
+		auto& command		= commands_[index];
+		auto& connection	= connections_[command.connection];
+
+		if(!connection->connected || connection->failed)
+		{
+			++not_sent;
+			return;
+		}
+
+		sent_at_[index] = replay_clock::now();
+
+		if(!command.in_batch)
+			++awaited_;
+
+		if(!command.tagged)
+			untagged_[command.connection].push_back(index);
+		else if(!command.in_batch)
+			tagged_[static_cast<int>(index)] = index;
+
+		connection->send(command.data);
+	}
+
+	void complete(std::size_t index)
+	{
+		latencies.push_back(std::make_pair(elapsed_millis(sent_at_[index]), index));
+
+		if(!commands_[index].in_batch)
+			--awaited_;
+	}
+
+	bool finish_if_done()
+	{
+		if(next_ < commands_.size() || awaited_ > 0)
+			return false;
+
+		finish();
+		return true;
+	}
+
+	void finish()
+	{
+		if(finished_)
+			return;
+
+		finished_ = true;
+
+		boost::system::error_code ec;
+		timer_.cancel(ec);
+
+		BOOST_FOREACH(auto& connection, connections_)
+			connection->close();
+	}
+};
+
+void replay_connection::connect(const tcp::endpoint& endpoint)
+{
+	auto self = shared_from_this();
+	socket_.async_connect(endpoint, [=](const boost::system::error_code& ec)
+	{
+		if(!ec)
+		{
+			boost::system::error_code ignored;
+			self->socket_.set_option(tcp::no_delay(true), ignored);
+			self->connected = true;
+			self->read_next();
+		}
+
+		self->replay_.on_connected();
+	});
+}
+
+void replay_connection::send(const std::string& data)
+{
+	writes_.push_back(data);
+	if(writes_.size() == 1)
+		write_next();
+}
+
+void replay_connection::write_next()
+{
+	auto self = shared_from_this();
+	boost::asio::async_write(socket_, boost::asio::buffer(writes_.front()), [=](const boost::system::error_code& ec, std::size_t)
+	{
+		if(ec)
+		{
+			self->fail();
+			return;
+		}
+
+		self->writes_.pop_front();
+		if(!self->writes_.empty())
+			self->write_next();
+	});
+}
+
+void replay_connection::read_next()
+{
+	auto self = shared_from_this();
+	boost::asio::async_read_until(socket_, response_, "\r\n", [=](const boost::system::error_code& ec, std::size_t bytes_transferred)
+	{
+		if(ec)
+		{
+			self->fail();
+			return;
+		}
+
+		std::string line(boost::asio::buffers_begin(self->response_.data()), boost::asio::buffers_begin(self->response_.data()) + bytes_transferred - 2);
+		self->response_.consume(bytes_transferred);
+
+		self->on_line(line);
+		self->read_next();
+	});
+}
+
+void replay_connection::on_line(const std::string& line)
+{
+	if(until_empty_)
+	{
+		until_empty_ = !line.empty();
+		return;
+	}
+
+	if(data_lines_ > 0)
+	{
+		--data_lines_;
+		return;
+	}
+
+	int request_id = -1;
+	auto reply = line;
+	if(boost::starts_with(line, "RES "))
+	{
+		auto id_end = line.find(' ', 4);
+		request_id	= std::atoi(line.substr(4, id_end - 4).c_str());
+		reply		= id_end != std::string::npos ? line.substr(id_end + 1) : std::string();
+	}
+
+	auto status_code = std::atoi(reply.substr(0, 3).c_str());
+	if(status_code == 200)
+		until_empty_ = true;
+	else if(status_code == 201 || status_code == 400)
+		data_lines_ = 1;
+
+	replay_.on_reply(index_, request_id, status_code, reply);
+}
+
+void replay_connection::fail()
+{
+	if(failed)
+		return;
+
+	// Closing also ends the pending read or write.
+	failed = true;
+	close();
+	replay_.on_failed(index_);
+}
+
+static int parse_status_code(const std::wstring& reply)
+{
+	auto start = 0;
+	if(boost::istarts_with(reply, L"RES "))
+	{
+		auto id_end = reply.find(L' ', 4);
+		if(id_end == std::wstring::npos)
+			return 0;
+		start = static_cast<int>(id_end) + 1;
+	}
+
+	return std::wcstol(reply.substr(start, 3).c_str(), nullptr, 10);
+}
+
+static std::wstring command_keyword(const std::wstring& message)
+{
+	auto start = message.find_first_not_of(L' ');
+	if(start != std::wstring::npos && message[start] == L'/')
+		start = message.find_first_not_of(L' ', message.find(L' ', start));
+	if(start == std::wstring::npos)
+		return std::wstring();
+
+	auto keyword = message.substr(start, message.find(L' ', start) - start);
+	std::transform(keyword.begin(), keyword.end(), keyword.begin(), std::towupper);
+	return keyword;
+}
+
+static boost::property_tree::wptree run_replay(boost::asio::io_service& service, const std::vector<session_trace_entry>& trace, const std::string& address, int port, double speed)
+{
+	if(speed < 0.0)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("speed") << arg_value_info(boost::lexical_cast<std::string>(speed)));
+
+	boost::system::error_code ec;
+	const tcp::endpoint endpoint(boost::asio::ip::address::from_string(address, ec), static_cast<unsigned short>(port));
+	if(ec)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("address") << arg_value_info(address));
+
+	// Commands that would end the replay, or interfere with the server, are left out.
+	static const wchar_t* skipped_keywords[] = {L"BYE", L"KILL", L"RESTART", L"TRACE"};
+
+	std::vector<replay_command>	commands;
+	std::map<int, std::size_t>	connections;
+	std::map<int, bool>			in_batch;
+	int							skipped = 0;
+	int							recorded_errors = 0;
+	long long					first_micros = -1;
+	long long					last_micros = 0;
+
+	BOOST_FOREACH(auto& entry, trace)
+	{
+		if(entry.reply)
+		{
+			if(parse_status_code(entry.message) >= 400)
+				++recorded_errors;
+			continue;
+		}
+
+		// The replay tags the commands that were tagged with ids of its own.
+		auto message = entry.message;
+		const bool tagged = boost::istarts_with(message, L"REQ ");
+		if(tagged)
+		{
+			auto id_end			= message.find(L' ', 4);
+			auto command_start	= id_end != std::wstring::npos ? message.find_first_not_of(L' ', id_end) : std::wstring::npos;
+			message = command_start != std::wstring::npos ? message.substr(command_start) : std::wstring();
+		}
+
+		auto keyword = command_keyword(message);
+		if(keyword.empty() || std::find(std::begin(skipped_keywords), std::end(skipped_keywords), keyword) != std::end(skipped_keywords))
+		{
+			++skipped;
+			continue;
+		}
+
+		if(first_micros < 0)
+			first_micros = entry.micros;
+		last_micros = entry.micros;
+
+		auto connection = connections.insert(std::make_pair(entry.connection, connections.size())).first->second;
+
+		replay_command command;
+		command.due_micros	= entry.micros - first_micros;
+		command.connection	= connection;
+		command.message		= message;
+		command.tagged		= tagged;
+
+		// The batch keywords are always replied to on their own.
+		if(keyword == L"BEGIN" || keyword == L"COMMIT" || keyword == L"DISCARD")
+		{
+			command.in_batch = false;
+			in_batch[entry.connection] = keyword == L"BEGIN";
+		}
+		else
+			command.in_batch = in_batch[entry.connection];
+
+		commands.push_back(command);
+	}
+
+	// Recorded commands are in the order they arrived, but keep the schedule in order regardless.
+	std::stable_sort(commands.begin(), commands.end(), [](const replay_command& lhs, const replay_command& rhs)
+	{
+		return lhs.due_micros < rhs.due_micros;
+	});
+
+	// The request id of a tagged command is its index in the schedule.
+	for(std::size_t n = 0; n < commands.size(); ++n)
+		commands[n].data = narrow((commands[n].tagged ? L"REQ " + boost::lexical_cast<std::wstring>(n) + L" " : L"") + commands[n].message + L"\r\n");
+
+	CASPAR_LOG(info) << L"[session-replay] Replaying " << commands.size() << L" commands over " << connections.size() << L" connections to " << widen(address) << L":" << port << L".";
+
+	session_replay replay(service, commands, connections.size(), speed);
+
+	auto start = replay_clock::now();
+	if(!commands.empty())
+	{
+		replay.start(endpoint);
+		service.run(); // Returns when the replay has closed its connections, or the service is stopped.
+	}
+	auto elapsed = elapsed_millis(start);
+
+	int failed_connections = 0;
+	BOOST_FOREACH(auto& connection, replay.connections())
+	{
+		if(!connection->connected)
+			++failed_connections;
+	}
+
+	std::vector<double> latencies;
+	BOOST_FOREACH(auto& latency, replay.latencies)
+		latencies.push_back(latency.first);
+	std::sort(latencies.begin(), latencies.end());
+
+	boost::property_tree::wptree info;
+	info.add(L"replay.address",						widen(address));
+	info.add(L"replay.port",						port);
+	info.add(L"replay.speed",						speed > 0.0 ? boost::lexical_cast<std::wstring>(speed) : L"max");
+	info.add(L"replay.connections",					connections.size());
+	info.add(L"replay.failed-connections",			failed_connections);
+	info.add(L"replay.commands",					commands.size());
+	info.add(L"replay.skipped-commands",			skipped);
+	info.add(L"replay.not-sent-commands",			replay.not_sent);
+	info.add(L"replay.recorded-duration-millis",	first_micros < 0 ? 0 : (last_micros - first_micros) / 1000);
+	info.add(L"replay.duration-millis",				elapsed);
+	info.add(L"replay.schedule-lag-millis.max",		replay.max_lag_millis);
+	info.add(L"replay.replies",						replay.replies);
+	info.add(L"replay.errors",						replay.errors);
+	info.add(L"replay.recorded-errors",				recorded_errors);
+	info.add(L"replay.unanswered",					replay.unanswered);
+	info.add(L"replay.timed-out",					replay.timed_out);
+	info.add(L"replay.latency-millis.p50",			percentile(latencies, 0.50));
+	info.add(L"replay.latency-millis.p95",			percentile(latencies, 0.95));
+	info.add(L"replay.latency-millis.p99",			percentile(latencies, 0.99));
+	info.add(L"replay.latency-millis.max",			latencies.empty() ? 0.0 : latencies.back());
+
+	BOOST_FOREACH(auto& status_code, replay.status_codes)
+	{
+		boost::property_tree::wptree status;
+		status.add(L"code",		status_code.first);
+		status.add(L"count",	status_code.second);
+		info.add_child(L"replay.status-codes.status", status);
+	}
+
+	auto slowest = replay.latencies;
+	auto slowest_count = std::min<std::size_t>(slowest.size(), 5);
+	std::partial_sort(slowest.begin(), slowest.begin() + slowest_count, slowest.end(), [](const std::pair<double, std::size_t>& lhs, const std::pair<double, std::size_t>& rhs)
+	{
+		return lhs.first > rhs.first;
+	});
+
+	for(std::size_t n = 0; n < slowest_count; ++n)
+	{
+		boost::property_tree::wptree command;
+		command.add(L"message",			commands[slowest[n].second].message.substr(0, 128));
+		command.add(L"latency-millis",	slowest[n].first);
+		info.add_child(L"replay.slowest.command", command);
+	}
+
+	return info;
+}
+
+boost::property_tree::wptree replay_session(const std::vector<session_trace_entry>& trace, const std::string& address, int port, double speed)
+{
+	boost::asio::io_service service;
+	return run_replay(service, trace, address, port, speed);
+}
+
+struct session_replayer::implementation : boost::noncopyable
+{
+	tbb::mutex									mutex_;
+	std::shared_ptr<boost::asio::io_service>	service_;	// Of the running replay.
+	boost::thread								thread_;
+	bool										stopped_;
+
+	implementation()
+		: stopped_(false)
+	{
+	}
+
+	~implementation()
+	{
+		{
+			tbb::mutex::scoped_lock lock(mutex_);
+
+			stopped_ = true;
+			if(service_)
+				service_->stop();
+		}
+
+		if(thread_.joinable())
+			thread_.join();
+	}
+
+	bool start(const std::vector<session_trace_entry>& trace, const std::string& address, int port, double speed, const report_func_t& on_done)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		if(service_ || stopped_)
+			return false;
+
+		// The previous replay has finished, and its thread is about to exit.
+		if(thread_.joinable())
+			thread_.join();
+
+		auto service = std::make_shared<boost::asio::io_service>();
+		service_ = service;
+
+		thread_ = boost::thread([=]
+		{
+			try
+			{
+				auto info = run_replay(*service, trace, address, port, speed);
+
+				// The service stops itself once it runs out of work, so only our own flag tells a shutdown apart.
+				bool stopped;
+				{
+					tbb::mutex::scoped_lock lock(mutex_);
+					stopped = stopped_;
+				}
+
+				if(!stopped)
+					on_done(info);
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+
+			tbb::mutex::scoped_lock lock(mutex_);
+			service_.reset();
+		});
+
+		return true;
+	}
+};
+
+session_replayer::session_replayer() : impl_(new implementation()){}
+bool session_replayer::start(const std::vector<session_trace_entry>& trace, const std::string& address, int port, double speed, const report_func_t& on_done){return impl_->start(trace, address, port, speed, on_done);}
+
+}}}
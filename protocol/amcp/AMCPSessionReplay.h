@@ -0,0 +1,61 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "AMCPSessionTrace.h"
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+// Replays the commands of a session trace against an AMCP server, over one connection for each 
+// recorded connection, at the recorded pace times speed, or as fast as possible if speed is 0. 
+// Commands are sent tagged with REQ only if they were recorded so; untagged replies are matched 
+// to the commands of their connection in order. Reports the reply latencies, the error replies 
+// compared with those of the recording and how far the sends fell behind the schedule. Blocks 
+// until every command has been replied to, or for at most 30 seconds after the last one was sent.
+boost::property_tree::wptree replay_session(const std::vector<session_trace_entry>& trace, const std::string& address, int port, double speed);
+
+// Runs one replay_session at a time on a thread of its own. Destroying it, e.g. when the server 
+// shuts down, stops a running replay and waits for its thread.
+class session_replayer : boost::noncopyable
+{
+public:
+	typedef std::function<void (const boost::property_tree::wptree&)> report_func_t;
+
+	session_replayer();
+
+	// Returns false if a replay is already running. The report of a replay that completes is 
+	// handed to on_done on the replay thread.
+	bool start(const std::vector<session_trace_entry>& trace, const std::string& address, int port, double speed, const report_func_t& on_done);
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}}
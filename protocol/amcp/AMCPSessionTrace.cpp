@@ -0,0 +1,260 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "AMCPSessionTrace.h"
+
+#include <common/concurrency/executor.h>
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/chrono.hpp>
+#include <boost/exception/errinfo_file_name.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
+
+#include <map>
+#include <sstream>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+typedef boost::chrono::high_resolution_clock trace_clock;
+
+static std::wstring escape_trace_message(const std::wstring& message)
+{
+	std::wstring result;
+	result.reserve(message.size() + 16);
+
+	BOOST_FOREACH(auto c, message)
+	{
+		if(c == L'\\')
+			result += L"\\\\";
+		else if(c == L'\r')
+			result += L"\\r";
+		else if(c == L'\n')
+			result += L"\\n";
+		else
+			result += c;
+	}
+
+	return result;
+}
+
+static std::wstring unescape_trace_message(const std::wstring& message)
+{
+	std::wstring result;
+	result.reserve(message.size());
+
+	for(std::size_t n = 0; n < message.size(); ++n)
+	{
+		if(message[n] != L'\\' || n + 1 == message.size())
+		{
+			result += message[n];
+			continue;
+		}
+
+		switch(message[++n])
+		{
+		case L'r':	result += L'\r';		break;
+		case L'n':	result += L'\n';		break;
+		default:	result += message[n];	break;
+		}
+	}
+
+	return result;
+}
+
+std::vector<session_trace_entry> read_session_trace(const std::wstring& filename)
+{
+	boost::filesystem::ifstream file(boost::filesystem::wpath(filename), std::ios::binary);
+	if(!file)
+		BOOST_THROW_EXCEPTION(file_not_found() << msg_info("Could not open session trace.") << boost::errinfo_file_name(narrow(filename)));
+
+	std::vector<session_trace_entry> trace;
+
+	std::string line;
+	int line_number = 0;
+	while(std::getline(file, line))
+	{
+		++line_number;
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream fields(line);
+		session_trace_entry entry;
+		char kind = 0;
+		fields >> entry.micros >> entry.connection >> kind;
+
+		if(!fields || (kind != 'C' && kind != 'R') || fields.get() != ' ')
+			BOOST_THROW_EXCEPTION(file_read_error() << msg_info("Malformed session trace on line " + boost::lexical_cast<std::string>(line_number) + ".") << boost::errinfo_file_name(narrow(filename)));
+
+		std::string message;
+		std::getline(fields, message);
+
+		entry.reply		= kind == 'R';
+		entry.message	= unescape_trace_message(widen(message));
+		trace.push_back(entry);
+	}
+
+	return trace;
+}
+
+class session_recorder : boost::noncopyable
+{
+	const std::wstring								filename_;
+	const trace_clock::time_point					start_;
+	boost::filesystem::ofstream						file_;
+
+	tbb::mutex										mutex_;
+	std::map<std::weak_ptr<IO::ClientInfo>, int, std::owner_less<std::weak_ptr<IO::ClientInfo>>> connections_;
+	tbb::atomic<long long>							messages_;
+
+	executor										executor_;
+public:
+	session_recorder(const std::wstring& filename)
+		: filename_(filename)
+		, start_(trace_clock::now())
+		, file_(boost::filesystem::wpath(filename), std::ios::binary | std::ios::trunc)
+		, executor_(L"session_recorder")
+	{
+		if(!file_)
+			BOOST_THROW_EXCEPTION(file_not_found() << msg_info("Could not create session trace.") << boost::errinfo_file_name(narrow(filename)));
+
+		messages_ = 0;
+		file_ << "# CasparCG AMCP session trace\n";
+	}
+
+	~session_recorder()
+	{
+		// Writes what has been queued before the executor stops.
+		executor_.wait();
+	}
+
+	void record(const IO::ClientInfoPtr& client, char kind, const std::wstring& message)
+	{
+		const auto micros = boost::chrono::duration_cast<boost::chrono::microseconds>(trace_clock::now() - start_).count();
+
+		int connection;
+		{
+			tbb::mutex::scoped_lock lock(mutex_);
+			auto it = connections_.find(client);
+			if(it == connections_.end())
+				it = connections_.insert(std::make_pair(std::weak_ptr<IO::ClientInfo>(client), static_cast<int>(connections_.size()) + 1)).first;
+			connection = it->second;
+		}
+
+		++messages_;
+
+		// The formatting and the write happen off the calling thread, which is the protocol's.
+		executor_.begin_invoke([=]
+		{
+			file_ << micros << ' ' << connection << ' ' << kind << ' ' << narrow(escape_trace_message(message)) << '\n';
+		});
+	}
+
+	boost::property_tree::wptree info()
+	{
+		executor_.wait();
+		file_.flush();
+
+		std::size_t connections;
+		{
+			tbb::mutex::scoped_lock lock(mutex_);
+			connections = connections_.size();
+		}
+
+		boost::property_tree::wptree info;
+		info.add(L"file",				filename_);
+		info.add(L"messages",			static_cast<long long>(messages_));
+		info.add(L"connections",		connections);
+		info.add(L"duration-millis",	boost::chrono::duration_cast<boost::chrono::milliseconds>(trace_clock::now() - start_).count());
+		info.add(L"write-failed",		!file_);
+		return info;
+	}
+};
+
+static tbb::mutex							g_recorder_mutex;
+static std::shared_ptr<session_recorder>	g_recorder;
+static tbb::atomic<bool>					g_recording;
+
+static std::shared_ptr<session_recorder> get_recorder()
+{
+	// Keeps the cost of an inactive recorder to one read.
+	if(!g_recording)
+		return nullptr;
+
+	tbb::mutex::scoped_lock lock(g_recorder_mutex);
+	return g_recorder;
+}
+
+void start_session_recording(const std::wstring& filename)
+{
+	tbb::mutex::scoped_lock lock(g_recorder_mutex);
+
+	if(g_recorder)
+		BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("A session recording is already running."));
+
+	g_recorder = std::make_shared<session_recorder>(filename);
+	g_recording = true;
+
+	CASPAR_LOG(info) << L"Started recording AMCP session to " << filename;
+}
+
+boost::property_tree::wptree stop_session_recording()
+{
+	std::shared_ptr<session_recorder> recorder;
+	{
+		tbb::mutex::scoped_lock lock(g_recorder_mutex);
+		recorder.swap(g_recorder);
+		g_recording = false;
+	}
+
+	if(!recorder)
+		BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("No session recording is running."));
+
+	auto info = recorder->info();
+
+	CASPAR_LOG(info) << L"Stopped recording AMCP session to " << info.get<std::wstring>(L"file") << L", " << info.get<long long>(L"messages") << L" messages.";
+
+	return info;
+}
+
+void record_command(const IO::ClientInfoPtr& client, const std::wstring& message)
+{
+	if(auto recorder = get_recorder())
+		recorder->record(client, 'C', message);
+}
+
+void record_reply(const IO::ClientInfoPtr& client, const std::wstring& reply)
+{
+	if(auto recorder = get_recorder())
+		recorder->record(client, 'R', reply);
+}
+
+}}}
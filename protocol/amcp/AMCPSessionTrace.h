@@ -0,0 +1,59 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "../util/ClientInfo.h"
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <string>
+#include <vector>
+
+namespace caspar { namespace protocol { namespace amcp {
+
+// A session trace has one line per AMCP message received or sent by the server:
+//
+//   <microseconds since the recording started> <connection> <C for commands, R for replies> <message>
+//
+// Backslashes and line breaks within the message are escaped as \\, \r and \n. Lines starting 
+// with # are comments.
+struct session_trace_entry
+{
+	long long		micros;
+	int				connection;
+	bool			reply;
+	std::wstring	message;
+};
+
+std::vector<session_trace_entry> read_session_trace(const std::wstring& filename);
+
+// Records the traffic of all AMCP connections to the given file until stopped. The messages are 
+// written on a thread of their own. Throws if a recording is already running.
+void start_session_recording(const std::wstring& filename);
+
+// Returns the file, the number of recorded messages and connections, and the duration of the 
+// recording that was stopped. Throws if no recording is running.
+boost::property_tree::wptree stop_session_recording();
+
+void record_command(const IO::ClientInfoPtr& client, const std::wstring& message);
+void record_reply(const IO::ClientInfoPtr& client, const std::wstring& reply);
+
+}}}
@@ -0,0 +1,248 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "binary_message.h"
+
+#include <common/exception/exceptions.h>
+
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstring>
+
+namespace caspar { namespace protocol { namespace binary {
+
+int transform_value_count(transform_property::type property)
+{
+	switch(property)
+	{
+	case transform_property::opacity:
+	case transform_property::volume:
+	case transform_property::brightness:
+	case transform_property::contrast:
+	case transform_property::saturation:
+	case transform_property::keyer:
+		return 1;
+	case transform_property::fill:
+	case transform_property::clip:
+		return 4;
+	case transform_property::levels:
+		return 5;
+	default:
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("property") << arg_value_info(boost::lexical_cast<std::string>(static_cast<int>(property))));
+	}
+}
+
+message_reader::message_reader(const char* data, std::size_t size)
+	: data_(data)
+	, size_(size)
+	, pos_(0)
+{
+}
+
+message_header message_reader::header()
+{
+	message_header header;
+	header.size		= get_uint32();
+	header.id		= get_uint32();
+	header.opcode	= get_uint8();
+	header.flags	= get_uint8();
+	header.channel	= get_uint16();
+
+	if(header.size != size_ - pos_)
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Message size does not match its header."));
+
+	return header;
+}
+
+boost::uint8_t message_reader::get_uint8()
+{
+	if(size_ - pos_ < 1)
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Message too short."));
+
+	return static_cast<boost::uint8_t>(data_[pos_++]);
+}
+
+boost::uint16_t message_reader::get_uint16()
+{
+	boost::uint16_t value = get_uint8();
+	value |= static_cast<boost::uint16_t>(get_uint8()) << 8;
+	return value;
+}
+
+boost::uint32_t message_reader::get_uint32()
+{
+	boost::uint32_t value = get_uint16();
+	value |= static_cast<boost::uint32_t>(get_uint16()) << 16;
+	return value;
+}
+
+boost::int32_t message_reader::get_int32()
+{
+	return static_cast<boost::int32_t>(get_uint32());
+}
+
+double message_reader::get_double()
+{
+	if(size_ - pos_ < sizeof(double))
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Message too short."));
+
+	double value;
+	std::memcpy(&value, data_ + pos_, sizeof(double));
+	pos_ += sizeof(double);
+	return value;
+}
+
+std::string message_reader::get_string(std::size_t size)
+{
+	if(size_ - pos_ < size)
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Message too short."));
+
+	std::string value(data_ + pos_, size);
+	pos_ += size;
+	return value;
+}
+
+std::string message_reader::get_rest()
+{
+	return get_string(size_ - pos_);
+}
+
+message_reader message_reader::get_message()
+{
+	message_reader size_reader(data_ + pos_, size_ - pos_);
+	std::size_t payload_size = size_reader.get_uint32();
+
+	// Checked before adding the header, so that a size near the 32-bit limit cannot wrap around.
+	if(payload_size > max_message_size)
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Message too large."));
+
+	auto size = header_size + payload_size;
+	if(size_ - pos_ < size)
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Message too short."));
+
+	message_reader message(data_ + pos_, size);
+	pos_ += size;
+	return message;
+}
+
+bool message_reader::empty() const
+{
+	return pos_ == size_;
+}
+
+void message_writer::begin(opcode::type op, boost::uint32_t id, int channel, int flags)
+{
+	open_.push_back(bytes_.size());
+	put_uint32(0);
+	put_uint32(id);
+	put_uint8(static_cast<boost::uint8_t>(op));
+	put_uint8(static_cast<boost::uint8_t>(flags));
+	put_uint16(static_cast<boost::uint16_t>(channel));
+}
+
+void message_writer::end()
+{
+	if(open_.empty())
+		BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("No message begun."));
+
+	auto start = open_.back();
+	open_.pop_back();
+
+	auto size = static_cast<boost::uint32_t>(bytes_.size() - start - header_size);
+	for(int n = 0; n < 4; ++n)
+		bytes_[start + n] = static_cast<char>((size >> (8 * n)) & 0xFF);
+}
+
+void message_writer::put_uint8(boost::uint8_t value)
+{
+	bytes_.push_back(static_cast<char>(value));
+}
+
+void message_writer::put_uint16(boost::uint16_t value)
+{
+	put_uint8(static_cast<boost::uint8_t>(value & 0xFF));
+	put_uint8(static_cast<boost::uint8_t>(value >> 8));
+}
+
+void message_writer::put_uint32(boost::uint32_t value)
+{
+	put_uint16(static_cast<boost::uint16_t>(value & 0xFFFF));
+	put_uint16(static_cast<boost::uint16_t>(value >> 16));
+}
+
+void message_writer::put_int32(boost::int32_t value)
+{
+	put_uint32(static_cast<boost::uint32_t>(value));
+}
+
+void message_writer::put_double(double value)
+{
+	const char* bytes = reinterpret_cast<const char*>(&value);
+	bytes_.insert(bytes_.end(), bytes, bytes + sizeof(double));
+}
+
+void message_writer::put_string(const std::string& value)
+{
+	bytes_.insert(bytes_.end(), value.begin(), value.end());
+}
+
+void message_writer::put_transform(boost::uint32_t id, int channel, int layer, transform_property::type property, const std::vector<double>& values, unsigned int duration, const std::string& tween, int flags)
+{
+	if(static_cast<int>(values.size()) != transform_value_count(property))
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("values") << msg_info("Wrong number of values for the property."));
+
+	if(tween.size() > 255)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("tween"));
+
+	begin(opcode::transform, id, channel, flags);
+	put_int32(layer);
+	put_uint32(duration);
+	put_uint8(static_cast<boost::uint8_t>(property));
+	put_uint8(static_cast<boost::uint8_t>(tween.size()));
+	put_string(tween);
+	BOOST_FOREACH(auto value, values)
+		put_double(value);
+	end();
+}
+
+void message_writer::put_call(boost::uint32_t id, int channel, int layer, bool foreground, const std::string& param, int flags)
+{
+	begin(opcode::call, id, channel, flags);
+	put_int32(layer);
+	put_uint8(foreground ? 0 : 1);
+	put_string(param);
+	end();
+}
+
+const std::vector<char>& message_writer::bytes() const
+{
+	return bytes_;
+}
+
+void message_writer::clear()
+{
+	bytes_.clear();
+	open_.clear();
+}
+
+}}}
@@ -0,0 +1,151 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+#include <vector>
+
+namespace caspar { namespace protocol { namespace binary {
+
+// Every message starts with a header of header_size bytes, followed by size bytes of payload. 
+// All numbers are little-endian, decimals are IEEE 754 doubles and text is UTF-8. See 
+// docs/source/binary-protocol.rst for the payload of each opcode.
+//
+//   uint32	size
+//   uint32	id			Echoed in the reply.
+//   uint8	opcode
+//   uint8	flags
+//   uint16	channel		1.., or 0 for none.
+
+const std::size_t header_size		= 12;
+const std::size_t max_message_size	= 1024 * 1024;
+
+struct opcode
+{
+	enum type
+	{
+		ping = 0,
+		transform,
+		call,
+		batch,
+		reply = 0x80	// Set in the opcode of replies.
+	};
+};
+
+struct flags
+{
+	enum type
+	{
+		none			= 0,
+		reply_requested	= 1		// Otherwise the message is fire-and-forget.
+	};
+};
+
+// The frame_transform fields set by opcode::transform, and the number of values each takes.
+struct transform_property
+{
+	enum type
+	{
+		opacity = 1,	// 1
+		volume,			// 1
+		brightness,		// 1
+		contrast,		// 1
+		saturation,		// 1
+		fill,			// 4: x, y, x-scale, y-scale
+		clip,			// 4: x, y, x-scale, y-scale
+		levels,			// 5: min-input, max-input, gamma, min-output, max-output
+		keyer			// 1: 0 or 1
+	};
+};
+
+int transform_value_count(transform_property::type property);
+
+struct status
+{
+	enum type
+	{
+		ok = 0,
+		bad_request,	// Malformed message.
+		not_found,		// No such channel.
+		failed
+	};
+};
+
+struct message_header
+{
+	boost::uint32_t	size;
+	boost::uint32_t	id;
+	boost::uint8_t	opcode;
+	boost::uint8_t	flags;
+	boost::uint16_t	channel;
+};
+
+// Reads the fields of one message in order. Throws invalid_argument when reading past its end.
+class message_reader
+{
+public:
+	message_reader(const char* data, std::size_t size);
+
+	message_header		header();
+	boost::uint8_t		get_uint8();
+	boost::uint16_t		get_uint16();
+	boost::uint32_t		get_uint32();
+	boost::int32_t		get_int32();
+	double				get_double();
+	std::string			get_string(std::size_t size);
+	std::string			get_rest();
+	message_reader		get_message(); // The next message inside a batch.
+
+	bool				empty() const;
+private:
+	const char*			data_;
+	std::size_t			size_;
+	std::size_t			pos_;
+};
+
+// Writes messages; begin() and end() nest for the messages of a batch.
+class message_writer
+{
+public:
+	void begin(opcode::type op, boost::uint32_t id, int channel, int flags = flags::none);
+	void end();
+
+	void put_uint8(boost::uint8_t value);
+	void put_uint16(boost::uint16_t value);
+	void put_uint32(boost::uint32_t value);
+	void put_int32(boost::int32_t value);
+	void put_double(double value);
+	void put_string(const std::string& value);
+
+	void put_transform(boost::uint32_t id, int channel, int layer, transform_property::type property, const std::vector<double>& values, 
+					   unsigned int duration = 0, const std::string& tween = "", int flags = flags::none);
+	void put_call(boost::uint32_t id, int channel, int layer, bool foreground, const std::string& param, int flags = flags::none);
+
+	const std::vector<char>& bytes() const;
+	void clear();
+private:
+	std::vector<char>			bytes_;
+	std::vector<std::size_t>	open_;
+};
+
+}}}
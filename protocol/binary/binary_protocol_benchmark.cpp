@@ -0,0 +1,351 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "binary_protocol_benchmark.h"
+#include "binary_message.h"
+#include "binary_protocol_strategy.h"
+
+#include "../util/AsyncEventServer.h"
+#include "../util/running_service.h"
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+
+#include <core/video_channel.h>
+#include <core/producer/stage.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+
+using boost::asio::ip::tcp;
+
+namespace caspar { namespace protocol { namespace binary {
+
+typedef boost::chrono::high_resolution_clock benchmark_clock;
+
+// At most this many replies are left unread while streaming, so that neither side blocks on a full socket.
+const int STREAM_WINDOW = 1000;
+
+static double elapsed_millis(benchmark_clock::time_point since)
+{
+	return boost::chrono::duration<double, boost::milli>(benchmark_clock::now() - since).count();
+}
+
+// Connects to a loopback port and reads and writes blocking, on the calling thread.
+class benchmark_client : boost::noncopyable
+{
+	boost::asio::io_service		service_;
+	tcp::socket					socket_;
+	boost::asio::streambuf		received_;
+public:
+	std::size_t					bytes_sent;
+	std::size_t					bytes_received;
+
+	explicit benchmark_client(int port)
+		: socket_(service_)
+		, bytes_sent(0)
+		, bytes_received(0)
+	{
+		socket_.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(port)));
+		socket_.set_option(tcp::no_delay(true));
+	}
+
+	void send(const char* data, std::size_t size)
+	{
+		boost::asio::write(socket_, boost::asio::buffer(data, size));
+		bytes_sent += size;
+	}
+
+	void send(const std::string& data)
+	{
+		send(data.data(), data.size());
+	}
+
+	void send(const std::vector<char>& data)
+	{
+		send(&data[0], data.size());
+	}
+
+	std::string read_line()
+	{
+		auto size = boost::asio::read_until(socket_, received_, "\r\n");
+		std::string line(boost::asio::buffers_begin(received_.data()), boost::asio::buffers_begin(received_.data()) + size - 2);
+		received_.consume(size);
+		bytes_received += size;
+		return line;
+	}
+
+	// 200 replies end with an empty line, 201 replies have one line of data.
+	void read_amcp_reply()
+	{
+		auto line = read_line();
+		if(boost::starts_with(line, "200"))
+		{
+			while(!read_line().empty())
+				;
+		}
+		else if(boost::starts_with(line, "201"))
+			read_line();
+	}
+
+	void read_binary_reply()
+	{
+		ensure(header_size);
+		message_reader size_reader(boost::asio::buffer_cast<const char*>(received_.data()), header_size);
+		std::size_t payload_size = size_reader.get_uint32();
+		if(payload_size > max_message_size)
+			BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Binary reply too large."));
+
+		auto size = header_size + payload_size;
+		ensure(size);
+
+		message_reader reply(boost::asio::buffer_cast<const char*>(received_.data()), size);
+		reply.header();
+		auto reply_status = reply.get_uint8();
+
+		received_.consume(size);
+		bytes_received += size;
+
+		if(reply_status != status::ok)
+			BOOST_THROW_EXCEPTION(operation_failed() << msg_info("Binary message failed with status " + boost::lexical_cast<std::string>(static_cast<int>(reply_status)) + "."));
+	}
+private:
+	void ensure(std::size_t size)
+	{
+		if(received_.size() < size)
+			boost::asio::read(socket_, received_, boost::asio::transfer_at_least(size - received_.size()));
+	}
+};
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if(sorted.empty())
+		return 0.0;
+
+	return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+}
+
+static boost::property_tree::wptree summarize(int messages, double elapsed, const benchmark_client& client, std::vector<double> latencies)
+{
+	std::sort(latencies.begin(), latencies.end());
+
+	boost::property_tree::wptree info;
+	info.add(L"messages",				messages);
+	info.add(L"elapsed-millis",			elapsed);
+	info.add(L"messages-per-second",	messages / (elapsed / 1000.0));
+	info.add(L"bytes-sent",				client.bytes_sent);
+	info.add(L"bytes-received",			client.bytes_received);
+
+	if(!latencies.empty())
+	{
+		info.add(L"latency-millis.p50", percentile(latencies, 0.50));
+		info.add(L"latency-millis.p99", percentile(latencies, 0.99));
+		info.add(L"latency-millis.max", latencies.back());
+	}
+
+	return info;
+}
+
+static boost::property_tree::wptree run_amcp(int port, const std::string& command, int messages, int batch_size)
+{
+	boost::property_tree::wptree info;
+
+	{
+		benchmark_client client(port);
+		std::vector<double> latencies;
+
+		auto start = benchmark_clock::now();
+		for(int n = 0; n < messages; ++n)
+		{
+			auto sent_at = benchmark_clock::now();
+			client.send(command);
+			client.read_amcp_reply();
+			latencies.push_back(elapsed_millis(sent_at));
+		}
+		info.add_child(L"round-trip", summarize(messages, elapsed_millis(start), client, latencies));
+	}
+	{
+		benchmark_client client(port);
+		int outstanding = 0;
+
+		auto start = benchmark_clock::now();
+		for(int n = 0; n < messages; ++n)
+		{
+			client.send(command);
+			if(++outstanding == STREAM_WINDOW)
+			{
+				client.read_amcp_reply();
+				--outstanding;
+			}
+		}
+		while(outstanding-- > 0)
+			client.read_amcp_reply();
+		info.add_child(L"streamed", summarize(messages, elapsed_millis(start), client, std::vector<double>()));
+	}
+	{
+		benchmark_client client(port);
+		int outstanding = 0;
+
+		// BEGIN and COMMIT are replied to, the commands in between are not.
+		auto start = benchmark_clock::now();
+		for(int n = 0; n < messages; n += batch_size)
+		{
+			client.send("BEGIN\r\n");
+			for(int m = n; m < std::min(messages, n + batch_size); ++m)
+				client.send(command);
+			client.send("COMMIT\r\n");
+
+			outstanding += 2;
+			while(outstanding * batch_size >= STREAM_WINDOW)
+			{
+				client.read_amcp_reply();
+				--outstanding;
+			}
+		}
+		while(outstanding-- > 0)
+			client.read_amcp_reply();
+		info.add_child(L"batched", summarize(messages, elapsed_millis(start), client, std::vector<double>()));
+	}
+
+	return info;
+}
+
+static boost::property_tree::wptree run_binary(int port, int channel, int layer, int messages, int batch_size)
+{
+	boost::property_tree::wptree info;
+
+	const std::vector<double> opacity(1, 1.0);
+	message_writer writer;
+
+	{
+		benchmark_client client(port);
+		std::vector<double> latencies;
+
+		auto start = benchmark_clock::now();
+		for(int n = 0; n < messages; ++n)
+		{
+			auto sent_at = benchmark_clock::now();
+			writer.clear();
+			writer.put_transform(n, channel, layer, transform_property::opacity, opacity, 0, "", flags::reply_requested);
+			client.send(writer.bytes());
+			client.read_binary_reply();
+			latencies.push_back(elapsed_millis(sent_at));
+		}
+		info.add_child(L"round-trip", summarize(messages, elapsed_millis(start), client, latencies));
+	}
+	{
+		benchmark_client client(port);
+
+		// Fire-and-forget, the ping is replied to after all of them.
+		auto start = benchmark_clock::now();
+		for(int n = 0; n < messages; ++n)
+		{
+			writer.clear();
+			writer.put_transform(n, channel, layer, transform_property::opacity, opacity);
+			client.send(writer.bytes());
+		}
+		writer.clear();
+		writer.begin(opcode::ping, messages, 0, flags::reply_requested);
+		writer.end();
+		client.send(writer.bytes());
+		client.read_binary_reply();
+		info.add_child(L"streamed", summarize(messages, elapsed_millis(start), client, std::vector<double>()));
+	}
+	{
+		benchmark_client client(port);
+
+		auto start = benchmark_clock::now();
+		for(int n = 0; n < messages; n += batch_size)
+		{
+			writer.clear();
+			writer.begin(opcode::batch, n, 0);
+			for(int m = n; m < std::min(messages, n + batch_size); ++m)
+				writer.put_transform(m, channel, layer, transform_property::opacity, opacity);
+			writer.end();
+			client.send(writer.bytes());
+		}
+		writer.clear();
+		writer.begin(opcode::ping, messages, 0, flags::reply_requested);
+		writer.end();
+		client.send(writer.bytes());
+		client.read_binary_reply();
+		info.add_child(L"batched", summarize(messages, elapsed_millis(start), client, std::vector<double>()));
+	}
+
+	return info;
+}
+
+boost::property_tree::wptree benchmark_binary_protocol(
+		const safe_ptr<IO::IProtocolStrategy>& amcp, 
+		const std::vector<safe_ptr<core::video_channel>>& channels, 
+		int channel, 
+		int layer, 
+		int messages, 
+		int batch_size)
+{
+	if(channel < 1 || channel > static_cast<int>(channels.size()))
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("channel") << arg_value_info(boost::lexical_cast<std::string>(channel)));
+
+	if(messages < 1 || messages > 1000000)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("messages") << arg_value_info(boost::lexical_cast<std::string>(messages)));
+
+	if(batch_size < 1 || batch_size > 256)
+		BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("batch_size") << arg_value_info(boost::lexical_cast<std::string>(batch_size)));
+
+	const auto command = "MIXER " + boost::lexical_cast<std::string>(channel) + "-" + boost::lexical_cast<std::string>(layer) + " OPACITY 1\r\n";
+
+	IO::running_service server_service;
+
+	boost::property_tree::wptree info;
+	info.add(L"binary-benchmark.channel",		channel);
+	info.add(L"binary-benchmark.layer",			layer);
+	info.add(L"binary-benchmark.batch-size",	batch_size);
+
+	try
+	{
+		IO::AsyncEventServer amcp_server(amcp, 0, server_service.get());
+		IO::AsyncEventServer binary_server(make_safe<binary_protocol_strategy>(channels), 0, server_service.get());
+		if(!amcp_server.Start() || !binary_server.Start())
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not start benchmark servers."));
+
+		CASPAR_LOG(info) << L"[binary-benchmark] Sending " << messages << L" AMCP messages.";
+		info.add_child(L"binary-benchmark.amcp", run_amcp(amcp_server.port(), command, messages, batch_size));
+
+		CASPAR_LOG(info) << L"[binary-benchmark] Sending " << messages << L" binary messages.";
+		info.add_child(L"binary-benchmark.binary", run_binary(binary_server.port(), channel, layer, messages, batch_size));
+	}
+	catch(...)
+	{
+		channels.at(channel - 1)->stage()->clear_transforms(layer);
+		throw;
+	}
+
+	channels.at(channel - 1)->stage()->clear_transforms(layer);
+
+	return info;
+}
+
+}}}
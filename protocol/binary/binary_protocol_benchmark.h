@@ -0,0 +1,51 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "../util/ProtocolStrategy.h"
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <vector>
+
+namespace caspar { 
+
+namespace core {
+	class video_channel;
+}
+
+namespace protocol { namespace binary {
+
+// Starts private loopback servers for the binary protocol and for the given AMCP strategy, and 
+// sends the same opacity updates of a layer through both: one at a time waiting for each reply, 
+// streamed, and streamed in batches of batch_size. Reports messages per second, bytes on the 
+// wire and round-trip latencies. Blocks until done, then clears the transforms of the layer.
+boost::property_tree::wptree benchmark_binary_protocol(
+		const safe_ptr<IO::IProtocolStrategy>& amcp, 
+		const std::vector<safe_ptr<core::video_channel>>& channels, 
+		int channel, 
+		int layer, 
+		int messages, 
+		int batch_size);
+
+}}}
@@ -0,0 +1,338 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "binary_protocol_strategy.h"
+#include "binary_message.h"
+
+#include <common/concurrency/executor.h>
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <core/video_channel.h>
+#include <core/producer/stage.h>
+#include <core/producer/frame/frame_transform.h>
+
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <map>
+
+namespace caspar { namespace protocol { namespace binary {
+
+struct operation
+{
+	message_header					header;
+	core::stage::transform_tuple_t	transform;	// opcode::transform
+	int								layer;		// opcode::call
+	bool							foreground;	
+	std::wstring					param;
+};
+
+static core::stage::transform_func_t make_transform(transform_property::type property, const std::vector<double>& v)
+{
+	using core::frame_transform;
+
+	switch(property)
+	{
+	case transform_property::opacity:
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.opacity = v[0];
+			return transform;
+		};
+	case transform_property::volume:
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.volume = v[0];
+			return transform;
+		};
+	case transform_property::brightness:
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.brightness = v[0];
+			return transform;
+		};
+	case transform_property::contrast:
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.contrast = v[0];
+			return transform;
+		};
+	case transform_property::saturation:
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.saturation = v[0];
+			return transform;
+		};
+	case transform_property::fill:
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.fill_translation[0]	= v[0];
+			transform.fill_translation[1]	= v[1];
+			transform.fill_scale[0]			= v[2];
+			transform.fill_scale[1]			= v[3];
+			return transform;
+		};
+	case transform_property::clip:
+		if(v[2] < 0 || v[3] < 0)
+			BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Negative clip scale."));
+
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.clip_translation[0]	= v[0];
+			transform.clip_translation[1]	= v[1];
+			transform.clip_scale[0]			= v[2];
+			transform.clip_scale[1]			= v[3];
+			return transform;
+		};
+	case transform_property::levels:
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.levels.min_input	= v[0];
+			transform.levels.max_input	= v[1];
+			transform.levels.gamma		= v[2];
+			transform.levels.min_output	= v[3];
+			transform.levels.max_output	= v[4];
+			return transform;
+		};
+	case transform_property::keyer:
+		return [=](frame_transform transform) -> frame_transform
+		{
+			transform.is_key = v[0] != 0.0;
+			return transform;
+		};
+	default:
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("property") << arg_value_info(boost::lexical_cast<std::string>(static_cast<int>(property))));
+	}
+}
+
+static operation parse_operation(message_reader message)
+{
+	operation op;
+	op.header		= message.header();
+	op.layer		= 0;
+	op.foreground	= true;
+
+	switch(op.header.opcode)
+	{
+	case opcode::ping:
+		break;
+	case opcode::transform:
+		{
+			auto layer		= message.get_int32();
+			auto duration	= message.get_uint32();
+			auto property	= static_cast<transform_property::type>(message.get_uint8());
+			auto tween		= widen(message.get_string(message.get_uint8()));
+			if(tween.empty())
+				tween = L"linear";
+
+			std::vector<double> values;
+			for(int n = transform_value_count(property); n > 0; --n)
+				values.push_back(message.get_double());
+
+			op.transform = core::stage::transform_tuple_t(layer, make_transform(property, values), duration, tween);
+			break;
+		}
+	case opcode::call:
+		op.layer		= message.get_int32();
+		op.foreground	= message.get_uint8() == 0;
+		op.param		= widen(message.get_rest());
+		break;
+	default:
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("opcode") << arg_value_info(boost::lexical_cast<std::string>(static_cast<int>(op.header.opcode))));
+	}
+
+	if(!message.empty())
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Trailing bytes in message."));
+
+	return op;
+}
+
+struct binary_protocol_strategy::implementation : boost::noncopyable
+{
+	const std::vector<safe_ptr<core::video_channel>>	channels_;
+	executor											executor_;
+
+	implementation(const std::vector<safe_ptr<core::video_channel>>& channels)
+		: channels_(channels)
+		, executor_(L"binary_protocol_strategy")
+	{
+	}
+
+	~implementation()
+	{
+		executor_.wait();
+	}
+
+	void parse(const char* data, int size, const IO::ClientInfoPtr& client)
+	{
+		auto& buffer = client->currentBytes_;
+		buffer.insert(buffer.end(), data, data + size);
+
+		std::size_t complete = 0;
+		while(buffer.size() - complete >= header_size)
+		{
+			// Checked before adding the header, so that a size near the 32-bit limit cannot wrap around.
+			std::size_t payload_size = message_reader(&buffer[complete], header_size).get_uint32();
+			if(payload_size > max_message_size)
+			{
+				CASPAR_LOG(error) << L"[binary] " << client->print() << L" sent a message of " << payload_size << L" bytes, disconnecting.";
+				buffer.clear();
+				client->Disconnect();
+				return;
+			}
+
+			auto message_size = header_size + payload_size;
+			if(buffer.size() - complete < message_size)
+				break;
+
+			complete += message_size;
+		}
+
+		if(complete == 0)
+			return;
+
+		// One task for all the messages of a read.
+		auto messages = std::make_shared<std::vector<char>>(buffer.begin(), buffer.begin() + complete);
+		buffer.erase(buffer.begin(), buffer.begin() + complete);
+
+		executor_.begin_invoke([=]
+		{
+			message_reader reader(&(*messages)[0], messages->size());
+			while(!reader.empty())
+				execute(reader.get_message(), client);
+		});
+	}
+
+	void execute(const message_reader& message, const IO::ClientInfoPtr& client)
+	{
+		message_header header = {};
+		auto result_status = status::ok;
+		std::wstring result;
+
+		try
+		{
+			header = message_reader(message).header();
+
+			if(header.opcode == opcode::batch)
+				execute_batch(message);
+			else
+				result = execute(parse_operation(message), (header.flags & flags::reply_requested) != 0);
+		}
+		catch(out_of_range&)
+		{
+			result_status = status::not_found;
+		}
+		catch(invalid_argument&)
+		{
+			result_status = status::bad_request;
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+			result_status = status::failed;
+		}
+
+		if(header.flags & flags::reply_requested)
+			reply(client, header, result_status, result);
+		else if(result_status != status::ok)
+			CASPAR_LOG(warning) << L"[binary] " << client->print() << L" message " << header.id << L" failed with status " << static_cast<int>(result_status) << L".";
+	}
+
+	std::wstring execute(const operation& op, bool wait_for_result)
+	{
+		switch(op.header.opcode)
+		{
+		case opcode::transform:
+			get_channel(op.header.channel)->stage()->apply_transforms(std::vector<core::stage::transform_tuple_t>(1, op.transform));
+			break;
+		case opcode::call:
+			{
+				auto result = get_channel(op.header.channel)->stage()->call(op.layer, op.foreground, op.param);
+				if(!wait_for_result)
+					break;
+
+				if(!result.timed_wait(boost::posix_time::seconds(2)))
+					BOOST_THROW_EXCEPTION(timed_out());
+
+				return result.get();
+			}
+		default:
+			break;
+		}
+
+		return L"";
+	}
+
+	// All of the batch is parsed before any of it is carried out. The transforms of a 
+	// channel then take effect on the same frame, after the calls, which are made in order.
+	void execute_batch(message_reader batch)
+	{
+		batch.header();
+
+		std::vector<operation> operations;
+		while(!batch.empty())
+		{
+			auto op = parse_operation(batch.get_message());
+			if(op.header.opcode != opcode::ping)
+				get_channel(op.header.channel);
+			operations.push_back(op);
+		}
+
+		std::map<int, std::vector<core::stage::transform_tuple_t>> transforms;
+		BOOST_FOREACH(auto& op, operations)
+		{
+			if(op.header.opcode == opcode::transform)
+				transforms[op.header.channel].push_back(op.transform);
+			else
+				execute(op, false);
+		}
+
+		BOOST_FOREACH(auto& channel_transforms, transforms)
+			get_channel(channel_transforms.first)->stage()->apply_transforms(channel_transforms.second);
+	}
+
+	const safe_ptr<core::video_channel>& get_channel(int index) const
+	{
+		if(index < 1 || index > static_cast<int>(channels_.size()))
+			BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("channel") << arg_value_info(boost::lexical_cast<std::string>(index)));
+
+		return channels_[index - 1];
+	}
+
+	void reply(const IO::ClientInfoPtr& client, const message_header& header, status::type result_status, const std::wstring& result)
+	{
+		message_writer writer;
+		writer.begin(static_cast<opcode::type>(header.opcode | opcode::reply), header.id, header.channel);
+		writer.put_uint8(static_cast<boost::uint8_t>(result_status));
+		writer.put_string(narrow(result));
+		writer.end();
+
+		client->SendBytes(writer.bytes());
+	}
+};
+
+binary_protocol_strategy::binary_protocol_strategy(const std::vector<safe_ptr<core::video_channel>>& channels) : impl_(new implementation(channels)){}
+void binary_protocol_strategy::ParseBytes(const char* pData, int byteCount, IO::ClientInfoPtr pClientInfo){impl_->parse(pData, byteCount, pClientInfo);}
+
+}}}
@@ -0,0 +1,53 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "../util/ProtocolStrategy.h"
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <vector>
+
+namespace caspar { 
+
+namespace core {
+	class video_channel;
+}
+
+namespace protocol { namespace binary {
+
+// Maps the messages of binary_message.h onto stage transforms and producer calls, without 
+// parsing text. The io thread only splits the received bytes into messages; they are then 
+// carried out in order on a thread of the strategy's own, and only replied to when asked.
+class binary_protocol_strategy : public IO::IBinaryProtocolStrategy, boost::noncopyable
+{
+public:
+	explicit binary_protocol_strategy(const std::vector<safe_ptr<core::video_channel>>& channels);
+
+	virtual void ParseBytes(const char* pData, int byteCount, IO::ClientInfoPtr pClientInfo) override;
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}}
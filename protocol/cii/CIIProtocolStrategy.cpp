@@ -27,6 +27,7 @@
 #include <algorithm>
 #include "CIIProtocolStrategy.h"
 #include "CIICommandsimpl.h"
+#include "../util/protocol_log.h"
 #include <modules/flash/producer/flash_producer.h>
 #include <core/producer/transition/transition_producer.h>
 #include <core/mixer/mixer.h>
@@ -85,7 +86,7 @@ void CIIProtocolStrategy::Parse(const TCHAR* pData, int charCount, IO::ClientInf
 
 void CIIProtocolStrategy::ProcessMessage(const std::wstring& message, IO::ClientInfoPtr pClientInfo)
 {	
-	CASPAR_LOG(info) << L"Received message from " << pClientInfo->print() << ": " << message << L"\\r\\n";
+	IO::log_received(*pClientInfo, message);
 
 	std::vector<std::wstring> tokens;
 	int tokenCount = TokenizeMessage(message, &tokens);
@@ -19,297 +19,35 @@
 * Author: Nicklas P Andersson
 */
 
- 
-// AsyncEventServer.cpp: implementation of the AsyncEventServer class.
-//
-//////////////////////////////////////////////////////////////////////
-
 #include "../stdafx.h"
 
 #include "AsyncEventServer.h"
-#include "SocketInfo.h"
+#include "protocol_log.h"
 
 #include <common/log/log.h>
-#include <string>
-#include <algorithm>
-#include <boost/algorithm/string/replace.hpp>
-
-#if defined(_MSC_VER)
-#pragma warning (push, 1) // TODO: Legacy code, just disable warnings, will replace with boost::asio in future
-#endif
-
-namespace caspar { namespace IO {
-	
-#define CASPAR_MAXIMUM_SOCKET_CLIENTS	(MAXIMUM_WAIT_OBJECTS-1)	
-
-long AsyncEventServer::instanceCount_ = 0;
-//////////////////////////////
-// AsyncEventServer constructor
-// PARAMS: port(TCP-port the server should listen to)
-// COMMENT: Initializes the WinSock2 library
-AsyncEventServer::AsyncEventServer(const safe_ptr<IProtocolStrategy>& pProtocol, int port) : port_(port), pProtocolStrategy_(pProtocol)
-{
-	if(instanceCount_ == 0) {
-		WSADATA wsaData;
-		if(WSAStartup(MAKEWORD(2,2), &wsaData) != NO_ERROR)
-			throw std::exception("Error initializing WinSock2");
-		else {
-			CASPAR_LOG(info) << "WinSock2 Initialized.";
-		}
-	}
-
-	InterlockedIncrement(&instanceCount_);
-}
-
-/////////////////////////////
-// AsyncEventServer destructor
-AsyncEventServer::~AsyncEventServer() {
-	Stop();
-
-	InterlockedDecrement(&instanceCount_);
-	if(instanceCount_ == 0)
-		WSACleanup();
-}
-
-void AsyncEventServer::SetClientDisconnectHandler(ClientDisconnectEvent handler) {
-	socketInfoCollection_.onSocketInfoRemoved = handler;
-}
-
-void AsyncEventServer::add_lifecycle_factory(const lifecycle_factory_t& factory)
-{
-	tbb::mutex::scoped_lock lock(mutex_);
-
-	lifecycle_factories_.push_back(factory);
-}
-
-//////////////////////////////
-// AsyncEventServer::Start
-// RETURNS: true at successful startup
-bool AsyncEventServer::Start() {
-	if(listenThread_.IsRunning())
-		return false;
-
-	socketInfoCollection_.Clear();
-
-	sockaddr_in sockAddr;
-	ZeroMemory(&sockAddr, sizeof(sockAddr));
-	sockAddr.sin_family = AF_INET;
-	sockAddr.sin_addr.s_addr = INADDR_ANY;
-	sockAddr.sin_port = htons(port_);
-	
-	SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if(listenSocket == INVALID_SOCKET) {
-		CASPAR_LOG(error) << "Failed to create listenSocket";
-		return false;
-	}
-	
-	pListenSocketInfo_ = SocketInfoPtr(new SocketInfo(listenSocket, this));
-
-	if(WSAEventSelect(pListenSocketInfo_->socket_, pListenSocketInfo_->event_, FD_ACCEPT|FD_CLOSE) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to enter EventSelect-mode for listenSocket";
-		return false;
-	}
-
-	if(bind(pListenSocketInfo_->socket_, (sockaddr*)&sockAddr, sizeof(sockAddr)) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to bind listenSocket";
-		return false;
-	}
-
-	if(listen(pListenSocketInfo_->socket_, SOMAXCONN) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to listen";
-		return false;
-	}
-
-	socketInfoCollection_.AddSocketInfo(pListenSocketInfo_);
-
-	//start thread: the entrypoint is Run(EVENT stopEvent)
-	if(!listenThread_.Start(this)) {
-		CASPAR_LOG(error) << "Failed to create ListenThread";
-		return false;
-	}
-
-	CASPAR_LOG(info) << "Listener successfully initialized";
-	return true;
-}
-
-void AsyncEventServer::Run(HANDLE stopEvent)
-{
-	WSANETWORKEVENTS networkEvents;
-
-	HANDLE waitHandlesCopy[MAXIMUM_WAIT_OBJECTS];
-	waitHandlesCopy[0] = stopEvent;
-
-	while(true)	{
-		//Update local copy of the array of wait-handles if nessecery
-		if(socketInfoCollection_.IsDirty()) {
-			socketInfoCollection_.CopyCollectionToArray(&(waitHandlesCopy[1]), CASPAR_MAXIMUM_SOCKET_CLIENTS);
-			socketInfoCollection_.ClearDirty();
-		}
-
-		DWORD waitResult = WSAWaitForMultipleEvents(std::min<DWORD>(static_cast<DWORD>(socketInfoCollection_.Size()+1), MAXIMUM_WAIT_OBJECTS), waitHandlesCopy, FALSE, 1500, FALSE);
-		if(waitResult == WAIT_TIMEOUT)
-			continue;
-		else if(waitResult == WAIT_FAILED)
-			break;
-		else {
-			DWORD eventIndex = waitResult - WAIT_OBJECT_0;
-
-			HANDLE waitEvent = waitHandlesCopy[eventIndex];
-			SocketInfoPtr pSocketInfo;
-
-			if(eventIndex == 0)	//stopEvent
-				break;
-			else if(socketInfoCollection_.FindSocketInfo(waitEvent, pSocketInfo)) {
-				WSAEnumNetworkEvents(pSocketInfo->socket_, waitEvent, &networkEvents);
-
-				if(networkEvents.lNetworkEvents & FD_ACCEPT) {
-					if(networkEvents.iErrorCode[FD_ACCEPT_BIT] == 0)
-						OnAccept(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnAccept (ErrorCode: " << networkEvents.iErrorCode[FD_ACCEPT_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_ACCEPT_BIT]);
-					}
-				}
-
-				if(networkEvents.lNetworkEvents & FD_CLOSE) {
-					if(networkEvents.iErrorCode[FD_CLOSE_BIT] == 0)
-						OnClose(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnClose (ErrorCode: " << networkEvents.iErrorCode[FD_CLOSE_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_CLOSE_BIT]);
-					}
-					continue;
-				}
-
-				if(networkEvents.lNetworkEvents & FD_READ) {
-					if(networkEvents.iErrorCode[FD_READ_BIT] == 0)
-						OnRead(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnRead (ErrorCode: " << networkEvents.iErrorCode[FD_READ_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_READ_BIT]);
-					}
-				}
-
-				if(networkEvents.lNetworkEvents & FD_WRITE) {
-					if(networkEvents.iErrorCode[FD_WRITE_BIT] == 0)
-						OnWrite(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnWrite (ErrorCode: " << networkEvents.iErrorCode[FD_WRITE_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_WRITE_BIT]);
-					}
-				}
-			}
-			else {
-				//Could not find the waitHandle in the SocketInfoCollection.
-				//It must have been removed during the last call to WSAWaitForMultipleEvents
-			}
-		}
-	}
-}
-
-bool AsyncEventServer::OnUnhandledException(const std::exception& ex) throw() {
-	bool bDoRestart = true;
-
-	try 
-	{
-		CASPAR_LOG(fatal) << "UNHANDLED EXCEPTION in TCPServers listeningthread. Message: " << ex.what();
-	}
-	catch(...)
-	{
-		bDoRestart = false;
-	}
-
-	return bDoRestart;
-}
-
-///////////////////////////////
-// AsyncEventServer:Stop
-// COMMENT: Shuts down
-void AsyncEventServer::Stop()
-{
-	//TODO: initiate shutdown on all clients connected
-//	for(int i=0; i < _totalActiveSockets; ++i) {
-//		shutdown(_pSocketInfo[i]->_socket, SD_SEND);
-//	}
-
-	if(!listenThread_.Stop()) {
-		CASPAR_LOG(warning) << "Wait for listenThread timed out.";
-	}
-
-	socketInfoCollection_.Clear();
-}
-
-////////////////////////////////////////////////////////////////////
-//
-// MESSAGE HANDLERS   
-//
-////////////////////////////////////////////////////////////////////
-
-
-//////////////////////////////
-// AsyncEventServer::OnAccept
-// PARAMS: ...
-// COMMENT: Called when a new client connects
-bool AsyncEventServer::OnAccept(SocketInfoPtr& pSI) {
-	sockaddr_in	clientAddr;
-	int addrSize = sizeof(clientAddr);
-	SOCKET clientSocket = WSAAccept(pSI->socket_, (sockaddr*)&clientAddr, &addrSize, NULL, NULL);
-	if(clientSocket == INVALID_SOCKET) {
-		LogSocketError(TEXT("Accept"));
-		return false;
-	}
-
-	SocketInfoPtr pClientSocket(new SocketInfo(clientSocket, this));
-
-	try
-	{ // !!!!!!!!!!!!
-		if(socketInfoCollection_.Size() >= 50) 
-		{
-			HANDLE handle = nullptr;
-			{
-				tbb::mutex::scoped_lock lock(socketInfoCollection_.mutex_);				
-				handle = *(socketInfoCollection_.waitEvents_.begin()+0);
-				if(handle == pListenSocketInfo_->event_)
-					handle = *(socketInfoCollection_.waitEvents_.begin()+1);
-			}
-			socketInfoCollection_.RemoveSocketInfo(handle);
-			CASPAR_LOG(error) << " Too many connections. Removed last used connection.";
-		}
-	}catch(...){}
-
-	//Determine if we can handle one more client
-	if(socketInfoCollection_.Size() >= CASPAR_MAXIMUM_SOCKET_CLIENTS) {
-		CASPAR_LOG(error) << "Could not accept ) << too many connections).";
-		return true;
-	}
-
-	if(WSAEventSelect(pClientSocket->socket_, pClientSocket->event_, FD_READ | FD_WRITE | FD_CLOSE) == SOCKET_ERROR) {
-		LogSocketError(TEXT("Accept (failed create event for new client)"));
-		return false;
-	}
+#include <common/utility/string.h>
 
-	TCHAR addressBuffer[32];
-	auto ipv4_address = inet_ntoa(clientAddr.sin_addr);
-	MultiByteToWideChar(CP_ACP, 0, ipv4_address, -1, addressBuffer, 32);
-	pClientSocket->host_ = addressBuffer;
+#include <boost/asio.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/future.hpp>
 
-	{
-		tbb::mutex::scoped_lock lock(mutex_);
-
-		BOOST_FOREACH(auto& lifecycle_factory, lifecycle_factories_)
-		{
-			auto lifecycle_bound = lifecycle_factory(ipv4_address);
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
 
-			pClientSocket->bind_to_lifecycle(lifecycle_bound);
-		}
-	}
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
 
-	socketInfoCollection_.AddSocketInfo(pClientSocket);
+using boost::asio::ip::tcp;
 
-	CASPAR_LOG(info) << "Accepted connection from " << pClientSocket->host_.c_str() << " " << socketInfoCollection_.Size();
+namespace caspar { namespace IO {
 
-	return true;
-}
+const std::size_t RECEIVE_BUFFER_SIZE	= 8192;
+const std::size_t SEND_QUEUE_HIGH_WATER	= 1024 * 1024;		// Reading from the client pauses above this.
+const std::size_t SEND_QUEUE_LOW_WATER	= 256 * 1024;		// ...and resumes below this.
+const std::size_t SEND_QUEUE_LIMIT		= 64 * 1024 * 1024;	// The client is disconnected above this.
 
 bool ConvertMultiByteToWideChar(UINT codePage, char* pSource, int sourceLength, std::vector<wchar_t>& wideBuffer, int& countLeftovers)
 {
@@ -371,69 +109,6 @@ bool ConvertMultiByteToWideChar(UINT codePage, char* pSource, int sourceLength,
 	return (charsWritten > 0);
 }
 
-//////////////////////////////
-// AsyncEventServer::OnRead
-// PARAMS: ...
-// COMMENT: Called then something arrives on the socket that has to be read
-bool AsyncEventServer::OnRead(SocketInfoPtr& pSI) {
-	int recvResult = SOCKET_ERROR;
-	
-	try
-	{ // !!!!!!!!!!!!
-		if(pSI)
-		{
-			tbb::mutex::scoped_lock lock(socketInfoCollection_.mutex_);
-			auto it = std::find(socketInfoCollection_.waitEvents_.begin(), socketInfoCollection_.waitEvents_.end(), pSI->event_);
-			if(it != socketInfoCollection_.waitEvents_.end())
-			{
-				auto handle = *it;
-				socketInfoCollection_.waitEvents_.erase(it);
-				socketInfoCollection_.waitEvents_.push_back(handle);
-			}
-		}
-	}catch(...){}
-
-	int maxRecvLength = sizeof(pSI->recvBuffer_)-pSI->recvLeftoverOffset_;
-	recvResult = recv(pSI->socket_, pSI->recvBuffer_+pSI->recvLeftoverOffset_, maxRecvLength, 0);
-	while(recvResult != SOCKET_ERROR) {
-		if(recvResult == 0) {
-			CASPAR_LOG(info) << "Client " << pSI->host_.c_str() << TEXT(" disconnected");
-
-			socketInfoCollection_.RemoveSocketInfo(pSI);
-			return true;
-		}
-
-		//Convert to widechar
-		if(ConvertMultiByteToWideChar(pProtocolStrategy_->GetCodepage(), pSI->recvBuffer_, recvResult + pSI->recvLeftoverOffset_, pSI->wideRecvBuffer_, pSI->recvLeftoverOffset_))		
-			pProtocolStrategy_->Parse(&pSI->wideRecvBuffer_[0], pSI->wideRecvBuffer_.size(), pSI);		
-		else			
-			CASPAR_LOG(error) << "Read from " << pSI->host_.c_str() << TEXT(" failed, could not convert command to UNICODE");
-			
-		maxRecvLength = sizeof(pSI->recvBuffer_)-pSI->recvLeftoverOffset_;
-		recvResult = recv(pSI->socket_, pSI->recvBuffer_+pSI->recvLeftoverOffset_, maxRecvLength, 0);
-	}
-			
-	if(recvResult == SOCKET_ERROR) {
-		int errorCode = WSAGetLastError();
-		if(errorCode == WSAEWOULDBLOCK)
-			return true;
-		else {
-			LogSocketError(TEXT("Read"), errorCode);
-			OnError(pSI->event_, errorCode);
-		}
-	}
-
-	return false;
-}
-
-//////////////////////////////
-// AsyncEventServer::OnWrite
-// PARAMS: ...
-// COMMENT: Called when the socket is ready to send more data
-void AsyncEventServer::OnWrite(SocketInfoPtr& pSI) {		
-	DoSend(*pSI);	
-}
-
 bool ConvertWideCharToMultiByte(UINT codePage, const std::wstring& wideString, std::vector<char>& destBuffer)
 {
 	int bytesWritten = 0;
@@ -447,189 +122,444 @@ bool ConvertWideCharToMultiByte(UINT codePage, const std::wstring& wideString, s
 	return (bytesWritten > 0);
 }
 
-void AsyncEventServer::DoSend(SocketInfo& socketInfo) {
-	//Locks the socketInfo-object so that no one else tampers with the sendqueue at the same time
-	tbb::mutex::scoped_lock lock(mutex_);
+class connection;
 
-	while(!socketInfo.sendQueue_.empty() || socketInfo.currentlySending_.size() > 0) {
-		if(socketInfo.currentlySending_.size() == 0) {
-			//Read the next string in the queue and convert to UTF-8
-			if(!ConvertWideCharToMultiByte(pProtocolStrategy_->GetCodepage(), socketInfo.sendQueue_.front(), socketInfo.currentlySending_))
-			{
-				CASPAR_LOG(error) << "Send to " << socketInfo.host_.c_str() << TEXT(" failed, could not convert response to UTF-8");
-			}
-			socketInfo.currentlySendingOffset_ = 0;
+// Shared between the server and its connections, since pending handlers may outlive the server.
+struct server_state : boost::noncopyable
+{
+	const std::shared_ptr<boost::asio::io_service>	service;
+
+	tbb::mutex										mutex;
+	safe_ptr<IProtocolStrategy>						protocol;
+	ClientDisconnectEvent							disconnect_handler;
+
+	std::set<std::shared_ptr<connection>>			connections; // Only accessed on the io_service.
+	tbb::atomic<std::size_t>						connection_count;
+
+	server_state(const safe_ptr<IProtocolStrategy>& protocol, const std::shared_ptr<boost::asio::io_service>& service)
+		: service(service)
+		, protocol(protocol)
+	{
+		connection_count = 0;
+	}
+
+	safe_ptr<IProtocolStrategy> get_protocol()
+	{
+		tbb::mutex::scoped_lock lock(mutex);
+		return protocol;
+	}
+
+	void add(const std::shared_ptr<connection>& c)
+	{
+		connections.insert(c);
+		++connection_count;
+	}
+
+	void remove(const std::shared_ptr<connection>& c);
+};
+
+class connection : public ClientInfo, public std::enable_shared_from_this<connection>
+{
+	const std::shared_ptr<server_state>				state_;
+	tcp::socket										socket_;
+	std::wstring									host_;
+	std::vector<std::shared_ptr<void>>				lifecycle_bound_items_;
+
+	char											receive_buffer_[RECEIVE_BUFFER_SIZE];
+	int												receive_leftover_;
+	std::vector<wchar_t>							wide_receive_buffer_;
+
+	std::deque<std::shared_ptr<std::vector<char>>>	send_queue_;
+	std::size_t										send_queue_bytes_;
+
+	bool											reading_;
+	bool											writing_;
+	bool											paused_;
+	bool											shutdown_after_send_;
+	bool											closed_;
+public:
+	explicit connection(const std::shared_ptr<server_state>& state)
+		: state_(state)
+		, socket_(*state->service)
+		, receive_leftover_(0)
+		, send_queue_bytes_(0)
+		, reading_(false)
+		, writing_(false)
+		, paused_(false)
+		, shutdown_after_send_(false)
+		, closed_(false)
+	{
+	}
+
+	tcp::socket& socket()
+	{
+		return socket_;
+	}
+
+	std::string ipv4_address()
+	{
+		boost::system::error_code ec;
+		auto endpoint = socket_.remote_endpoint(ec);
+		return ec ? "" : endpoint.address().to_string();
+	}
+
+	void bind_to_lifecycle(const std::shared_ptr<void>& lifecycle_bound)
+	{
+		lifecycle_bound_items_.push_back(lifecycle_bound);
+	}
+
+	void start()
+	{
+		boost::system::error_code ec;
+		socket_.set_option(tcp::no_delay(true), ec);
+		host_ = widen(ipv4_address());
+		read();
+	}
+
+	void close()
+	{
+		if(closed_)
+			return;
+
+		closed_ = true;
+
+		boost::system::error_code ec;
+		socket_.shutdown(tcp::socket::shutdown_both, ec);
+		socket_.close(ec);
+
+		send_queue_.clear();
+		send_queue_bytes_ = 0;
+
+		state_->remove(shared_from_this());
+	}
+
+	// ClientInfo
+
+	virtual void Send(const std::wstring& data) override
+	{
+		if(data.empty())
+			return;
+
+		auto bytes = std::make_shared<std::vector<char>>();
+		if(!ConvertWideCharToMultiByte(state_->get_protocol()->GetCodepage(), data, *bytes))
+		{
+			CASPAR_LOG(error) << "Send to " << host_ << TEXT(" failed, could not convert response to UTF-8");
+			return;
 		}
 
-		if(socketInfo.currentlySending_.size() > 0) {
-			int bytesToSend = static_cast<int>(socketInfo.currentlySending_.size()-socketInfo.currentlySendingOffset_);
-			int sentBytes = send(socketInfo.socket_, &socketInfo.currentlySending_[0] + socketInfo.currentlySendingOffset_, bytesToSend, 0);
-			if(sentBytes == SOCKET_ERROR) {
-				int errorCode = WSAGetLastError();
-				if(errorCode == WSAEWOULDBLOCK) {
-					CASPAR_LOG(debug) << "Send to " << socketInfo.host_.c_str() << TEXT(" would block, sending later");
-					break;
-				}
-				else {
-					LogSocketError(TEXT("Send"), errorCode);
-					OnError(socketInfo.event_, errorCode);
+		log_sent(*this, data);
 
-					socketInfo.currentlySending_.resize(0);
-					socketInfo.currentlySendingOffset_ = 0;
-					socketInfo.sendQueue_.pop();
-					break;
-				}
-			}
-			else {
-				if(sentBytes == bytesToSend) {
-					
-					if(sentBytes < 512)
-					{
-						boost::replace_all(socketInfo.sendQueue_.front(), L"\n", L"\\n");
-						boost::replace_all(socketInfo.sendQueue_.front(), L"\r", L"\\r");
-						CASPAR_LOG(info) << L"Sent message to " << socketInfo.host_.c_str() << L": " << socketInfo.sendQueue_.front().c_str();
-					}
-					else
-						CASPAR_LOG(info) << "Sent more than 512 bytes to " << socketInfo.host_.c_str();
+		auto self = shared_from_this();
+		state_->service->post([=]
+		{
+			self->enqueue(bytes);
+		});
+	}
 
-					socketInfo.currentlySending_.resize(0);
-					socketInfo.currentlySendingOffset_ = 0;
-					socketInfo.sendQueue_.pop();
-				}
-				else {
-					socketInfo.currentlySendingOffset_ += sentBytes;
-					CASPAR_LOG(info) << "Sent partial message to " << socketInfo.host_.c_str();
-				}
-			}
+	virtual void SendBytes(const std::vector<char>& data) override
+	{
+		if(data.empty())
+			return;
+
+		auto bytes = std::make_shared<std::vector<char>>(data);
+
+		auto self = shared_from_this();
+		state_->service->post([=]
+		{
+			self->enqueue(bytes);
+		});
+	}
+
+	virtual void Disconnect() override
+	{
+		auto self = shared_from_this();
+		state_->service->post([=]
+		{
+			self->shutdown_after_send_ = true;
+			if(!self->writing_)
+				self->shutdown();
+		});
+	}
+
+	virtual std::wstring print() const override
+	{
+		return host_;
+	}
+private:
+	void read()
+	{
+		reading_ = true;
+
+		auto self = shared_from_this();
+		socket_.async_read_some(boost::asio::buffer(receive_buffer_ + receive_leftover_, RECEIVE_BUFFER_SIZE - receive_leftover_), 
+			[=](const boost::system::error_code& ec, std::size_t bytes_transferred)
+			{
+				self->on_read(ec, bytes_transferred);
+			});
+	}
+
+	void on_read(const boost::system::error_code& ec, std::size_t bytes_transferred)
+	{
+		reading_ = false;
+
+		if(closed_)
+			return;
+
+		if(ec)
+		{
+			if(ec == boost::asio::error::eof)
+				CASPAR_LOG(info) << "Client " << host_ << TEXT(" disconnected");
+			else if(ec != boost::asio::error::operation_aborted)
+				CASPAR_LOG(info) << "Client " << host_ << TEXT(" was disconnected, ") << widen(ec.message());
+
+			close();
+			return;
 		}
+
+		auto protocol = state_->get_protocol();
+		auto binary_protocol = dynamic_cast<IBinaryProtocolStrategy*>(protocol.get());
+		if(binary_protocol)
+			binary_protocol->ParseBytes(receive_buffer_, static_cast<int>(bytes_transferred), shared_from_this());
+		else if(ConvertMultiByteToWideChar(protocol->GetCodepage(), receive_buffer_, static_cast<int>(bytes_transferred) + receive_leftover_, wide_receive_buffer_, receive_leftover_))
+			protocol->Parse(&wide_receive_buffer_[0], static_cast<int>(wide_receive_buffer_.size()), shared_from_this());
 		else
-			socketInfo.sendQueue_.pop();
+			CASPAR_LOG(error) << "Read from " << host_ << TEXT(" failed, could not convert command to UNICODE");
+
+		if(!paused_ && !closed_)
+			read();
 	}
-}
 
-//////////////////////////////
-// AsyncEventServer::OnClose
-// PARAMS: ...
-// COMMENT: Called when a client disconnects / is disconnected
-void AsyncEventServer::OnClose(SocketInfoPtr& pSI) {
-	CASPAR_LOG(info) << "Client " << pSI->host_.c_str() << TEXT(" was disconnected");
+	void enqueue(const std::shared_ptr<std::vector<char>>& bytes)
+	{
+		if(closed_)
+			return;
 
-	socketInfoCollection_.RemoveSocketInfo(pSI);
-}
+		send_queue_.push_back(bytes);
+		send_queue_bytes_ += bytes->size();
+
+		if(send_queue_bytes_ > SEND_QUEUE_LIMIT)
+		{
+			CASPAR_LOG(error) << "Client " << host_ << TEXT(" is not reading its replies, disconnecting");
+			close();
+			return;
+		}
 
-//////////////////////////////
-// AsyncEventServer::OnError
-// PARAMS: ...
-// COMMENT: Called when an errorcode is recieved
-void AsyncEventServer::OnError(HANDLE waitEvent, int errorCode) {
-	if(errorCode == WSAENETDOWN || errorCode == WSAECONNABORTED || errorCode == WSAECONNRESET || errorCode == WSAESHUTDOWN || errorCode == WSAETIMEDOUT || errorCode == WSAENOTCONN || errorCode == WSAENETRESET) {
-		SocketInfoPtr pSocketInfo;
-		if(socketInfoCollection_.FindSocketInfo(waitEvent, pSocketInfo)) {
-			CASPAR_LOG(info) << "Client " << pSocketInfo->host_.c_str() << TEXT(" was disconnected, Errorcode ") << errorCode;
+		if(!paused_ && send_queue_bytes_ > SEND_QUEUE_HIGH_WATER)
+		{
+			CASPAR_LOG(warning) << "Client " << host_ << TEXT(" is reading slowly, pausing its commands");
+			paused_ = true;
 		}
 
-		socketInfoCollection_.RemoveSocketInfo(waitEvent);
+		if(!writing_)
+			write();
 	}
-}
 
-//////////////////////////////
-// AsyncEventServer::DisconnectClient
-// PARAMS: ...
-// COMMENT: The client is removed from the actual client-list when an FD_CLOSE notification is recieved
-void AsyncEventServer::DisconnectClient(SocketInfo& socketInfo) {
-	int result = shutdown(socketInfo.socket_, SD_SEND);
-	if(result == SOCKET_ERROR)
-		OnError(socketInfo.event_, result);
-}
+	void write()
+	{
+		writing_ = true;
 
-//////////////////////////////
-// AsyncEventServer::LogSocketError
-void AsyncEventServer::LogSocketError(const TCHAR* pStr, int socketError) {
-	if(socketError == 0)
-		socketError = WSAGetLastError();
+		// The handler keeps the buffer alive, since close() clears the queue while the write may still be pending.
+		auto self = shared_from_this();
+		auto bytes = send_queue_.front();
+		boost::asio::async_write(socket_, boost::asio::buffer(*bytes), 
+			[self, bytes](const boost::system::error_code& ec, std::size_t)
+			{
+				self->on_write(ec);
+			});
+	}
 
-	CASPAR_LOG(error) << "Failed to " << pStr << TEXT(" Errorcode: ") << socketError;
-}
+	void on_write(const boost::system::error_code& ec)
+	{
+		writing_ = false;
 
+		if(closed_)
+			return;
 
-//////////////////////////////
-//  SocketInfoCollection
-//////////////////////////////
+		if(ec)
+		{
+			if(ec != boost::asio::error::operation_aborted)
+				CASPAR_LOG(info) << "Client " << host_ << TEXT(" was disconnected, ") << widen(ec.message());
 
-AsyncEventServer::SocketInfoCollection::SocketInfoCollection() : bDirty_(false) {
-}
+			close();
+			return;
+		}
 
-AsyncEventServer::SocketInfoCollection::~SocketInfoCollection() {
-}
+		send_queue_bytes_ -= send_queue_.front()->size();
+		send_queue_.pop_front();
 
-bool AsyncEventServer::SocketInfoCollection::AddSocketInfo(SocketInfoPtr& pSocketInfo) {
-	tbb::mutex::scoped_lock lock(mutex_);
+		if(paused_ && send_queue_bytes_ < SEND_QUEUE_LOW_WATER)
+		{
+			CASPAR_LOG(info) << "Client " << host_ << TEXT(" caught up, resuming its commands");
+			paused_ = false;
+			if(!reading_)
+				read();
+		}
 
-	waitEvents_.resize(waitEvents_.size()+1);
-	bool bSuccess = socketInfoMap_.insert(SocketInfoMap::value_type(pSocketInfo->event_, pSocketInfo)).second;
-	if(bSuccess) {
-		waitEvents_[waitEvents_.size()-1] = pSocketInfo->event_;
-		bDirty_ = true;
+		if(!send_queue_.empty())
+			write();
+		else if(shutdown_after_send_)
+			shutdown();
 	}
 
-	return bSuccess;
-}
+	void shutdown()
+	{
+		// The client closes its end in response, which completes the pending read.
+		boost::system::error_code ec;
+		socket_.shutdown(tcp::socket::shutdown_send, ec);
+		if(ec)
+			close();
+	}
+};
+
+void server_state::remove(const std::shared_ptr<connection>& c)
+{
+	if(connections.erase(c) == 0)
+		return;
 
-void AsyncEventServer::SocketInfoCollection::RemoveSocketInfo(SocketInfoPtr& pSocketInfo) {
-	if(pSocketInfo != 0) {
-		RemoveSocketInfo(pSocketInfo->event_);
+	--connection_count;
+
+	ClientDisconnectEvent handler;
+	{
+		tbb::mutex::scoped_lock lock(mutex);
+		handler = disconnect_handler;
 	}
+
+	if(handler)
+		handler(c);
 }
-void AsyncEventServer::SocketInfoCollection::RemoveSocketInfo(HANDLE waitEvent) {
-	tbb::mutex::scoped_lock lock(mutex_);
 
-	//Find instance
-	SocketInfoPtr pSocketInfo;
-	SocketInfoMap::iterator it = socketInfoMap_.find(waitEvent);
-	SocketInfoMap::iterator end = socketInfoMap_.end();
-	if(it != end)
-		pSocketInfo = it->second;
+struct AsyncEventServer::implementation : public std::enable_shared_from_this<implementation>
+{
+	const std::shared_ptr<server_state>	state_;
+	const int							port_;
+	tcp::acceptor						acceptor_;
+	tbb::atomic<int>					bound_port_;
+
+	tbb::mutex							lifecycle_mutex_;
+	std::vector<lifecycle_factory_t>	lifecycle_factories_;
+
+	implementation(const safe_ptr<IProtocolStrategy>& protocol, int port, const std::shared_ptr<boost::asio::io_service>& service)
+		: state_(std::make_shared<server_state>(protocol, service))
+		, port_(port)
+		, acceptor_(*service)
+	{
+		bound_port_ = 0;
+	}
 
-	if(pSocketInfo) {
-		pSocketInfo->pServer_ = NULL;
+	bool start()
+	{
+		if(acceptor_.is_open())
+			return false;
+
+		boost::system::error_code ec;
+		acceptor_.open(tcp::v4(), ec);
+		if(!ec)
+			acceptor_.bind(tcp::endpoint(tcp::v4(), static_cast<unsigned short>(port_)), ec);
+		if(!ec)
+			acceptor_.listen(boost::asio::socket_base::max_connections, ec);
+		if(!ec)
+			bound_port_ = acceptor_.local_endpoint(ec).port();
+
+		if(ec)
+		{
+			CASPAR_LOG(error) << "Failed to listen on port " << port_ << ". " << widen(ec.message());
+			boost::system::error_code ignored;
+			acceptor_.close(ignored);
+			return false;
+		}
+
+		accept();
+		return true;
+	}
 
-		socketInfoMap_.erase(waitEvent);
+	void stop()
+	{
+		auto self = shared_from_this();
+		auto done = std::make_shared<boost::promise<void>>();
+		auto future = done->get_future();
 
-		HandleVector::iterator it = std::find(waitEvents_.begin(), waitEvents_.end(), waitEvent);
-		if(it != waitEvents_.end()) {
-			std::swap((*it), waitEvents_.back());
-			waitEvents_.resize(waitEvents_.size()-1);
+		state_->service->post([=]
+		{
+			self->close_all();
+			done->set_value();
+		});
 
-			bDirty_ = true;
-		}
+		if(!future.timed_wait(boost::posix_time::seconds(5)))
+			CASPAR_LOG(warning) << "Timed out closing connections on port " << bound_port_;
 	}
-	if(onSocketInfoRemoved)
-		onSocketInfoRemoved(pSocketInfo);
-}
 
-bool AsyncEventServer::SocketInfoCollection::FindSocketInfo(HANDLE key, SocketInfoPtr& pResult) {
-	tbb::mutex::scoped_lock lock(mutex_);
+	void accept()
+	{
+		auto self = shared_from_this();
+		auto c = std::make_shared<connection>(state_);
+		acceptor_.async_accept(c->socket(), [=](const boost::system::error_code& ec)
+		{
+			self->on_accept(ec, c);
+		});
+	}
 
-	SocketInfoMap::iterator it = socketInfoMap_.find(key);
-	SocketInfoMap::iterator end = socketInfoMap_.end();
-	if(it != end)
-		pResult = it->second;
+	void on_accept(const boost::system::error_code& ec, const std::shared_ptr<connection>& c)
+	{
+		if(!acceptor_.is_open() || ec == boost::asio::error::operation_aborted)
+			return;
 
-	return (it != end);
-}
+		if(ec)
+		{
+			CASPAR_LOG(error) << "Failed to accept connection on port " << bound_port_ << ". " << widen(ec.message());
+			accept();
+			return;
+		}
 
-void AsyncEventServer::SocketInfoCollection::CopyCollectionToArray(HANDLE* pDest, int maxCount) {
-	tbb::mutex::scoped_lock lock(mutex_);
+		auto ipv4_address = c->ipv4_address();
+		{
+			tbb::mutex::scoped_lock lock(lifecycle_mutex_);
+			BOOST_FOREACH(auto& lifecycle_factory, lifecycle_factories_)
+			{
+				auto lifecycle_bound = lifecycle_factory(ipv4_address);
+				c->bind_to_lifecycle(lifecycle_bound);
+			}
+		}
 
-	memcpy(pDest, &(waitEvents_[0]), std::min( maxCount, static_cast<int>(waitEvents_.size()) ) * sizeof(HANDLE) );
-}
+		state_->add(c);
+		c->start();
 
-void AsyncEventServer::SocketInfoCollection::Clear() {
-	tbb::mutex::scoped_lock lock(mutex_);
+		CASPAR_LOG(info) << "Accepted connection from " << c->print() << " " << state_->connection_count;
+
+		accept();
+	}
+
+	void close_all()
+	{
+		boost::system::error_code ec;
+		acceptor_.close(ec);
 
-	socketInfoMap_.clear();
-	waitEvents_.clear();
+		auto connections = state_->connections;
+		BOOST_FOREACH(auto& c, connections)
+			c->close();
+	}
+};
+
+AsyncEventServer::AsyncEventServer(const safe_ptr<IProtocolStrategy>& pProtocol, int port, const std::shared_ptr<boost::asio::io_service>& service) 
+	: impl_(new implementation(pProtocol, port, service)){}
+AsyncEventServer::~AsyncEventServer(){impl_->stop();}
+bool AsyncEventServer::Start(){return impl_->start();}
+void AsyncEventServer::Stop(){impl_->stop();}
+void AsyncEventServer::SetProtocolStrategy(const safe_ptr<IProtocolStrategy>& pPS)
+{
+	tbb::mutex::scoped_lock lock(impl_->state_->mutex);
+	impl_->state_->protocol = pPS;
+}
+void AsyncEventServer::SetClientDisconnectHandler(ClientDisconnectEvent handler)
+{
+	tbb::mutex::scoped_lock lock(impl_->state_->mutex);
+	impl_->state_->disconnect_handler = handler;
+}
+void AsyncEventServer::add_lifecycle_factory(const lifecycle_factory_t& factory)
+{
+	tbb::mutex::scoped_lock lock(impl_->lifecycle_mutex_);
+	impl_->lifecycle_factories_.push_back(factory);
 }
+int AsyncEventServer::port() const{return impl_->bound_port_;}
+std::size_t AsyncEventServer::connection_count() const{return impl_->state_->connection_count;}
 
-}	//namespace IO
-}	//namespace caspar
\ No newline at end of file
+}}
@@ -24,6 +24,7 @@
 #include <memory>
 #include <string>
 #include <iostream>
+#include <vector>
 
 #include <common/log/log.h>
 
@@ -38,10 +39,12 @@ public:
 	virtual ~ClientInfo(){}
 
 	virtual void Send(const std::wstring& data) = 0;
+	virtual void SendBytes(const std::vector<char>& data) = 0;
 	virtual void Disconnect() = 0;
 	virtual std::wstring print() const = 0;
 
 	std::wstring		currentMessage_;
+	std::vector<char>	currentBytes_;
 };
 typedef std::shared_ptr<ClientInfo> ClientInfoPtr;
 
@@ -51,6 +54,10 @@ struct ConsoleClientInfo : public caspar::IO::ClientInfo
 	{
 		std::wcout << (L"#" + caspar::log::replace_nonprintable_copy(data, L'?'));
 	}
+	void SendBytes(const std::vector<char>& data)
+	{
+		std::wcout << L"#" << data.size() << L" bytes\n";
+	}
 	void Disconnect(){}
 	virtual std::wstring print() const {return L"Console";}
 };
@@ -36,4 +36,15 @@ public:
 };
 typedef std::shared_ptr<IProtocolStrategy> ProtocolStrategyPtr;
 
+// A protocol that is not text. The received bytes are given to ParseBytes() as they are, 
+// instead of being decoded to Parse(), and replies are sent with ClientInfo::SendBytes().
+class IBinaryProtocolStrategy : public IProtocolStrategy
+{
+public:
+	virtual void ParseBytes(const char* pData, int byteCount, ClientInfoPtr pClientInfo) = 0;
+
+	virtual void Parse(const wchar_t* pData, int charCount, ClientInfoPtr pClientInfo){}
+	virtual unsigned int GetCodepage(){return CP_UTF8;}
+};
+
 }}	//namespace caspar
\ No newline at end of file
@@ -0,0 +1,233 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "protocol_log.h"
+
+#include "ClientInfo.h"
+
+#include <common/log/log.h>
+
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/chrono.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <tbb/mutex.h>
+
+#include <algorithm>
+#include <cwctype>
+#include <map>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace caspar { namespace IO {
+
+typedef boost::chrono::steady_clock protocol_log_clock;
+
+// The first word of a command, or of the reply after its status code, with any request tag skipped.
+static std::wstring command_class(const std::wstring& message, bool reply)
+{
+	static const std::size_t max_length = 32;
+
+	auto next_token = [&](std::size_t& pos) -> std::pair<std::size_t, std::size_t>
+	{
+		auto begin = message.find_first_not_of(L' ', pos);
+		if(begin == std::wstring::npos)
+			begin = message.size();
+		auto end = message.find_first_of(L" \r\n", begin);
+		if(end == std::wstring::npos)
+			end = message.size();
+		pos = end;
+		return std::make_pair(begin, end);
+	};
+
+	std::size_t pos = 0;
+	auto token = next_token(pos);
+
+	auto tag = message.substr(token.first, std::min<std::size_t>(token.second - token.first, 4));
+	if(token.second - token.first == 3 && (_wcsnicmp(tag.c_str(), reply ? L"RES" : L"REQ", 3) == 0))
+	{
+		next_token(pos);
+		token = next_token(pos);
+	}
+
+	if(reply && token.first < token.second && std::iswdigit(message[token.first]))
+		token = next_token(pos);
+
+	std::wstring result = message.substr(token.first, std::min(token.second - token.first, max_length));
+	std::transform(result.begin(), result.end(), result.begin(), std::towupper);
+	return result;
+}
+
+struct protocol_log
+{
+	struct counter
+	{
+		std::wstring	client;
+		int				logged;
+		int				suppressed;
+
+		counter() : logged(0), suppressed(0){}
+	};
+
+	typedef std::pair<const ClientInfo*, std::wstring> counter_key;
+
+	tbb::mutex							mutex_;
+	protocol_log_settings				settings_;
+	protocol_log_clock::time_point		interval_start_;
+	std::map<counter_key, counter>		counters_;
+	long long							received_;
+	long long							sent_;
+	long long							suppressed_;
+
+	protocol_log()
+		: interval_start_(protocol_log_clock::now())
+		, received_(0)
+		, sent_(0)
+		, suppressed_(0)
+	{
+	}
+
+	void configure(const protocol_log_settings& settings)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+		settings_ = settings;
+		settings_.interval_seconds = std::max(1, settings_.interval_seconds);
+	}
+
+	void log(const ClientInfo& client, const std::wstring& message, bool sent)
+	{
+		auto key = counter_key(&client, sent ? command_class(message, true) + L" replies" : command_class(message, false));
+
+		std::wstring summary;
+		std::size_t max_length;
+		bool suppress = false;
+		{
+			tbb::mutex::scoped_lock lock(mutex_);
+			summary = flush_if_due();
+
+			++(sent ? sent_ : received_);
+			if(settings_.messages_per_interval > 0)
+			{
+				auto& counter = counters_[key];
+				suppress = counter.logged >= settings_.messages_per_interval;
+				if(suppress)
+				{
+					if(counter.suppressed++ == 0)
+						counter.client = client.print();
+					++suppressed_;
+				}
+				else
+					++counter.logged;
+			}
+			max_length = settings_.max_message_length;
+		}
+
+		log_summary(summary);
+		if(suppress)
+			return;
+
+		// Only messages that are actually logged are formatted.
+		std::wstring text;
+		if(max_length > 0 && message.size() > max_length)
+			text = message.substr(0, max_length) + L" [... " + boost::lexical_cast<std::wstring>(message.size()) + L" characters]";
+		else
+			text = message;
+		boost::replace_all(text, L"\n", L"\\n");
+		boost::replace_all(text, L"\r", L"\\r");
+
+		if(sent)
+			CASPAR_LOG(info) << L"Sent message to " << client.print() << L": " << text;
+		else
+			CASPAR_LOG(info) << L"Received message from " << client.print() << L": " << text;
+	}
+
+	void flush()
+	{
+		std::wstring summary;
+		{
+			tbb::mutex::scoped_lock lock(mutex_);
+			summary = flush_if_due();
+		}
+		log_summary(summary);
+	}
+
+	static void log_summary(const std::wstring& summary)
+	{
+		if(!summary.empty())
+			CASPAR_LOG(info) << summary;
+	}
+
+	// Must be called with the mutex held, returns the summary of the interval that ended, if any.
+	std::wstring flush_if_due()
+	{
+		auto now = protocol_log_clock::now();
+		if(now - interval_start_ < boost::chrono::seconds(settings_.interval_seconds))
+			return std::wstring();
+
+		std::wstringstream summary;
+		if(received_ > 0 || sent_ > 0)
+		{
+			summary << L"Protocol messages in the last " << settings_.interval_seconds << L"s: " 
+					<< received_ << L" received, " << sent_ << L" sent, " << suppressed_ << L" not logged";
+
+			std::vector<std::pair<int, std::wstring>> top;
+			BOOST_FOREACH(auto& entry, counters_)
+			{
+				if(entry.second.suppressed > 0)
+					top.push_back(std::make_pair(entry.second.suppressed, entry.second.client + L" " + entry.first.second));
+			}
+			auto top_count = std::min<std::size_t>(top.size(), 3);
+			std::partial_sort(top.begin(), top.begin() + top_count, top.end(), [](const std::pair<int, std::wstring>& lhs, const std::pair<int, std::wstring>& rhs)
+			{
+				return lhs.first > rhs.first;
+			});
+
+			for(std::size_t n = 0; n < top_count; ++n)
+				summary << (n == 0 ? L" (" : L", ") << top[n].second << L" x" << top[n].first;
+			if(top_count > 0)
+				summary << L")";
+		}
+
+		interval_start_ = now;
+		counters_.clear();
+		received_ = 0;
+		sent_ = 0;
+		suppressed_ = 0;
+
+		return summary.str();
+	}
+};
+
+static protocol_log& get_protocol_log()
+{
+	static protocol_log instance;
+	return instance;
+}
+
+void configure_protocol_log(const protocol_log_settings& settings){get_protocol_log().configure(settings);}
+void log_received(const ClientInfo& client, const std::wstring& message){get_protocol_log().log(client, message, false);}
+void log_sent(const ClientInfo& client, const std::wstring& message){get_protocol_log().log(client, message, true);}
+void flush_protocol_log(){get_protocol_log().flush();}
+
+}}
@@ -0,0 +1,55 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <string>
+
+namespace caspar { namespace IO {
+
+class ClientInfo;
+
+struct protocol_log_settings
+{
+	int				messages_per_interval;	// Per connection and command, 0 logs every message.
+	int				interval_seconds;
+	std::size_t		max_message_length;		// Longer messages are truncated, 0 logs them whole.
+
+	protocol_log_settings()
+		: messages_per_interval(10)
+		, interval_seconds(10)
+		, max_message_length(512)
+	{
+	}
+};
+
+void configure_protocol_log(const protocol_log_settings& settings);
+
+// Logs a message received from or sent to a client, unless that connection has already logged 
+// the allowed number of messages of the same command this interval. Suppressed messages are 
+// only counted, and are reported in a summary line at the end of the interval.
+void log_received(const ClientInfo& client, const std::wstring& message);
+void log_sent(const ClientInfo& client, const std::wstring& message);
+
+// Logs the summary line if the current interval has ended. Called periodically so that the 
+// summary is not held back until the next message arrives.
+void flush_protocol_log();
+
+}}
@@ -0,0 +1,72 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <boost/asio/io_service.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/future.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <functional>
+#include <memory>
+
+namespace caspar { namespace IO {
+
+// An io_service with a thread of its own, stopped on destruction.
+class running_service : boost::noncopyable
+{
+	std::shared_ptr<boost::asio::io_service>	service_;
+	boost::asio::io_service::work				work_;
+	boost::thread								thread_;
+public:
+	running_service()
+		: service_(std::make_shared<boost::asio::io_service>())
+		, work_(*service_)
+		, thread_([this]{service_->run();})
+	{
+	}
+
+	~running_service()
+	{
+		service_->stop();
+		thread_.join();
+	}
+
+	const std::shared_ptr<boost::asio::io_service>& get() const
+	{
+		return service_;
+	}
+
+	// Runs the function on the service thread and waits for it.
+	void invoke(const std::function<void()>& func)
+	{
+		auto done = std::make_shared<boost::promise<void>>();
+		auto future = done->get_future();
+		service_->post([=]
+		{
+			func();
+			done->set_value();
+		});
+		future.wait();
+	}
+};
+
+}}
@@ -0,0 +1,350 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../StdAfx.h"
+
+#include "server_load_test.h"
+
+#include "AsyncEventServer.h"
+#include "ProtocolStrategy.h"
+#include "running_service.h"
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+
+using boost::asio::ip::tcp;
+
+namespace caspar { namespace IO {
+
+typedef boost::chrono::high_resolution_clock load_test_clock;
+
+static double elapsed_millis(load_test_clock::time_point since)
+{
+	return boost::chrono::duration<double, boost::milli>(load_test_clock::now() - since).count();
+}
+
+struct load_test_round;
+
+// Connects, waits for the round to start, then sends its commands one at a time and times each reply.
+// Only accessed on the client service thread.
+class load_test_client : public std::enable_shared_from_this<load_test_client>
+{
+	// The lines of an AMCP reply that are still to be read after the current one.
+	enum
+	{
+		first_line			= -1,	// Not known until the status code has been read.
+		until_empty_line	= -2	// A 200 reply ends with an empty line.
+	};
+
+	const std::shared_ptr<load_test_round>	round_;
+	tcp::socket						socket_;
+	boost::asio::streambuf			response_;
+	std::string						request_;
+	load_test_clock::time_point		sent_at_;
+	int								sent_;
+public:
+	std::vector<double>				latencies;
+	int								error_replies;
+	double							connect_millis;
+	bool							connected;
+	bool							failed;
+
+	load_test_client(const std::shared_ptr<load_test_round>& round, boost::asio::io_service& service)
+		: round_(round)
+		, socket_(service)
+		, sent_(0)
+		, error_replies(0)
+		, connect_millis(0.0)
+		, connected(false)
+		, failed(false)
+	{
+	}
+
+	void connect(const tcp::endpoint& endpoint);
+	void run(int commands);
+	void close()
+	{
+		boost::system::error_code ec;
+		socket_.close(ec);
+	}
+private:
+	void send_next(int commands);
+	void read_reply_line(int commands, int lines_left);
+	void fail();
+};
+
+struct load_test_round
+{
+	std::vector<std::shared_ptr<load_test_client>>	clients;
+	std::string										command;
+	int												commands;
+	int												pending_connects;
+	int												pending_runs;
+	boost::promise<void>							done;
+
+	void on_connected()
+	{
+		if(--pending_connects > 0)
+			return;
+
+		BOOST_FOREACH(auto& client, clients)
+		{
+			if(client->connected)
+				++pending_runs;
+		}
+
+		if(pending_runs == 0)
+			done.set_value();
+
+		// All clients are connected before any sends, so the server holds every connection at once.
+		BOOST_FOREACH(auto& client, clients)
+		{
+			if(client->connected)
+				client->run(commands);
+		}
+	}
+
+	void on_finished()
+	{
+		if(--pending_runs == 0)
+			done.set_value();
+	}
+};
+
+void load_test_client::connect(const tcp::endpoint& endpoint)
+{
+	auto self = shared_from_this();
+	auto start = load_test_clock::now();
+	socket_.async_connect(endpoint, [=](const boost::system::error_code& ec)
+	{
+		self->connect_millis	= elapsed_millis(start);
+		self->connected			= !ec;
+		self->failed			= !!ec;
+
+		if(!ec)
+		{
+			boost::system::error_code ignored;
+			self->socket_.set_option(tcp::no_delay(true), ignored);
+		}
+
+		self->round_->on_connected();
+	});
+}
+
+void load_test_client::run(int commands)
+{
+	send_next(commands);
+}
+
+void load_test_client::send_next(int commands)
+{
+	if(sent_ == commands)
+	{
+		round_->on_finished();
+		return;
+	}
+
+	request_	= round_->command + "\r\n";
+	sent_at_	= load_test_clock::now();
+
+	auto self = shared_from_this();
+	boost::asio::async_write(socket_, boost::asio::buffer(request_), [=](const boost::system::error_code& ec, std::size_t)
+	{
+		if(ec)
+			self->close(); // Fails the pending read.
+	});
+	read_reply_line(commands, first_line);
+}
+
+void load_test_client::read_reply_line(int commands, int lines_left)
+{
+	auto self = shared_from_this();
+	boost::asio::async_read_until(socket_, response_, "\r\n", [=](const boost::system::error_code& ec, std::size_t bytes_transferred)
+	{
+		if(ec)
+		{
+			self->fail();
+			return;
+		}
+
+		auto begin = boost::asio::buffers_begin(self->response_.data());
+		const std::string line(begin, begin + bytes_transferred - 2);
+		self->response_.consume(bytes_transferred);
+
+		int left = lines_left;
+		if(left == first_line)
+		{
+			if(!boost::starts_with(line, "2"))
+				++self->error_replies;
+
+			left = boost::starts_with(line, "201") ? 1 : boost::starts_with(line, "200") ? until_empty_line : 0;
+		}
+		else if(left == until_empty_line)
+			left = line.empty() ? 0 : until_empty_line;
+		else
+			--left;
+
+		if(left != 0)
+		{
+			self->read_reply_line(commands, left);
+			return;
+		}
+
+		self->latencies.push_back(elapsed_millis(self->sent_at_));
+		++self->sent_;
+		self->send_next(commands);
+	});
+}
+
+void load_test_client::fail()
+{
+	if(failed)
+		return;
+
+	failed = true;
+	close();
+	round_->on_finished();
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if(sorted.empty())
+		return 0.0;
+
+	return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+}
+
+static boost::property_tree::wptree run_round(running_service& client_service, const AsyncEventServer& server, const std::string& command, int connections, int commands)
+{
+	const tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(server.port()));
+
+	// The round and its clients keep each other alive until the clients are cleared below.
+	auto round = std::make_shared<load_test_round>();
+	round->command			= command;
+	round->commands			= commands;
+	round->pending_connects	= connections;
+	round->pending_runs		= 0;
+
+	auto done = round->done.get_future();
+	auto start = load_test_clock::now();
+
+	client_service.invoke([&]
+	{
+		for(int n = 0; n < connections; ++n)
+			round->clients.push_back(std::make_shared<load_test_client>(round, *client_service.get()));
+
+		BOOST_FOREACH(auto& client, round->clients)
+			client->connect(endpoint);
+	});
+
+	const bool timed_out	= !done.timed_wait(boost::posix_time::seconds(60));
+	const auto elapsed		= elapsed_millis(start);
+	const auto server_connections = server.connection_count();
+
+	std::vector<double> connect_times;
+	std::vector<double> latencies;
+	int failures = 0;
+	int error_replies = 0;
+
+	client_service.invoke([&]
+	{
+		BOOST_FOREACH(auto& client, round->clients)
+		{
+			client->close();
+
+			if(client->connected)
+				connect_times.push_back(client->connect_millis);
+			if(client->failed)
+				++failures;
+
+			error_replies += client->error_replies;
+
+			latencies.insert(latencies.end(), client->latencies.begin(), client->latencies.end());
+		}
+
+		round->clients.clear();
+	});
+
+	std::sort(connect_times.begin(), connect_times.end());
+	std::sort(latencies.begin(), latencies.end());
+
+	boost::property_tree::wptree info;
+	info.add(L"connections",				connections);
+	info.add(L"server-connections",			server_connections);
+	info.add(L"failed-connections",			failures);
+	info.add(L"timed-out",					timed_out);
+	info.add(L"connect-millis.p50",			percentile(connect_times, 0.50));
+	info.add(L"connect-millis.max",			connect_times.empty() ? 0.0 : connect_times.back());
+	info.add(L"commands",					latencies.size());
+	info.add(L"error-replies",				error_replies);
+	info.add(L"commands-per-second",		latencies.size() / (elapsed / 1000.0));
+	info.add(L"latency-millis.p50",			percentile(latencies, 0.50));
+	info.add(L"latency-millis.p99",			percentile(latencies, 0.99));
+	info.add(L"latency-millis.max",			latencies.empty() ? 0.0 : latencies.back());
+
+	return info;
+}
+
+boost::property_tree::wptree run_server_load_test(const safe_ptr<IProtocolStrategy>& protocol, const std::string& command, const std::vector<int>& connection_counts, int commands_per_connection)
+{
+	if(commands_per_connection < 1)
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("commands_per_connection"));
+
+	BOOST_FOREACH(auto connections, connection_counts)
+	{
+		if(connections < 1 || connections > 10000)
+			BOOST_THROW_EXCEPTION(out_of_range() << arg_name_info("connection_counts") << arg_value_info(boost::lexical_cast<std::string>(connections)));
+	}
+
+	running_service server_service;
+	running_service client_service;
+
+	boost::property_tree::wptree info;
+	{
+		AsyncEventServer server(protocol, 0, server_service.get());
+		if(!server.Start())
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not start load test server."));
+
+		info.add(L"load-test.port",		server.port());
+		info.add(L"load-test.command",	widen(command));
+		info.add(L"load-test.commands",	commands_per_connection);
+
+		BOOST_FOREACH(auto connections, connection_counts)
+		{
+			CASPAR_LOG(info) << L"[server-load-test] Running " << connections << L" connections with " << commands_per_connection << L" commands each.";
+
+			info.add_child(L"load-test.rounds.round", run_round(client_service, server, command, connections, commands_per_connection));
+		}
+	} // Closes the server connections while the server service still runs.
+
+	return info;
+}
+
+}}
@@ -0,0 +1,40 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "ProtocolStrategy.h"
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <string>
+#include <vector>
+
+namespace caspar { namespace IO {
+
+// Starts a private AsyncEventServer on a loopback port with the given protocol, and for each of the 
+// given connection counts connects that many clients at once, which then each send the given command 
+// the given number of times, one after another. Replies are read as AMCP replies. Reports connect 
+// times, round-trip latencies, error replies and command throughput. Blocks until done.
+boost::property_tree::wptree run_server_load_test(const safe_ptr<IProtocolStrategy>& protocol, const std::string& command, const std::vector<int>& connection_counts, int commands_per_connection);
+
+}}
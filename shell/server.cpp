@@ -59,11 +59,15 @@
 #include <modules/decklink/consumer/blocking_decklink_consumer.h>
 #include <modules/ogl/consumer/ogl_consumer.h>
 #include <modules/ffmpeg/consumer/ffmpeg_consumer.h>
+#include <modules/ffmpeg/consumer/replay_consumer.h>
 
+#include <protocol/amcp/AMCPMediaIndex.h>
 #include <protocol/amcp/AMCPProtocolStrategy.h>
+#include <protocol/binary/binary_protocol_strategy.h>
 #include <protocol/cii/CIIProtocolStrategy.h>
 #include <protocol/CLK/CLKProtocolStrategy.h>
 #include <protocol/util/AsyncEventServer.h>
+#include <protocol/util/protocol_log.h>
 #include <protocol/util/stateful_protocol_strategy_wrapper.h>
 #include <protocol/osc/client.h>
 
@@ -120,6 +124,8 @@ struct server::implementation : boost::noncopyable
 	boost::thread								initial_media_info_thread_;
 	tbb::atomic<bool>							running_;
 	std::shared_ptr<thumbnail_generator>		thumbnail_generator_;
+	std::shared_ptr<amcp::media_index>			media_index_;
+	std::shared_ptr<boost::asio::deadline_timer>	protocol_log_timer_;
 
 	implementation(boost::promise<bool>& shutdown_server_now)
 		: io_service_(create_running_io_service())
@@ -163,6 +169,10 @@ struct server::implementation : boost::noncopyable
 
 		setup_thumbnail_generation(env::properties());
 
+		setup_media_index(env::properties());
+
+		setup_protocol_log(env::properties());
+
 		setup_controllers(env::properties());
 		CASPAR_LOG(info) << L"Initialized controllers.";
 
@@ -177,6 +187,11 @@ struct server::implementation : boost::noncopyable
 	{
 		running_ = false;
 		initial_media_info_thread_.join();
+		auto protocol_log_timer = protocol_log_timer_;
+		io_service_->post([protocol_log_timer]
+		{
+			protocol_log_timer->cancel();
+		});
 		thumbnail_generator_.reset();
 		primary_amcp_server_.reset();
 		async_servers_.clear();
@@ -270,6 +285,8 @@ struct server::implementation : boost::noncopyable
 					on_consumer(decklink::create_blocking_consumer(xml_consumer.second));				
 				else if (name == L"file" || name == L"stream")					
 					on_consumer(ffmpeg::create_consumer(xml_consumer.second));						
+				else if (name == L"replay")
+					on_consumer(ffmpeg::create_replay_consumer(xml_consumer.second));
 				else if (name == L"system-audio")
 					on_consumer(oal::create_consumer());
 				else if (name == L"synchronizing")
@@ -286,6 +303,32 @@ struct server::implementation : boost::noncopyable
 		}
 	}
 		
+	void setup_protocol_log(const boost::property_tree::wptree& pt)
+	{
+		IO::protocol_log_settings settings;
+		settings.messages_per_interval	= pt.get(L"configuration.protocol-log.messages-per-interval", settings.messages_per_interval);
+		settings.interval_seconds		= pt.get(L"configuration.protocol-log.interval-seconds", settings.interval_seconds);
+		settings.max_message_length		= pt.get(L"configuration.protocol-log.max-message-length", settings.max_message_length);
+		IO::configure_protocol_log(settings);
+
+		// The summary of an interval is logged even if no message arrives after it.
+		protocol_log_timer_ = std::make_shared<boost::asio::deadline_timer>(*io_service_);
+		schedule_protocol_log_flush(protocol_log_timer_);
+	}
+
+	static void schedule_protocol_log_flush(const std::shared_ptr<boost::asio::deadline_timer>& timer)
+	{
+		timer->expires_from_now(boost::posix_time::seconds(1));
+		timer->async_wait([timer](const boost::system::error_code& ec)
+		{
+			if(ec == boost::asio::error::operation_aborted)
+				return;
+
+			IO::flush_protocol_log();
+			schedule_protocol_log_flush(timer);
+		});
+	}
+
 	void setup_controllers(const boost::property_tree::wptree& pt)
 	{		
 		using boost::property_tree::wptree;
@@ -299,7 +342,7 @@ struct server::implementation : boost::noncopyable
 				if(name == L"tcp")
 				{					
 					unsigned int port = xml_controller.second.get(L"port", 5250);
-					auto asyncbootstrapper = make_safe<IO::AsyncEventServer>(create_protocol(protocol), port);
+					auto asyncbootstrapper = make_safe<IO::AsyncEventServer>(create_protocol(protocol), port, io_service_);
 					asyncbootstrapper->Start();
 					async_servers_.push_back(asyncbootstrapper);
 
@@ -381,10 +424,19 @@ struct server::implementation : boost::noncopyable
 		CASPAR_LOG(info) << L"Initialized thumbnail generator.";
 	}
 
+	void setup_media_index(const boost::property_tree::wptree& pt)
+	{
+		polling_filesystem_monitor_factory monitor_factory(
+				io_service_, pt.get(L"configuration.media-index.scan-interval-millis", 5000));
+		media_index_ = std::make_shared<amcp::media_index>(monitor_factory, media_info_repo_);
+
+		CASPAR_LOG(info) << L"Initialized media index.";
+	}
+
 	safe_ptr<IO::IProtocolStrategy> create_protocol(const std::wstring& name) const
 	{
 		if(boost::iequals(name, L"AMCP"))
-			return make_safe<amcp::AMCPProtocolStrategy>(channels_, thumbnail_generator_, media_info_repo_, shutdown_server_now_);
+			return make_safe<amcp::AMCPProtocolStrategy>(channels_, thumbnail_generator_, media_info_repo_, media_index_, shutdown_server_now_);
 		else if(boost::iequals(name, L"CII"))
 			return make_safe<cii::CIIProtocolStrategy>(channels_);
 		else if(boost::iequals(name, L"CLOCK"))
@@ -393,6 +445,8 @@ struct server::implementation : boost::noncopyable
 			{
 				return std::make_shared<CLK::CLKProtocolStrategy>(channels_);
 			});
+		else if(boost::iequals(name, L"BINARY"))
+			return make_safe<protocol::binary::binary_protocol_strategy>(channels_);
 		
 		BOOST_THROW_EXCEPTION(caspar_exception() << arg_name_info("name") << arg_value_info(narrow(name)) << msg_info("Invalid protocol"));
 	}